@@ -1,4 +1,13 @@
 ASFLAGS  +=
 WFLAGS   += -Wall -Wextra -Wno-unused-parameter -Wstrict-prototypes -Werror
-CFLAGS   += -std=gnu11 -Og -ggdb3 -fomit-frame-pointer
+CFLAGS   += -std=gnu11 -Og -ggdb3
 CPPFLAGS += -DDEBUG
+
+# Keep frame pointers, so that the sampling profiler (/dev/prof) is able to
+# unwind both kernel and user stacks.
+PROFILE ?= 0
+ifeq ($(PROFILE), 1)
+CFLAGS   += -fno-omit-frame-pointer
+else
+CFLAGS   += -fomit-frame-pointer
+endif
@@ -17,4 +17,8 @@ typedef struct pmap pmap_t;
 #define PMAP_USER_BEGIN 0x0000000000400000L
 #define PMAP_USER_END 0x0000800000000000L
 
+/* Checks if mapping of `va` may be made writable, as modified bit emulation
+ * keeps writable user mappings read-only until the first write. */
+bool pmap_writable_p(pmap_t *pmap, vaddr_t va);
+
 #endif /* !_AARCH64_PMAP_H_ */
@@ -33,13 +33,14 @@
 
 #include <sys/types.h>
 
-typedef uint8_t asid_t;
+typedef uint16_t asid_t;
 typedef uint64_t pte_t;
 typedef uint64_t pde_t;
 
 #define PAGE_SHIFT 12
 #define ASID_SHIFT 48
-#define MAX_ASID 0xFF
+#define MAX_ASID 0xFFFF
+#define MAX_ASID_8BIT 0xFF
 
 /* Block and Page attributes */
 #define ATTR_MASK_H UINT64_C(0xfff0000000000000)
@@ -81,6 +82,9 @@ typedef uint64_t pde_t;
 #define ATTR_S2_S2AP_READ 1
 #define ATTR_S2_S2AP_WRITE 2
 
+/* Type of descriptor: invalid, block, table or page. */
+#define ATTR_DESCR_MASK 3
+
 /* Level 0 table, 512GiB per entry */
 #define L0_SHIFT 39
 #define L0_SIZE (1ul << L0_SHIFT)
@@ -7,7 +7,36 @@
 
 #include <aarch64/pte.h>
 
+/* Checks whether CPU implements TLB range maintenance instructions. */
+void init_aarch64_tlb(void);
+
 void tlb_invalidate(vaddr_t va, asid_t asid);
 void tlb_invalidate_asid(asid_t asid);
+/* Invalidates translations for all address spaces. */
+void tlb_invalidate_all(void);
+
+/* Invalidates translations for all pages within [start, end) range. */
+void tlb_invalidate_range(vaddr_t start, vaddr_t end, asid_t asid);
+
+/* Number of pages that are invalidated one by one by tlb_gather_flush.
+ * Above that the whole range is invalidated at once. */
+#define TLB_GATHER_MAX 16
+
+/* Gathers invalidations done by range operations on page tables, so that
+ * they're issued together, with a single pair of barriers. */
+typedef struct tlb_gather {
+  asid_t asid;
+  unsigned count;             /* number of pending invalidations */
+  vaddr_t start, end;         /* range covered by pending invalidations */
+  vaddr_t va[TLB_GATHER_MAX]; /* addresses of first few of them */
+} tlb_gather_t;
+
+void tlb_gather_init(tlb_gather_t *tg, asid_t asid);
+/* Records that translations for [va, va + size) range must be invalidated.
+ * A single TLBI by va is enough for both pages and blocks. */
+void tlb_gather_add(tlb_gather_t *tg, vaddr_t va, size_t size);
+/* Issues all pending invalidations. Must be called before page table lock is
+ * released. */
+void tlb_gather_flush(tlb_gather_t *tg);
 
 #endif /* !_AARCH64_TLB_H_ */
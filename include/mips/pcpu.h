@@ -7,6 +7,8 @@
     void *ksp;                                                                 \
     /*!< registers that cannot be saved directly to kernel stack */            \
     register_t status, sp, cause, epc, badvaddr;                               \
+    /*!< number of TLB refill exceptions */                                    \
+    unsigned tlb_misses;                                                       \
   }
 
 #ifdef _MACHDEP
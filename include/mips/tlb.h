@@ -5,11 +5,13 @@
 #error "Do not use this header file outside kernel machine dependent code!"
 #endif
 
-#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
 #include <mips/m32c0.h>
 
 typedef uint32_t tlbhi_t;
 typedef uint32_t tlblo_t;
+typedef uint32_t tlbmask_t;
 
 /* Choose index specified by the Random Register. */
 #define TLBI_RANDOM (-1U)
@@ -18,6 +20,7 @@ typedef struct {
   tlbhi_t hi;
   tlblo_t lo0;
   tlblo_t lo1;
+  tlbmask_t mask; /* PageMask, zero for pair of 4KiB pages */
 } tlbentry_t;
 
 #define MAX_ASID C0_ENTRYHI_ASID_MASK
@@ -68,12 +71,25 @@ typedef struct {
 #define PDE_VALID PTE_VALID
 #define PDE_GLOBAL PTE_GLOBAL
 
+/* Value of PageMask register for TLB entry that maps a pair of pages of
+ * given size. Each of the pages must be aligned to its size. */
+#define PAGEMASK(size) ((((size)-1) << 1) & ~0x1fff)
+#define PAGEMASK_4K PAGEMASK(0x1000)
+#define PAGEMASK_64K PAGEMASK(0x10000)
+#define PAGEMASK_1M PAGEMASK(0x100000)
+#define PAGEMASK_16M PAGEMASK(0x1000000)
+
+/* Maximum number of wired TLB entries with large pages. The first wired
+ * entry is used by page directories and is not counted here. */
+#define TLB_WIRED_MAX 4
+
 void init_mips_tlb(void);
 
 /*
- * Note that MIPS implements variable page size by specifying PageMask register,
- * so intuitively these functions shall specify PageMask. However in current
- * implementation we aren't going to use other page size than 4KiB.
+ * Note that MIPS implements variable page size by specifying PageMask register.
+ * TLB refill handler always loads pairs of 4KiB pages, so PageMask register
+ * must be zero, unless a wired entry with large pages is being written.
+ * Functions below never touch wired entries, unless stated otherwise.
  */
 
 /* Probes the TLB for an entry matching hi, and if present invalidates it. */
@@ -82,7 +98,45 @@ void tlb_invalidate(tlbhi_t hi);
 /* Invalidate all TLB entries with given ASID (save wired). */
 void tlb_invalidate_asid(tlbhi_t asid);
 
+/* Invalidate all non-global TLB entries (save wired). */
+void tlb_invalidate_all(void);
+
+/* Invalidate TLB entries mapping [start, end) range with given ASID,
+ * or global ones. */
+void tlb_invalidate_range(vaddr_t start, vaddr_t end, tlbhi_t asid);
+
+/* Number of pages that are invalidated one by one by tlb_gather_flush.
+ * Above that the whole range is invalidated at once. */
+#define TLB_GATHER_MAX 16
+
+/* Gathers invalidations done by range operations on page tables, so that
+ * they're issued together, with interrupts disabled only once. */
+typedef struct tlb_gather {
+  tlbhi_t asid;
+  unsigned count;             /* number of pending invalidations */
+  vaddr_t start, end;         /* range covered by pending invalidations */
+  vaddr_t va[TLB_GATHER_MAX]; /* addresses of first few of them */
+} tlb_gather_t;
+
+void tlb_gather_init(tlb_gather_t *tg, tlbhi_t asid);
+/* Records that translation for page at va must be invalidated. */
+void tlb_gather_add(tlb_gather_t *tg, vaddr_t va);
+/* Issues all pending invalidations. Must be called before page table lock is
+ * released. */
+void tlb_gather_flush(tlb_gather_t *tg);
+
 /* Writes the TLB entry specified by @i or random entry if TLBI_RANDOM. */
 void tlb_write(unsigned i, tlbentry_t *e);
 
+/* Puts global entry @e into a free wired slot, after any other entries
+ * overlapping with it are invalidated. Returns false if there's no free slot
+ * left. */
+bool tlb_wire(tlbentry_t *e);
+
+/* Releases wired slots of entries that overlap with [start, end) range. */
+void tlb_unwire(vaddr_t start, vaddr_t end);
+
+/* Returns number of TLB refill exceptions since boot. */
+unsigned tlb_misses(void);
+
 #endif /* !_MIPS_TLB_H_ */
@@ -10,16 +10,18 @@ typedef void (*timeout_t)(void *);
 
 typedef struct callout {
   TAILQ_ENTRY(callout) c_link;
-  systime_t c_time; /* absolute time of the event */
-  timeout_t c_func; /* function to call */
-  void *c_arg;      /* function argument */
+  systime_t c_time;     /* absolute time of the event */
+  bintime_t c_deadline; /* absolute uptime of high-resolution event */
+  timeout_t c_func;     /* function to call */
+  void *c_arg;          /* function argument */
   uint32_t c_flags;
-  unsigned c_index; /* index of bucket this callout is assigned to */
+  unsigned c_index; /* index of wheel bucket or position in deadline heap */
 } callout_t;
 
 /* callout has been delegated to callout thread and will be executed soon */
 #define CALLOUT_ACTIVE 0x0001
 #define CALLOUT_PENDING 0x0002 /* callout is waiting for timeout */
+#define CALLOUT_HIRES 0x0004   /* callout is kept in deadline heap */
 
 /*! \brief Called during kernel initialization. */
 void init_callout(void);
@@ -37,6 +39,15 @@ void callout_setup(callout_t *handle, systime_t time, timeout_t fn, void *arg);
 void callout_setup_relative(callout_t *handle, systime_t time, timeout_t fn,
                             void *arg);
 
+/*
+ * Add a high-resolution callout to the queue.
+ * When system uptime reaches @deadline function @fn is called with argument
+ * @arg. Unlike tick based callouts the deadline isn't rounded up to the next
+ * system clock tick, provided that system clock runs in one-shot mode.
+ */
+void callout_setup_bt(callout_t *handle, bintime_t deadline, timeout_t fn,
+                      void *arg);
+
 /*
  * Cancel a callout if it is currently pending.
  *
@@ -50,9 +61,16 @@ bool callout_stop(callout_t *handle);
 
 /*
  * Process all callouts that happened since last time and delegate them to
- * callout thread.
+ * callout thread. Both tick based and high-resolution callouts are handled.
+ */
+void callout_process(bintime_t now);
+
+/*
+ * Fetch the earliest deadline of pending high-resolution callouts.
+ *
+ * \return False if there are no high-resolution callouts pending.
  */
-void callout_process(systime_t now);
+bool callout_next_deadline(bintime_t *deadline);
 
 /*
  * Wait until a callout ends its execution or return immediately if the
@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/lock.h>
+#include <sys/time.h>
 
 typedef struct condvar {
   const char *name;     /*!< name for debugging purpose */
@@ -43,6 +44,13 @@ void cv_wait(condvar_t *cv, lock_t m);
  */
 int cv_wait_timed(condvar_t *cv, lock_t m, systime_t timeout);
 
+/*! \brief Wait on a conditional variable with high-resolution timeout.
+ *
+ * \arg deadline Absolute uptime at which the wait times out.
+ *
+ * \sa cv_wait_timed */
+int cv_wait_timed_bt(condvar_t *cv, lock_t m, bintime_t deadline);
+
 /*! \brief Wake a single thread waiting on a conditional variable.
  *
  * If there are multiple waiting threads then the one with the highest priority
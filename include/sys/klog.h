@@ -48,27 +48,34 @@ typedef enum {
 #undef _KLOG_PRIVATE
 
 #include <sys/time.h>
+#include <sys/pcpu.h>
+#include <sys/seqring.h>
 
-#define KL_SIZE 1024
+/* Number of entries in per-CPU log ring. Must be a power of 2.
+ * Can be overridden at build time, e.g. `CPPFLAGS += -DKL_SIZE=16384`. */
+#ifndef KL_SIZE
+#define KL_SIZE 4096
+#endif
 
+/* Binary record stored in log ring and exported through /dev/klog.
+ * Format strings and file names are kept as pointers into kernel image,
+ * so a decoder must resolve them using kernel ELF file. */
 typedef struct klog_entry {
+  atomic_uint kl_seq; /* (index of the entry in the ring + 1) when valid */
+  klog_origin_t kl_origin;
   bintime_t kl_timestamp;
   tid_t kl_tid;
   unsigned kl_line;
   const char *kl_file;
-  klog_origin_t kl_origin;
   const char *kl_format;
   uintptr_t kl_params[6];
 } klog_entry_t;
 
 typedef struct klog {
-  klog_entry_t array[KL_SIZE];
+  klog_entry_t entries[MAXCPU][KL_SIZE];
+  seqring_t ring[MAXCPU];
   atomic_uint mask;
   bool verbose;
-  volatile unsigned first;
-  volatile unsigned last;
-  bool repeated;
-  int prev;
 } klog_t;
 
 extern klog_t klog;
@@ -8,6 +8,9 @@ typedef struct vm_page vm_page_t;
 /*! \brief Called during kernel initialization. */
 void init_kmem(void);
 
+/*! \brief Allocates wired kernel memory.
+ *
+ * \returns NULL only if M_NOWAIT was given and there are no free pages */
 void *kmem_alloc(size_t size, kmem_flags_t flags) __warn_unused;
 
 /*! \brief Map consecutive physical pages with given pmap flags. */
@@ -19,7 +22,10 @@ vaddr_t kva_alloc(size_t size);
 void kva_free(vaddr_t ptr, size_t size);
 vm_page_t *kva_find_page(vaddr_t ptr);
 
-void kva_map(vaddr_t ptr, size_t size, kmem_flags_t flags);
+/*! \brief Backs given range of kernel virtual memory with pages.
+ *
+ * \returns ENOMEM if M_NOWAIT was given and there are no free pages */
+int kva_map(vaddr_t ptr, size_t size, kmem_flags_t flags);
 void kva_unmap(vaddr_t ptr, size_t size);
 
 #endif /* !_SYS_KMEM_H_ */
@@ -0,0 +1,44 @@
+#ifndef _SYS_KMEMSTAT_H_
+#define _SYS_KMEMSTAT_H_
+
+#include <sys/types.h>
+
+/* Length of allocator name stored in a record (including NUL). */
+#define KMEMSTAT_NAMELEN 32
+
+/* Kinds of kernel memory allocators. */
+#define KMEMSTAT_MALLOC 1 /* kmalloc pool defined with KMALLOC_DEFINE */
+#define KMEMSTAT_POOL 2   /* pool of fixed-size objects */
+
+/* Binary record describing memory usage of a single kernel allocator. Reading
+ * /dev/kmemstat returns an array of these. Layout is the same on all
+ * architectures. */
+typedef struct kmemstat {
+  char ks_name[KMEMSTAT_NAMELEN];
+  uint32_t ks_type;      /* KMEMSTAT_MALLOC or KMEMSTAT_POOL */
+  uint32_t ks_itemsize;  /* size of pool items, 0 for kmalloc pools */
+  uint64_t ks_inuse;     /* bytes currently allocated */
+  uint64_t ks_peak;      /* peak of ks_inuse */
+  uint64_t ks_limit;     /* bytes that can be allocated, 0 if unlimited */
+  uint64_t ks_active;    /* number of live allocations */
+  uint64_t ks_nrequests; /* number of allocation requests */
+  uint64_t ks_nfailed;   /* number of requests failed due to the limit */
+  uint64_t ks_size;      /* memory held by pool slabs, same as ks_inuse
+                          * for kmalloc pools */
+} kmemstat_t;
+
+#ifdef _KERNEL
+
+/*! \brief Fills statistics of kmalloc pools.
+ *
+ * At most \a n records are stored in \a ks array.
+ *
+ * \returns the number of kmalloc pools */
+size_t kmalloc_stats(kmemstat_t *ks, size_t n);
+
+/*! \brief Fills statistics of pools the same way \a kmalloc_stats does. */
+size_t pool_stats(kmemstat_t *ks, size_t n);
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_KMEMSTAT_H_ */
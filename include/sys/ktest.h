@@ -27,6 +27,9 @@
 #define KTEST_FLAG_BROKEN 0x08
 /* Marks that the test wishes to receive a random integer as an argument. */
 #define KTEST_FLAG_RANDINT 0x10
+/* Marks a benchmark, which only reports timings. It is not run in auto mode,
+   but it can be started by its name. */
+#define KTEST_FLAG_BENCHMARK 0x20
 
 typedef struct {
   const char test_name[KTEST_NAME_MAX];
@@ -0,0 +1,35 @@
+#ifndef _SYS_LZ4_H_
+#define _SYS_LZ4_H_
+
+#include <sys/types.h>
+
+/*! \file lz4.h
+ *
+ * Compressor and decompressor of LZ4 block format, see:
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * Compression is greedy with single hash table lookup per position, which
+ * favours speed over ratio.
+ */
+
+/* Number of entries in hash table used by compressor. */
+#define LZ4_HASHLOG 12
+#define LZ4_HASHSIZE (1 << LZ4_HASHLOG)
+
+/*! \brief Compresses \a srclen bytes from \a src into \a dst buffer.
+ *
+ * \a srclen must not exceed 64KiB. Caller provides the hash table, since it
+ * does not fit on kernel stack.
+ *
+ * \returns size of compressed data or 0 if it does not fit into \a dstlen */
+size_t lz4_compress(const void *src, size_t srclen, void *dst, size_t dstlen,
+                    uint16_t htab[LZ4_HASHSIZE]);
+
+/*! \brief Decompresses \a srclen bytes from \a src into \a dst buffer.
+ *
+ * \returns size of decompressed data or -1 if input is malformed or does not
+ * fit into \a dstlen */
+ssize_t lz4_decompress(const void *src, size_t srclen, void *dst,
+                       size_t dstlen);
+
+#endif /* !_SYS_LZ4_H_ */
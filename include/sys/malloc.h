@@ -4,24 +4,39 @@
 #include <sys/types.h>
 #include <sys/linker_set.h>
 #include <sys/kmem_flags.h>
+#include <sys/spinlock.h>
+#include <sys/condvar.h>
 #include <machine/vm_param.h>
 
 /*
  * General purpose kernel memory allocator.
+ *
+ * Requests up to KMALLOC_MAXCLASS bytes are rounded up to a size class and
+ * served from a pool dedicated to that class, with a per-CPU cache of free
+ * objects in front of it. Bigger requests go to boundary-tag allocator that
+ * manages arenas obtained from kmem_alloc.
  */
 
+#define KMALLOC_MAXCLASS 2048
+
 typedef struct kmalloc_pool {
+  spin_t lock;      /* Protects statistics. */
   const char *desc; /* Printable type name. */
   size_t nrequests; /* Number of allocation requests. */
+  size_t nfailed;   /* Number of requests failed due to the limit. */
   size_t active;    /* Numer of active blocks. */
   size_t used;      /* Bytes currently used. */
   size_t maxused;   /* Peak usage of memory. */
+  size_t limit;     /* Maximum number of bytes used, 0 if unlimited. */
+  condvar_t wait;   /* Threads waiting for usage to drop below limit. */
 } kmalloc_pool_t;
 
 /* Defines a local pool of memory for use by a subsystem. */
 #define KMALLOC_DEFINE(NAME, DESC)                                             \
   kmalloc_pool_t *NAME = &(kmalloc_pool_t){                                    \
+    .lock.s_attr = LK_TYPE_SPIN,                                               \
     .desc = (DESC),                                                            \
+    .wait.name = (DESC),                                                       \
   };                                                                           \
   SET_ENTRY(kmalloc_pool, NAME)
 
@@ -30,11 +45,28 @@ typedef struct kmalloc_pool {
 /*! \brief Called during kernel initialization. */
 void init_kmalloc(void);
 
+/*! \brief Called during kernel initialization, once kmem_alloc is usable.
+ *
+ * Creates pools for size classes. Until then all requests are served from
+ * the arena allocator. */
+void init_kmalloc_classes(void);
+
 void *kmalloc(kmalloc_pool_t *mp, size_t size,
               kmem_flags_t flags) __warn_unused;
 void kfree(kmalloc_pool_t *mp, void *addr);
 char *kstrndup(kmalloc_pool_t *mp, const char *s, size_t maxlen);
 
+/*! \brief Sets hard limit on memory used by the pool.
+ *
+ * Allocations that would exceed the limit fail if M_NOWAIT flag was given,
+ * otherwise they wait until memory gets freed. Limit of 0 means no limit. */
+void kmalloc_setlimit(kmalloc_pool_t *mp, size_t limit);
+
+/*! \brief Returns objects cached by current CPU back to size class pools.
+ *
+ * Called by pagedaemon before empty slabs are reclaimed. */
+void kmalloc_reclaim(void);
+
 void kmcheck(void);
 
 /*! \brief M_TEMP delivers storage for short lived temporary objects. */
@@ -27,6 +27,11 @@
 #define MADV_NORMAL 0     /* No further special treatment */
 #define MADV_RANDOM 1     /* Expect random page references */
 #define MADV_SEQUENTIAL 2 /* Expect sequential page references */
+#define MADV_WILLNEED 3   /* Will need these pages */
+#define MADV_DONTNEED 4   /* Dont need these pages */
+
+/* Additional advice values. */
+#define MADV_FREE 6 /* Pages are empty, free them */
 
 #ifndef _KERNEL
 
@@ -36,6 +41,9 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd,
 int munmap(void *addr, size_t len);
 int mprotect(void *addr, size_t len, int prot);
 int madvise(void *addr, size_t len, int advice);
+int mincore(void *addr, size_t len, char *vec);
+int mlock(const void *addr, size_t len);
+int munlock(const void *addr, size_t len);
 
 #endif /* !_KERNEL */
 
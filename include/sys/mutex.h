@@ -64,6 +64,11 @@ static inline void mtx_lock(mtx_t *m) {
 /*! \brief Unlocks sleep mutex */
 void mtx_unlock(mtx_t *m);
 
+/*! \brief Locks sleep mutex if that can be done without blocking.
+ *
+ * \returns true if the mutex has been locked */
+bool mtx_trylock(mtx_t *m);
+
 /*! \brief Locks a pair of distinct mutexes belonging to the same class.
  *
  * The mutex with the lower address is locked first. */
@@ -8,6 +8,10 @@
 typedef struct thread thread_t;
 typedef struct pmap pmap_t;
 typedef struct vm_map vm_map_t;
+typedef struct ctx ctx_t;
+
+/* Maximum number of CPUs supported by the kernel. */
+#define MAXCPU 1
 
 /*! \brief Private per-cpu structure. */
 typedef struct pcpu {
@@ -16,12 +20,14 @@ typedef struct pcpu {
   thread_t *idle_thread; /*!< idle thread executed on this CPU */
   pmap_t *curpmap;       /*!< current page table */
   vm_map_t *uspace;      /*!< user space virtual memory map */
+  unsigned cpuid;        /*!< index of this CPU in _pcpu_data array */
+  ctx_t *intr_ctx;       /*!< context interrupted by handled interrupt */
 
   /* Machine-dependent part */
   PCPU_MD_FIELDS;
 } pcpu_t;
 
-extern pcpu_t _pcpu_data[1];
+extern pcpu_t _pcpu_data[MAXCPU];
 
 /* Read pcpu.h from FreeBSD for API reference */
 #define PCPU_GET(member) (_pcpu_data->member)
@@ -42,7 +42,23 @@ void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
 bool pmap_extract(pmap_t *pmap, vaddr_t va, paddr_t *pap);
 void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end);
 
+/* Returns size of large pages, or 0 if pmap is not able to map them. */
+size_t pmap_block_size(void);
+/* Maps block of pmap_block_size() bytes at va to consecutive physical pages
+ * starting with pg using a single large page. Both addresses must be aligned
+ * to the block size. The large page is split into small ones once any part
+ * of it is unmapped or its protection changes. Referenced & modified bits
+ * are tracked for the large page as a whole. Returns false if there's no
+ * memory for page tables. */
+bool pmap_enter_block(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
+                      unsigned flags);
+
 void pmap_kenter(vaddr_t va, paddr_t pa, vm_prot_t prot, unsigned flags);
+/* Maps [va, va + size) range to consecutive physical pages starting at pa.
+ * Page tables are filled under single lock followed by one TLB shootdown.
+ * Large ranges may be mapped with wired TLB entries of large pages. */
+void pmap_kenter_range(vaddr_t va, paddr_t pa, size_t size, vm_prot_t prot,
+                       unsigned flags);
 bool pmap_kextract(vaddr_t va, paddr_t *pap);
 void pmap_kremove(vaddr_t va, size_t size);
 
@@ -61,6 +77,10 @@ void pmap_set_modified(vm_page_t *pg);
 
 void pmap_activate(pmap_t *pmap);
 
+/* Returns number of TLB misses handled in software since boot, or 0 if page
+ * tables are walked by hardware. */
+unsigned pmap_tlb_misses(void);
+
 pmap_t *pmap_lookup(vaddr_t va);
 pmap_t *pmap_kernel(void);
 pmap_t *pmap_user(void);
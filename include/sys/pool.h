@@ -38,12 +38,30 @@ void pool_destroy(pool_t *pool);
 
 /*! \brief Allocate an object from the pool.
  *
- * \note The pool may grow in page size units. */
+ * \note The pool grows by slabs of one or more pages. */
 void *pool_alloc(pool_t *pool, kmem_flags_t flags) __warn_unused;
 
 /*! \brief Release an object that belongs to the pool. */
 void pool_free(pool_t *pool, void *ptr);
 
+/*! \brief Find the pool that an object was allocated from.
+ *
+ * \note Page of \a ptr must be either a slab or have its slab pointer
+ * cleared, otherwise the result is undefined.
+ *
+ * \returns the pool or NULL if \a ptr doesn't lie within a slab */
+pool_t *pool_find(void *ptr);
+
+/*! \brief Returns size of objects managed by the pool. */
+size_t pool_item_size(pool_t *pool);
+
+/*! \brief Returns memory of empty slabs of all pools to the system.
+ *
+ * Called by pagedaemon when free memory is scarce.
+ *
+ * \returns the number of bytes released */
+size_t pool_reclaim(void);
+
 /*! \brief Define a pool that will be initialized during system startup. */
 #define POOL_DEFINE(NAME, ...)                                                 \
   struct pool *NAME;                                                           \
@@ -0,0 +1,72 @@
+#ifndef _SYS_PROF_H_
+#define _SYS_PROF_H_
+
+#include <sys/types.h>
+
+/* Maximum number of program counters stored in a single sample. */
+#define PROF_DEPTH 8
+
+/* Length of program name stored in a sample (including NUL). */
+#define PROF_NAMELEN 16
+
+#ifdef _KERNEL
+
+#include <sys/mimiker.h>
+#include <sys/seqring.h>
+
+typedef struct thread thread_t;
+typedef struct mcontext mcontext_t;
+
+/* Binary record stored in per-CPU sample buffer and exported through
+ * /dev/prof. Layout is the same on all architectures.
+ *
+ * First ps_kdepth entries of ps_pc are kernel program counters, and next
+ * ps_udepth entries are user program counters. In both parts the innermost
+ * frame comes first, and it's the address of interrupted instruction - all
+ * other entries are return addresses. */
+typedef struct prof_sample {
+  atomic_uint ps_seq;         /* (index of the sample + 1) when valid */
+  uint16_t ps_cpu;            /* CPU the sample was taken on */
+  uint8_t ps_kdepth;          /* number of kernel frames */
+  uint8_t ps_udepth;          /* number of user frames */
+  uint32_t ps_tid;            /* thread that was running */
+  uint32_t ps_pid;            /* its process, or 0 for kernel threads */
+  char ps_name[PROF_NAMELEN]; /* program name or kernel thread name */
+  uint64_t ps_pc[PROF_DEPTH];
+} prof_sample_t;
+
+/* Number of samples in per-CPU buffer. Must be a power of 2. */
+#ifndef PROF_SIZE
+#define PROF_SIZE 1024
+#endif
+
+/* Per-CPU rings of samples. */
+extern seqring_t prof_ring[];
+
+/*! \brief Called during kernel initialization.
+ *
+ * Profiler is started if "prof" kernel environment variable is set. */
+void init_prof(void);
+
+/*! \brief Start or stop sampling.
+ *
+ * \returns true if the profiler was enabled before */
+bool prof_enable(bool enable);
+
+/*! \brief Called by clock interrupt handler on every tick.
+ *
+ * Records kernel stack of interrupted thread. If user-space code was
+ * interrupted, taking the sample is deferred to \a prof_user_sample. */
+void prof_clock(void);
+
+/*! \brief Records user stack of current thread if a sample is pending.
+ *
+ * User stack is read with copyin, so it's called on return to user-space. */
+void prof_user_sample(thread_t *td, mcontext_t *uctx);
+
+/* Fetch and consume the oldest valid sample from CPU's buffer. */
+bool prof_get(unsigned cpu, prof_sample_t *sample);
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_PROF_H_ */
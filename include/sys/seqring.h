@@ -0,0 +1,65 @@
+#ifndef _SYS_SEQRING_H_
+#define _SYS_SEQRING_H_
+
+#include <sys/mimiker.h>
+
+typedef struct uio uio_t;
+
+/*
+ * Ring of fixed-size records written without locks, used by klog, tracepoints
+ * and the profiler. Every record must begin with an `atomic_uint` sequence
+ * number.
+ *
+ * A writer reserves a slot by incrementing `head`, invalidates the record by
+ * clearing its sequence number, fills it in, and publishes it by setting the
+ * sequence number to (index of the record + 1). Writers never wait for
+ * readers, so the oldest records are overwritten when the ring is full.
+ *
+ * Readers consume records from `tail`. A record is copied out only if its
+ * sequence number matches, and it's checked again after copying, so records
+ * which are still being written or were overwritten in the meantime are
+ * never returned.
+ */
+
+/* Maximum size of a record. */
+#define SEQRING_RECMAX 128
+
+typedef struct seqring {
+  void *array;      /* storage for records */
+  size_t recsize;   /* size of a record in bytes */
+  unsigned nrecs;   /* number of records, must be a power of 2 */
+  atomic_uint head; /* index of next record to be reserved by a writer */
+  atomic_uint tail; /* index of first record not yet consumed by a reader */
+} seqring_t;
+
+/*! \brief Makes the ring store \a nrecs records of \a recsize bytes in
+ * \a array, and drops all records that it held before. */
+void seqring_init(seqring_t *sr, void *array, size_t recsize, unsigned nrecs);
+
+/*! \brief Reserves the next record for writing.
+ *
+ * \returns invalidated record, and its index in \a idxp */
+void *seqring_reserve(seqring_t *sr, unsigned *idxp);
+
+/*! \brief Makes a record reserved under index \a idx visible to readers. */
+static inline void seqring_publish(void *rec, unsigned idx) {
+  atomic_store((atomic_uint *)rec, idx + 1);
+}
+
+/*! \brief Copies the oldest valid record to \a rec and consumes it.
+ *
+ * \returns false if there are no records to consume */
+bool seqring_get(seqring_t *sr, void *rec);
+
+/*! \brief Returns the number of records (possibly still being written). */
+unsigned seqring_count(seqring_t *sr);
+
+/*! \brief Consumes all records in the ring. */
+void seqring_clear(seqring_t *sr);
+
+/*! \brief Moves whole records from \a n rings into \a uio.
+ *
+ * Records from different rings are not merged. */
+int seqring_read(seqring_t *rings, unsigned n, uio_t *uio);
+
+#endif /* !_SYS_SEQRING_H_ */
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/time.h>
 
 typedef struct thread thread_t;
 typedef struct sleepq sleepq_t;
@@ -39,6 +40,13 @@ void sleepq_wait(void *wchan, const void *waitpt);
  * \returns how the thread was actually woken up */
 int sleepq_wait_timed(void *wchan, const void *waitpt, systime_t timeout);
 
+/*! \brief Performs interruptible sleep with high-resolution timeout.
+ *
+ * \param deadline absolute uptime at which the sleep times out
+ * \returns how the thread was actually woken up
+ * \sa sleepq_wait_timed */
+int sleepq_wait_timed_bt(void *wchan, const void *waitpt, bintime_t deadline);
+
 /*! \brief Wakes up highest priority thread waiting on \a wchan.
  *
  * \param wchan unique sleep queue identifier
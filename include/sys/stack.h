@@ -0,0 +1,27 @@
+#ifndef _SYS_STACK_H_
+#define _SYS_STACK_H_
+
+#include <sys/types.h>
+
+typedef struct thread thread_t;
+typedef struct ctx ctx_t;
+typedef struct mcontext mcontext_t;
+
+/*! \brief Stores program counters of kernel frames interrupted by \a ctx.
+ *
+ * The first stored address is the interrupted instruction, the rest are
+ * return addresses of callers. Only kernel stack of \a td is ever read,
+ * hence it's safe to call it from interrupt context.
+ *
+ * \returns number of addresses stored in \a pcs (at most \a n) */
+unsigned stack_unwind_kernel(thread_t *td, ctx_t *ctx, uint64_t *pcs,
+                             unsigned n);
+
+/*! \brief Stores program counters of user frames saved in \a uctx.
+ *
+ * User stack is read with copyin, so it must be called in thread context.
+ *
+ * \returns number of addresses stored in \a pcs (at most \a n) */
+unsigned stack_unwind_user(mcontext_t *uctx, uint64_t *pcs, unsigned n);
+
+#endif /* !_SYS_STACK_H_ */
@@ -80,6 +80,10 @@
 #define SYS_getlogin 72
 #define SYS_setlogin 73
 #define SYS_posix_openpt 74
-#define SYS_MAXSYSCALL 75
+#define SYS_madvise 75
+#define SYS_mincore 76
+#define SYS_mlock 77
+#define SYS_munlock 78
+#define SYS_MAXSYSCALL 79
 
 #define SYS_MAXSYSARGS 6
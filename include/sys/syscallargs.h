@@ -379,3 +379,25 @@ typedef struct {
 typedef struct {
   SYSCALLARG(int) flags;
 } posix_openpt_args_t;
+
+typedef struct {
+  SYSCALLARG(void *) addr;
+  SYSCALLARG(size_t) len;
+  SYSCALLARG(int) advice;
+} madvise_args_t;
+
+typedef struct {
+  SYSCALLARG(const void *) addr;
+  SYSCALLARG(size_t) len;
+  SYSCALLARG(char *) vec;
+} mincore_args_t;
+
+typedef struct {
+  SYSCALLARG(const void *) addr;
+  SYSCALLARG(size_t) len;
+} mlock_args_t;
+
+typedef struct {
+  SYSCALLARG(const void *) addr;
+  SYSCALLARG(size_t) len;
+} munlock_args_t;
@@ -2,13 +2,20 @@
 #define _SYS_TASKQUEUE_H_
 
 #include <sys/queue.h>
-#include <sys/mutex.h>
+#include <sys/spinlock.h>
 #include <sys/condvar.h>
+#include <sys/callout.h>
+#include <sys/priority.h>
+
+typedef struct thread thread_t;
+typedef struct taskqueue taskqueue_t;
 
 typedef struct task {
   STAILQ_ENTRY(task) t_link;
   void (*t_func)(void *); /* callback function */
   void *t_arg;            /* callback argument */
+  unsigned t_pending;     /* # of times the task was enqueued before run */
+  bool t_running;         /* task is being executed by some thread */
 } task_t;
 
 #define TASK_INIT(func, arg)                                                   \
@@ -16,24 +23,68 @@ typedef struct task {
     .t_func = (func), .t_arg = (void *)(arg)                                   \
   }
 
+/* Task that is appended onto a taskqueue after given number of ticks. */
+typedef struct timeout_task {
+  task_t tt_task;
+  callout_t tt_callout;
+  taskqueue_t *tt_queue;
+  bool tt_scheduled; /* callout is armed and will enqueue the task */
+} timeout_task_t;
+
+#define TIMEOUT_TASK_INIT(func, arg)                                           \
+  (timeout_task_t) {                                                           \
+    .tt_task = TASK_INIT(func, arg)                                            \
+  }
+
 typedef STAILQ_HEAD(, task) task_list_t;
 
+#define TQ_MAXWORKERS 8
+
+#define TQF_EXITING 0x1 /* worker threads are requested to terminate */
+
 typedef struct taskqueue {
-  mtx_t tq_mutex;
+  /* spin lock, so tasks can be enqueued from interrupt filters */
+  spin_t tq_lock;
   /* worker waits on this cv for tq_list to become non empty */
   condvar_t tq_nonempty;
   task_list_t tq_list;
+  unsigned tq_flags;
+  unsigned tq_nworkers;
+  thread_t *tq_workers[TQ_MAXWORKERS];
 } taskqueue_t;
 
+/* System-wide taskqueue for deferring bottom-half work of device drivers. */
+extern taskqueue_t taskqueue_system;
+
+/*! \brief Called during kernel initialization. */
+void init_taskqueue(void);
+
 /* Creates a new taskqueue. */
 void taskqueue_init(taskqueue_t *tq);
-/* Destroys a taskqueue. */
+/* Destroys a taskqueue. Worker threads are terminated and joined. */
 void taskqueue_destroy(taskqueue_t *tq);
+/* Creates @nworkers threads with priority @prio, which will execute tasks
+ * enqueued onto @tq. */
+void taskqueue_start_threads(taskqueue_t *tq, unsigned nworkers, prio_t prio,
+                             const char *name);
 /* Appends a task onto a taskqueue. The task will be executed later in a thread
- * context. */
+ * context. If the task is already pending, it's not appended again - only its
+ * pending count is incremented. If the task is running, it's appended when the
+ * current run finishes, so a task never runs concurrently with itself.
+ * Can be called from interrupt filter. */
 void taskqueue_add(taskqueue_t *tq, task_t *task);
 /* Executes all task in the queue without holding a lock, i.e. new tasks may
  * arrive while old ones are processed. */
 void taskqueue_run(taskqueue_t *tq);
 
+/* Appends a task onto a taskqueue after @ticks system clock ticks.
+ *
+ * \return False if the task is already scheduled, true otherwise. */
+bool taskqueue_enqueue_timeout(taskqueue_t *tq, timeout_task_t *tt,
+                               systime_t ticks);
+/* Cancels scheduled timeout task.
+ *
+ * \return True if the task was scheduled and has been cancelled. */
+bool taskqueue_cancel_timeout(taskqueue_t *tq, timeout_task_t *tt);
+
 #endif /* !_SYS_TASKQUEUE_H_ */
@@ -71,8 +71,9 @@ typedef enum {
 typedef enum {
   TDP_OLDSIGMASK = 0x01,  /* Pass td_oldsigmask as return mask to send_sig(). */
   TDP_FPUCTXSAVED = 0x02, /* FPU context was saved by `ctx_switch`. */
-  TDP_FPUINUSE = 0x04     /* FPU is in use and its context should be saved &
+  TDP_FPUINUSE = 0x04,    /* FPU is in use and its context should be saved &
                               restored on demand. */
+  TDP_PROFSAMPLE = 0x08   /* Profiler requested user stack sample. */
 } tdp_flags_t;
 
 /*! \brief Thread structure
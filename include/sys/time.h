@@ -60,6 +60,12 @@ static inline void bt2ts(bintime_t *bt, timespec_t *ts) {
   ts->tv_nsec = (1000000000ULL * (uint32_t)(bt->frac >> 32)) >> 32;
 }
 
+static inline void ts2bt(timespec_t *ts, bintime_t *bt) {
+  bt->sec = ts->tv_sec;
+  /* 18446744073 = int(2^64 / 1000000000) */
+  bt->frac = ts->tv_nsec * (uint64_t)18446744073LL;
+}
+
 /* Operations on timevals. */
 #define timerclear(tvp) (tvp)->tv_sec = (tvp)->tv_usec = 0L
 #define timerisset(tvp) ((tvp)->tv_sec || (tvp)->tv_usec)
@@ -173,6 +179,10 @@ bintime_t bintime(void);
  * and is maintained by system clock. */
 systime_t getsystime(void);
 
+/* Make system clock trigger no later than at given uptime. Has an effect only
+ * if system clock is driven by a timer working in one-shot mode. */
+void clock_schedule(bintime_t deadline);
+
 int do_clock_gettime(clockid_t clk, timespec_t *tp);
 
 int do_clock_nanosleep(clockid_t clk, int flags, timespec_t *rqtp,
@@ -72,7 +72,10 @@ int tm_release(timer_t *tm);
 
 /*! \brief Prepares timer to call event trigger callback. */
 int tm_init(timer_t *tm, tm_event_cb_t event, void *arg);
-/*! \brief Configures timer to trigger callback(s). */
+/*! \brief Configures timer to trigger callback(s).
+ *
+ * For TMF_ONESHOT timers \a start is an absolute uptime at which callback
+ * will be called. Such timer can be rearmed while it's active. */
 int tm_start(timer_t *tm, unsigned flags, const bintime_t start,
              const bintime_t period);
 /*! \brief Stops timer from triggering a callback. */
@@ -0,0 +1,80 @@
+#ifndef _SYS_TRACE_H_
+#define _SYS_TRACE_H_
+
+#include <sys/types.h>
+
+/* Static tracepoints compiled into the kernel. */
+typedef enum {
+  TRACE_SCHED_SWITCH,    /* args: old thread id, new thread id, old state */
+  TRACE_SCHED_WAKEUP,    /* args: woken thread id, wakeup reason */
+  TRACE_SYSCALL_ENTER,   /* args: syscall number */
+  TRACE_SYSCALL_EXIT,    /* args: syscall number, error, return value */
+  TRACE_PAGE_FAULT,      /* args: fault address, access type */
+  TRACE_TURNSTILE_BLOCK, /* args: owner thread id, waiting channel */
+  TRACE_INTR_ENTER,      /* args: interrupt request line */
+  TRACE_INTR_EXIT,       /* args: interrupt request line, filter status */
+  TRACE_NTYPES
+} trace_type_t;
+
+#define TRACE_MASK(t) (1 << (t))
+#define TRACE_NONE 0x00000000
+#define TRACE_ALL ((1 << TRACE_NTYPES) - 1)
+
+#ifdef _KERNEL
+
+#include <sys/mimiker.h>
+#include <sys/seqring.h>
+
+/* Binary record stored in per-CPU trace buffer and exported through
+ * /dev/trace. Layout is the same on all architectures. */
+typedef struct trace_event {
+  atomic_uint te_seq; /* (index of the event in the buffer + 1) when valid */
+  uint16_t te_type;   /* one of TRACE_* */
+  uint16_t te_cpu;    /* CPU the event was recorded on */
+  uint64_t te_time;   /* system uptime in nanoseconds */
+  uint32_t te_tid;    /* thread that was running when event was recorded */
+  uint32_t te_pad;
+  uint64_t te_args[3];
+} trace_event_t;
+
+/* Number of events in per-CPU trace buffer. Must be a power of 2. */
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 4096
+#endif
+
+/* Per-CPU rings of trace events. */
+extern seqring_t trace_ring[];
+
+/* Mask of enabled tracepoints. */
+extern atomic_uint trace_mask;
+
+/*! \brief Called during kernel initialization. */
+void init_trace(void);
+
+/*! \brief Enable tracepoints given by \a newmask and disable others.
+ *
+ * \returns previous mask */
+unsigned trace_setmask(unsigned newmask);
+
+/* Record an event. Use TRACE macro instead of calling it directly. */
+void trace_record(trace_type_t type, uint64_t arg0, uint64_t arg1,
+                  uint64_t arg2);
+
+/* Fetch and consume the oldest valid event from CPU's trace buffer. */
+bool trace_get(unsigned cpu, trace_event_t *event);
+
+#define _TRACE(type, a0, a1, a2, ...)                                          \
+  do {                                                                         \
+    if (__predict_false(atomic_load_explicit(&trace_mask,                      \
+                                             memory_order_relaxed) &           \
+                        TRACE_MASK(type)))                                     \
+      trace_record((type), (uint64_t)(a0), (uint64_t)(a1), (uint64_t)(a2));    \
+  } while (0)
+
+/* Record an event with up to three arguments if the tracepoint is enabled.
+ * When tracepoint is disabled the cost is a load and a branch. */
+#define TRACE(...) _TRACE(__VA_ARGS__, 0, 0, 0)
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_TRACE_H_ */
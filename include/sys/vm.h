@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <machine/vm_param.h>
 
 #define page_aligned_p(addr) is_aligned((addr), PAGESIZE)
@@ -15,8 +16,15 @@ typedef enum {
   PG_MANAGED = 0x02,    /* a page is on a freeq */
   PG_REFERENCED = 0x04, /* page has been accessed since last check */
   PG_MODIFIED = 0x08,   /* page has been modified since last check */
+  PG_ZERO = 0x10,       /* shared page filled with zeros, mapped read-only */
+  PG_WIRED = 0x20,      /* page must not be paged out (locked by mlock) */
+  PG_MERGED = 0x40,     /* page shared by objects after merging, read-only */
 } __packed pg_flags_t;
 
+/* Pages shared by many objects are mapped read-only, and vm_page_fault gives
+ * the object a private copy on write. */
+#define PG_COW (PG_ZERO | PG_MERGED)
+
 typedef enum {
   VM_PROT_NONE = 0,
   VM_PROT_READ = 1,  /* can read page */
@@ -35,6 +43,15 @@ typedef enum {
   VM_FIXED = 0x0004,   /* map addr must be exactly as requested */
 } vm_flags_t;
 
+typedef enum {
+  VM_ADV_NORMAL = 0,     /* no special treatment */
+  VM_ADV_RANDOM = 1,     /* do not map pages around faulting one */
+  VM_ADV_SEQUENTIAL = 2, /* map pages ahead of faulting one */
+  VM_ADV_WILLNEED = 3,   /* bring pages in and map them */
+  VM_ADV_DONTNEED = 4,   /* drop pages and their contents */
+  VM_ADV_FREE = 6,       /* let pagedaemon drop pages unless modified again */
+} vm_advice_t;
+
 typedef struct vm_page vm_page_t;
 typedef TAILQ_HEAD(vm_pagelist, vm_page) vm_pagelist_t;
 
@@ -43,28 +60,60 @@ typedef struct vm_object vm_object_t;
 typedef struct slab slab_t;
 
 /* Field marking and corresponding locks:
- * (@) pv_list_lock (in pmap.c)
+ * (@) pv lock assigned to the page (pv_locks in pmap.c)
  * (P) physmem_lock (in vm_physmem.c)
- * (O) vm_object::mtx */
+ * (O) vm_object::mtx
+ * (Q) pageq_lock (in vm_pageout.c)
+ *
+ * There's one vm_page for every page of physical memory, so the structure is
+ * kept small. Physical address is not stored, but computed from position of
+ * the page in its segment, and the offset is kept in PAGESIZE units. On
+ * AArch64 the structure fits in a single 64-byte cache line. On MIPS it takes
+ * 36 bytes, i.e. a bit more than one 32-byte line. */
 
 struct vm_page {
   union {
     TAILQ_ENTRY(vm_page) freeq; /* (P) list of free pages for buddy system */
     TAILQ_ENTRY(vm_page) pageq; /* used to group allocated pages */
     struct {
-      TAILQ_ENTRY(vm_page) list;
-    } obj;        /* (O) list of pages in vm_object */
+      SPLAY_ENTRY(vm_page) tree;
+    } obj;        /* (O) tree of pages in vm_object */
     slab_t *slab; /* active when page is used by pool allocator */
   };
-  TAILQ_HEAD(, pv_entry) pv_list; /* (@) where this page is mapped? */
+  TAILQ_ENTRY(vm_page) pageout;   /* (Q) pagedaemon queue entry */
+  SLIST_HEAD(, pv_entry) pv_list; /* (@) where this page is mapped? */
   vm_object_t *object;            /* (O) object owning that page */
-  off_t offset;                   /* (O) offset to page in vm_object */
-  paddr_t paddr;                  /* (P) physical address of page */
+  uint32_t pindex;                /* (O) offset to page in vm_object */
+  uint16_t size;                  /* (P) size of page in PAGESIZE units */
   pg_flags_t flags;               /* (P) page flags (used by physmem as well) */
-  uint32_t size;                  /* (P) size of page in PAGESIZE units */
+  uint8_t segidx;                 /* (P) physical segment the page belongs to */
+  uint8_t queue;                  /* (Q) pagedaemon queue the page is on */
 };
 
+#ifdef _KERNEL
+
+/* Physical address and vm_page of the first page in each segment
+ * (set up by init_vm_page). */
+extern paddr_t vm_physseg_start[VM_PHYSSEG_NMAX];
+extern vm_page_t *vm_physseg_pages[VM_PHYSSEG_NMAX];
+
+/* Returns physical address of the page. */
+static inline paddr_t vm_page_paddr(vm_page_t *pg) {
+  unsigned i = pg->segidx;
+  return vm_physseg_start[i] + (paddr_t)(pg - vm_physseg_pages[i]) * PAGESIZE;
+}
+
+/* Returns offset to the page in the object owning it. */
+static inline off_t vm_page_offset(vm_page_t *pg) {
+  return (off_t)pg->pindex * PAGESIZE;
+}
+
 int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags);
 int do_munmap(vaddr_t addr, size_t length);
+int do_madvise(vaddr_t addr, size_t length, int advice);
+int do_mincore(vaddr_t addr, size_t length, char *u_vec);
+int do_mlock(vaddr_t addr, size_t length, bool lock);
+
+#endif /* _KERNEL */
 
 #endif /* !_SYS_VM_H_ */
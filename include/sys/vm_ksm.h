@@ -0,0 +1,65 @@
+#ifndef _SYS_VM_KSM_H_
+#define _SYS_VM_KSM_H_
+
+#include <sys/types.h>
+
+/*! \file vm_ksm.h
+ *
+ * Same-page merging finds anonymous pages with identical contents and makes
+ * objects share a single read-only copy of them. A write to a shared page
+ * gives the object its private copy back. Pages are found by a background
+ * scanner, which is enabled by `ksm=<npages>` kernel argument telling how many
+ * pages it may check every KSM_PERIOD ticks.
+ */
+
+#ifdef _KERNEL
+
+typedef struct vm_page vm_page_t;
+typedef struct vm_object vm_object_t;
+
+/*! \brief Called during kernel initialization. */
+void init_vm_ksm(void);
+
+/*! \brief Makes pages of anonymous object \a obj candidates for merging. */
+void ksm_register(vm_object_t *obj);
+
+/*! \brief Withdraws \a obj from the scanner before the object is freed.
+ *
+ * \note Must be called without object's lock held. */
+void ksm_unregister(vm_object_t *obj);
+
+/*! \brief Returns shared page holding contents of page at \a offset in \a obj.
+ *
+ * The page must be mapped read-only.
+ *
+ * \returns NULL if the page was not merged
+ * \note Must be called with object's lock held. */
+vm_page_t *ksm_lookup(vm_object_t *obj, off_t offset);
+
+/*! \brief Copies shared contents of page at \a offset in \a obj into \a pg.
+ *
+ * The page is no longer shared by the object, so it's marked as modified.
+ *
+ * \returns false if the page was not merged
+ * \note Must be called with object's lock held. */
+bool ksm_get(vm_object_t *obj, off_t offset, vm_page_t *pg);
+
+/*! \brief Makes \a new_obj share all merged pages of \a obj.
+ *
+ * \note Must be called with lock of \a obj held. */
+void ksm_clone(vm_object_t *obj, vm_object_t *new_obj);
+
+/*! \brief Drops merged pages of \a obj in range [offset, offset+length).
+ *
+ * \note Must be called with object's lock held. */
+void ksm_remove(vm_object_t *obj, off_t offset, size_t length);
+
+/*! \brief Checks up to \a npages pages, stopping at the end of a pass over all
+ * registered objects.
+ *
+ * \returns number of pages checked */
+size_t ksm_scan(size_t npages);
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_VM_KSM_H_ */
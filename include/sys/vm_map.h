@@ -88,6 +88,28 @@ void vm_map_dump(vm_map_t *vm_map);
 
 vm_map_t *vm_map_clone(vm_map_t *map);
 
+/*! \brief Makes page at \a fault_addr accessible for \a fault_type access.
+ *
+ * \returns EIO if pager failed to provide the page, errno if access is not
+ * allowed */
 int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type);
 
+/*! \brief Applies \a advice on expected use of pages in [start, end) range.
+ *
+ * \returns ENOMEM if the range is not entirely mapped */
+int vm_map_advise(vm_map_t *map, vaddr_t start, vaddr_t end,
+                  vm_advice_t advice);
+
+/*! \brief Locks pages in [start, end) range in memory, or unlocks them.
+ *
+ * \returns ENOMEM if the range is not entirely mapped */
+int vm_map_wire(vm_map_t *map, vaddr_t start, vaddr_t end, bool wire);
+
+/*! \brief Reports which pages in [start, end) range are resident.
+ *
+ * For each page a byte of \a vec is set to 1 if it is resident, 0 otherwise.
+ *
+ * \returns ENOMEM if the range is not entirely mapped */
+int vm_map_mincore(vm_map_t *map, vaddr_t start, vaddr_t end, char *vec);
+
 #endif /* !_SYS_VM_MAP_H_ */
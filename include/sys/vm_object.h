@@ -11,22 +11,52 @@
  * Field marking and corresponding locks:
  * (a) atomic
  * (@) vm_object::mtx
+ * (K) ksm_lock (in vm_ksm.c)
+ * (S) swap_lock (in vm_swap.c)
+ * (Z) zstore_lock (in vm_zstore.c)
  */
 
+typedef SPLAY_HEAD(vm_pagetree, vm_page) vm_pagetree_t;
+
 typedef struct vm_object {
   mtx_t mtx;
-  vm_pagelist_t list;   /* (@) List of pages */
+  vm_pagetree_t pages;  /* (@) Pages sorted by offset */
   size_t npages;        /* (@) Number of pages */
+  size_t nswapped;      /* (@) Number of pages in swap area */
+  size_t ncompressed;   /* (@) Number of pages in compressed store */
+  size_t nwired;        /* (@) Number of pages locked in memory */
+  size_t nmerged;       /* (@) Number of pages shared with other objects */
   vm_pager_t *pager;    /* Pager type and page fault function for object */
   refcnt_t ref_counter; /* (a) How many objects refer to this object? */
+  /* (K) Entry on list of objects checked by same-page merging scanner. */
+  TAILQ_ENTRY(vm_object) ksm_link;
+  TAILQ_HEAD(, swslot) swslots; /* (S) Slots of swapped out pages */
+  TAILQ_HEAD(, zchunk) zchunks; /* (Z) Chunks of compressed pages */
 } vm_object_t;
 
 vm_object_t *vm_object_alloc(vm_pgr_type_t type);
 void vm_object_free(vm_object_t *obj);
 void vm_object_add_page(vm_object_t *obj, off_t offset, vm_page_t *pg);
 void vm_object_remove_page(vm_object_t *obj, vm_page_t *pg);
+void vm_object_remove_page_nolock(vm_object_t *obj, vm_page_t *pg);
 void vm_object_remove_range(vm_object_t *obj, off_t offset, size_t length);
+void vm_object_free_range(vm_object_t *obj, off_t offset, size_t length);
+void vm_object_wire_range(vm_object_t *obj, off_t offset, size_t length,
+                          bool wire);
+void vm_object_mincore(vm_object_t *obj, off_t offset, size_t length,
+                       char *vec);
 vm_page_t *vm_object_find_page(vm_object_t *obj, off_t offset);
+
+/*! \brief Returns the page at \a offset or the first page that follows it.
+ *
+ * \note Must be called with object's lock held. */
+vm_page_t *vm_object_page_from(vm_object_t *obj, off_t offset);
+
+/*! \brief Returns the page that follows \a pg in the object.
+ *
+ * \note Must be called with object's lock held. */
+vm_page_t *vm_object_next_page(vm_object_t *obj, vm_page_t *pg);
+
 vm_object_t *vm_object_clone(vm_object_t *obj);
 void vm_map_object_dump(vm_object_t *obj);
 
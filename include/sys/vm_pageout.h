@@ -0,0 +1,75 @@
+#ifndef _SYS_VM_PAGEOUT_H_
+#define _SYS_VM_PAGEOUT_H_
+
+#include <sys/vm.h>
+
+/*! \file vm_pageout.h
+ *
+ * Pagedaemon reclaims memory when the number of free pages drops below
+ * a threshold. Pages that belong to vm_objects are kept on one of the page
+ * queues below and aged using referenced and modified bits tracked by pmap.
+ */
+
+typedef enum {
+  PQ_NONE,     /* not on any queue */
+  PQ_ACTIVE,   /* recently referenced pages */
+  PQ_INACTIVE, /* pages not referenced since last scan, may be reclaimed */
+  PQ_LAUNDRY,  /* modified pages that must be cleaned before reuse */
+  PQ_COUNT
+} vm_pagequeue_t;
+
+/* Maximum number of pages written back to pager by single request. */
+#define VM_PAGEOUT_CLUSTER 16
+
+/*! \brief Called during kernel initialization. Starts pagedaemon thread. */
+void init_vm_pageout(void);
+
+/*! \brief Puts a page that has just been added to a vm_object on the active
+ * queue.
+ *
+ * \note Must be called with the object's lock held. */
+void vm_pageq_insert(vm_page_t *pg);
+
+/*! \brief Takes page off pagedaemon queues.
+ *
+ * \note Must be called with lock of the page's object held. */
+void vm_pageq_remove(vm_page_t *pg);
+
+/*! \brief Moves page to the inactive queue, so it's reclaimed before others.
+ *
+ * Wired pages and pages that pagedaemon is working on are left alone.
+ *
+ * \note Must be called with lock of the page's object held. */
+void vm_pageq_deactivate(vm_page_t *pg);
+
+/*! \brief Takes page off pagedaemon queues until \a vm_page_unwire is called.
+ *
+ * \note Must be called with lock of the page's object held. */
+void vm_page_wire(vm_page_t *pg);
+
+/*! \brief Lets pagedaemon reclaim a page that was wired.
+ *
+ * \note Must be called with lock of the page's object held. */
+void vm_page_unwire(vm_page_t *pg);
+
+/*! \brief Checks if the current thread is pagedaemon. */
+bool vm_pageout_thread_p(void);
+
+/*! \brief Wakes up pagedaemon if free memory is getting scarce. */
+void vm_pageout_check(void);
+
+/*! \brief Performs single pass of page reclamation.
+ *
+ * Tries to free at least \a target pages.
+ *
+ * \returns the number of pages freed */
+size_t vm_pageout_scan(size_t target);
+
+/*! \brief Sleeps until pagedaemon makes an attempt to free some memory.
+ *
+ * Used when an allocation request that cannot fail has not been satisfied.
+ * If pagedaemon itself exhausted the reserve of free pages, it sleeps for
+ * a while, hoping that other threads will free some memory. */
+void vm_wait(void);
+
+#endif /* !_SYS_VM_PAGEOUT_H_ */
@@ -8,11 +8,17 @@ typedef enum {
   VM_ANONYMOUS,
 } vm_pgr_type_t;
 
+/* Both operations are called with object's lock held.
+ *
+ * Page-out returns the number of pages that were saved to backing store and
+ * may be freed. These are moved to the beginning of `pgs` array. */
 typedef vm_page_t *vm_pgr_fault_t(vm_object_t *obj, off_t offset);
+typedef int vm_pgr_pageout_t(vm_object_t *obj, vm_page_t **pgs, int npgs);
 
 typedef struct vm_pager {
   vm_pgr_type_t pgr_type;
   vm_pgr_fault_t *pgr_fault;
+  vm_pgr_pageout_t *pgr_pageout; /* save modified pages to backing store */
 } vm_pager_t;
 
 extern vm_pager_t pagers[];
@@ -2,24 +2,50 @@
 #define _SYS_VM_PHYSMEM_H_
 
 #include <sys/vm.h>
+#include <sys/kmem_flags.h>
 
 typedef struct vm_physseg vm_physseg_t;
 
 /* \brief Allocate vm_page structures to be managed by vm_physseg allocator. */
 void init_vm_page(void);
 
+/* \brief Start thread that supplies idle thread with pages to zero. */
+void init_vm_prezero(void);
+
 /* \brief Allocate physical memory segment without vm_page structures. */
 #define vm_physseg_plug(start, end) _vm_physseg_plug((start), (end), false)
 #define vm_physseg_plug_used(start, end) _vm_physseg_plug((start), (end), true)
 void _vm_physseg_plug(paddr_t start, paddr_t end, bool used);
 
-/* Allocates contiguous big page that consists of n machine pages. */
+/* Allocates contiguous big page that consists of n machine pages. Its
+ * physical address is aligned to its size. */
 vm_page_t *vm_page_alloc(size_t n);
 
+/* Same as vm_page_alloc, but with M_ZERO flag returned pages are filled with
+ * zeros. Single pages are taken from a queue of pages zeroed in advance.
+ * Last free pages are reserved for pagedaemon and M_NOWAIT requests. */
+vm_page_t *vm_page_alloc_flags(size_t n, kmem_flags_t flags);
+
+/* Zeroes a free page from per-CPU cache in advance if there is one to spare.
+ * Called by idle thread, so it never blocks nor takes sleep locks.
+ *
+ * \returns true if a page was zeroed */
+bool vm_page_prezero(void);
+
+/* Turns big page into separate machine pages, each of which may be freed on
+ * its own. Free pages are merged back by buddy system. */
+void vm_page_split(vm_page_t *page);
+
 /* Returns vm_page associated with frame of given address. */
 vm_page_t *vm_page_find(paddr_t pa);
 
 /* Returns vm_page to physical memory manager. */
 void vm_page_free(vm_page_t *page);
 
+/* Returns the number of free pages, including ones cached per CPU. */
+size_t vm_page_nfree(void);
+
+/* Returns the number of pages managed by physical memory manager. */
+size_t vm_page_ntotal(void);
+
 #endif /* !_SYS_VM_PHYSMEM_H_ */
@@ -0,0 +1,61 @@
+#ifndef _SYS_VM_SWAP_H_
+#define _SYS_VM_SWAP_H_
+
+#include <sys/vm.h>
+
+/*! \file vm_swap.h
+ *
+ * Swap area is a regular file (or device node) divided into page sized slots.
+ * Modified pages of anonymous objects are written there by pagedaemon and
+ * read back on page fault. Swapping is enabled at boot with `swap=<path>`
+ * kernel argument and optionally `swapsize=<bytes>`.
+ */
+
+typedef struct proc proc_t;
+
+/*! \brief Called during kernel initialization after filesystems are mounted.
+ *
+ * Enables swapping if requested by kernel environment. */
+void init_vm_swap(void);
+
+/*! \brief Starts using file at \a path as a swap area of \a size bytes.
+ *
+ * File is created if it does not exist and filled with zeros, so that page-out
+ * never needs to allocate memory in filesystem code.
+ *
+ * \returns EBUSY if swap area is already configured, errno otherwise */
+int swap_on(proc_t *p, char *path, size_t size);
+
+/*! \brief Returns the number of unused swap slots. */
+size_t swap_nfree(void);
+
+/*! \brief Writes \a npgs pages of \a obj to consecutive slots of swap area.
+ *
+ * Pages must have been unmapped, so their contents do not change in meantime.
+ * On success the caller frees the pages, as their contents will be restored
+ * by \a swap_pagein.
+ *
+ * \note Must be called with object's lock held. */
+int swap_pageout(vm_object_t *obj, vm_page_t **pgs, int npgs);
+
+/*! \brief Reads contents of page at \a offset in \a obj from swap into \a pg.
+ *
+ * The slot is released, so the page must be treated as modified.
+ *
+ * \returns ENOENT if the page has never been swapped out, I/O error otherwise
+ * \note Must be called with object's lock held. */
+int swap_pagein(vm_object_t *obj, off_t offset, vm_page_t *pg);
+
+/*! \brief Brings all swapped out pages of \a obj back to memory.
+ *
+ * Panics if any of the pages cannot be read from swap area.
+ *
+ * \note Must be called with object's lock held. */
+void swap_pagein_all(vm_object_t *obj);
+
+/*! \brief Drops swapped out pages of \a obj in range [offset, offset+length).
+ *
+ * \note Must be called with object's lock held. */
+void swap_remove(vm_object_t *obj, off_t offset, size_t length);
+
+#endif /* !_SYS_VM_SWAP_H_ */
@@ -0,0 +1,73 @@
+#ifndef _SYS_VM_ZSTORE_H_
+#define _SYS_VM_ZSTORE_H_
+
+#include <sys/types.h>
+
+/*! \file vm_zstore.h
+ *
+ * Compressed store keeps modified anonymous pages evicted by pagedaemon in
+ * memory, compressed with LZ4. Compressed pages are packed into slabs of
+ * fixed size chunks, one slab per physical page. Pages that do not compress
+ * well enough go to swap area (if there's one) instead.
+ */
+
+/* Number of buckets in fault-in latency histogram. */
+#define ZSTAT_NBUCKETS 16
+
+/* Statistics record returned by reading /dev/zstat. Layout is the same on all
+ * architectures. */
+typedef struct zstat {
+  uint64_t zs_npages;    /* number of pages currently stored */
+  uint64_t zs_comprsize; /* total size of their compressed contents */
+  uint64_t zs_memsize;   /* memory held by slabs of the store */
+  uint64_t zs_limit;     /* maximum number of pages used by slabs */
+  uint64_t zs_nstored;   /* number of pages stored since boot */
+  uint64_t zs_nrejected; /* pages that were not compressible enough */
+  uint64_t zs_nloaded;   /* number of pages brought back on fault */
+  /* Histogram of time to bring a page back. Bucket 0 counts loads that took
+   * less than 2us, bucket i > 0 those that took [2^i, 2^(i+1)) us, and the
+   * last one all the longer ones. */
+  uint64_t zs_latency[ZSTAT_NBUCKETS];
+} zstat_t;
+
+#ifdef _KERNEL
+
+typedef struct vm_page vm_page_t;
+typedef struct vm_object vm_object_t;
+
+/*! \brief Called during kernel initialization. */
+void init_vm_zstore(void);
+
+/*! \brief Compresses contents of \a pg of \a obj and saves them in the store.
+ *
+ * On success the caller frees the page, as its contents will be restored
+ * by \a zstore_get. The page must not be mapped.
+ *
+ * \returns false if the page is not compressible or the store is full
+ * \note Must be called with object's lock held. */
+bool zstore_put(vm_object_t *obj, vm_page_t *pg);
+
+/*! \brief Restores contents of page at \a offset in \a obj into \a pg.
+ *
+ * The page is released from the store, so it must be treated as modified.
+ *
+ * \returns false if the page is not in the store
+ * \note Must be called with object's lock held. */
+bool zstore_get(vm_object_t *obj, off_t offset, vm_page_t *pg);
+
+/*! \brief Brings all pages of \a obj kept in the store back to memory.
+ *
+ * \note Must be called with object's lock held. */
+void zstore_get_all(vm_object_t *obj);
+
+/*! \brief Drops pages of \a obj in range [offset, offset+length).
+ *
+ * \note Must be called with object's lock held. */
+void zstore_remove(vm_object_t *obj, off_t offset, size_t length);
+
+/*! \brief Takes a snapshot of store statistics. */
+void zstore_stats(zstat_t *zs);
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_VM_ZSTORE_H_ */
@@ -14,12 +14,24 @@ typedef struct vmem vmem_t;
  * https://netbsd.gw.com/cgi-bin/man-cgi?vmem+9+NetBSD-current
  */
 
+/* Allocation policies, can be or-ed with kmem flags. If none is given then
+ * VM_INSTANTFIT is used. */
+#define VM_INSTANTFIT 0x00000100 /* take any segment that is big enough */
+#define VM_BESTFIT 0x00000200    /* take smallest segment that is big enough */
+
+#define VMEM_ADDR_MIN 0
+#define VMEM_ADDR_MAX (~(vmem_addr_t)0)
+
 /*! \brief Called during kernel initialization. */
 void init_vmem(void);
 
 /*! \brief Create a new vmem arena.
- * You need to specify quantum, the smallest unit of allocation. */
-vmem_t *vmem_create(const char *name, vmem_size_t quantum);
+ *
+ * You need to specify quantum, the smallest unit of allocation. Requests of
+ * up to \a qcache_max bytes are served from per-CPU quantum caches, which
+ * avoid taking the arena lock. Use 0 to disable quantum caching. */
+vmem_t *vmem_create(const char *name, vmem_size_t quantum,
+                    vmem_size_t qcache_max);
 
 /*! \brief Add a new address span to the arena. */
 int vmem_add(vmem_t *vm, vmem_addr_t addr, vmem_size_t size);
@@ -28,9 +40,22 @@ int vmem_add(vmem_t *vm, vmem_addr_t addr, vmem_size_t size);
 int vmem_alloc(vmem_t *vm, vmem_size_t size, vmem_addr_t *addrp,
                kmem_flags_t flags);
 
+/*! \brief Allocate an address segment satisfying given constraints.
+ *
+ * Start address of the segment is equal to \a phase modulo \a align, the
+ * segment doesn't cross a multiple of \a nocross and lies within
+ * [\a minaddr, \a maxaddr] range. Zero values of \a align, \a phase and
+ * \a nocross mean no constraint. Quantum caches are bypassed. */
+int vmem_xalloc(vmem_t *vm, vmem_size_t size, vmem_size_t align,
+                vmem_size_t phase, vmem_size_t nocross, vmem_addr_t minaddr,
+                vmem_addr_t maxaddr, kmem_flags_t flags, vmem_addr_t *addrp);
+
 /*! \brief Free segment previously allocated by vmem_alloc(). */
 void vmem_free(vmem_t *vm, vmem_addr_t addr, vmem_size_t size);
 
+/*! \brief Free segment previously allocated by vmem_xalloc(). */
+void vmem_xfree(vmem_t *vm, vmem_addr_t addr, vmem_size_t size);
+
 /*! \brief Destroy existing vmem arena. */
 void vmem_destroy(vmem_t *vm);
 
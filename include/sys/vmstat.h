@@ -0,0 +1,49 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+#include <sys/types.h>
+
+/* Statistics record returned by reading /dev/vmstat. Layout is the same on all
+ * architectures. */
+typedef struct vmstat {
+  uint64_t v_faults;       /* page faults handled by vm_page_fault */
+  uint64_t v_prefaults;    /* pages mapped by fault-around */
+  uint64_t v_zerofaults;   /* read faults that mapped the shared zero page */
+  uint64_t v_ksm_scanned;  /* pages checked by same-page merging */
+  uint64_t v_ksm_shared;   /* pages with contents shared by objects */
+  uint64_t v_ksm_sharing;  /* pages of objects replaced by shared ones */
+  uint64_t v_ksm_zeroed;   /* pages released as they held only zeros */
+  uint64_t v_ksm_unmerged; /* shared pages copied on write */
+  uint64_t v_prezeroed;    /* pages zeroed in advance by idle thread */
+  uint64_t v_prezero_hits; /* zero-filled pages taken from prezeroed queue */
+} vmstat_t;
+
+#ifdef _KERNEL
+
+#include <sys/mimiker.h>
+
+/* Counters behind vmstat_t, updated without locks. */
+typedef struct vmcnt {
+  atomic_uint faults;
+  atomic_uint prefaults;
+  atomic_uint zerofaults;
+  atomic_uint ksm_scanned;
+  atomic_uint ksm_shared;
+  atomic_uint ksm_sharing;
+  atomic_uint ksm_zeroed;
+  atomic_uint ksm_unmerged;
+  atomic_uint prezeroed;
+  atomic_uint prezero_hits;
+} vmcnt_t;
+
+extern vmcnt_t vmcnt;
+
+#define VMCNT_ADD(name, n) atomic_fetch_add(&vmcnt.name, (n))
+#define VMCNT_SUB(name, n) atomic_fetch_sub(&vmcnt.name, (n))
+
+/*! \brief Takes a snapshot of virtual memory statistics. */
+void vmstat_read(vmstat_t *vs);
+
+#endif /* _KERNEL */
+
+#endif /* !_SYS_VMSTAT_H_ */
@@ -907,10 +907,8 @@ static inline void free_pages(void *ptr, size_t idx, struct pginfo *info) {
   if (malloc_junk)
     memset(ptr, SOME_JUNK, l);
 
-#if 0 /* XXX: mimiker workaround */
-    if (malloc_hint)
-	madvise(ptr, l, MADV_FREE);
-#endif
+  if (malloc_hint)
+    madvise(ptr, l, MADV_FREE);
 
   tail = (char *)ptr + l;
 
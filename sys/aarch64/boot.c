@@ -132,13 +132,12 @@ __boot_text static void clear_bss(void) {
 #define DMAP_SIZE 0x3c000000
 #define DMAP_BASE 0xffffff8000000000 /* last 512GB */
 
-#define DMAP_L3_ENTRIES max(1, DMAP_SIZE / PAGESIZE)
-#define DMAP_L2_ENTRIES max(1, DMAP_L3_ENTRIES / PT_ENTRIES)
+/* Direct map is built of 2MB blocks, so it needs no level 3 tables. */
+#define DMAP_L2_ENTRIES max(1, DMAP_SIZE / L2_SIZE)
 #define DMAP_L1_ENTRIES max(1, DMAP_L2_ENTRIES / PT_ENTRIES)
 
 #define DMAP_L1_SIZE roundup(DMAP_L1_ENTRIES * sizeof(pde_t), PAGESIZE)
 #define DMAP_L2_SIZE roundup(DMAP_L2_ENTRIES * sizeof(pde_t), PAGESIZE)
-#define DMAP_L3_SIZE roundup(DMAP_L3_ENTRIES * sizeof(pte_t), PAGESIZE)
 
 __boot_text static paddr_t build_page_table(void) {
   /* l0 entry is 512GB */
@@ -186,13 +185,10 @@ __boot_text static paddr_t build_page_table(void) {
   /* direct map construction */
   volatile pde_t *l1d = bootmem_alloc(DMAP_L1_SIZE);
   volatile pde_t *l2d = bootmem_alloc(DMAP_L2_SIZE);
-  volatile pde_t *l3d = bootmem_alloc(DMAP_L3_SIZE);
-
-  for (intptr_t i = 0; i < DMAP_L3_ENTRIES; i++)
-    l3d[i] = (i * PAGESIZE) | ATTR_AP(ATTR_AP_RW) | ATTR_XN | pte_default;
 
   for (intptr_t i = 0; i < DMAP_L2_ENTRIES; i++)
-    l2d[i] = (pde_t)&l3d[i * PT_ENTRIES] | L2_TABLE;
+    l2d[i] = (i * L2_SIZE) | ATTR_AP(ATTR_AP_RW) | ATTR_XN |
+             (pte_default & ~ATTR_DESCR_MASK) | L2_BLOCK;
 
   for (intptr_t i = 0; i < DMAP_L1_ENTRIES; i++)
     l1d[i] = (pde_t)&l2d[i * PT_ENTRIES] | L1_TABLE;
@@ -226,10 +222,6 @@ __boot_text static void enable_mmu(paddr_t pde) {
   uint64_t mmfr0 = READ_SPECIALREG(id_aa64mmfr0_el1);
   uint64_t mmfr1 = READ_SPECIALREG(id_aa64mmfr1_el1);
 
-  /* CPU must support 16 bits ASIDs. */
-  if (ID_AA64MMFR0_ASIDBits_VAL(mmfr0) != ID_AA64MMFR0_ASIDBits_16)
-    halt();
-
   /* CPU must support 4kB granules. */
   if (ID_AA64MMFR0_TGran4_VAL(mmfr0) != ID_AA64MMFR0_TGran4_IMPL)
     halt();
@@ -241,8 +233,9 @@ __boot_text static void enable_mmu(paddr_t pde) {
 
   /* Copy Intermediate Physical Address Size. */
   uint64_t tcr = ID_AA64MMFR0_PARange_VAL(mmfr0) << TCR_IPS_SHIFT;
-  /* Use 16 bits ASIDs. */
-  tcr |= TCR_ASID_16;
+  /* Use 16 bits ASIDs if CPU supports them. */
+  if (ID_AA64MMFR0_ASIDBits_VAL(mmfr0) == ID_AA64MMFR0_ASIDBits_16)
+    tcr |= TCR_ASID_16;
   /* Set user & kernel address space to have 2^48 addresses. */
   tcr |= TCR_T0SZ(16ULL) | TCR_T1SZ(16ULL);
   /* Set user & kernel granule to have 4kB. */
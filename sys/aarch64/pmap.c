@@ -11,20 +11,22 @@
 #include <sys/pmap.h>
 #include <sys/mutex.h>
 #include <sys/sched.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
-#include <bitstring.h>
 
 typedef struct pmap {
   mtx_t mtx;                      /* protects all fields in this structure */
   asid_t asid;                    /* address space identifier */
+  uint32_t asid_gen;              /* generation of asid (asid_lock) */
   paddr_t pde;                    /* directory page table physical address */
   vm_pagelist_t pte_pages;        /* pages we allocate in page table */
+  vm_pagelist_t blk_pages;        /* page tables set aside for demotion */
   TAILQ_HEAD(, pv_entry) pv_list; /* all pages mapped by this physical map */
 } pmap_t;
 
 typedef struct pv_entry {
   TAILQ_ENTRY(pv_entry) pmap_link; /* link on pmap::pv_list */
-  TAILQ_ENTRY(pv_entry) page_link; /* link on vm_page::pv_list */
+  SLIST_ENTRY(pv_entry) page_link; /* link on vm_page::pv_list */
   pmap_t *pmap;                    /* page is mapped in this pmap */
   vaddr_t va;                      /* under this address */
 } pv_entry_t;
@@ -32,6 +34,15 @@ typedef struct pv_entry {
 static POOL_DEFINE(P_PMAP, "pmap", sizeof(pmap_t));
 static POOL_DEFINE(P_PV, "pv_entry", sizeof(pv_entry_t));
 
+/* Page zeroing and copying routines implemented in pagecopy.S. */
+void pagezero(void *va);
+void pagezero_zva(void *va, size_t bs);
+void pagecopy(void *dst, const void *src);
+
+/* Size of block cleared by DC ZVA, or 0 if it cannot be used.
+ * Set up by init_pmap. */
+static size_t dczva_size;
+
 #define PA_MASK 0xfffffffff000
 #define ADDR_MASK 0x8ffffffff000
 #define DMAP_BASE 0xffffff8000000000 /* last 512GB */
@@ -39,29 +50,40 @@ static POOL_DEFINE(P_PV, "pv_entry", sizeof(pv_entry_t));
 
 static const pte_t pte_default = L3_PAGE | ATTR_AF | ATTR_SH(ATTR_SH_IS);
 
+/* Hardware doesn't track accesses to pages, so user mappings are entered
+ * without access flag and read-only until the page gets referenced and
+ * modified respectively. ATTR_SW_RW marks mappings that may become writable
+ * once abort handler notices a write. */
+static const pte_t pte_rw = ATTR_AP(ATTR_AP_RW) | ATTR_SW_RW;
+
 static const pte_t vm_prot_map[] = {
   [VM_PROT_NONE] = ATTR_XN | pte_default,
   [VM_PROT_READ] = ATTR_AP(ATTR_AP_RO) | ATTR_XN | pte_default,
-  [VM_PROT_WRITE] = ATTR_AP(ATTR_AP_RW) | ATTR_XN | pte_default,
-  [VM_PROT_READ | VM_PROT_WRITE] = ATTR_AP(ATTR_AP_RW) | ATTR_XN | pte_default,
+  [VM_PROT_WRITE] = pte_rw | ATTR_XN | pte_default,
+  [VM_PROT_READ | VM_PROT_WRITE] = pte_rw | ATTR_XN | pte_default,
   [VM_PROT_EXEC] = pte_default,
   [VM_PROT_READ | VM_PROT_EXEC] = ATTR_AP(ATTR_AP_RO) | pte_default,
-  [VM_PROT_WRITE | VM_PROT_EXEC] = ATTR_AP(ATTR_AP_RW) | pte_default,
-  [VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXEC] =
-    ATTR_AP(ATTR_AP_RW) | pte_default,
+  [VM_PROT_WRITE | VM_PROT_EXEC] = pte_rw | pte_default,
+  [VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXEC] = pte_rw | pte_default,
 };
 
 static pmap_t kernel_pmap;
 paddr_t _kernel_pmap_pde;
-static bitstr_t asid_used[bitstr_size(MAX_ASID)] = {0};
 static spin_t *asid_lock = &SPIN_INITIALIZER(0);
+static unsigned asid_next = 1; /* next ASID to be assigned */
+static uint32_t asid_gen = 1;  /* current ASID generation */
+static unsigned asid_max;      /* 0xFF or 0xFFFF if CPU has 16-bit ASIDs */
 
-/* this lock is used to protect the vm_page::pv_list field */
-static mtx_t *pv_list_lock = &MTX_INITIALIZER(0);
+/* Pv lists of pages are protected by a pool of locks, each page is assigned
+ * one of them by its physical address. Lock order is pv lock -> pmap::mtx.
+ * Functions that find pages by walking page tables must use pv_lock_pmap.
+ * Locking all pv locks at once is done in ascending order. */
+#define PV_LOCKS 64
+static mtx_t pv_locks[PV_LOCKS];
 
 #define PTE_FRAME_ADDR(pte) ((pte)&PA_MASK)
 #define PAGE_OFFSET(x) ((x) & (PAGESIZE - 1))
-#define PG_DMAP_ADDR(pg) ((void *)((intptr_t)(pg)->paddr + DMAP_BASE))
+#define PG_DMAP_ADDR(pg) ((void *)((intptr_t)vm_page_paddr(pg) + DMAP_BASE))
 
 /*
  * Helper functions.
@@ -75,11 +97,11 @@ static bool kern_addr_p(vaddr_t addr) {
 }
 
 inline vaddr_t pmap_start(pmap_t *pmap) {
-  return pmap->asid ? PMAP_USER_BEGIN : PMAP_KERNEL_BEGIN;
+  return pmap == pmap_kernel() ? PMAP_KERNEL_BEGIN : PMAP_USER_BEGIN;
 }
 
 inline vaddr_t pmap_end(pmap_t *pmap) {
-  return pmap->asid ? PMAP_USER_END : PMAP_KERNEL_END;
+  return pmap == pmap_kernel() ? PMAP_KERNEL_END : PMAP_USER_END;
 }
 
 inline bool pmap_address_p(pmap_t *pmap, vaddr_t va) {
@@ -110,42 +132,94 @@ pmap_t *pmap_lookup(vaddr_t addr) {
  * Address space identifiers management.
  */
 
-static asid_t alloc_asid(void) {
-  int free = 0;
-  WITH_SPIN_LOCK (asid_lock) {
-    bit_ffc(asid_used, MAX_ASID, &free);
-    if (free < 0)
-      panic("Out of asids!");
-    bit_set(asid_used, free);
+/* ASIDs are assigned when a pmap is activated. Once all of them are used up
+ * a new generation begins: whole TLB is flushed and each pmap receives a new
+ * ASID when it's activated next time. Thus the number of address spaces is
+ * not limited by the number of ASIDs. ASID 0 is reserved for the kernel. */
+static void pmap_asid_assign(pmap_t *pmap) {
+  SCOPED_SPIN_LOCK(asid_lock);
+
+  if (pmap->asid_gen == asid_gen)
+    return;
+
+  if (asid_next > asid_max) {
+    /* Generation 0 marks pmaps that were never activated. */
+    if (++asid_gen == 0)
+      asid_gen = 1;
+    asid_next = 1;
+    tlb_invalidate_all();
+    klog("ASID generation %u begins", asid_gen);
   }
-  klog("alloc_asid() = %d", free);
-  return free;
-}
 
-static void free_asid(asid_t asid) {
-  klog("free_asid(%d)", asid);
-  SCOPED_SPIN_LOCK(asid_lock);
-  bit_clear(asid_used, (unsigned)asid);
-  tlb_invalidate_asid(asid);
+  pmap->asid = asid_next++;
+  pmap->asid_gen = asid_gen;
+  klog("Assigned ASID %d to pmap %p", pmap->asid, pmap);
 }
 
 /*
  * Physical-to-virtual entries are managed for all pageable mappings.
  */
 
-static void pv_add(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
-  pv_entry_t *pv = pool_alloc(P_PV, M_ZERO);
+static inline mtx_t *pv_lock(vm_page_t *pg) {
+  return &pv_locks[(vm_page_paddr(pg) / PAGESIZE) % PV_LOCKS];
+}
+
+static void pv_lock_all(void) {
+  for (int i = 0; i < PV_LOCKS; i++)
+    mtx_lock(&pv_locks[i]);
+}
+
+static bool pv_trylock_all(void) {
+  for (int i = 0; i < PV_LOCKS; i++) {
+    if (!mtx_trylock(&pv_locks[i])) {
+      while (--i >= 0)
+        mtx_unlock(&pv_locks[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void pv_unlock_all(void) {
+  for (int i = PV_LOCKS - 1; i >= 0; i--)
+    mtx_unlock(&pv_locks[i]);
+}
+
+/* Locks pv list of `pg` (or of all pages if it's NULL) with pmap already
+ * locked. If the lock is contended, pmap is unlocked to respect lock order,
+ * after gathered TLB invalidations are flushed. Returns false in that case,
+ * as the caller must look up the mapping again. */
+static bool pv_lock_pmap(pmap_t *pmap, vm_page_t *pg, tlb_gather_t *tg) {
+  assert(mtx_owned(&pmap->mtx));
+
+  if (pg ? mtx_trylock(pv_lock(pg)) : pv_trylock_all())
+    return true;
+
+  if (tg)
+    tlb_gather_flush(tg);
+  mtx_unlock(&pmap->mtx);
+  if (pg)
+    mtx_lock(pv_lock(pg));
+  else
+    pv_lock_all();
+  mtx_lock(&pmap->mtx);
+  return false;
+}
+
+/* Entry is allocated by the caller before taking any locks, since pool
+ * allocator may wait for memory. */
+static void pv_add(pmap_t *pmap, vaddr_t va, vm_page_t *pg, pv_entry_t *pv) {
+  assert(mtx_owned(pv_lock(pg)));
   pv->pmap = pmap;
   pv->va = va;
-  TAILQ_INSERT_TAIL(&pg->pv_list, pv, page_link);
+  SLIST_INSERT_HEAD(&pg->pv_list, pv, page_link);
   TAILQ_INSERT_TAIL(&pmap->pv_list, pv, pmap_link);
 }
 
 static pv_entry_t *pv_find(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
+  assert(mtx_owned(pv_lock(pg)));
   pv_entry_t *pv;
-  TAILQ_FOREACH (pv, &pg->pv_list, page_link) {
+  SLIST_FOREACH (pv, &pg->pv_list, page_link) {
     if (pv->pmap == pmap && pv->va == va)
       return pv;
   }
@@ -153,10 +227,10 @@ static pv_entry_t *pv_find(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
 }
 
 static void pv_remove(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
+  assert(mtx_owned(pv_lock(pg)));
   pv_entry_t *pv = pv_find(pmap, va, pg);
   assert(pv != NULL);
-  TAILQ_REMOVE(&pg->pv_list, pv, page_link);
+  SLIST_REMOVE(&pg->pv_list, pv, pv_entry, page_link);
   TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
   pool_free(P_PV, pv);
 }
@@ -165,13 +239,14 @@ static void pv_remove(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
  * Routines for accessing page table entries.
  */
 
+/* Page tables are allocated with pmap locked, so they must not wait for
+ * memory, but may use pages kept in reserve. */
 static vm_page_t *pmap_pagealloc(void) {
-  vm_page_t *pg = vm_page_alloc(1);
-  pmap_zero_page(pg);
-  return pg;
+  return vm_page_alloc_flags(1, M_ZERO | M_NOWAIT);
 }
 
-static pte_t *pmap_lookup_pte(pmap_t *pmap, vaddr_t va) {
+/* Returns pointer to level 2 entry mapping va, or NULL if there's none. */
+static pde_t *pmap_lookup_l2(pmap_t *pmap, vaddr_t va) {
   pde_t *pdep;
   paddr_t pa = pmap->pde;
 
@@ -186,22 +261,25 @@ static pte_t *pmap_lookup_pte(pmap_t *pmap, vaddr_t va) {
     return NULL;
 
   /* Level 2 */
-  pdep = (pde_t *)PHYS_TO_DMAP(pa) + L2_INDEX(va);
-  if (!(pa = PTE_FRAME_ADDR(*pdep)))
-    return NULL;
+  return (pde_t *)PHYS_TO_DMAP(pa) + L2_INDEX(va);
+}
 
-  /* Level 3 */
-  return (pde_t *)PHYS_TO_DMAP(pa) + L3_INDEX(va);
+static inline bool pde_block_p(pde_t pde) {
+  return (pde & ATTR_DESCR_MASK) == L2_BLOCK;
 }
 
+/* Returns 0 if there's no memory for the page table. */
 static paddr_t pmap_alloc_pde(pmap_t *pmap, vaddr_t vaddr) {
   vm_page_t *pg = pmap_pagealloc();
+  if (pg == NULL)
+    return 0;
 
   TAILQ_INSERT_TAIL(&pmap->pte_pages, pg, pageq);
 
-  klog("Page table for 0x%016lx allocated at 0x%016lx", vaddr, pg->paddr);
+  paddr_t pa = vm_page_paddr(pg);
+  klog("Page table for 0x%016lx allocated at 0x%016lx", vaddr, pa);
 
-  return pg->paddr;
+  return pa;
 }
 
 static pte_t make_pte(paddr_t pa, vm_prot_t prot, unsigned flags) {
@@ -214,40 +292,131 @@ static pte_t make_pte(paddr_t pa, vm_prot_t prot, unsigned flags) {
   return pte | ATTR_IDX(ATTR_NORMAL_MEM_WB);
 }
 
-static void pmap_write_pte(pmap_t *pmap, pte_t *ptep, pte_t pte, vaddr_t va) {
+/* Shared pages are not on pagedaemon queues, so their access is not tracked. */
+static bool pmap_tracked_p(pmap_t *pmap, vm_page_t *pg) {
+  return pmap != pmap_kernel() && !(pg->flags & PG_COW);
+}
+
+/* Revokes access that would let the page be referenced or modified without
+ * the kernel noticing it. */
+static pte_t pte_track(pte_t pte, vm_page_t *pg) {
+  if (!(pg->flags & PG_REFERENCED))
+    pte &= ~ATTR_AF;
+  if (!(pg->flags & PG_MODIFIED))
+    pte |= ATTR_AP_RW_BIT;
+  return pte;
+}
+
+/* Stores the entry without invalidating TLB. */
+static void pmap_store_pte(pmap_t *pmap, pte_t *ptep, pte_t pte) {
   if (pmap != pmap_kernel())
     pte |= ATTR_AP(ATTR_AP_USER);
   *ptep = pte;
+}
+
+static void pmap_write_pte(pmap_t *pmap, pte_t *ptep, pte_t pte, vaddr_t va) {
+  pmap_store_pte(pmap, ptep, pte);
   tlb_invalidate(va, pmap->asid);
 }
 
+/* Replaces large page mapping with level 3 table of equivalent page mappings,
+ * so that each page can be changed on its own. The table was set aside when
+ * the large page was entered, so demotion never fails for lack of memory. */
+static void pmap_demote(pmap_t *pmap, pde_t *l2p, vaddr_t va) {
+  /* Direct map is never demoted, as page tables are accessed through it. */
+  assert(pmap != pmap_kernel());
+  assert(mtx_owned(&pmap->mtx));
+
+  vm_page_t *ptp = TAILQ_FIRST(&pmap->blk_pages);
+  assert(ptp != NULL);
+  TAILQ_REMOVE(&pmap->blk_pages, ptp, pageq);
+  TAILQ_INSERT_TAIL(&pmap->pte_pages, ptp, pageq);
+
+  vaddr_t start = va & ~(vaddr_t)L2_OFFSET;
+  pde_t block = *l2p;
+  paddr_t pa = vm_page_paddr(ptp);
+  pte_t *l3 = (pte_t *)PHYS_TO_DMAP(pa);
+  pte_t pte = (block & ~(L2_BLOCK_MASK | ATTR_DESCR_MASK)) | L3_PAGE;
+
+  for (int i = 0; i < Ln_ENTRIES; i++)
+    l3[i] = pte | (PTE_FRAME_ADDR(block) + i * PAGESIZE);
+
+  /* Break-before-make: old and new translations must not coexist in TLB. */
+  *l2p = 0;
+  tlb_invalidate(start, pmap->asid);
+  *l2p = pa | L2_TABLE;
+  tlb_invalidate(start, pmap->asid);
+
+  klog("Large page at 0x%016lx demoted", start);
+}
+
+/* Returns pointer to entry of va in level 3 of page table, or NULL if there's
+ * none. Large page mapping va is demoted, since the caller is going to modify
+ * the entry. */
+static pte_t *pmap_lookup_pte(pmap_t *pmap, vaddr_t va) {
+  pde_t *l2p = pmap_lookup_l2(pmap, va);
+  if (l2p == NULL)
+    return NULL;
+
+  if (pde_block_p(*l2p))
+    pmap_demote(pmap, l2p, va);
+
+  paddr_t pa = PTE_FRAME_ADDR(*l2p);
+  if (pa == 0)
+    return NULL;
+
+  /* Level 3 */
+  return (pte_t *)PHYS_TO_DMAP(pa) + L3_INDEX(va);
+}
+
 /*
- * Return pointer to entry of va in level 3 of page table. Allocate space if
- * needed.
+ * Return pointer to entry of va in level 2 of page table. Allocate space if
+ * needed. If there's no memory for it, return NULL, so the caller can release
+ * pmap lock and wait for free memory with vm_wait before trying again.
  */
 
-static pte_t *pmap_ensure_pte(pmap_t *pmap, vaddr_t va) {
+static pde_t *pmap_ensure_l2(pmap_t *pmap, vaddr_t va) {
   pde_t *pdep;
   paddr_t pa = pmap->pde;
 
   /* Level 0 */
   pdep = (pde_t *)PHYS_TO_DMAP(pa) + L0_INDEX(va);
   if (!(pa = PTE_FRAME_ADDR(*pdep))) {
-    pa = pmap_alloc_pde(pmap, va);
+    if (!(pa = pmap_alloc_pde(pmap, va)))
+      return NULL;
     *pdep = pa | L0_TABLE;
   }
 
   /* Level 1 */
   pdep = (pde_t *)PHYS_TO_DMAP(pa) + L1_INDEX(va);
   if (!(pa = PTE_FRAME_ADDR(*pdep))) {
-    pa = pmap_alloc_pde(pmap, va);
+    if (!(pa = pmap_alloc_pde(pmap, va)))
+      return NULL;
     *pdep = pa | L1_TABLE;
   }
 
   /* Level 2 */
-  pdep = (pde_t *)PHYS_TO_DMAP(pa) + L2_INDEX(va);
+  return (pde_t *)PHYS_TO_DMAP(pa) + L2_INDEX(va);
+}
+
+/*
+ * Return pointer to entry of va in level 3 of page table. Allocate space if
+ * needed. Return NULL if there's no memory for it, as above.
+ */
+
+static pte_t *pmap_ensure_pte(pmap_t *pmap, vaddr_t va) {
+  pde_t *pdep = pmap_ensure_l2(pmap, va);
+  paddr_t pa;
+
+  if (pdep == NULL)
+    return NULL;
+
+  /* Level 2 */
+  if (pde_block_p(*pdep))
+    pmap_demote(pmap, pdep, va);
   if (!(pa = PTE_FRAME_ADDR(*pdep))) {
-    pa = pmap_alloc_pde(pmap, va);
+    if (!(pa = pmap_alloc_pde(pmap, va)))
+      return NULL;
     *pdep = pa | L2_TABLE;
   }
 
@@ -265,6 +434,7 @@ void pmap_activate(pmap_t *umap) {
   if (umap == NULL) {
     WRITE_SPECIALREG(TCR_EL1, tcr | TCR_EPD0);
   } else {
+    pmap_asid_assign(umap);
     uint64_t ttbr0 = ((uint64_t)umap->asid << ASID_SHIFT) | umap->pde;
     WRITE_SPECIALREG(TTBR0_EL1, ttbr0);
     WRITE_SPECIALREG(TCR_EL1, tcr & ~TCR_EPD0);
@@ -276,19 +446,40 @@ void pmap_activate(pmap_t *umap) {
  */
 
 void pmap_kenter(vaddr_t va, paddr_t pa, vm_prot_t prot, unsigned flags) {
+  pmap_kenter_range(va, pa, PAGESIZE, prot, flags);
+}
+
+void pmap_kenter_range(vaddr_t va, paddr_t pa, size_t size, vm_prot_t prot,
+                       unsigned flags) {
   pmap_t *pmap = pmap_kernel();
 
-  assert(page_aligned_p(pa) && page_aligned_p(va));
-  assert(pmap_address_p(pmap, va));
+  assert(page_aligned_p(pa) && page_aligned_p(va) && page_aligned_p(size));
+  assert(pmap_contains_p(pmap, va, va + size));
   assert(pa != 0);
 
-  klog("Enter unmanaged mapping from %p to %p", va, pa);
+  klog("Enter unmanaged mapping from %p - %p to %p", va, va + size - 1, pa);
 
-  pte_t pte = make_pte(pa, prot, flags);
+  /* If page table can't be allocated, the range is resumed after waiting for
+   * free memory with no locks held. */
+  size_t off = 0;
 
-  WITH_MTX_LOCK (&pmap->mtx) {
-    pte_t *ptep = pmap_ensure_pte(pmap, va);
-    pmap_write_pte(pmap, ptep, pte, va);
+  while (off < size) {
+    WITH_MTX_LOCK (&pmap->mtx) {
+      pte_t *ptep = NULL;
+      size_t first = off;
+      for (; off < size; off += PAGESIZE, ptep++) {
+        /* Look up page table only when crossing its boundary. */
+        if (ptep == NULL || L3_INDEX(va + off) == 0) {
+          if (!(ptep = pmap_ensure_pte(pmap, va + off)))
+            break;
+        }
+        *ptep = make_pte(pa + off, prot, flags);
+      }
+      if (off > first)
+        tlb_invalidate_range(va + first, va + off, pmap->asid);
+    }
+    if (off < size)
+      vm_wait();
   }
 }
 
@@ -302,18 +493,17 @@ void pmap_kremove(vaddr_t va, size_t size) {
        va + size - 1);
 
   WITH_MTX_LOCK (&pmap->mtx) {
-    for (size_t off = 0; off < size; off += PAGESIZE) {
-      pte_t *ptep = pmap_lookup_pte(pmap, va);
+    pte_t *ptep = NULL;
+    for (size_t off = 0; off < size; off += PAGESIZE, ptep++) {
+      if (ptep == NULL || L3_INDEX(va + off) == 0)
+        ptep = pmap_lookup_pte(pmap, va + off);
       assert(ptep != NULL);
-      pmap_write_pte(pmap, ptep, 0, va);
+      *ptep = 0;
     }
+    tlb_invalidate_range(va, va + size, pmap->asid);
   }
 }
 
-bool pmap_kextract(vaddr_t va, paddr_t *pap) {
-  return pmap_extract(pmap_kernel(), va, pap);
-}
-
 /*
  * Pageable (user & kernel) memory interface.
  */
@@ -322,6 +512,15 @@ static bool pmap_extract_nolock(pmap_t *pmap, vaddr_t va, paddr_t *pap) {
   if (!pmap_address_p(pmap, va))
     return false;
 
+  pde_t *l2p = pmap_lookup_l2(pmap, va);
+  if (l2p == NULL)
+    return false;
+
+  if (pde_block_p(*l2p)) {
+    *pap = (*l2p & L2_BLOCK_MASK) | (va & L2_OFFSET);
+    return true;
+  }
+
   pte_t *ptep = pmap_lookup_pte(pmap, va);
   if (ptep == NULL)
     return false;
@@ -332,9 +531,15 @@ static bool pmap_extract_nolock(pmap_t *pmap, vaddr_t va, paddr_t *pap) {
   return true;
 }
 
+/* Kernel page tables are never freed, and mappings of kernel memory do not
+ * change while it's in use, so the owner may look it up without the lock. */
+bool pmap_kextract(vaddr_t va, paddr_t *pap) {
+  return pmap_extract_nolock(pmap_kernel(), va, pap);
+}
+
 void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
                 unsigned flags) {
-  paddr_t pa = pg->paddr;
+  paddr_t pa = vm_page_paddr(pg);
 
   assert(page_aligned_p(va));
   assert(pmap_address_p(pmap, va));
@@ -343,22 +548,165 @@ void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
 
   bool kern_mapping = (pmap == pmap_kernel());
 
-  /* TODO(pj) Mark user pages as non-referenced & non-modified. */
+  /* Writes to shared pages must fault to get a private copy. */
+  if (pg->flags & PG_COW)
+    prot &= ~VM_PROT_WRITE;
+
+  pte_t *ptep = NULL;
+
+  /* Zero page is never written to nor paged out, so it has no pv entries. */
+  if (pg->flags & PG_ZERO) {
+    pte_t pte = make_pte(pa, prot, flags);
+    while (ptep == NULL) {
+      WITH_MTX_LOCK (&pmap->mtx) {
+        if ((ptep = pmap_ensure_pte(pmap, va)))
+          pmap_write_pte(pmap, ptep, pte, va);
+      }
+      if (ptep == NULL)
+        vm_wait();
+    }
+    return;
+  }
+
   pte_t pte = make_pte(pa, prot, flags);
 
+  /* Nothing may wait for memory with pv lock held, as pagedaemon needs these
+   * locks to free pages. */
+  pv_entry_t *pv = pool_alloc(P_PV, M_ZERO);
+
+  while (ptep == NULL) {
+    WITH_MTX_LOCK (pv_lock(pg)) {
+      WITH_MTX_LOCK (&pmap->mtx) {
+        /* Page table is allocated first, so nothing changes on failure. */
+        if ((ptep = pmap_ensure_pte(pmap, va))) {
+          if (pv_find(pmap, va, pg) == NULL) {
+            pv_add(pmap, va, pg, pv);
+            pv = NULL;
+          }
+          if (kern_mapping)
+            pg->flags |= PG_MODIFIED | PG_REFERENCED;
+          else /* Modified bit is sticky, as contents were not written back. */
+            pg->flags &= ~PG_REFERENCED;
+          if (pmap_tracked_p(pmap, pg))
+            pte = pte_track(pte, pg);
+          pmap_write_pte(pmap, ptep, pte, va);
+        }
+      }
+    }
+    if (ptep == NULL)
+      vm_wait();
+  }
+
+  if (pv)
+    pool_free(P_PV, pv);
+}
+
+unsigned pmap_tlb_misses(void) {
+  return 0;
+}
+
+size_t pmap_block_size(void) {
+  return L2_SIZE;
+}
+
+bool pmap_enter_block(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
+                      unsigned flags) {
+  paddr_t pa = vm_page_paddr(pg);
+  bool entered = false;
+
+  assert(pmap != pmap_kernel());
+  assert(is_aligned(va, L2_SIZE) && is_aligned(pa, L2_SIZE));
+  assert(pmap_contains_p(pmap, va, va + L2_SIZE));
+
+  klog("Enter large page mapping %p for frame %p", va, pa);
+
+  /* Access flag is set by the first access, as with small pages. */
+  pte_t pte = (make_pte(pa, prot, flags) & ~(ATTR_DESCR_MASK | ATTR_AF)) |
+              L2_BLOCK;
+
+  /* Entries are allocated before taking locks, as pool allocator may wait for
+   * memory, and pagedaemon needs pv locks to free pages. */
+  SLIST_HEAD(, pv_entry) pvs = SLIST_HEAD_INITIALIZER(pvs);
+  for (int i = 0; i < Ln_ENTRIES; i++) {
+    pv_entry_t *pv = pool_alloc(P_PV, M_ZERO);
+    SLIST_INSERT_HEAD(&pvs, pv, page_link);
+  }
+
+  /* Pages of a block are assigned all pv locks. */
+  pv_lock_all();
+
   WITH_MTX_LOCK (&pmap->mtx) {
-    WITH_MTX_LOCK (pv_list_lock) {
-      pv_entry_t *pv = pv_find(pmap, va, pg);
-      if (pv == NULL)
-        pv_add(pmap, va, pg);
+    pde_t *l2p = pmap_ensure_l2(pmap, va);
+    vm_page_t *ptp = NULL;
+
+    /* Page table left after pages that were mapped here before is set aside
+     * for demotion of the large page. Otherwise a new one is needed. If there's
+     * no memory, the caller falls back to small pages. */
+    if (l2p && *l2p) {
+      assert(!pde_block_p(*l2p));
+      pte_t *l3 = (pte_t *)PHYS_TO_DMAP(PTE_FRAME_ADDR(*l2p));
+      for (int i = 0; i < Ln_ENTRIES; i++)
+        assert(l3[i] == 0);
+      ptp = vm_page_find(PTE_FRAME_ADDR(*l2p));
+      pmap_write_pte(pmap, l2p, 0, va);
+      TAILQ_REMOVE(&pmap->pte_pages, ptp, pageq);
+    } else if (l2p) {
+      ptp = pmap_pagealloc();
+    }
+
+    if (ptp) {
+      TAILQ_INSERT_TAIL(&pmap->blk_pages, ptp, pageq);
+
+      for (int i = 0; i < Ln_ENTRIES; i++) {
+        pv_entry_t *pv = SLIST_FIRST(&pvs);
+        SLIST_REMOVE_HEAD(&pvs, page_link);
+        pv_add(pmap, va + i * PAGESIZE, &pg[i], pv);
+        /* Block is entered writable on write fault, so writes to its pages
+         * are not tracked. */
+        pg[i].flags &= ~PG_REFERENCED;
+        pg[i].flags |= PG_MODIFIED;
+      }
+
+      pmap_write_pte(pmap, l2p, pte, va);
+      entered = true;
     }
-    if (kern_mapping)
-      pg->flags |= PG_MODIFIED | PG_REFERENCED;
-    else
-      pg->flags &= ~(PG_MODIFIED | PG_REFERENCED);
-    pte_t *ptep = pmap_ensure_pte(pmap, va);
-    pmap_write_pte(pmap, ptep, pte, va);
   }
+
+  pv_unlock_all();
+
+  while (!SLIST_EMPTY(&pvs)) {
+    pv_entry_t *pv = SLIST_FIRST(&pvs);
+    SLIST_REMOVE_HEAD(&pvs, page_link);
+    pool_free(P_PV, pv);
+  }
+
+  return entered;
+}
+
+/* Removes large page mapping without demoting it first. */
+static void pmap_remove_block(pmap_t *pmap, pde_t *l2p, vaddr_t va,
+                              tlb_gather_t *tg) {
+  vm_page_t *pg = vm_page_find(*l2p & L2_BLOCK_MASK);
+
+  for (int i = 0; i < Ln_ENTRIES; i++)
+    pv_remove(pmap, va + i * PAGESIZE, &pg[i]);
+
+  pmap_store_pte(pmap, l2p, 0);
+  tlb_gather_add(tg, va, L2_SIZE);
+
+  /* Page table set aside for demotion is no longer needed. */
+  vm_page_t *ptp = TAILQ_FIRST(&pmap->blk_pages);
+  TAILQ_REMOVE(&pmap->blk_pages, ptp, pageq);
+  vm_page_free(ptp);
+}
+
+/* Returns level 2 entry if it maps a large page, which is entirely contained
+ * in [va, end) range. */
+static pde_t *pmap_lookup_block(pmap_t *pmap, vaddr_t va, vaddr_t end) {
+  if (!is_aligned(va, L2_SIZE) || end - va < L2_SIZE)
+    return NULL;
+  pde_t *l2p = pmap_lookup_l2(pmap, va);
+  return (l2p && pde_block_p(*l2p)) ? l2p : NULL;
 }
 
 void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end) {
@@ -367,19 +715,43 @@ void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end) {
 
   klog("Remove page mapping for address range %p-%p", start, end);
 
+  tlb_gather_t tg;
+
   WITH_MTX_LOCK (&pmap->mtx) {
-    for (vaddr_t va = start; va < end; va += PAGESIZE) {
-      pte_t *ptep = pmap_lookup_pte(pmap, va);
-      if (ptep == NULL)
+    tlb_gather_init(&tg, pmap->asid);
+    /* If pmap had to be unlocked to get pv lock, the address is retried. */
+    for (vaddr_t va = start; va < end;) {
+      pde_t *l2p = pmap_lookup_block(pmap, va, end);
+      if (l2p) {
+        if (pv_lock_pmap(pmap, NULL, &tg)) {
+          pmap_remove_block(pmap, l2p, va, &tg);
+          va += L2_SIZE;
+        }
+        pv_unlock_all();
         continue;
-      paddr_t pa = PTE_FRAME_ADDR(*ptep);
-      if (pa == 0)
+      }
+      pte_t *ptep = pmap_lookup_pte(pmap, va);
+      paddr_t pa = ptep ? PTE_FRAME_ADDR(*ptep) : 0;
+      if (pa == 0) {
+        va += PAGESIZE;
         continue;
+      }
       vm_page_t *pg = vm_page_find(pa);
-      WITH_MTX_LOCK (pv_list_lock)
+      if (pg->flags & PG_ZERO) {
+        pmap_store_pte(pmap, ptep, 0);
+        tlb_gather_add(&tg, va, PAGESIZE);
+        va += PAGESIZE;
+        continue;
+      }
+      if (pv_lock_pmap(pmap, pg, &tg)) {
         pv_remove(pmap, va, pg);
-      pmap_write_pte(pmap, ptep, 0, va);
+        pmap_store_pte(pmap, ptep, 0);
+        tlb_gather_add(&tg, va, PAGESIZE);
+        va += PAGESIZE;
+      }
+      mtx_unlock(pv_lock(pg));
     }
+    tlb_gather_flush(&tg);
   }
 }
 
@@ -390,14 +762,40 @@ void pmap_protect(pmap_t *pmap, vaddr_t start, vaddr_t end, vm_prot_t prot) {
   klog("Change protection bits to %x for address range %p-%p", prot, start,
        end);
 
+  tlb_gather_t tg;
+
   WITH_MTX_LOCK (&pmap->mtx) {
+    tlb_gather_init(&tg, pmap->asid);
     for (vaddr_t va = start; va < end; va += PAGESIZE) {
+      pde_t *l2p = pmap_lookup_block(pmap, va, end);
+      if (l2p) {
+        /* Access flag and write-protection used to track large page
+         * are retained, so that its pages won't miss being marked. */
+        pte_t pte = (vm_prot_map[prot] & ~(ATTR_DESCR_MASK | ATTR_AF)) |
+                    (*l2p & ~(ATTR_AP(ATTR_AP_USER) | ATTR_XN | ATTR_SW_RW));
+        if (!(pte & ATTR_SW_RW))
+          pte |= ATTR_AP_RW_BIT;
+        pmap_store_pte(pmap, l2p, pte);
+        tlb_gather_add(&tg, va, L2_SIZE);
+        va += L2_SIZE - PAGESIZE;
+        continue;
+      }
       pte_t *ptep = pmap_lookup_pte(pmap, va);
-      if (ptep == NULL)
+      if (ptep == NULL || *ptep == 0)
         continue;
-      pte_t pte = vm_prot_map[prot] | (*ptep & (~ATTR_AP_MASK & ~ATTR_XN));
-      pmap_write_pte(pmap, ptep, pte, va);
+      /* Shared pages stay read-only. */
+      vm_prot_t pg_prot = prot;
+      vm_page_t *pg = vm_page_find(PTE_FRAME_ADDR(*ptep));
+      if (pg->flags & PG_COW)
+        pg_prot &= ~VM_PROT_WRITE;
+      pte_t pte = vm_prot_map[pg_prot] |
+                  (*ptep & ~(ATTR_AP_MASK | ATTR_XN | ATTR_SW_RW | ATTR_AF));
+      if (pmap_tracked_p(pmap, pg))
+        pte = pte_track(pte, pg);
+      pmap_store_pte(pmap, ptep, pte);
+      tlb_gather_add(&tg, va, PAGESIZE);
     }
+    tlb_gather_flush(&tg);
   }
 }
 
@@ -406,44 +804,93 @@ bool pmap_extract(pmap_t *pmap, vaddr_t va, paddr_t *pap) {
   return pmap_extract_nolock(pmap, va, pap);
 }
 
+bool pmap_writable_p(pmap_t *pmap, vaddr_t va) {
+  SCOPED_MTX_LOCK(&pmap->mtx);
+
+  if (!pmap_address_p(pmap, va))
+    return false;
+
+  pde_t *l2p = pmap_lookup_l2(pmap, va);
+  if (l2p == NULL)
+    return false;
+
+  if (pde_block_p(*l2p))
+    return *l2p & ATTR_SW_RW;
+
+  pte_t *ptep = pmap_lookup_pte(pmap, va);
+  return ptep && (*ptep & ATTR_SW_RW);
+}
+
 void pmap_page_remove(vm_page_t *pg) {
-  SCOPED_MTX_LOCK(pv_list_lock);
+  SCOPED_MTX_LOCK(pv_lock(pg));
 
-  while (!TAILQ_EMPTY(&pg->pv_list)) {
-    pv_entry_t *pv = TAILQ_FIRST(&pg->pv_list);
+  while (!SLIST_EMPTY(&pg->pv_list)) {
+    pv_entry_t *pv = SLIST_FIRST(&pg->pv_list);
     pmap_t *pmap = pv->pmap;
     vaddr_t va = pv->va;
-    TAILQ_REMOVE(&pg->pv_list, pv, page_link);
+    SLIST_REMOVE_HEAD(&pg->pv_list, page_link);
     TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
-    pte_t *ptep = pmap_lookup_pte(pmap, va);
-    assert(ptep != NULL);
-    pmap_write_pte(pmap, ptep, 0, va);
+    WITH_MTX_LOCK (&pmap->mtx) {
+      pte_t *ptep = pmap_lookup_pte(pmap, va);
+      assert(ptep != NULL);
+      pmap_write_pte(pmap, ptep, 0, va);
+    }
     pool_free(P_PV, pv);
   }
 }
 
 void pmap_zero_page(vm_page_t *pg) {
-  bzero(PG_DMAP_ADDR(pg), PAGESIZE);
+  if (dczva_size)
+    pagezero_zva(PG_DMAP_ADDR(pg), dczva_size);
+  else
+    pagezero(PG_DMAP_ADDR(pg));
 }
 
 void pmap_copy_page(vm_page_t *src, vm_page_t *dst) {
-  memcpy(PG_DMAP_ADDR(dst), PG_DMAP_ADDR(src), PAGESIZE);
+  pagecopy(PG_DMAP_ADDR(dst), PG_DMAP_ADDR(src));
 }
 
+/* Large page has single access flag and write permission, so it can't tell
+ * which of its pages were referenced or modified. These bits are set in all
+ * pages of the block when the hardware might have needed them. */
+static void pmap_block_flags(pde_t pde) {
+  vm_page_t *pg = vm_page_find(pde & L2_BLOCK_MASK);
+  uint16_t flags = 0;
+
+  if (pde & ATTR_AF)
+    flags |= PG_REFERENCED;
+  if (!(pde & ATTR_AP_RW_BIT))
+    flags |= PG_MODIFIED;
+
+  if (flags)
+    for (int i = 0; i < Ln_ENTRIES; i++)
+      pg[i].flags |= flags;
+}
+
+/* Large pages are tracked with their level 2 entries, so aging their pages
+ * doesn't split them. */
 static void pmap_modify_flags(vm_page_t *pg, pte_t set, pte_t clr) {
-  SCOPED_MTX_LOCK(pv_list_lock);
+  SCOPED_MTX_LOCK(pv_lock(pg));
   pv_entry_t *pv;
-  TAILQ_FOREACH (pv, &pg->pv_list, page_link) {
+  SLIST_FOREACH (pv, &pg->pv_list, page_link) {
     pmap_t *pmap = pv->pmap;
     vaddr_t va = pv->va;
     WITH_MTX_LOCK (&pmap->mtx) {
-      pte_t *ptep = pmap_lookup_pte(pmap, va);
+      pde_t *l2p = pmap_lookup_l2(pmap, va);
+      assert(l2p != NULL);
+      bool block = pde_block_p(*l2p);
+      pte_t *ptep = block ? l2p : pmap_lookup_pte(pmap, va);
       assert(ptep != NULL);
       pte_t pte = *ptep;
       pte |= set;
       pte &= ~clr;
+      /* Read-only mappings never become writable. */
+      if (!(pte & ATTR_SW_RW))
+        pte |= ATTR_AP_RW_BIT;
       *ptep = pte;
       tlb_invalidate(va, pmap->asid);
+      if (block)
+        pmap_block_flags(pte);
     }
   }
 }
@@ -458,7 +905,7 @@ bool pmap_clear_referenced(vm_page_t *pg) {
 bool pmap_clear_modified(vm_page_t *pg) {
   bool prev = pmap_is_modified(pg);
   pg->flags &= ~PG_MODIFIED;
-  pmap_modify_flags(pg, 0, ATTR_DBM);
+  pmap_modify_flags(pg, ATTR_AP_RW_BIT, 0);
   return prev;
 }
 
@@ -477,7 +924,7 @@ void pmap_set_referenced(vm_page_t *pg) {
 
 void pmap_set_modified(vm_page_t *pg) {
   pg->flags |= PG_MODIFIED;
-  pmap_modify_flags(pg, ATTR_DBM, 0);
+  pmap_modify_flags(pg, 0, ATTR_AP_RW_BIT);
 }
 
 /*
@@ -485,24 +932,48 @@ void pmap_set_modified(vm_page_t *pg) {
  */
 
 static void pmap_setup(pmap_t *pmap) {
-  pmap->asid = alloc_asid();
   mtx_init(&pmap->mtx, 0);
   TAILQ_INIT(&pmap->pte_pages);
+  TAILQ_INIT(&pmap->blk_pages);
   TAILQ_INIT(&pmap->pv_list);
 }
 
 void init_pmap(void) {
   pmap_setup(&kernel_pmap);
   kernel_pmap.pde = _kernel_pmap_pde;
+
+  for (int i = 0; i < PV_LOCKS; i++)
+    mtx_init(&pv_locks[i], 0);
+
+  uint64_t ctr = READ_SPECIALREG(ctr_el0);
+  uint64_t dczid = READ_SPECIALREG(dczid_el0);
+  uint64_t tcr = READ_SPECIALREG(TCR_EL1);
+
+  /* Boot code enables 16-bit ASIDs if they're available. */
+  asid_max = (tcr & TCR_ASID_16) ? MAX_ASID : MAX_ASID_8BIT;
+
+  init_aarch64_tlb();
+
+  /* DC ZVA clears whole block, which is usually a data cache line. */
+  if (!(dczid & DCZID_DZP)) {
+    size_t bs = 4 << DCZID_BS_SIZE(dczid);
+    if (bs >= 16 && bs <= PAGESIZE)
+      dczva_size = bs;
+  }
+
+  klog("D-cache line: %d bytes, DC ZVA block: %d bytes",
+       CTR_DLINE_SIZE(ctr), dczva_size);
 }
 
 pmap_t *pmap_new(void) {
   pmap_t *pmap = pool_alloc(P_PMAP, M_ZERO);
   pmap_setup(pmap);
 
-  vm_page_t *pg = pmap_pagealloc();
+  vm_page_t *pg;
+  while (!(pg = pmap_pagealloc()))
+    vm_wait();
   TAILQ_INSERT_TAIL(&pmap->pte_pages, pg, pageq);
-  pmap->pde = pg->paddr;
+  pmap->pde = vm_page_paddr(pg);
   klog("Page directory table allocated at %p", pmap->pde);
 
   return pmap;
@@ -511,16 +982,19 @@ pmap_t *pmap_new(void) {
 void pmap_delete(pmap_t *pmap) {
   assert(pmap != pmap_kernel());
 
-  while (!TAILQ_EMPTY(&pmap->pv_list)) {
-    pv_entry_t *pv = TAILQ_FIRST(&pmap->pv_list);
-    vm_page_t *pg;
-    paddr_t pa;
-    pmap_extract_nolock(pmap, pv->va, &pa);
-    pg = vm_page_find(pa);
-    WITH_MTX_LOCK (pv_list_lock)
-      TAILQ_REMOVE(&pg->pv_list, pv, page_link);
-    TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
-    pool_free(P_PV, pv);
+  WITH_MTX_LOCK (&pmap->mtx) {
+    while (!TAILQ_EMPTY(&pmap->pv_list)) {
+      pv_entry_t *pv = TAILQ_FIRST(&pmap->pv_list);
+      paddr_t pa;
+      pmap_extract_nolock(pmap, pv->va, &pa);
+      vm_page_t *pg = vm_page_find(pa);
+      if (pv_lock_pmap(pmap, pg, NULL)) {
+        SLIST_REMOVE(&pg->pv_list, pv, pv_entry, page_link);
+        TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
+        pool_free(P_PV, pv);
+      }
+      mtx_unlock(pv_lock(pg));
+    }
   }
 
   while (!TAILQ_EMPTY(&pmap->pte_pages)) {
@@ -529,6 +1003,11 @@ void pmap_delete(pmap_t *pmap) {
     vm_page_free(pg);
   }
 
-  free_asid(pmap->asid);
+  while (!TAILQ_EMPTY(&pmap->blk_pages)) {
+    vm_page_t *pg = TAILQ_FIRST(&pmap->blk_pages);
+    TAILQ_REMOVE(&pmap->blk_pages, pg, pageq);
+    vm_page_free(pg);
+  }
+
   pool_free(P_PMAP, pmap);
 }
@@ -0,0 +1,78 @@
+#include <sys/mimiker.h>
+#include <sys/context.h>
+#include <sys/stack.h>
+#include <sys/thread.h>
+#include <machine/vm_param.h>
+
+/*
+ * Frame records form a linked list: x29 points at a pair of {previous x29,
+ * return address} stored on the stack. Walking the list requires code to be
+ * compiled with frame pointers (see PROFILE in build/flags.mk), otherwise
+ * unwinding stops as soon as x29 doesn't look like a frame record.
+ */
+
+extern char __etext[];
+
+static inline bool kernel_text_p(register_t pc) {
+  return (register_t)__text <= pc && pc < (register_t)__etext;
+}
+
+unsigned stack_unwind_kernel(thread_t *td, ctx_t *ctx, uint64_t *pcs,
+                             unsigned n) {
+  vaddr_t lo = (vaddr_t)td->td_kstack.stk_base;
+  vaddr_t hi = lo + td->td_kstack.stk_size;
+  vaddr_t fp = _REG(ctx, FP);
+  unsigned i = 0;
+
+  if (n == 0)
+    return 0;
+
+  pcs[i++] = _REG(ctx, PC);
+
+  while (i < n) {
+    if (fp < lo || fp + 2 * sizeof(register_t) > hi ||
+        !is_aligned(fp, sizeof(register_t)))
+      break;
+
+    register_t *frame = (register_t *)fp;
+    if (!kernel_text_p(frame[1]))
+      break;
+    pcs[i++] = frame[1];
+
+    /* Stack grows down, so caller's frame record lies above. */
+    if ((vaddr_t)frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+
+  return i;
+}
+
+unsigned stack_unwind_user(mcontext_t *uctx, uint64_t *pcs, unsigned n) {
+  vaddr_t fp = _REG(uctx, FP);
+  unsigned i = 0;
+
+  if (n == 0)
+    return 0;
+
+  pcs[i++] = _REG(uctx, PC);
+
+  while (i < n) {
+    register_t frame[2];
+
+    if (fp == 0 || !is_aligned(fp, sizeof(register_t)) ||
+        fp >= USER_SPACE_END)
+      break;
+    if (copyin((void *)fp, frame, sizeof(frame)))
+      break;
+    if (frame[1] == 0 || frame[1] >= USER_SPACE_END)
+      break;
+    pcs[i++] = frame[1];
+
+    if ((vaddr_t)frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+
+  return i;
+}
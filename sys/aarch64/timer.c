@@ -14,12 +14,25 @@ typedef struct arm_timer_state {
   resource_t *irq_res;
   timer_t timer;
   uint64_t step;
+  bool oneshot;
 } arm_timer_state_t;
 
-static int arm_timer_start(timer_t *tm, unsigned flags __unused,
-                           const bintime_t start __unused,
+static int arm_timer_start(timer_t *tm, unsigned flags, const bintime_t start,
                            const bintime_t period) {
   arm_timer_state_t *state = ((device_t *)tm->tm_priv)->state;
+
+  if (flags & TMF_ONESHOT) {
+    state->oneshot = true;
+    /* Comparator fires immediately if the deadline has already passed. */
+    uint64_t deadline = bintime_mul(start, tm->tm_frequency).sec;
+    WITH_INTR_DISABLED {
+      WRITE_SPECIALREG(cntp_cval_el0, deadline);
+      WRITE_SPECIALREG(cntp_ctl_el0, CNTCTL_ENABLE);
+    }
+    return 0;
+  }
+
+  state->oneshot = false;
   state->step = bintime_mul(period, tm->tm_frequency).sec;
 
   WITH_INTR_DISABLED {
@@ -44,6 +57,13 @@ static bintime_t arm_timer_gettime(timer_t *tm) {
 static intr_filter_t arm_timer_intr(void *data /* device_t* */) {
   arm_timer_state_t *state = ((device_t *)data)->state;
 
+  if (state->oneshot) {
+    /* Acknowledge the interrupt. Callback is expected to rearm the timer. */
+    WRITE_SPECIALREG(cntp_cval_el0, UINT64_MAX);
+    tm_trigger(&state->timer);
+    return IF_FILTERED;
+  }
+
   tm_trigger(&state->timer);
 
   /*
@@ -69,7 +89,7 @@ static int arm_timer_attach(device_t *dev) {
   /* Save link to timer device. */
   state->timer = (timer_t){
     .tm_name = "arm-cpu-timer",
-    .tm_flags = TMF_PERIODIC,
+    .tm_flags = TMF_PERIODIC | TMF_ONESHOT,
     .tm_start = arm_timer_start,
     .tm_stop = arm_timer_stop,
     .tm_gettime = arm_timer_gettime,
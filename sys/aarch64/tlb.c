@@ -1,14 +1,41 @@
+#include <sys/mimiker.h>
+#include <machine/vm_param.h>
+#include <aarch64/armreg.h>
 #include <aarch64/tlb.h>
 
 #define ASID_TO_PTE(x) ((uint64_t)(x) << ASID_SHIFT)
 
+/* Above that many pages it's cheaper to flush whole address space. */
+#define TLB_RANGE_MAX 256
+
 #define __tlbi(x, r) __asm__ volatile("TLBI " x ", %0" : : "r"(r))
 #define __dsb(x) __asm__ volatile("DSB " x)
 #define __isb() __asm__ volatile("ISB")
 
-void tlb_invalidate(vaddr_t va, asid_t asid) {
-  __dsb("ishst");
+/* TLBI RVAE1IS and TLBI RVAAE1IS (ARMv8.4-TLBIRANGE) written as SYS
+ * instructions, since assembler may not know them. */
+#define __tlbi_rvae1is(r)                                                      \
+  __asm__ volatile("SYS #0, C8, C2, #1, %0" : : "r"(r))
+#define __tlbi_rvaae1is(r)                                                     \
+  __asm__ volatile("SYS #0, C8, C2, #3, %0" : : "r"(r))
 
+/* Range TLBI operand invalidates (num + 1) * 2^(5 * scale + 1) pages starting
+ * at va. TG field set to 1 selects 4KiB translation granule. */
+#define TLBI_RANGE_PAGES(scale, num) ((size_t)((num) + 1) << (5 * (scale) + 1))
+#define TLBI_RANGE_MAX TLBI_RANGE_PAGES(3, 31)
+#define TLBI_RANGE(asid, scale, num, va)                                       \
+  (ASID_TO_PTE(asid) | (1UL << 46) | ((uint64_t)(scale) << 44) |               \
+   ((uint64_t)(num) << 39) | (((va) >> PAGE_SHIFT) & ((1UL << 37) - 1)))
+
+static bool tlb_range_p; /* CPU implements range TLBI instructions */
+
+void init_aarch64_tlb(void) {
+  uint64_t isar0 = READ_SPECIALREG(id_aa64isar0_el1);
+  tlb_range_p = ID_AA64ISAR0_TLB_VAL(isar0) >= ID_AA64ISAR0_TLB_TLBIOSR;
+}
+
+/* Issues TLBI for single page without any barriers. */
+static inline void tlbi_page(vaddr_t va, asid_t asid) {
   /*
    * vae1is - Invalidate translation used at EL1 for the specified VA and
    * Address Space Identifier (ASID) and the current VMID, Inner Shareable.
@@ -29,14 +56,111 @@ void tlb_invalidate(vaddr_t va, asid_t asid) {
      */
     __tlbi("vaae1is", va >> PAGE_SHIFT);
   }
+}
+
+/* Issues range TLBIs for npages starting at va, without any barriers.
+ * Each instruction covers a range described by 5-bit number and 2-bit scale,
+ * so npages is split the same way Linux's __flush_tlb_range_op does it. */
+static void tlbi_range(vaddr_t va, size_t npages, asid_t asid) {
+  assert(npages < TLBI_RANGE_MAX);
 
+  for (unsigned scale = 0; npages > 0;) {
+    if (npages % 2) {
+      tlbi_page(va, asid);
+      va += PAGESIZE;
+      npages--;
+      continue;
+    }
+
+    int num = (int)((npages >> (5 * scale + 1)) & 31) - 1;
+    if (num >= 0) {
+      uint64_t r = TLBI_RANGE(asid, scale, num, va);
+      if (asid > 0)
+        __tlbi_rvae1is(r);
+      else
+        __tlbi_rvaae1is(r);
+      va += TLBI_RANGE_PAGES(scale, num) * PAGESIZE;
+      npages -= TLBI_RANGE_PAGES(scale, num);
+    }
+    scale++;
+  }
+}
+
+static inline void tlbi_asid(asid_t asid) {
+  if (asid > 0)
+    __tlbi("aside1is", ASID_TO_PTE(asid));
+  else
+    __asm__ volatile("TLBI vmalle1is");
+}
+
+void tlb_invalidate(vaddr_t va, asid_t asid) {
+  __dsb("ishst");
+  tlbi_page(va, asid);
   __dsb("ish");
   __isb();
 }
 
 void tlb_invalidate_asid(asid_t asid) {
   __dsb("ishst");
-  __tlbi("aside1is", ASID_TO_PTE(asid));
+  tlbi_asid(asid);
+  __dsb("ish");
+  __isb();
+}
+
+void tlb_invalidate_all(void) {
+  __dsb("ishst");
+  __asm__ volatile("TLBI vmalle1is");
+  __dsb("ish");
+  __isb();
+}
+
+void tlb_invalidate_range(vaddr_t start, vaddr_t end, asid_t asid) {
+  size_t npages = (end - start) >> PAGE_SHIFT;
+
+  __dsb("ishst");
+
+  /* Barriers are issued once for the whole range. */
+  if (tlb_range_p && npages < TLBI_RANGE_MAX) {
+    tlbi_range(start, npages, asid);
+  } else if (npages > TLB_RANGE_MAX) {
+    tlbi_asid(asid);
+  } else {
+    for (vaddr_t va = start; va < end; va += PAGESIZE)
+      tlbi_page(va, asid);
+  }
+
   __dsb("ish");
   __isb();
 }
+
+void tlb_gather_init(tlb_gather_t *tg, asid_t asid) {
+  tg->asid = asid;
+  tg->count = 0;
+  tg->start = (vaddr_t)-1;
+  tg->end = 0;
+}
+
+void tlb_gather_add(tlb_gather_t *tg, vaddr_t va, size_t size) {
+  if (tg->count < TLB_GATHER_MAX)
+    tg->va[tg->count] = va;
+  tg->count++;
+  tg->start = min(tg->start, va);
+  tg->end = max(tg->end, va + size);
+}
+
+void tlb_gather_flush(tlb_gather_t *tg) {
+  if (tg->count == 0)
+    return;
+
+  if (tg->count > TLB_GATHER_MAX) {
+    tlb_invalidate_range(tg->start, tg->end, tg->asid);
+  } else {
+    __dsb("ishst");
+    for (unsigned i = 0; i < tg->count; i++)
+      tlbi_page(tg->va[i], tg->asid);
+    __dsb("ish");
+    __isb();
+  }
+
+  tlb_gather_init(tg, tg->asid);
+}
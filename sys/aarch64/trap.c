@@ -2,6 +2,7 @@
 #include <sys/context.h>
 #include <sys/mimiker.h>
 #include <sys/thread.h>
+#include <sys/trace.h>
 #include <sys/pmap.h>
 #include <sys/vm_physmem.h>
 #include <sys/vm_map.h>
@@ -41,8 +42,12 @@ static void syscall_handler(register_t code, ctx_t *ctx,
 
   assert(td->td_proc != NULL);
 
+  TRACE(TRACE_SYSCALL_ENTER, code);
+
   int error = se->call(td->td_proc, (void *)args, &retval);
 
+  TRACE(TRACE_SYSCALL_EXIT, code, error, retval);
+
   result->retval = error ? -1 : retval;
   result->error = error;
 }
@@ -51,6 +56,7 @@ static void abort_handler(ctx_t *ctx, register_t esr, vaddr_t vaddr,
                           bool usermode) {
   uint32_t exception = ESR_ELx_EXCEPTION(esr);
   thread_t *td = thread_self();
+  int error = EFAULT;
 
   klog("%x at $%lx, caused by reference to $%lx!", exception, _REG(ctx, PC),
        vaddr);
@@ -69,19 +75,18 @@ static void abort_handler(ctx_t *ctx, register_t esr, vaddr_t vaddr,
     access |= VM_PROT_WRITE;
   }
 
+  /* Writes to the zero page or pages shared after merging are resolved by
+   * vm_page_fault, which replaces them with a private copy. Writes to pages
+   * mapped read-only are reported by vm_page_fault as well. */
   paddr_t pa;
-  if (pmap_extract(pmap, vaddr, &pa)) {
-    vm_page_t *pg = vm_page_find(pa);
-
-    if (access & (VM_PROT_READ | VM_PROT_EXEC)) {
-      pmap_set_referenced(pg);
-    } else if (access & VM_PROT_WRITE) {
-      pmap_set_referenced(pg);
+  vm_page_t *pg;
+  if (pmap_extract(pmap, vaddr, &pa) &&
+      !((pg = vm_page_find(pa))->flags & PG_COW) &&
+      (!(access & VM_PROT_WRITE) || pmap_writable_p(pmap, vaddr))) {
+    /* Mapping is made accessible only when page gets marked. */
+    pmap_set_referenced(pg);
+    if (access & VM_PROT_WRITE)
       pmap_set_modified(pg);
-    } else {
-      kernel_oops(ctx);
-    }
-
     return;
   }
 
@@ -90,7 +95,7 @@ static void abort_handler(ctx_t *ctx, register_t esr, vaddr_t vaddr,
     klog("No virtual address space defined for %lx!", vaddr);
     goto fault;
   }
-  if (vm_page_fault(vmap, vaddr, access) == 0)
+  if ((error = vm_page_fault(vmap, vaddr, access)) == 0)
     return;
 
 fault:
@@ -98,8 +103,9 @@ fault:
     _REG(ctx, PC) = td->td_onfault;
     td->td_onfault = 0;
   } else if (usermode) {
-    /* Send a segmentation fault signal to the user program. */
-    sig_trap(ctx, SIGSEGV);
+    /* Send a segmentation fault signal to the user program, or bus error if
+     * the page couldn't be read from backing store. */
+    sig_trap(ctx, error == EIO ? SIGBUS : SIGSEGV);
   } else {
     kernel_oops(ctx);
   }
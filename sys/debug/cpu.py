@@ -48,16 +48,23 @@ class TLBLo():
 
 class TLBEntry(metaclass=GdbStructMeta):
     __ctype__ = 'tlbentry_t'
-    __cast__ = {'hi': TLBHi, 'lo0': TLBLo, 'lo1': TLBLo}
+    __cast__ = {'hi': TLBHi, 'lo0': TLBLo, 'lo1': TLBLo, 'mask': int}
+
+    @property
+    def pagesize(self):
+        return ((self.mask | 0x1fff) + 1) // 2
 
     def dump(self):
         if not self.lo0.valid and not self.lo1.valid:
             return None
         globl, lo0, lo1 = '-', '-', '-'
+        vpn0 = self.hi.vpn0 & ~(self.mask | 0x1fff)
         if self.lo0.valid:
-            lo0 = '%08x %s' % (self.hi.vpn0, self.lo0)
+            lo0 = '%08x %s' % (vpn0, self.lo0)
         if self.lo1.valid:
-            lo1 = '%08x %s' % (self.hi.vpn1, self.lo1)
+            lo1 = '%08x %s' % (vpn0 + self.pagesize, self.lo1)
+        if self.mask:
+            lo1 += ' (%dK)' % (self.pagesize // 1024)
         asid = '%02x' % self.hi.asid
         if self.lo0.globl and self.lo1.globl:
             asid = '-'
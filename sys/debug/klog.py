@@ -29,25 +29,42 @@ class LogEntry(metaclass=GdbStructMeta):
             return printf
 
 
+class SeqRing(metaclass=GdbStructMeta):
+    __ctype__ = 'struct seqring'
+    __cast__ = {'head': int, 'tail': int, 'nrecs': int}
+
+    def records(self, ctype):
+        array = self.array.cast(gdb.lookup_type(ctype).pointer())
+        head = self.head
+        tail = max(self.tail, head - self.nrecs)
+        for i in range(tail, head):
+            rec = array[i % self.nrecs]
+            # Skip records that are still being written. Every record
+            # begins with its sequence number.
+            if int(rec[rec.type.fields()[0].name]) == i + 1:
+                yield rec
+
+    def __len__(self):
+        return min(self.head - self.tail, self.nrecs)
+
+
 class LogBuffer(metaclass=GdbStructMeta):
     __ctype__ = 'struct klog'
     __cast__ = {'verbose': bool}
 
     @property
-    def size(self):
-        return int(self.array.type.range()[1]) + 1
+    def rings(self):
+        n = int(self.ring.type.range()[1]) + 1
+        return [SeqRing(self.ring[i]) for i in range(n)]
 
     def __iter__(self):
-        first, last = self.first, self.last
-        while first != last:
-            yield LogEntry(self.array[first])
-            first = (first + 1) % self.size
+        entries = [LogEntry(entry) for ring in self.rings
+                   for entry in ring.records('struct klog_entry')]
+        return iter(sorted(entries,
+                           key=lambda e: e.kl_timestamp.as_float()))
 
     def __len__(self):
-        n = self.last - self.first
-        if n < 0:
-            n += self.size
-        return n
+        return sum(len(ring) for ring in self.rings)
 
 
 class Klog(SimpleCommand):
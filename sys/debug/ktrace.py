@@ -1,21 +1,72 @@
-from .thread import ThreadCreateBP, ThreadSwitchBP
-from .cmd import CommandDispatcher, TraceCommand
+import gdb
 
+from .cmd import CommandDispatcher, UserCommand
+from .klog import SeqRing
+from .struct import GdbStructMeta
+from .utils import TextTable, global_var
+
+
+class TraceEvent(metaclass=GdbStructMeta):
+    __ctype__ = 'struct trace_event'
+    __cast__ = {'te_cpu': int, 'te_time': int, 'te_tid': int}
+
+    @property
+    def type(self):
+        return str(self.te_type.cast(gdb.lookup_type('trace_type_t')))
+
+    @property
+    def args(self):
+        return [int(self.te_args[i]) for i in range(3)]
+
+
+def trace_events():
+    rings = global_var('trace_ring')
+    n = int(rings.type.range()[1]) + 1
+    return [TraceEvent(ev) for i in range(n)
+            for ev in SeqRing(rings[i]).records('struct trace_event')]
+
+
+def trace_types():
+    return [f.name for f in gdb.lookup_type('trace_type_t').fields()
+            if f.name != 'TRACE_NTYPES']
+
+
+class TraceMask(UserCommand):
+    """Display or set mask of enabled tracepoints"""
 
-class ThreadCreateTrace(TraceCommand):
-    """Trace thread create events"""
     def __init__(self):
-        super().__init__('thread_create', ThreadCreateBP)
+        super().__init__('mask')
 
+    def __call__(self, args):
+        if args:
+            gdb.execute('set var trace_mask = %s' % args)
+        mask = int(global_var('trace_mask'))
+        table = TextTable(align='ll')
+        table.header(['Tracepoint', 'Enabled'])
+        for i, name in enumerate(trace_types()):
+            table.add_row([name, bool(mask & (1 << i))])
+        print(table)
+
+
+class TraceDump(UserCommand):
+    """Display events recorded in trace buffers"""
 
-class ThreadSwitchTrace(TraceCommand):
-    """Trace thread switch events"""
     def __init__(self):
-        super().__init__('thread_switch', ThreadSwitchBP)
+        super().__init__('dump')
+
+    def __call__(self, args):
+        events = trace_events()
+        events.sort(key=lambda ev: ev.te_time)
+        table = TextTable(align='rrrll')
+        table.header(['Time [us]', 'Cpu', 'Tid', 'Event', 'Arguments'])
+        for ev in events:
+            table.add_row([ev.te_time // 1000, ev.te_cpu, ev.te_tid, ev.type,
+                           ' '.join(hex(arg) for arg in ev.args)])
+        print(table)
 
 
 class Ktrace(CommandDispatcher):
-    """Trace important kernel events."""
+    """Inspect static tracepoints and events recorded by them."""
 
     def __init__(self):
-        super().__init__('ktrace', [ThreadCreateTrace(), ThreadSwitchTrace()])
+        super().__init__('ktrace', [TraceMask(), TraceDump()])
@@ -129,13 +129,14 @@ class MallocStats(UserCommand):
 
     def __call__(self, args):
         mps = LinkerSet('kmalloc_pool', 'kmalloc_pool_t *')
-        table = TextTable(types='tiiii', align='lrrrr')
-        table.header(['description', 'nrequests', 'active', 'memory in use',
-                      'peak usage'])
+        table = TextTable(types='tiiiiii', align='lrrrrrr')
+        table.header(['description', 'nrequests', 'nfailed', 'active',
+                      'memory in use', 'peak usage', 'limit'])
         for mp in sorted(mps, key=lambda x: x['desc'].string()):
             table.add_row([mp['desc'].string(), int(mp['nrequests']),
-                           int(mp['active']), int(mp['used']),
-                           int(mp['maxused'])])
+                           int(mp['nfailed']), int(mp['active']),
+                           int(mp['used']), int(mp['maxused']),
+                           int(mp['limit'])])
         print(table)
 
 
@@ -2,7 +2,7 @@ import gdb
 
 from .cmd import SimpleCommand, AutoCompleteMixin
 from .struct import enum, cstr, GdbStructMeta, ProgramCounter, TailQueue
-from .utils import func_ret_addr, local_var, TextTable
+from .utils import TextTable
 from .ctx import Context
 
 
@@ -44,24 +44,6 @@ class Thread(metaclass=GdbStructMeta):
         return 'thread{%s/%d}' % (self.td_name, self.td_tid)
 
 
-class ThreadSwitchBP(gdb.Breakpoint):
-    def __init__(self):
-        super().__init__('ctx_switch')
-
-    def stop(self):
-        td_from = Thread.from_pointer('$a0')
-        td_to = Thread.from_pointer('$a1')
-        print('context switch from {} to {}'.format(td_from, td_to))
-
-
-class ThreadCreateBP(gdb.Breakpoint):
-    def __init__(self):
-        super().__init__('*0x%x' % func_ret_addr('thread_create'))
-
-    def stop(self):
-        print('New', local_var('td').dereference(), 'in the system!')
-
-
 class Kthread(SimpleCommand, AutoCompleteMixin):
     """dump info about threads
 
@@ -68,9 +68,17 @@ class VmFreePages(UserCommand):
         table.header(['#pages', 'size', 'addresses'])
         print(table)
         print('Free pages count: {}'.format(free_pages))
+        pcache = global_var('pcache')
+        cached = sum(int(pcache[i]['count'])
+                     for i in range(pcache.type.range()[1] + 1))
+        zeroed = sum(int(pcache[i]['zcount'])
+                     for i in range(pcache.type.range()[1] + 1))
+        print('Cached pages count: {}'.format(cached))
+        print('Pre-zeroed pages count: {}'.format(zeroed))
         segments = TailQueue(global_var('seglist'), 'seglink')
         pages = int(sum(seg['npages'] for seg in segments if not seg['used']))
-        print('Used pages count: {}'.format(pages - free_pages))
+        used = pages - free_pages - cached - zeroed
+        print('Used pages count: {}'.format(used))
 
 
 class VmMapSeg(UserCommand):
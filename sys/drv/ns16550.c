@@ -4,7 +4,7 @@
 #include <sys/vnode.h>
 #include <sys/devfs.h>
 #include <sys/klog.h>
-#include <sys/condvar.h>
+#include <sys/taskqueue.h>
 #include <sys/ringbuf.h>
 #include <sys/pci.h>
 #include <sys/termios.h>
@@ -15,8 +15,6 @@
 #include <sys/stat.h>
 #include <sys/devclass.h>
 #include <sys/tty.h>
-#include <sys/priority.h>
-#include <sys/sched.h>
 
 #define UART_BUFSIZE 128
 
@@ -26,7 +24,7 @@ typedef struct ns16550_state {
   resource_t *irq_res;
   resource_t *regs;
   tty_t *tty;
-  condvar_t tty_thread_cv;
+  task_t tty_task;
   uint8_t tty_thread_flags;
 } ns16550_state_t;
 
@@ -72,7 +70,7 @@ static intr_filter_t ns16550_intr(void *data) {
     if (iir & IIR_RXRDY) {
       (void)ringbuf_putb(&ns16550->rx_buf, in(uart, RBR));
       ns16550->tty_thread_flags |= TTY_THREAD_RXRDY;
-      cv_signal(&ns16550->tty_thread_cv);
+      taskqueue_add(&taskqueue_system, &ns16550->tty_task);
       res = IF_FILTERED;
     }
 
@@ -88,7 +86,7 @@ static intr_filter_t ns16550_intr(void *data) {
          * in the tty's output queue, signal the tty thread to refill. */
         if (ns16550->tty_thread_flags & TTY_THREAD_OUTQ_NONEMPTY) {
           ns16550->tty_thread_flags |= TTY_THREAD_TXRDY;
-          cv_signal(&ns16550->tty_thread_cv);
+          taskqueue_add(&taskqueue_system, &ns16550->tty_task);
         }
         /* Disable TXRDY interrupts - the tty thread will re-enable them
          * after filling tx_buf. */
@@ -154,29 +152,30 @@ static bool ns16550_getb_lock(ns16550_state_t *ns16550, uint8_t *byte_p) {
   return ringbuf_getb(&ns16550->rx_buf, byte_p);
 }
 
-/* TODO: revisit after per-intr_event ithreads are implemented. */
-static void ns16550_tty_thread(void *arg) {
+/* Bottom half of interrupt handler executed by system taskqueue. */
+static void ns16550_tty_task(void *arg) {
   ns16550_state_t *ns16550 = (ns16550_state_t *)arg;
   tty_t *tty = ns16550->tty;
   uint8_t work, byte;
 
-  while (true) {
-    WITH_SPIN_LOCK (&ns16550->lock) {
-      /* Sleep until there's work for us to do. */
-      while ((work = ns16550->tty_thread_flags & TTY_THREAD_WORK_MASK) == 0)
-        cv_wait(&ns16550->tty_thread_cv, &ns16550->lock);
-      ns16550->tty_thread_flags &= ~TTY_THREAD_WORK_MASK;
+  WITH_SPIN_LOCK (&ns16550->lock) {
+    work = ns16550->tty_thread_flags & TTY_THREAD_WORK_MASK;
+    ns16550->tty_thread_flags &= ~TTY_THREAD_WORK_MASK;
+  }
+
+  /* Task could have been enqueued again while it was running. */
+  if (work == 0)
+    return;
+
+  WITH_MTX_LOCK (&tty->t_lock) {
+    if (work & TTY_THREAD_RXRDY) {
+      /* Move characters from rx_buf into the tty's input queue. */
+      while (ns16550_getb_lock(ns16550, &byte))
+        if (!tty_input(tty, byte))
+          klog("dropped character %hhx", byte);
     }
-    WITH_MTX_LOCK (&tty->t_lock) {
-      if (work & TTY_THREAD_RXRDY) {
-        /* Move characters from rx_buf into the tty's input queue. */
-        while (ns16550_getb_lock(ns16550, &byte))
-          if (!tty_input(tty, byte))
-            klog("dropped character %hhx", byte);
-      }
-      if (work & TTY_THREAD_TXRDY) {
-        ns16550_fill_txbuf(ns16550, tty);
-      }
+    if (work & TTY_THREAD_TXRDY) {
+      ns16550_fill_txbuf(ns16550, tty);
     }
   }
 }
@@ -212,11 +211,7 @@ static int ns16550_attach(device_t *dev) {
   tty->t_data = ns16550;
   ns16550->tty = tty;
 
-  cv_init(&ns16550->tty_thread_cv, "NS16550 TTY thread notification");
-  thread_t *tty_thread =
-    thread_create("ns16550-tty-worker", ns16550_tty_thread, ns16550,
-                  prio_ithread(PRIO_ITHRD_QTY - 1));
-  sched_add(tty_thread);
+  ns16550->tty_task = TASK_INIT(ns16550_tty_task, ns16550);
 
   /* TODO Small hack to select COM1 UART */
   ns16550->regs = device_take_ioports(dev, 0, RF_ACTIVE);
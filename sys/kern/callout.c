@@ -9,9 +9,23 @@
 #include <sys/sched.h>
 #include <sys/interrupt.h>
 
-/* Note: If the difference in time between ticks is greater than the number of
-   buckets, some callouts may be called out-of-order! */
-#define CALLOUT_BUCKETS 64
+/*
+ * Tick based callouts are kept in a hierarchical timing wheel. Each level of
+ * the wheel has CALLOUT_BUCKETS buckets, and a bucket at level `n` spans
+ * CALLOUT_BUCKETS^n system clock ticks. Whenever lower level wraps around,
+ * callouts from corresponding bucket of upper level are cascaded down.
+ * Callouts that are further in the future than the wheel can represent are
+ * kept in the last bucket of the top level and are reinserted on cascade.
+ */
+#define CALLOUT_WHEEL_BITS 6
+#define CALLOUT_BUCKETS (1 << CALLOUT_WHEEL_BITS)
+#define CALLOUT_BUCKET_MASK (CALLOUT_BUCKETS - 1)
+#define CALLOUT_LEVELS 4
+#define CALLOUT_WHEEL_SPAN (1U << (CALLOUT_WHEEL_BITS * CALLOUT_LEVELS))
+
+/* Maximum number of pending high-resolution callouts. If the heap is full,
+ * a high-resolution callout falls back to tick based timing wheel. */
+#define CALLOUT_HEAP_SIZE 256
 
 #define callout_is_active(c) ((c)->c_flags & CALLOUT_ACTIVE)
 #define callout_set_active(c) ((c)->c_flags |= CALLOUT_ACTIVE)
@@ -21,27 +35,33 @@
 #define callout_set_pending(c) ((c)->c_flags |= CALLOUT_PENDING)
 #define callout_clear_pending(c) ((c)->c_flags &= ~CALLOUT_PENDING)
 
-/*
-  Every event is inside one of CALLOUT_BUCKETS buckets.
-  The buckets is a cyclic list, but we implement it as an array,
-  allowing us to access random elements in constant time.
-*/
+#define callout_is_hires(c) ((c)->c_flags & CALLOUT_HIRES)
+
+/* Compare system times taking counter wrap-around into account. */
+#define systime_before(a, b) ((int32_t)((a) - (b)) < 0)
 
 typedef TAILQ_HEAD(callout_list, callout) callout_list_t;
 
 static struct {
-  callout_list_t heads[CALLOUT_BUCKETS];
-  /* Stores the value of the argument callout_process was previously
-     called with. All callouts up to this timestamp have already been
-     processed. */
-  systime_t last;
+  callout_list_t heads[CALLOUT_LEVELS * CALLOUT_BUCKETS];
+  /* Next tick to be processed. All callouts before this timestamp have
+   * already been processed. */
+  systime_t next;
+  /* Min-heap of high-resolution callouts ordered by c_deadline. */
+  callout_t *heap[CALLOUT_HEAP_SIZE];
+  unsigned heap_size;
   spin_t lock;
 } ci;
 
-static inline callout_list_t *ci_list(int i) {
+static inline callout_list_t *ci_list(unsigned i) {
   return &ci.heads[i];
 }
 
+static inline unsigned ci_bucket(unsigned level, systime_t time) {
+  unsigned slot = (time >> (level * CALLOUT_WHEEL_BITS)) & CALLOUT_BUCKET_MASK;
+  return level * CALLOUT_BUCKETS + slot;
+}
+
 static callout_list_t delegated;
 
 static void callout_thread(void *arg) {
@@ -73,7 +93,7 @@ void init_callout(void) {
 
   ci.lock = SPIN_INITIALIZER(0);
 
-  for (int i = 0; i < CALLOUT_BUCKETS; i++)
+  for (int i = 0; i < CALLOUT_LEVELS * CALLOUT_BUCKETS; i++)
     TAILQ_INIT(ci_list(i));
 
   TAILQ_INIT(&delegated);
@@ -83,23 +103,100 @@ void init_callout(void) {
   sched_add(td);
 }
 
+/* Put a callout into the wheel bucket that corresponds to its timeout. */
+static void ci_wheel_insert(callout_t *c) {
+  systime_t time = c->c_time;
+
+  /* Callouts from the past will be run during next call to callout_process. */
+  if (systime_before(time, ci.next))
+    time = ci.next;
+
+  systime_t delta = time - ci.next;
+  unsigned level = 0;
+
+  while (level < CALLOUT_LEVELS - 1 &&
+         delta >= (1U << ((level + 1) * CALLOUT_WHEEL_BITS)))
+    level++;
+
+  /* Too far in the future - park it at the end of the top level. */
+  if (delta >= CALLOUT_WHEEL_SPAN)
+    time = ci.next + CALLOUT_WHEEL_SPAN - 1;
+
+  c->c_index = ci_bucket(level, time);
+  TAILQ_INSERT_TAIL(ci_list(c->c_index), c, c_link);
+}
+
+static inline bool ci_heap_less(unsigned i, unsigned j) {
+  return bintime_cmp(&ci.heap[i]->c_deadline, &ci.heap[j]->c_deadline, <);
+}
+
+static inline void ci_heap_swap(unsigned i, unsigned j) {
+  callout_t *c = ci.heap[i];
+  ci.heap[i] = ci.heap[j];
+  ci.heap[j] = c;
+  ci.heap[i]->c_index = i;
+  ci.heap[j]->c_index = j;
+}
+
+static void ci_heap_up(unsigned i) {
+  while (i > 0) {
+    unsigned parent = (i - 1) / 2;
+    if (!ci_heap_less(i, parent))
+      break;
+    ci_heap_swap(i, parent);
+    i = parent;
+  }
+}
+
+static void ci_heap_down(unsigned i) {
+  while (true) {
+    unsigned min = i, left = 2 * i + 1, right = 2 * i + 2;
+    if (left < ci.heap_size && ci_heap_less(left, min))
+      min = left;
+    if (right < ci.heap_size && ci_heap_less(right, min))
+      min = right;
+    if (min == i)
+      break;
+    ci_heap_swap(i, min);
+    i = min;
+  }
+}
+
+static void ci_heap_insert(callout_t *c) {
+  assert(ci.heap_size < CALLOUT_HEAP_SIZE);
+  unsigned i = ci.heap_size++;
+  ci.heap[i] = c;
+  c->c_index = i;
+  ci_heap_up(i);
+}
+
+static void ci_heap_remove(callout_t *c) {
+  unsigned i = c->c_index;
+  assert(i < ci.heap_size && ci.heap[i] == c);
+
+  unsigned last = --ci.heap_size;
+  if (i != last) {
+    ci_heap_swap(i, last);
+    ci_heap_up(i);
+    ci_heap_down(i);
+  }
+  ci.heap[last] = NULL;
+}
+
 static void _callout_setup(callout_t *handle, systime_t time, timeout_t fn,
                            void *arg) {
   assert(spin_owned(&ci.lock));
   assert(!callout_is_pending(handle));
   assert(!callout_is_active(handle));
 
-  int index = time % CALLOUT_BUCKETS;
-
   bzero(handle, sizeof(callout_t));
   handle->c_time = time;
   handle->c_func = fn;
   handle->c_arg = arg;
-  handle->c_index = index;
   callout_set_pending(handle);
 
   klog("Add callout {%p} with wakeup at %ld.", handle, handle->c_time);
-  TAILQ_INSERT_TAIL(ci_list(index), handle, c_link);
+  ci_wheel_insert(handle);
 }
 
 void callout_setup(callout_t *handle, systime_t time, timeout_t fn, void *arg) {
@@ -116,6 +213,34 @@ void callout_setup_relative(callout_t *handle, systime_t time, timeout_t fn,
   _callout_setup(handle, now + time, fn, arg);
 }
 
+void callout_setup_bt(callout_t *handle, bintime_t deadline, timeout_t fn,
+                      void *arg) {
+  SCOPED_SPIN_LOCK(&ci.lock);
+
+  if (ci.heap_size == CALLOUT_HEAP_SIZE) {
+    /* Round up to the next tick, so the callout never fires too early. */
+    _callout_setup(handle, bt2st(&deadline) + 1, fn, arg);
+    return;
+  }
+
+  assert(!callout_is_pending(handle));
+  assert(!callout_is_active(handle));
+
+  bzero(handle, sizeof(callout_t));
+  handle->c_deadline = deadline;
+  handle->c_func = fn;
+  handle->c_arg = arg;
+  handle->c_flags = CALLOUT_PENDING | CALLOUT_HIRES;
+
+  klog("Add hires callout {%p} with wakeup at %ld.%08lx.", handle,
+       (long)deadline.sec, (long)(deadline.frac >> 32));
+  ci_heap_insert(handle);
+
+  /* Reprogram system clock if the callout became the earliest event. */
+  if (handle->c_index == 0)
+    clock_schedule(deadline);
+}
+
 bool callout_stop(callout_t *handle) {
   SCOPED_SPIN_LOCK(&ci.lock);
 
@@ -123,61 +248,102 @@ bool callout_stop(callout_t *handle) {
 
   if (callout_is_pending(handle)) {
     callout_clear_pending(handle);
-    TAILQ_REMOVE(ci_list(handle->c_index), handle, c_link);
+    if (callout_is_hires(handle))
+      ci_heap_remove(handle);
+    else
+      TAILQ_REMOVE(ci_list(handle->c_index), handle, c_link);
     return true;
   }
 
   return false;
 }
 
+static void callout_delegate(callout_t *elem) {
+  callout_set_active(elem);
+  callout_clear_pending(elem);
+  /* Attach elem to callout thread's queue. */
+  TAILQ_INSERT_TAIL(&delegated, elem, c_link);
+}
+
+/* Move callouts from upper level bucket down the wheel. */
+static void ci_cascade(unsigned level, systime_t time) {
+  callout_list_t *head = ci_list(ci_bucket(level, time));
+  callout_list_t moved = TAILQ_HEAD_INITIALIZER(moved);
+  TAILQ_CONCAT(&moved, head, c_link);
+
+  callout_t *elem;
+  while ((elem = TAILQ_FIRST(&moved))) {
+    TAILQ_REMOVE(&moved, elem, c_link);
+    ci_wheel_insert(elem);
+  }
+}
+
+/* Delegate all callouts scheduled for tick @time to callout thread. */
+static void ci_wheel_tick(systime_t time) {
+  /* Lower level wrapped around - refill it from upper levels. */
+  for (unsigned level = 1; level < CALLOUT_LEVELS; level++) {
+    if ((time >> ((level - 1) * CALLOUT_WHEEL_BITS)) & CALLOUT_BUCKET_MASK)
+      break;
+    ci_cascade(level, time);
+  }
+
+  callout_list_t *head = ci_list(ci_bucket(0, time));
+  callout_t *elem, *next;
+
+  TAILQ_FOREACH_SAFE (elem, head, c_link, next) {
+    TAILQ_REMOVE(head, elem, c_link);
+    if (systime_before(time, elem->c_time)) {
+      /* Parked callout has not expired yet. */
+      ci_wheel_insert(elem);
+    } else {
+      callout_delegate(elem);
+    }
+  }
+}
+
 /*
- * Process all timeouted callouts from queues between last position and current
- * position and delegate them to callout thread.
+ * Process all timeouted callouts from wheel buckets between last position and
+ * current position, and all expired high-resolution callouts, then delegate
+ * them to callout thread.
  */
-void callout_process(systime_t time) {
-  unsigned int last_bucket;
-  unsigned int current_bucket = ci.last % CALLOUT_BUCKETS;
-
-  if (time - ci.last > CALLOUT_BUCKETS) {
-    /* Process all buckets */
-    last_bucket = (ci.last - 1) % CALLOUT_BUCKETS;
-  } else {
-    /* Process only buckets in time range ci.last to time */
-    last_bucket = time % CALLOUT_BUCKETS;
-  }
+void callout_process(bintime_t now) {
+  systime_t time = bt2st(&now);
 
   /* We are in kernel's bottom half. */
   assert(intr_disabled());
 
-  while (true) {
-    callout_list_t *head = ci_list(current_bucket);
-    callout_t *elem, *next;
-
-    /* Detach triggered callouts from ci_list queue. */
-    TAILQ_FOREACH_SAFE (elem, head, c_link, next) {
-      if (elem->c_time <= time) {
-        callout_set_active(elem);
-        callout_clear_pending(elem);
-        TAILQ_REMOVE(head, elem, c_link);
-        /* Attach elem to callout thread's queue. */
-        TAILQ_INSERT_TAIL(&delegated, elem, c_link);
-      }
+  WITH_SPIN_LOCK (&ci.lock) {
+    /* Ticks are processed one by one, so callouts are run in order even if
+     * system clock skipped some ticks. */
+    while (!systime_before(time, ci.next)) {
+      ci_wheel_tick(ci.next);
+      ci.next++;
     }
 
-    if (current_bucket == last_bucket)
-      break;
-
-    current_bucket = (current_bucket + 1) % CALLOUT_BUCKETS;
+    while (ci.heap_size > 0 &&
+           bintime_cmp(&ci.heap[0]->c_deadline, &now, <=)) {
+      callout_t *elem = ci.heap[0];
+      ci_heap_remove(elem);
+      callout_delegate(elem);
+    }
   }
 
-  ci.last = time;
-
   /* Wake callout thread. */
   if (!TAILQ_EMPTY(&delegated)) {
     sleepq_signal(&delegated);
   }
 }
 
+bool callout_next_deadline(bintime_t *deadline) {
+  SCOPED_SPIN_LOCK(&ci.lock);
+
+  if (ci.heap_size == 0)
+    return false;
+
+  *deadline = ci.heap[0]->c_deadline;
+  return true;
+}
+
 bool callout_drain(callout_t *handle) {
   WITH_INTR_DISABLED {
     if (callout_is_pending(handle) || callout_is_active(handle)) {
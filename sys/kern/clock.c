@@ -3,29 +3,92 @@
 #include <sys/sched.h>
 #include <sys/mimiker.h>
 #include <sys/klog.h>
+#include <sys/interrupt.h>
 #include <sys/timer.h>
+#include <sys/prof.h>
 
 static systime_t now = 0;
 static timer_t *clock = NULL;
 
+/* If the clock timer supports one-shot mode, it's reprogrammed on each event
+ * to trigger either at the next system tick or at the deadline of the earliest
+ * high-resolution callout, whichever comes first. */
+static bool clock_oneshot = false;
+static bintime_t clock_tick;  /* duration of a single system tick */
+static bintime_t next_tick;   /* uptime of the next system tick */
+static bintime_t next_event;  /* uptime the clock timer is programmed for */
+
 systime_t getsystime(void) {
   return now;
 }
 
+static void clock_program(bintime_t deadline) {
+  next_event = deadline;
+  if (tm_start(clock, TMF_ONESHOT, deadline, (bintime_t){}))
+    panic("Failed to reprogram system clock!");
+}
+
+void clock_schedule(bintime_t deadline) {
+  SCOPED_INTR_DISABLED();
+
+  if (!clock_oneshot)
+    return;
+
+  if (bintime_cmp(&deadline, &next_event, <))
+    clock_program(deadline);
+}
+
 static void clock_cb(timer_t *tm, void *arg) {
   bintime_t bin = binuptime();
-  now = bt2st(&bin);
-  callout_process(now);
-  sched_clock();
+  bool tick = !clock_oneshot || bintime_cmp(&bin, &next_tick, >=);
+
+  if (tick)
+    now = bt2st(&bin);
+  callout_process(bin);
+  if (tick) {
+    sched_clock();
+    prof_clock();
+  }
+
+  if (!clock_oneshot)
+    return;
+
+  while (bintime_cmp(&next_tick, &bin, <=))
+    bintime_add(&next_tick, &clock_tick);
+
+  bintime_t deadline = next_tick;
+  bintime_t hires;
+  if (callout_next_deadline(&hires) && bintime_cmp(&hires, &deadline, <))
+    deadline = hires;
+  clock_program(deadline);
 }
 
 void init_clock(void) {
+  clock_tick = HZ2BT(CLK_TCK);
+
+  clock = tm_reserve(NULL, TMF_ONESHOT);
+  if (clock != NULL) {
+    tm_init(clock, clock_cb, NULL);
+    WITH_INTR_DISABLED {
+      next_tick = binuptime();
+      bintime_add(&next_tick, &clock_tick);
+      next_event = next_tick;
+      if (tm_start(clock, TMF_ONESHOT | TMF_TIMESOURCE, next_tick,
+                   (bintime_t){}))
+        panic("Failed to start system clock!");
+      clock_oneshot = true;
+    }
+    klog("System clock uses \'%s\' hardware timer in one-shot mode.",
+         clock->tm_name);
+    return;
+  }
+
   clock = tm_reserve(NULL, TMF_PERIODIC);
   if (clock == NULL)
     panic("Missing suitable timer for maintenance of system clock!");
   tm_init(clock, clock_cb, NULL);
   if (tm_start(clock, TMF_PERIODIC | TMF_TIMESOURCE, (bintime_t){},
-               HZ2BT(CLK_TCK)))
+               clock_tick))
     panic("Failed to start system clock!");
   klog("System clock uses \'%s\' hardware timer.", clock->tm_name);
 }
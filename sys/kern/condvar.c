@@ -32,6 +32,17 @@ int cv_wait_timed(condvar_t *cv, lock_t m, systime_t timeout) {
   return status;
 }
 
+int cv_wait_timed_bt(condvar_t *cv, lock_t m, bintime_t deadline) {
+  int status;
+  WITH_INTR_DISABLED {
+    cv->waiters++;
+    lk_release(m);
+    status = sleepq_wait_timed_bt(cv, __caller(0), deadline);
+  }
+  lk_acquire(m, __caller(0));
+  return status;
+}
+
 void cv_signal(condvar_t *cv) {
   SCOPED_NO_PREEMPTION();
   if (cv->waiters > 0) {
@@ -0,0 +1,24 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/linker_set.h>
+#include <sys/seqring.h>
+#define _KLOG_PRIVATE
+#include <sys/klog.h>
+
+/* Reading from /dev/klog consumes binary records (klog_entry_t) from log
+ * rings. Only whole records are returned, and a read returns zero bytes if
+ * there are no new records. Records from different CPUs are not merged, thus
+ * a decoder is expected to sort them by timestamp. */
+static int dev_klog_read(vnode_t *v, uio_t *uio, int ioflag) {
+  return seqring_read(klog.ring, MAXCPU, uio);
+}
+
+static vnodeops_t dev_klog_vnodeops = {.v_read = dev_klog_read};
+
+static void init_dev_klog(void) {
+  devfs_makedev(NULL, "klog", &dev_klog_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_klog);
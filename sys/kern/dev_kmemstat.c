@@ -0,0 +1,39 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/libkern.h>
+#include <sys/linker_set.h>
+#include <sys/malloc.h>
+#include <sys/kmemstat.h>
+
+/* Reading /dev/kmemstat returns an array of binary records (kmemstat_t), one
+ * for each kmalloc pool followed by one for each pool. The array is a
+ * snapshot taken when the read is performed, so whole file should be read
+ * with a single call. */
+static int dev_kmemstat_read(vnode_t *v, uio_t *uio, int ioflag) {
+  size_t nmalloc = kmalloc_stats(NULL, 0);
+  size_t npool = pool_stats(NULL, 0);
+  /* Leave some room for pools created in the meantime. */
+  size_t n = nmalloc + npool + 8;
+  kmemstat_t *ks = kmalloc(M_TEMP, n * sizeof(kmemstat_t), 0);
+  int error = 0;
+
+  nmalloc = min(kmalloc_stats(ks, n), n);
+  npool = min(pool_stats(ks + nmalloc, n - nmalloc), n - nmalloc);
+
+  size_t len = (nmalloc + npool) * sizeof(kmemstat_t);
+  if ((size_t)uio->uio_offset < len)
+    error = uiomove_frombuf(ks, len, uio);
+
+  kfree(M_TEMP, ks);
+  return error;
+}
+
+static vnodeops_t dev_kmemstat_vnodeops = {.v_read = dev_kmemstat_read};
+
+static void init_dev_kmemstat(void) {
+  devfs_makedev(NULL, "kmemstat", &dev_kmemstat_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_kmemstat);
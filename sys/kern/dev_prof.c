@@ -0,0 +1,43 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/linker_set.h>
+#include <sys/pcpu.h>
+#include <sys/prof.h>
+
+/* Reading from /dev/prof consumes binary samples (prof_sample_t) from
+ * per-CPU buffers. Only whole samples are returned, and a read returns zero
+ * bytes if there are no new samples. */
+static int dev_prof_read(vnode_t *v, uio_t *uio, int ioflag) {
+  return seqring_read(prof_ring, MAXCPU, uio);
+}
+
+/* Writing "1" to /dev/prof starts the profiler, and "0" stops it. */
+static int dev_prof_write(vnode_t *v, uio_t *uio, int ioflag) {
+  char c;
+  int error;
+
+  if (uio->uio_resid == 0)
+    return 0;
+
+  if ((error = uiomove(&c, 1, uio)))
+    return error;
+
+  if (c != '0' && c != '1')
+    return EINVAL;
+
+  prof_enable(c == '1');
+  /* Ignore the rest (e.g. new line character). */
+  uio->uio_resid = 0;
+  return 0;
+}
+
+static vnodeops_t dev_prof_vnodeops = {.v_read = dev_prof_read,
+                                       .v_write = dev_prof_write};
+
+static void init_dev_prof(void) {
+  devfs_makedev(NULL, "prof", &dev_prof_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_prof);
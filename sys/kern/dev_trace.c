@@ -0,0 +1,44 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/libkern.h>
+#include <sys/linker_set.h>
+#include <sys/pcpu.h>
+#include <sys/trace.h>
+
+/* Reading from /dev/trace consumes binary records (trace_event_t) from
+ * per-CPU trace buffers. Only whole records are returned, and a read returns
+ * zero bytes if there are no new records. */
+static int dev_trace_read(vnode_t *v, uio_t *uio, int ioflag) {
+  return seqring_read(trace_ring, MAXCPU, uio);
+}
+
+/* Writing a hexadecimal number to /dev/trace sets the mask of enabled
+ * tracepoints, e.g. `echo ff > /dev/trace` enables all of them. */
+static int dev_trace_write(vnode_t *v, uio_t *uio, int ioflag) {
+  char buf[16];
+  size_t len = min(uio->uio_resid, sizeof(buf) - 1);
+  int error;
+
+  if ((error = uiomove(buf, len, uio)))
+    return error;
+  buf[len] = '\0';
+
+  char *end;
+  unsigned long mask = strtoul(buf, &end, 16);
+  if (end == buf)
+    return EINVAL;
+
+  trace_setmask(mask);
+  return 0;
+}
+
+static vnodeops_t dev_trace_vnodeops = {.v_read = dev_trace_read,
+                                        .v_write = dev_trace_write};
+
+static void init_dev_trace(void) {
+  devfs_makedev(NULL, "trace", &dev_trace_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_trace);
@@ -0,0 +1,41 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/libkern.h>
+#include <sys/linker_set.h>
+#include <sys/vmstat.h>
+
+vmcnt_t vmcnt;
+
+void vmstat_read(vmstat_t *vs) {
+  vs->v_faults = vmcnt.faults;
+  vs->v_prefaults = vmcnt.prefaults;
+  vs->v_zerofaults = vmcnt.zerofaults;
+  vs->v_ksm_scanned = vmcnt.ksm_scanned;
+  vs->v_ksm_shared = vmcnt.ksm_shared;
+  vs->v_ksm_sharing = vmcnt.ksm_sharing;
+  vs->v_ksm_zeroed = vmcnt.ksm_zeroed;
+  vs->v_ksm_unmerged = vmcnt.ksm_unmerged;
+  vs->v_prezeroed = vmcnt.prezeroed;
+  vs->v_prezero_hits = vmcnt.prezero_hits;
+}
+
+/* Reading /dev/vmstat returns a single binary record (vmstat_t) with a
+ * snapshot of virtual memory statistics. */
+static int dev_vmstat_read(vnode_t *v, uio_t *uio, int ioflag) {
+  vmstat_t vs;
+  vmstat_read(&vs);
+
+  if ((size_t)uio->uio_offset >= sizeof(vmstat_t))
+    return 0;
+  return uiomove_frombuf(&vs, sizeof(vmstat_t), uio);
+}
+
+static vnodeops_t dev_vmstat_vnodeops = {.v_read = dev_vmstat_read};
+
+static void init_dev_vmstat(void) {
+  devfs_makedev(NULL, "vmstat", &dev_vmstat_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_vmstat);
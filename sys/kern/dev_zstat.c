@@ -0,0 +1,26 @@
+#include <sys/mimiker.h>
+#include <sys/devfs.h>
+#include <sys/vnode.h>
+#include <sys/uio.h>
+#include <sys/libkern.h>
+#include <sys/linker_set.h>
+#include <sys/vm_zstore.h>
+
+/* Reading /dev/zstat returns a single binary record (zstat_t) with a snapshot
+ * of compressed store statistics. */
+static int dev_zstat_read(vnode_t *v, uio_t *uio, int ioflag) {
+  zstat_t zs;
+  zstore_stats(&zs);
+
+  if ((size_t)uio->uio_offset >= sizeof(zstat_t))
+    return 0;
+  return uiomove_frombuf(&zs, sizeof(zstat_t), uio);
+}
+
+static vnodeops_t dev_zstat_vnodeops = {.v_read = dev_zstat_read};
+
+static void init_dev_zstat(void) {
+  devfs_makedev(NULL, "zstat", &dev_zstat_vnodeops, NULL, NULL);
+}
+
+SET_ENTRY(devfs_init, init_dev_zstat);
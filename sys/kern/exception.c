@@ -7,6 +7,7 @@
 #include <sys/sched.h>
 #include <sys/proc.h>
 #include <sys/signal.h>
+#include <sys/prof.h>
 
 void on_exc_leave(void) {
   /* If thread requested not to be preempted, then do not switch out! */
@@ -60,6 +61,8 @@ void on_user_exc_leave(mcontext_t *ctx, syscall_result_t *result) {
   int sig = 0;
   ksiginfo_t ksi;
 
+  prof_user_sample(td, ctx);
+
   /* XXX we need to know if there's a signal to be delivered in order to call
    * set_syscall_retval(), but we also need to call set_syscall_retval() before
    * sig_post(), as set_syscall_retval() assumes the context has not been
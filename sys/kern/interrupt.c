@@ -7,6 +7,7 @@
 #include <sys/pcpu.h>
 #include <sys/sleepq.h>
 #include <sys/sched.h>
+#include <sys/trace.h>
 
 static KMALLOC_DEFINE(M_INTR, "interrupt events & handlers");
 
@@ -171,8 +172,10 @@ void intr_root_handler(ctx_t *ctx) {
 
   intr_disable();
   PCPU_SET(no_switch, true);
+  PCPU_SET(intr_ctx, ctx);
   if (ir_filter != NULL)
     ir_filter(ctx, ir_dev, ir_arg);
+  PCPU_SET(intr_ctx, NULL);
   PCPU_SET(no_switch, false);
   intr_enable();
 
@@ -190,6 +193,8 @@ void intr_event_run_handlers(intr_event_t *ie) {
   /* Do we wake up an ithread */
   intr_filter_t ie_status = IF_STRAY;
 
+  TRACE(TRACE_INTR_ENTER, ie->ie_irq);
+
   TAILQ_FOREACH_SAFE (ih, &ie->ie_handlers, ih_link, next) {
     intr_filter_t status = ih->ih_filter(ih->ih_argument);
 
@@ -206,6 +211,8 @@ void intr_event_run_handlers(intr_event_t *ie) {
     sleepq_signal(ie);
   }
 
+  TRACE(TRACE_INTR_EXIT, ie->ie_irq, ie_status);
+
   if (ie_status == IF_STRAY)
     klog("Spurious %s interrupt!", ie->ie_name);
 }
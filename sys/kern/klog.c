@@ -1,15 +1,17 @@
 #include <sys/mimiker.h>
-#include <sys/mutex.h>
 #include <sys/kenv.h>
 #include <sys/time.h>
 #include <sys/libkern.h>
+#include <sys/seqring.h>
 #include <sys/thread.h>
 #define _KLOG_PRIVATE
 #include <sys/klog.h>
 
-klog_t klog;
+static_assert(powerof2(KL_SIZE), "KL_SIZE must be a power of 2!");
+static_assert(offsetof(klog_entry_t, kl_seq) == 0,
+              "klog_entry_t must begin with sequence number!");
 
-static spin_t klog_lock = SPIN_INITIALIZER(LK_RECURSIVE);
+klog_t klog;
 
 static const char *subsystems[] = {
   [KL_RUNQ] = "runq",   [KL_SLEEPQ] = "sleepq",   [KL_CALLOUT] = "callout",
@@ -23,17 +25,13 @@ static const char *subsystems[] = {
   [KL_UNDEF] = "???"};
 
 void init_klog(void) {
+  for (int i = 0; i < MAXCPU; i++)
+    seqring_init(&klog.ring[i], klog.entries[i], sizeof(klog_entry_t),
+                 KL_SIZE);
+
   const char *mask = kenv_get("klog-mask");
   klog.mask = mask ? (unsigned)strtol(mask, NULL, 16) : KL_DEFAULT_MASK;
   klog.verbose = kenv_get("klog-quiet") ? 0 : 1;
-  klog.first = 0;
-  klog.last = 0;
-  klog.repeated = 0;
-  klog.prev = -1;
-}
-
-static inline unsigned next(unsigned i) {
-  return (i + 1) % KL_SIZE;
 }
 
 static void klog_entry_dump(klog_entry_t *entry) {
@@ -54,57 +52,23 @@ void klog_append(klog_origin_t origin, const char *file, unsigned line,
   if (!(KL_MASK(origin) & atomic_load(&klog.mask)))
     return;
 
-  klog_entry_t *entry;
-  tid_t tid = thread_self()->td_tid;
-
-  WITH_SPIN_LOCK (&klog_lock) {
-    bintime_t now = binuptime();
-
-    entry = (klog.prev >= 0) ? &klog.array[klog.prev] : NULL;
-
-    /* Do not store repeating log messages, just count them. */
-    if (entry) {
-      bool repeats =
-        (entry->kl_params[0] == arg1) && (entry->kl_params[1] == arg2) &&
-        (entry->kl_params[2] == arg3) && (entry->kl_params[3] == arg4) &&
-        (entry->kl_params[4] == arg5) && (entry->kl_params[5] == arg6) &&
-        (entry->kl_origin == origin) && (entry->kl_file == file) &&
-        (entry->kl_line == line) && (entry->kl_tid = tid);
-
-      if (repeats) {
-        if (!klog.repeated) {
-          int old_prev = klog.prev;
-          klog.prev = -1;
-          klog_append(entry->kl_origin, entry->kl_file, entry->kl_line,
-                      "Last message repeated %d times.", 0, 0, 0, 0, 0, 0);
-          klog.prev = old_prev;
-          klog.repeated = true;
-        }
-
-        entry = &klog.array[next(klog.prev)];
-        entry->kl_timestamp = now;
-        entry->kl_params[0]++;
-        return;
-      } else {
-        klog.repeated = false;
-      }
-    }
+  unsigned idx;
+  klog_entry_t *entry = seqring_reserve(&klog.ring[PCPU_GET(cpuid)], &idx);
 
-    entry = &klog.array[klog.last];
+  entry->kl_origin = origin;
+  entry->kl_timestamp = binuptime();
+  entry->kl_tid = thread_self()->td_tid;
+  entry->kl_line = line;
+  entry->kl_file = file;
+  entry->kl_format = format;
+  entry->kl_params[0] = arg1;
+  entry->kl_params[1] = arg2;
+  entry->kl_params[2] = arg3;
+  entry->kl_params[3] = arg4;
+  entry->kl_params[4] = arg5;
+  entry->kl_params[5] = arg6;
 
-    *entry = (klog_entry_t){.kl_timestamp = now,
-                            .kl_tid = tid,
-                            .kl_line = line,
-                            .kl_file = file,
-                            .kl_origin = origin,
-                            .kl_format = format,
-                            .kl_params = {arg1, arg2, arg3, arg4, arg5, arg6}};
-
-    klog.prev = klog.last;
-    klog.last = next(klog.last);
-    if (klog.first == klog.last)
-      klog.first = next(klog.first);
-  }
+  seqring_publish(entry, idx);
 
   if (klog.verbose && !intr_disabled())
     klog_entry_dump(entry);
@@ -115,18 +79,33 @@ unsigned klog_setmask(unsigned newmask) {
 }
 
 void klog_dump(void) {
-  klog_entry_t entry;
-
-  while (klog.first != klog.last) {
-    WITH_SPIN_LOCK (&klog_lock) {
-      entry = klog.array[klog.first];
-      klog.first = next(klog.first);
+  klog_entry_t entry[MAXCPU];
+  bool valid[MAXCPU];
+
+  for (int i = 0; i < MAXCPU; i++)
+    valid[i] = seqring_get(&klog.ring[i], &entry[i]);
+
+  /* Merge entries from all rings in order of their timestamps. */
+  while (true) {
+    int oldest = -1;
+
+    for (int i = 0; i < MAXCPU; i++) {
+      if (!valid[i])
+        continue;
+      if (oldest < 0 || bintime_cmp(&entry[i].kl_timestamp,
+                                    &entry[oldest].kl_timestamp, <))
+        oldest = i;
     }
-    klog_entry_dump(&entry);
+
+    if (oldest < 0)
+      break;
+
+    klog_entry_dump(&entry[oldest]);
+    valid[oldest] = seqring_get(&klog.ring[oldest], &entry[oldest]);
   }
 }
 
 void klog_clear(void) {
-  klog.first = 0;
-  klog.last = 0;
+  for (int i = 0; i < MAXCPU; i++)
+    seqring_clear(&klog.ring[i]);
 }
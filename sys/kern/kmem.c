@@ -1,18 +1,25 @@
 #define KL_LOG KL_KMEM
 #include <sys/klog.h>
 #include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/kmem.h>
 #include <sys/libkern.h>
 #include <sys/param.h>
 #include <sys/pmap.h>
 #include <sys/vmem.h>
 #include <sys/vm.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
 #include <sys/kasan.h>
 
 static vmem_t *kvspace; /* Kernel virtual address space allocator. */
 
+/* Thread stacks, pipe buffers and pool slabs are a few pages long, so they
+ * are served from quantum caches of kvspace. */
+#define KVA_QCACHE_MAX (8 * PAGESIZE)
+
 void init_kmem(void) {
-  kvspace = vmem_create("kvspace", PAGESIZE);
+  kvspace = vmem_create("kvspace", PAGESIZE, KVA_QCACHE_MAX);
   if (KERNEL_SPACE_BEGIN < (vaddr_t)__kernel_start)
     vmem_add(kvspace, KERNEL_SPACE_BEGIN,
              (vaddr_t)__kernel_start - KERNEL_SPACE_BEGIN);
@@ -21,7 +28,7 @@ void init_kmem(void) {
 }
 
 static void kick_swapper(void) {
-  panic("Cannot allocate more kernel memory: swapper not implemented!");
+  panic("Kernel virtual address space exhausted!");
 }
 
 vaddr_t kva_alloc(size_t size) {
@@ -37,35 +44,44 @@ void kva_free(vaddr_t ptr, size_t size) {
   vmem_free(kvspace, ptr, size);
 }
 
-void kva_map(vaddr_t ptr, size_t size, kmem_flags_t flags) {
+int kva_map(vaddr_t ptr, size_t size, kmem_flags_t flags) {
   assert(page_aligned_p(size));
 
-  /* Mark the entire block as valid */
-  kasan_mark_valid((void *)ptr, size);
-
   size_t npages = size / PAGESIZE;
   vaddr_t va = ptr;
 
   while (npages > 0) {
     size_t pagecnt = 1L << log2(npages);
-    vm_page_t *pg = vm_page_alloc(pagecnt);
-    if (pg == NULL)
-      kick_swapper();
-    paddr_t pa = pg->paddr;
-    for (size_t i = 0; i < pagecnt; i++)
-      pmap_kenter(va + PAGESIZE * i, pa + PAGESIZE * i,
-                  VM_PROT_READ | VM_PROT_WRITE, 0);
+    vm_page_t *pg;
+
+    /* Fall back to smaller blocks if memory is fragmented, then wait for
+     * pagedaemon to free some pages. */
+    while (!(pg = vm_page_alloc_flags(pagecnt, flags & (M_ZERO | M_NOWAIT)))) {
+      if (pagecnt > 1) {
+        pagecnt /= 2;
+      } else if (flags & M_NOWAIT) {
+        if (va > ptr)
+          kva_unmap(ptr, va - ptr);
+        return ENOMEM;
+      } else {
+        vm_wait();
+      }
+    }
+
+    pmap_kenter_range(va, vm_page_paddr(pg), pagecnt * PAGESIZE,
+                      VM_PROT_READ | VM_PROT_WRITE, 0);
     npages -= pagecnt;
     va += pagecnt * PAGESIZE;
   }
 
-  if (flags & M_ZERO)
-    bzero((void *)ptr, size);
+  /* Mark the entire block as valid */
+  kasan_mark_valid((void *)ptr, size);
+  return 0;
 }
 
 vm_page_t *kva_find_page(vaddr_t ptr) {
   paddr_t pa;
-  if (pmap_extract(pmap_kernel(), ptr, &pa))
+  if (pmap_kextract(ptr, &pa))
     return vm_page_find(pa);
   return NULL;
 }
@@ -92,10 +108,16 @@ void *kmem_alloc(size_t size, kmem_flags_t flags) {
   assert(!(flags & M_NOGROW));
 
   vmem_addr_t start;
-  if (vmem_alloc(kvspace, size, &start, M_NOGROW))
+  if (vmem_alloc(kvspace, size, &start, M_NOGROW)) {
+    if (flags & M_NOWAIT)
+      return NULL;
     kick_swapper();
+  }
 
-  kva_map(start, size, flags);
+  if (kva_map(start, size, flags)) {
+    vmem_free(kvspace, start, size);
+    return NULL;
+  }
 
   return (void *)start;
 }
@@ -109,8 +131,17 @@ void kmem_free(void *ptr, size_t size) {
 vaddr_t kmem_map(paddr_t pa, size_t size, unsigned flags) {
   assert(page_aligned_p(pa) && page_aligned_p(size));
 
+  /* Large mappings get virtual address aligned like the physical one, so
+   * that pmap is able to map them with large pages. */
+  vmem_size_t alignment = 0;
+  if (size > KVA_QCACHE_MAX)
+    for (alignment = 1L << log2(size); !is_aligned(pa, alignment);)
+      alignment /= 2;
+
   vmem_addr_t start;
-  if (vmem_alloc(kvspace, size, &start, M_NOGROW))
+  if (vmem_xalloc(kvspace, size, alignment, 0, 0, VMEM_ADDR_MIN, VMEM_ADDR_MAX,
+                  M_NOGROW, &start) &&
+      vmem_alloc(kvspace, size, &start, M_NOGROW))
     kick_swapper();
 
   /* Mark the entire block as valid */
@@ -118,9 +149,7 @@ vaddr_t kmem_map(paddr_t pa, size_t size, unsigned flags) {
 
   klog("%s: map %p of size %ld at %p", __func__, pa, size, start);
 
-  for (size_t offset = 0; offset < size; offset += PAGESIZE)
-    pmap_kenter(start + offset, pa + offset, VM_PROT_READ | VM_PROT_WRITE,
-                flags);
+  pmap_kenter_range(start, pa, size, VM_PROT_READ | VM_PROT_WRITE, flags);
 
   return start;
 }
@@ -131,7 +131,7 @@ static int run_test(test_entry_t *t) {
 
 inline static int test_is_autorunnable(test_entry_t *t) {
   return !(t->flags & KTEST_FLAG_NORETURN) && !(t->flags & KTEST_FLAG_DIRTY) &&
-         !(t->flags & KTEST_FLAG_BROKEN);
+         !(t->flags & KTEST_FLAG_BROKEN) && !(t->flags & KTEST_FLAG_BENCHMARK);
 }
 
 static int test_name_compare(const void *a_, const void *b_) {
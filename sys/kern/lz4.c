@@ -0,0 +1,169 @@
+#include <sys/mimiker.h>
+#include <sys/libkern.h>
+#include <sys/lz4.h>
+
+#define MINMATCH 4     /* shortest match that can be encoded */
+#define MFLIMIT 12     /* last match must start this far from the end */
+#define LASTLITERALS 5 /* last bytes of input are always literals */
+#define RUN_MASK 15    /* length stored in a token nibble */
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline unsigned lz4_hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
+
+/* Worst case size of length encoded as a token nibble followed by bytes. */
+static inline size_t lz4_length_size(size_t len) {
+  return len < RUN_MASK ? 0 : (len - RUN_MASK) / 255 + 1;
+}
+
+static uint8_t *lz4_put_length(uint8_t *op, size_t len) {
+  for (len -= RUN_MASK; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/* Emits a sequence of literals followed by a match, unless `mlen` is 0. */
+static uint8_t *lz4_put_sequence(uint8_t *op, uint8_t *oend,
+                                 const uint8_t *lit, size_t litlen,
+                                 size_t offset, size_t mlen) {
+  size_t need = 1 + lz4_length_size(litlen) + litlen;
+  if (mlen)
+    need += 2 + lz4_length_size(mlen - MINMATCH);
+  if ((size_t)(oend - op) < need)
+    return NULL;
+
+  uint8_t *token = op++;
+  *token = min(litlen, (size_t)RUN_MASK) << 4;
+  if (litlen >= RUN_MASK)
+    op = lz4_put_length(op, litlen);
+  memcpy(op, lit, litlen);
+  op += litlen;
+
+  if (mlen) {
+    mlen -= MINMATCH;
+    *token |= min(mlen, (size_t)RUN_MASK);
+    *op++ = offset;
+    *op++ = offset >> 8;
+    if (mlen >= RUN_MASK)
+      op = lz4_put_length(op, mlen);
+  }
+
+  return op;
+}
+
+size_t lz4_compress(const void *src, size_t srclen, void *dst, size_t dstlen,
+                    uint16_t htab[LZ4_HASHSIZE]) {
+  assert(srclen <= UINT16_MAX);
+
+  const uint8_t *base = src;
+  const uint8_t *ip = base, *anchor = base;
+  const uint8_t *iend = base + srclen;
+  uint8_t *op = dst, *oend = op + dstlen;
+
+  /* Stale entries are harmless, as each candidate match is verified. */
+  bzero(htab, LZ4_HASHSIZE * sizeof(uint16_t));
+
+  if (srclen > MFLIMIT) {
+    const uint8_t *mflimit = iend - MFLIMIT;
+    const uint8_t *matchlimit = iend - LASTLITERALS;
+
+    while (ip < mflimit) {
+      uint32_t seq = lz4_read32(ip);
+      unsigned h = lz4_hash(seq);
+      const uint8_t *ref = base + htab[h];
+      htab[h] = ip - base;
+
+      if (ref >= ip || lz4_read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      /* Extend the match in both directions. */
+      while (ip > anchor && ref > base && ip[-1] == ref[-1])
+        ip--, ref--;
+
+      const uint8_t *mp = ip + MINMATCH, *rp = ref + MINMATCH;
+      while (mp < matchlimit && *mp == *rp)
+        mp++, rp++;
+
+      op = lz4_put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+      if (op == NULL)
+        return 0;
+
+      ip = anchor = mp;
+    }
+  }
+
+  op = lz4_put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+  if (op == NULL)
+    return 0;
+
+  return op - (uint8_t *)dst;
+}
+
+static bool lz4_get_length(const uint8_t **ipp, const uint8_t *iend,
+                           size_t *lenp) {
+  const uint8_t *ip = *ipp;
+  uint8_t b;
+
+  do {
+    if (ip >= iend)
+      return false;
+    b = *ip++;
+    *lenp += b;
+  } while (b == 255);
+
+  *ipp = ip;
+  return true;
+}
+
+ssize_t lz4_decompress(const void *src, size_t srclen, void *dst,
+                       size_t dstlen) {
+  const uint8_t *ip = src, *iend = ip + srclen;
+  uint8_t *op = dst, *oend = op + dstlen;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+
+    size_t len = token >> 4;
+    if (len == RUN_MASK && !lz4_get_length(&ip, iend, &len))
+      return -1;
+    if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+      return -1;
+    memcpy(op, ip, len);
+    op += len;
+    ip += len;
+
+    /* The last sequence has no match part. */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst))
+      return -1;
+
+    len = token & RUN_MASK;
+    if (len == RUN_MASK && !lz4_get_length(&ip, iend, &len))
+      return -1;
+    len += MINMATCH;
+    if ((size_t)(oend - op) < len)
+      return -1;
+
+    /* Source and destination may overlap, so copy byte by byte. */
+    const uint8_t *ref = op - offset;
+    while (len--)
+      *op++ = *ref++;
+  }
+
+  return op - (uint8_t *)dst;
+}
@@ -12,6 +12,9 @@
 #include <sys/interrupt.h>
 #include <sys/sleepq.h>
 #include <sys/turnstile.h>
+#include <sys/taskqueue.h>
+#include <sys/trace.h>
+#include <sys/prof.h>
 #include <sys/thread.h>
 #include <sys/proc.h>
 #include <sys/filedesc.h>
@@ -20,8 +23,12 @@
 #include <sys/fcntl.h>
 #include <sys/vfs.h>
 #include <sys/vnode.h>
+#include <sys/vm_ksm.h>
 #include <sys/vm_map.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
+#include <sys/vm_swap.h>
+#include <sys/vm_zstore.h>
 #include <sys/pmap.h>
 #include <sys/console.h>
 #include <sys/stat.h>
@@ -82,6 +89,7 @@ __noreturn void kernel_init(void) {
   init_pool();
   init_vmem();
   init_kmem();
+  init_kmalloc_classes();
   init_vm_map();
 
   init_cons();
@@ -94,6 +102,13 @@ __noreturn void kernel_init(void) {
 
   /* With scheduler ready we can create necessary threads. */
   init_callout();
+  init_taskqueue();
+  init_vm_pageout();
+  init_vm_prezero();
+  init_vm_zstore();
+  init_vm_ksm();
+  init_trace();
+  init_prof();
   preempt_enable();
 
   /* [FIRST_PASS] Initialize first timer and console devices. */
@@ -106,6 +121,9 @@ __noreturn void kernel_init(void) {
   /* Mount filesystems (including devfs). */
   mount_fs();
 
+  /* Swap area may reside on any of mounted filesystems. */
+  init_vm_swap();
+
   /* Some clocks has been found during device init process,
    * so it's high time to start system clock. */
   init_clock();
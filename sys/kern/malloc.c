@@ -7,6 +7,11 @@
 #include <sys/kmem.h>
 #include <sys/kasan.h>
 #include <sys/queue.h>
+#include <sys/pool.h>
+#include <sys/pcpu.h>
+#include <sys/sched.h>
+#include <sys/vm.h>
+#include <sys/kmemstat.h>
 
 #define BLOCK_MAXSIZE (1L << 16) /* Maximum block size. */
 #define ARENA_SIZE (1L << 18)    /* Size of each allocated arena. */
@@ -332,7 +337,7 @@ static void *realloc(void *old_ptr, size_t size) {
   return new_ptr;
 }
 
-/* --=[ kernel API ]=------------------------------------------------------- */
+/* --=[ arena allocator ]=------------------------------------------------- */
 
 static void arena_init(arena_t *ar) {
   size_t sz = rounddown(ARENA_SIZE - sizeof(arena_t), ALIGNMENT);
@@ -355,19 +360,23 @@ static void arena_add(void) {
   arena_t *ar = kmem_alloc(ARENA_SIZE, M_WAITOK);
   if (ar == NULL)
     panic("memory exhausted!");
+  /* Pages may have been used by a pool before, so clear their slab pointers
+   * to let kfree tell arena blocks apart from pool objects. */
+  for (size_t i = 0; i < ARENA_SIZE; i += PAGESIZE)
+    kva_find_page((vaddr_t)ar + i)->slab = NULL;
   arena_init(ar);
 }
 
-void *kmalloc(kmalloc_pool_t *mp, size_t size, unsigned flags) {
-  if (size == 0)
-    return NULL;
-
+static inline size_t arena_blksz(size_t size) {
 #if KASAN
-  size_t req_size = blk_size(size + KASAN_KMALLOC_REDZONE_SIZE);
+  return blk_size(size + KASAN_KMALLOC_REDZONE_SIZE);
 #else /* !KASAN */
-  size_t req_size = blk_size(size);
+  return blk_size(size);
 #endif
+}
 
+static void *arena_alloc(size_t size, unsigned flags) {
+  size_t req_size = arena_blksz(size);
   void *ptr = NULL;
 
   assert(req_size <= BLOCK_MAXSIZE);
@@ -379,32 +388,19 @@ void *kmalloc(kmalloc_pool_t *mp, size_t size, unsigned flags) {
         return NULL;
       arena_add();
     }
-
-    mp->used += req_size;
-    mp->maxused = max(mp->used, mp->maxused);
-    mp->active++;
-    mp->nrequests++;
   }
 
   /* Create redzone after the buffer. */
   kasan_mark(ptr, size, req_size - USEDBLK_SZ, KASAN_CODE_KMALLOC_OVERFLOW);
-  if (flags & M_ZERO)
-    bzero(ptr, size);
   return ptr;
 }
 
 static void kfree_nokasan(kmalloc_pool_t *mp, void *ptr) {
   assert(mtx_owned(&arena_lock));
-  word_t *bt = bt_fromptr(ptr);
-  mp->used -= bt_size(bt);
-  mp->active--;
   free(ptr);
 }
 
-void kfree(kmalloc_pool_t *mp, void *ptr) {
-  if (ptr == NULL)
-    return;
-
+static void arena_free(kmalloc_pool_t *mp, void *ptr) {
   WITH_MTX_LOCK (&arena_lock) {
 #if KASAN
     word_t *bt = bt_fromptr(ptr);
@@ -416,8 +412,163 @@ void kfree(kmalloc_pool_t *mp, void *ptr) {
   }
 }
 
+static alignas(PAGESIZE) uint8_t BOOT_ARENA[ARENA_SIZE];
+
+/* --=[ size classes ]=----------------------------------------------------- */
+
+/* Size classes follow the bins of arena allocator, i.e. there are 8 classes
+ * of 16 byte spacing and 4 classes for each power of 2 above. */
+#define NCLASSES 24
+#define CLASS_SHIFT 4 /* granularity of size to class lookup table */
+
+/* Number of free objects cached per CPU for each size class. With KASAN
+ * objects must go through pool's quarantine, so there's no cache. */
+#if KASAN
+#define CACHE_SIZE 0
+#else
+#define CACHE_SIZE 32
+#endif
+
+typedef struct kmalloc_cache {
+  unsigned count;
+  void *objs[CACHE_SIZE];
+} kmalloc_cache_t;
+
+typedef struct kmalloc_class {
+  size_t size;
+  pool_t *pool;
+  kmalloc_cache_t cache[MAXCPU];
+} kmalloc_class_t;
+
+static kmalloc_class_t classes[NCLASSES];
+static uint8_t size2class[(KMALLOC_MAXCLASS >> CLASS_SHIFT) + 1];
+static bool classes_ready = false;
+
+static kmalloc_class_t *class_lookup(size_t size) {
+  return &classes[size2class[(size + (1 << CLASS_SHIFT) - 1) >> CLASS_SHIFT]];
+}
+
+/* Returns size class of the object, or NULL if it's an arena block. Pages of
+ * both are found with a single lookup, and pool's item size is the size of
+ * its class. */
+static kmalloc_class_t *class_of(void *ptr) {
+  if (BOOT_ARENA <= (uint8_t *)ptr && (uint8_t *)ptr < BOOT_ARENA + ARENA_SIZE)
+    return NULL;
+
+  pool_t *pool = pool_find(ptr);
+  if (pool == NULL)
+    return NULL;
+
+  kmalloc_class_t *kc = class_lookup(pool_item_size(pool));
+  assert(kc->pool == pool);
+  return kc;
+}
+
+static void *class_alloc(kmalloc_class_t *kc, unsigned flags) {
+  void *ptr = NULL;
+
+#if CACHE_SIZE > 0
+  WITH_NO_PREEMPTION {
+    kmalloc_cache_t *cache = &kc->cache[PCPU_GET(cpuid)];
+    if (cache->count > 0)
+      ptr = cache->objs[--cache->count];
+  }
+#endif
+
+  if (ptr == NULL)
+    ptr = pool_alloc(kc->pool, flags & ~M_ZERO);
+  return ptr;
+}
+
+static void class_free(kmalloc_class_t *kc, void *ptr) {
+#if CACHE_SIZE > 0
+  WITH_NO_PREEMPTION {
+    kmalloc_cache_t *cache = &kc->cache[PCPU_GET(cpuid)];
+    if (cache->count < CACHE_SIZE) {
+      cache->objs[cache->count++] = ptr;
+      return;
+    }
+  }
+#endif
+
+  pool_free(kc->pool, ptr);
+}
+
+/* --=[ kernel API ]=------------------------------------------------------- */
+
+/* Charges the pool for a new block of given size. */
+static bool kmalloc_account(kmalloc_pool_t *mp, size_t size, unsigned flags) {
+  SCOPED_SPIN_LOCK(&mp->lock);
+  mp->nrequests++;
+  while (mp->limit && mp->used + size > mp->limit) {
+    if (flags & M_NOWAIT) {
+      mp->nfailed++;
+      return false;
+    }
+    cv_wait(&mp->wait, &mp->lock);
+  }
+  mp->used += size;
+  mp->maxused = max(mp->used, mp->maxused);
+  mp->active++;
+  return true;
+}
+
+static void kfree_account(kmalloc_pool_t *mp, size_t size) {
+  SCOPED_SPIN_LOCK(&mp->lock);
+  mp->used -= size;
+  mp->active--;
+  if (mp->limit)
+    cv_broadcast(&mp->wait);
+}
+
+void *kmalloc(kmalloc_pool_t *mp, size_t size, unsigned flags) {
+  kmalloc_class_t *kc = NULL;
+  size_t blksz;
+  void *ptr;
+
+  if (size == 0)
+    return NULL;
+
+  if (classes_ready && size <= KMALLOC_MAXCLASS) {
+    kc = class_lookup(size);
+    blksz = kc->size;
+  } else {
+    blksz = arena_blksz(size);
+  }
+
+  if (!kmalloc_account(mp, blksz, flags))
+    return NULL;
+
+  ptr = kc ? class_alloc(kc, flags) : arena_alloc(size, flags);
+
+  if (ptr == NULL) {
+    kfree_account(mp, blksz);
+    return NULL;
+  }
+
+  if (flags & M_ZERO)
+    bzero(ptr, size);
+  return ptr;
+}
+
+void kfree(kmalloc_pool_t *mp, void *ptr) {
+  if (ptr == NULL)
+    return;
+
+  kmalloc_class_t *kc = class_of(ptr);
+
+  if (kc == NULL) {
+    kfree_account(mp, bt_size(bt_fromptr(ptr)));
+    arena_free(mp, ptr);
+  } else {
+    kfree_account(mp, kc->size);
+    class_free(kc, ptr);
+  }
+}
+
 void *krealloc(kmalloc_pool_t *mp, void *old_ptr, size_t size, unsigned flags) {
   void *new_ptr;
+  size_t old_size;
 
   if (size == 0) {
     kfree(mp, old_ptr);
@@ -427,15 +578,38 @@ void *krealloc(kmalloc_pool_t *mp, void *old_ptr, size_t size, unsigned flags) {
   if (old_ptr == NULL)
     return kmalloc(mp, size, flags);
 
-  WITH_MTX_LOCK (&arena_lock) {
-    if ((new_ptr = realloc(old_ptr, size)))
-      return new_ptr;
+  kmalloc_class_t *kc = class_of(old_ptr);
+
+  if (kc == NULL) {
+    word_t *bt = bt_fromptr(old_ptr);
+    size_t old_blksz = bt_size(bt);
+
+    /* Block may shrink or grow in place unless it should move to a pool.
+     * Pools with a limit must check it before growing, so they always move
+     * the block. */
+    if ((!classes_ready || size > KMALLOC_MAXCLASS) && !mp->limit) {
+      WITH_MTX_LOCK (&arena_lock)
+        new_ptr = realloc(old_ptr, size);
+      if (new_ptr) {
+        WITH_SPIN_LOCK (&mp->lock) {
+          mp->used += bt_size(bt) - old_blksz;
+          mp->maxused = max(mp->used, mp->maxused);
+        }
+        return new_ptr;
+      }
+    }
+
+    old_size = old_blksz - USEDBLK_SZ;
+  } else {
+    /* Object still fits into its size class. */
+    if (size <= kc->size && (kc == classes || size > kc[-1].size))
+      return old_ptr;
+    old_size = kc->size;
   }
 
   /* Run out of options - need to move block physically. */
   if ((new_ptr = kmalloc(mp, size, flags))) {
-    word_t *bt = bt_fromptr(old_ptr);
-    memcpy(new_ptr, old_ptr, bt_size(bt) - sizeof(word_t));
+    memcpy(new_ptr, old_ptr, min(old_size, size));
     kfree(mp, old_ptr);
     return new_ptr;
   }
@@ -443,6 +617,63 @@ void *krealloc(kmalloc_pool_t *mp, void *old_ptr, size_t size, unsigned flags) {
   return NULL;
 }
 
+void kmalloc_setlimit(kmalloc_pool_t *mp, size_t limit) {
+  SCOPED_SPIN_LOCK(&mp->lock);
+  mp->limit = limit;
+  cv_broadcast(&mp->wait);
+}
+
+void kmalloc_reclaim(void) {
+#if CACHE_SIZE > 0
+  if (!classes_ready)
+    return;
+
+  for (int i = 0; i < NCLASSES; i++) {
+    kmalloc_class_t *kc = &classes[i];
+    void *objs[CACHE_SIZE];
+    unsigned n;
+
+    WITH_NO_PREEMPTION {
+      kmalloc_cache_t *cache = &kc->cache[PCPU_GET(cpuid)];
+      n = cache->count;
+      memcpy(objs, cache->objs, n * sizeof(void *));
+      cache->count = 0;
+    }
+
+    for (unsigned j = 0; j < n; j++)
+      pool_free(kc->pool, objs[j]);
+  }
+#endif
+}
+
+size_t kmalloc_stats(kmemstat_t *ks, size_t n) {
+  SET_DECLARE(kmalloc_pool, kmalloc_pool_t *);
+  kmalloc_pool_t ***mp_p;
+  size_t i = 0;
+
+  SET_FOREACH (mp_p, kmalloc_pool) {
+    kmalloc_pool_t *mp = **mp_p;
+    if (i < n) {
+      kmemstat_t *k = &ks[i];
+      bzero(k, sizeof(kmemstat_t));
+      strlcpy(k->ks_name, mp->desc, KMEMSTAT_NAMELEN);
+      k->ks_type = KMEMSTAT_MALLOC;
+      WITH_SPIN_LOCK (&mp->lock) {
+        k->ks_inuse = mp->used;
+        k->ks_peak = mp->maxused;
+        k->ks_limit = mp->limit;
+        k->ks_active = mp->active;
+        k->ks_nrequests = mp->nrequests;
+        k->ks_nfailed = mp->nfailed;
+      }
+      k->ks_size = k->ks_inuse;
+    }
+    i++;
+  }
+
+  return i;
+}
+
 char *kstrndup(kmalloc_pool_t *mp, const char *s, size_t maxlen) {
   size_t n = strnlen(s, maxlen) + 1;
   char *copy = kmalloc(mp, n, M_ZERO);
@@ -489,8 +720,6 @@ void kmcheck(void) {
   assert(dangling == 0);
 }
 
-static alignas(PAGESIZE) uint8_t BOOT_ARENA[ARENA_SIZE];
-
 void init_kmalloc(void) {
   TAILQ_INIT(&arena_list);
   mtx_init(&arena_lock, 0);
@@ -503,5 +732,31 @@ void init_kmalloc(void) {
   arena_init((arena_t *)BOOT_ARENA);
 }
 
+void init_kmalloc_classes(void) {
+  static const char *names[NCLASSES] = {
+    "kmalloc-16",   "kmalloc-32",   "kmalloc-48",   "kmalloc-64",
+    "kmalloc-80",   "kmalloc-96",   "kmalloc-112",  "kmalloc-128",
+    "kmalloc-160",  "kmalloc-192",  "kmalloc-224",  "kmalloc-256",
+    "kmalloc-320",  "kmalloc-384",  "kmalloc-448",  "kmalloc-512",
+    "kmalloc-640",  "kmalloc-768",  "kmalloc-896",  "kmalloc-1024",
+    "kmalloc-1280", "kmalloc-1536", "kmalloc-1792", "kmalloc-2048"};
+
+  size_t size = 0;
+  for (int i = 0; i < NCLASSES; i++) {
+    size += (i < 8) ? 16 : 1 << (log2(size) - 2);
+    classes[i].size = size;
+    classes[i].pool = pool_create(names[i], size);
+  }
+  assert(size == KMALLOC_MAXCLASS);
+
+  for (int i = 0, j = 0; j <= (KMALLOC_MAXCLASS >> CLASS_SHIFT); j++) {
+    if ((size_t)j << CLASS_SHIFT > classes[i].size)
+      i++;
+    size2class[j] = i;
+  }
+
+  classes_ready = true;
+}
+
 KMALLOC_DEFINE(M_TEMP, "temporaries");
 KMALLOC_DEFINE(M_STR, "strings");
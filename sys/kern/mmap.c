@@ -22,6 +22,19 @@ static_assert(VM_PRIVATE == MAP_PRIVATE, "VM_PRIVATE != MAP_PRIVATE");
 static_assert(VM_FIXED == MAP_FIXED, "VM_FIXED != MAP_FIXED");
 static_assert(VM_STACK == MAP_STACK, "VM_STACK != MAP_STACK");
 
+static_assert(VM_ADV_NORMAL == MADV_NORMAL, "VM_ADV_NORMAL != MADV_NORMAL");
+static_assert(VM_ADV_RANDOM == MADV_RANDOM, "VM_ADV_RANDOM != MADV_RANDOM");
+static_assert(VM_ADV_SEQUENTIAL == MADV_SEQUENTIAL,
+              "VM_ADV_SEQUENTIAL != MADV_SEQUENTIAL");
+static_assert(VM_ADV_WILLNEED == MADV_WILLNEED,
+              "VM_ADV_WILLNEED != MADV_WILLNEED");
+static_assert(VM_ADV_DONTNEED == MADV_DONTNEED,
+              "VM_ADV_DONTNEED != MADV_DONTNEED");
+static_assert(VM_ADV_FREE == MADV_FREE, "VM_ADV_FREE != MADV_FREE");
+
+/* Number of pages reported by single mincore step. */
+#define MINCORE_CHUNK 64
+
 int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags) {
   thread_t *td = thread_self();
   assert(td->td_proc != NULL);
@@ -85,3 +98,65 @@ int do_munmap(vaddr_t addr, size_t length) {
   }
   return 0;
 }
+
+int do_madvise(vaddr_t addr, size_t length, int advice) {
+  vm_map_t *uspace = proc_self()->p_uspace;
+
+  if (!page_aligned_p(addr))
+    return EINVAL;
+
+  length = roundup(length, PAGESIZE);
+
+  if (addr + length < addr || !vm_map_contains_p(uspace, addr, addr + length))
+    return ENOMEM;
+
+  switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+    case MADV_FREE:
+      return vm_map_advise(uspace, addr, addr + length, advice);
+    default:
+      return EINVAL;
+  }
+}
+
+int do_mincore(vaddr_t addr, size_t length, char *u_vec) {
+  vm_map_t *uspace = proc_self()->p_uspace;
+  char vec[MINCORE_CHUNK];
+  int error;
+
+  if (!page_aligned_p(addr))
+    return EINVAL;
+
+  length = roundup(length, PAGESIZE);
+
+  if (addr + length < addr || !vm_map_contains_p(uspace, addr, addr + length))
+    return ENOMEM;
+
+  for (size_t done = 0; done < length;) {
+    size_t n = min(length - done, (size_t)MINCORE_CHUNK * PAGESIZE);
+    vaddr_t start = addr + done;
+    if ((error = vm_map_mincore(uspace, start, start + n, vec)))
+      return error;
+    if ((error = copyout(vec, u_vec + done / PAGESIZE, n / PAGESIZE)))
+      return error;
+    done += n;
+  }
+
+  return 0;
+}
+
+int do_mlock(vaddr_t addr, size_t length, bool lock) {
+  vm_map_t *uspace = proc_self()->p_uspace;
+
+  vaddr_t start = rounddown(addr, PAGESIZE);
+  vaddr_t end = roundup(addr + length, PAGESIZE);
+
+  if (end < start || !vm_map_contains_p(uspace, start, end))
+    return ENOMEM;
+
+  return vm_map_wire(uspace, start, end, lock);
+}
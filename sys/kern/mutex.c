@@ -53,6 +53,19 @@ void _mtx_lock(mtx_t *m, const void *waitpt) {
   }
 }
 
+bool mtx_trylock(mtx_t *m) {
+  if (mtx_owned(m)) {
+    if (!lk_recursive_p(m))
+      return false;
+    m->m_count++;
+    return true;
+  }
+
+  intptr_t expected = 0;
+  return atomic_compare_exchange_strong(&m->m_owner, &expected,
+                                        (intptr_t)thread_self());
+}
+
 void mtx_unlock(mtx_t *m) {
   assert(mtx_owned(m));
 
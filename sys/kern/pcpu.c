@@ -1,6 +1,7 @@
 #include <sys/pcpu.h>
 #include <sys/thread.h>
 
-pcpu_t _pcpu_data[1] = {{
+pcpu_t _pcpu_data[MAXCPU] = {{
   .curthread = &thread0,
+  .cpuid = 0,
 }};
@@ -13,9 +13,15 @@
 #include <machine/vm_param.h>
 #include <bitstring.h>
 #include <sys/kasan.h>
+#include <sys/kmemstat.h>
 
 #define PI_ALIGNMENT sizeof(uint64_t)
 
+/* Slabs grow until they hold at least this number of items, so big items do
+ * not waste most of a page. */
+#define PI_MINITEMS 8
+#define PI_MAXSLAB (8 * PAGESIZE)
+
 #define POOL_DEBUG 0
 
 #if defined(POOL_DEBUG) && POOL_DEBUG > 0
@@ -39,15 +45,17 @@ typedef struct pool {
   pool_ctor_t pp_ctor;
   pool_dtor_t pp_dtor;
   size_t pp_itemsize; /* size of item */
+  size_t pp_slabsize; /* size of memory allocated for a new slab */
 #if KASAN
   size_t pp_redzone; /* size of redzone after each item */
   quar_t pp_quarantine;
 #endif
   /* statistics */
-  size_t pp_npages;   /* number of allocated pages (in bytes) */
-  size_t pp_nused;    /* number of used items in all slabs */
-  size_t pp_nmaxused; /* peak number of used items in all slabs */
-  size_t pp_ntotal;   /* total number of items in all slabs */
+  size_t pp_npages;    /* number of allocated pages (in bytes) */
+  size_t pp_nused;     /* number of used items in all slabs */
+  size_t pp_nmaxused;  /* peak number of used items in all slabs */
+  size_t pp_ntotal;    /* total number of items in all slabs */
+  size_t pp_nrequests; /* number of allocation requests */
 } pool_t;
 
 static TAILQ_HEAD(, pool) pool_list = TAILQ_HEAD_INITIALIZER(pool_list);
@@ -56,8 +64,10 @@ static KMALLOC_DEFINE(M_POOL, "pool allocators");
 
 typedef struct slab {
   LIST_ENTRY(slab) ph_link; /* pool slab list */
+  pool_t *ph_pool;          /* pool the slab belongs to */
   uint16_t ph_nused;        /* # of items in use */
   uint16_t ph_ntotal;       /* total number of chunks */
+  bool ph_static;           /* memory was not obtained from kmem_alloc */
   size_t ph_size;           /* size of memory allocated for the slab */
   size_t ph_itemsize;       /* total size of item (with header and redzone) */
   void *ph_items;           /* ptr to array of items after bitmap */
@@ -75,7 +85,9 @@ static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize) {
 
   klog("add slab at %p to '%s' pool", slab, pool->pp_desc);
 
+  slab->ph_pool = pool;
   slab->ph_nused = 0;
+  slab->ph_static = false;
   slab->ph_size = slabsize;
   slab->ph_itemsize = pool->pp_itemsize;
 #if KASAN
@@ -134,9 +146,9 @@ void *pool_alloc(pool_t *pool, unsigned flags) {
 
     if (!(slab = LIST_FIRST(&pool->pp_part_slabs))) {
       if (!(slab = LIST_FIRST(&pool->pp_empty_slabs))) {
-        slab = kmem_alloc(PAGESIZE, flags);
-        assert(slab != NULL);
-        add_slab(pool, slab, PAGESIZE);
+        if (!(slab = kmem_alloc(pool->pp_slabsize, flags)))
+          return NULL;
+        add_slab(pool, slab, pool->pp_slabsize);
       } else {
         /* We're going to allocate from empty slab
          * -> move it to the list of non-empty slabs. */
@@ -160,6 +172,7 @@ void *pool_alloc(pool_t *pool, unsigned flags) {
     }
 
     pool->pp_nused++;
+    pool->pp_nrequests++;
     pool->pp_nmaxused = max(pool->pp_nmaxused, pool->pp_nused);
   }
 
@@ -265,6 +278,10 @@ static void pool_init(pool_t *pool, const char *desc, size_t size,
   /* no redzone, we have to align the size itself */
   pool->pp_itemsize = align(size, PI_ALIGNMENT);
 #endif
+  pool->pp_slabsize = PAGESIZE;
+  while (pool->pp_slabsize < PI_MAXSLAB &&
+         pool->pp_slabsize < PI_MINITEMS * pool->pp_itemsize)
+    pool->pp_slabsize *= 2;
   kasan_quar_init(&pool->pp_quarantine, (quar_free_t)_pool_free);
   klog("initialized '%s' pool at %p (item size = %d)", pool->pp_desc, pool,
        pool->pp_itemsize);
@@ -280,6 +297,7 @@ void pool_add_page(pool_t *pool, void *page, size_t size) {
   assert(is_aligned(size, PAGESIZE));
   SCOPED_MTX_LOCK(&pool->pp_mtx);
   add_slab(pool, page, size);
+  ((slab_t *)page)->ph_static = true;
 }
 
 pool_t *pool_create(const char *desc, size_t size) {
@@ -288,6 +306,73 @@ pool_t *pool_create(const char *desc, size_t size) {
   return pool;
 }
 
+pool_t *pool_find(void *ptr) {
+  vm_page_t *pg = kva_find_page((vaddr_t)ptr);
+  if (pg == NULL || pg->slab == NULL)
+    return NULL;
+  return pg->slab->ph_pool;
+}
+
+size_t pool_item_size(pool_t *pool) {
+  return pool->pp_itemsize;
+}
+
+size_t pool_stats(kmemstat_t *ks, size_t n) {
+  pool_t *pool;
+  size_t i = 0;
+
+  SCOPED_MTX_LOCK(pool_list_lock);
+
+  TAILQ_FOREACH (pool, &pool_list, pp_link) {
+    if (i < n) {
+      kmemstat_t *k = &ks[i];
+      bzero(k, sizeof(kmemstat_t));
+      strlcpy(k->ks_name, pool->pp_desc, KMEMSTAT_NAMELEN);
+      k->ks_type = KMEMSTAT_POOL;
+      k->ks_itemsize = pool->pp_itemsize;
+      WITH_MTX_LOCK (&pool->pp_mtx) {
+        k->ks_inuse = pool->pp_nused * pool->pp_itemsize;
+        k->ks_peak = pool->pp_nmaxused * pool->pp_itemsize;
+        k->ks_active = pool->pp_nused;
+        k->ks_nrequests = pool->pp_nrequests;
+        k->ks_size = pool->pp_npages;
+      }
+    }
+    i++;
+  }
+
+  return i;
+}
+
+size_t pool_reclaim(void) {
+  size_t freed = 0;
+
+  SCOPED_MTX_LOCK(pool_list_lock);
+
+  pool_t *pool;
+  TAILQ_FOREACH (pool, &pool_list, pp_link) {
+    slab_list_t slabs = LIST_HEAD_INITIALIZER(slabs);
+
+    WITH_MTX_LOCK (&pool->pp_mtx) {
+      slab_t *slab, *next;
+      LIST_FOREACH_SAFE (slab, &pool->pp_empty_slabs, ph_link, next) {
+        if (slab->ph_static)
+          continue;
+        LIST_REMOVE(slab, ph_link);
+        LIST_INSERT_HEAD(&slabs, slab, ph_link);
+        pool->pp_ntotal -= slab->ph_ntotal;
+        pool->pp_npages -= slab->ph_size;
+        freed += slab->ph_size;
+      }
+    }
+
+    /* Releasing memory may need other pools, so pool lock is dropped. */
+    destroy_slabs(pool, &slabs);
+  }
+
+  return freed;
+}
+
 void pool_destroy(pool_t *pool) {
   WITH_MTX_LOCK (pool_list_lock)
     TAILQ_REMOVE(&pool_list, pool, pp_link);
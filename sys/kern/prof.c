@@ -0,0 +1,100 @@
+#include <sys/mimiker.h>
+#include <sys/context.h>
+#include <sys/kenv.h>
+#include <sys/libkern.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/stack.h>
+#include <sys/thread.h>
+#include <sys/prof.h>
+
+static_assert(powerof2(PROF_SIZE), "PROF_SIZE must be a power of 2!");
+static_assert(sizeof(prof_sample_t) == 96, "prof_sample_t layout changed!");
+static_assert(offsetof(prof_sample_t, ps_seq) == 0,
+              "prof_sample_t must begin with sequence number!");
+
+static atomic_bool prof_enabled;
+seqring_t prof_ring[MAXCPU];
+static prof_sample_t prof_samples[MAXCPU][PROF_SIZE];
+
+void init_prof(void) {
+  for (int i = 0; i < MAXCPU; i++)
+    seqring_init(&prof_ring[i], prof_samples[i], sizeof(prof_sample_t),
+                 PROF_SIZE);
+
+  prof_enable(kenv_get("prof") != NULL);
+}
+
+bool prof_enable(bool enable) {
+  return atomic_exchange(&prof_enabled, enable);
+}
+
+static void prof_record(prof_sample_t *sample) {
+  unsigned cpu = PCPU_GET(cpuid);
+  unsigned idx;
+  prof_sample_t *ps = seqring_reserve(&prof_ring[cpu], &idx);
+
+  sample->ps_cpu = cpu;
+  /* Copy everything but the sequence number, which invalidates the sample
+   * until it's published. */
+  memcpy((void *)ps + sizeof(ps->ps_seq), (void *)sample + sizeof(ps->ps_seq),
+         sizeof(prof_sample_t) - sizeof(ps->ps_seq));
+
+  seqring_publish(ps, idx);
+}
+
+static void prof_sample_init(prof_sample_t *ps, thread_t *td) {
+  proc_t *p = td->td_proc;
+  const char *name = td->td_name;
+
+  if (p != NULL && p->p_elfpath != NULL) {
+    const char *slash = strrchr(p->p_elfpath, '/');
+    name = slash ? slash + 1 : p->p_elfpath;
+  }
+
+  /* Unused entries must be cleared, so kernel memory doesn't leak out. */
+  bzero(ps, sizeof(prof_sample_t));
+  ps->ps_tid = td->td_tid;
+  ps->ps_pid = p ? p->p_pid : 0;
+  strlcpy(ps->ps_name, name, PROF_NAMELEN);
+}
+
+void prof_clock(void) {
+  if (!atomic_load_explicit(&prof_enabled, memory_order_relaxed))
+    return;
+
+  thread_t *td = thread_self();
+  ctx_t *ctx = PCPU_GET(intr_ctx);
+  if (ctx == NULL)
+    return;
+
+  /* User stack cannot be read in interrupt context. */
+  if (user_mode_p(ctx)) {
+    td->td_pflags |= TDP_PROFSAMPLE;
+    return;
+  }
+
+  prof_sample_t ps;
+  prof_sample_init(&ps, td);
+  ps.ps_kdepth = stack_unwind_kernel(td, ctx, ps.ps_pc, PROF_DEPTH);
+  /* Thread is in a syscall or handles an exception, so add the place where
+   * it entered the kernel. Only the PC is taken as we can't copyin here. */
+  if (td->td_proc != NULL && ps.ps_kdepth < PROF_DEPTH)
+    ps.ps_udepth = stack_unwind_user(td->td_uctx, ps.ps_pc + ps.ps_kdepth, 1);
+  prof_record(&ps);
+}
+
+void prof_user_sample(thread_t *td, mcontext_t *uctx) {
+  if (!(td->td_pflags & TDP_PROFSAMPLE))
+    return;
+  td->td_pflags &= ~TDP_PROFSAMPLE;
+
+  prof_sample_t ps;
+  prof_sample_init(&ps, td);
+  ps.ps_udepth = stack_unwind_user(uctx, ps.ps_pc, PROF_DEPTH);
+  prof_record(&ps);
+}
+
+bool prof_get(unsigned cpu, prof_sample_t *sample) {
+  return seqring_get(&prof_ring[cpu], sample);
+}
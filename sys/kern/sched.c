@@ -10,6 +10,8 @@
 #include <sys/spinlock.h>
 #include <sys/pcpu.h>
 #include <sys/turnstile.h>
+#include <sys/vm_physmem.h>
+#include <sys/trace.h>
 
 static spin_t sched_lock = SPIN_INITIALIZER(0);
 static runq_t runq;
@@ -44,6 +46,8 @@ void sched_wakeup(thread_t *td, long reason) {
 
   ctx_set_retval(td->td_kctx, reason);
 
+  TRACE(TRACE_SCHED_WAKEUP, td->td_tid, reason);
+
   runq_add(&runq, td);
 
   /* Check if we need to reschedule threads. */
@@ -157,6 +161,8 @@ long sched_switch(void) {
   /* If we got here then a context switch is required. */
   td->td_nctxsw++;
 
+  TRACE(TRACE_SCHED_SWITCH, td->td_tid, newtd->td_tid, td->td_state);
+
   if (PCPU_GET(no_switch))
     panic("Switching context while interrupts are disabled is forbidden!");
 
@@ -198,6 +204,8 @@ __noreturn void sched_run(void) {
   sched_active = true;
 
   while (true) {
+    /* Use spare cycles to prepare zeroed pages for page faults. */
+    vm_page_prezero();
     WITH_SPIN_LOCK (td->td_lock)
       td->td_flags |= TDF_NEEDSWITCH;
   }
@@ -0,0 +1,94 @@
+#include <sys/mimiker.h>
+#include <sys/libkern.h>
+#include <sys/seqring.h>
+#include <sys/uio.h>
+
+static inline atomic_uint *seqring_seq(seqring_t *sr, unsigned idx) {
+  return sr->array + (idx & (sr->nrecs - 1)) * sr->recsize;
+}
+
+void seqring_init(seqring_t *sr, void *array, size_t recsize, unsigned nrecs) {
+  assert(powerof2(nrecs));
+  assert(recsize <= SEQRING_RECMAX);
+
+  bzero(array, recsize * nrecs);
+  sr->array = array;
+  sr->recsize = recsize;
+  sr->nrecs = nrecs;
+  atomic_store(&sr->head, 0);
+  atomic_store(&sr->tail, 0);
+}
+
+void *seqring_reserve(seqring_t *sr, unsigned *idxp) {
+  unsigned idx = atomic_fetch_add(&sr->head, 1);
+  atomic_uint *seq = seqring_seq(sr, idx);
+
+  /* Invalidate the record, so readers won't copy it until it's published. */
+  atomic_store(seq, 0);
+
+  *idxp = idx;
+  return seq;
+}
+
+bool seqring_get(seqring_t *sr, void *rec) {
+  while (true) {
+    unsigned tail = atomic_load(&sr->tail);
+    unsigned head = atomic_load(&sr->head);
+
+    if (tail == head)
+      return false;
+
+    /* Writers have already overwritten the oldest records. */
+    if (head - tail > sr->nrecs) {
+      atomic_compare_exchange_weak(&sr->tail, &tail, head - sr->nrecs);
+      continue;
+    }
+
+    atomic_uint *seqp = seqring_seq(sr, tail);
+    unsigned seq = atomic_load(seqp);
+
+    if (seq != tail + 1) {
+      /* Record is still being written by a writer. */
+      if ((int)(seq - (tail + 1)) < 0)
+        return false;
+      /* Record has been overwritten in the meantime - skip it. */
+      atomic_compare_exchange_weak(&sr->tail, &tail, tail + 1);
+      continue;
+    }
+
+    memcpy(rec, seqp, sr->recsize);
+
+    /* Make sure the record wasn't overwritten while we were copying it. */
+    if (atomic_load(seqp) != seq)
+      continue;
+
+    if (atomic_compare_exchange_strong(&sr->tail, &tail, tail + 1))
+      return true;
+  }
+}
+
+unsigned seqring_count(seqring_t *sr) {
+  unsigned n = atomic_load(&sr->head) - atomic_load(&sr->tail);
+  return min(n, sr->nrecs);
+}
+
+void seqring_clear(seqring_t *sr) {
+  atomic_store(&sr->tail, atomic_load(&sr->head));
+}
+
+int seqring_read(seqring_t *rings, unsigned n, uio_t *uio) {
+  uint64_t rec[SEQRING_RECMAX / sizeof(uint64_t)];
+  int error;
+
+  for (unsigned i = 0; i < n; i++) {
+    seqring_t *sr = &rings[i];
+    while (uio->uio_resid >= sr->recsize) {
+      if (!seqring_get(sr, rec))
+        break;
+      if ((error = uiomove(rec, sr->recsize, uio)))
+        return error;
+    }
+  }
+
+  return 0;
+}
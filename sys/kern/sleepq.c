@@ -281,27 +281,29 @@ static void sq_timeout(thread_t *td) {
   _sleepq_abort(td, ETIMEDOUT);
 }
 
-int sleepq_wait_timed(void *wchan, const void *waitpt, systime_t timeout) {
+/* Sleep with timeout given either in system ticks or as absolute uptime. */
+static int _sleepq_wait_timed(void *wchan, const void *waitpt,
+                              systime_t timeout, const bintime_t *deadline) {
   thread_t *td = thread_self();
-
-  if (waitpt == NULL)
-    waitpt = __caller(0);
+  bool timed = (timeout > 0) || (deadline != NULL);
 
   sleepq_chain_t *sc = sc_acquire(wchan);
   spin_lock(td->td_lock);
 
   /* If there are pending signals, interrupt the sleep immediately. */
-  if ((td->td_flags & TDF_NEEDSIGCHK) && (timeout == 0)) {
+  if ((td->td_flags & TDF_NEEDSIGCHK) && !timed) {
     spin_unlock(td->td_lock);
     sc_release(sc);
     return EINTR;
   }
 
-  if (timeout > 0)
+  if (deadline != NULL)
+    callout_setup_bt(&td->td_slpcallout, *deadline, (timeout_t)sq_timeout, td);
+  else if (timeout > 0)
     callout_setup_relative(&td->td_slpcallout, timeout, (timeout_t)sq_timeout,
                            td);
 
-  td->td_flags |= (timeout > 0) ? TDF_SLPTIMED : TDF_SLPINTR;
+  td->td_flags |= timed ? TDF_SLPTIMED : TDF_SLPINTR;
   sq_enter(td, sc, wchan, waitpt);
 
   /* After wakeup, only one of the following flags may be set:
@@ -317,8 +319,22 @@ int sleepq_wait_timed(void *wchan, const void *waitpt, systime_t timeout) {
     td->td_flags &= ~(TDF_SLPINTR | TDF_SLPTIMED);
   }
 
-  if (timeout > 0)
+  if (timed)
     callout_stop(&td->td_slpcallout);
 
   return error;
 }
+
+int sleepq_wait_timed(void *wchan, const void *waitpt, systime_t timeout) {
+  if (waitpt == NULL)
+    waitpt = __caller(0);
+
+  return _sleepq_wait_timed(wchan, waitpt, timeout, NULL);
+}
+
+int sleepq_wait_timed_bt(void *wchan, const void *waitpt, bintime_t deadline) {
+  if (waitpt == NULL)
+    waitpt = __caller(0);
+
+  return _sleepq_wait_timed(wchan, waitpt, 0, &deadline);
+}
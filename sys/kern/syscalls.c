@@ -191,6 +191,30 @@ static int sys_mprotect(proc_t *p, mprotect_args_t *args, register_t *res) {
   return ENOTSUP;
 }
 
+static int sys_madvise(proc_t *p, madvise_args_t *args, register_t *res) {
+  klog("madvise(%p, %u, %d)", SCARG(args, addr), SCARG(args, len),
+       SCARG(args, advice));
+  return do_madvise((vaddr_t)SCARG(args, addr), SCARG(args, len),
+                    SCARG(args, advice));
+}
+
+static int sys_mincore(proc_t *p, mincore_args_t *args, register_t *res) {
+  klog("mincore(%p, %u, %p)", SCARG(args, addr), SCARG(args, len),
+       SCARG(args, vec));
+  return do_mincore((vaddr_t)SCARG(args, addr), SCARG(args, len),
+                    SCARG(args, vec));
+}
+
+static int sys_mlock(proc_t *p, mlock_args_t *args, register_t *res) {
+  klog("mlock(%p, %u)", SCARG(args, addr), SCARG(args, len));
+  return do_mlock((vaddr_t)SCARG(args, addr), SCARG(args, len), true);
+}
+
+static int sys_munlock(proc_t *p, munlock_args_t *args, register_t *res) {
+  klog("munlock(%p, %u)", SCARG(args, addr), SCARG(args, len));
+  return do_mlock((vaddr_t)SCARG(args, addr), SCARG(args, len), false);
+}
+
 static int sys_openat(proc_t *p, openat_args_t *args, register_t *res) {
   int fdat = SCARG(args, fd);
   const char *u_path = SCARG(args, path);
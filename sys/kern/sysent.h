@@ -80,6 +80,10 @@ static int sys_fchownat(proc_t *, fchownat_args_t *, register_t *);
 static int sys_getlogin(proc_t *, getlogin_args_t *, register_t *);
 static int sys_setlogin(proc_t *, setlogin_args_t *, register_t *);
 static int sys_posix_openpt(proc_t *, posix_openpt_args_t *, register_t *);
+static int sys_madvise(proc_t *, madvise_args_t *, register_t *);
+static int sys_mincore(proc_t *, mincore_args_t *, register_t *);
+static int sys_mlock(proc_t *, mlock_args_t *, register_t *);
+static int sys_munlock(proc_t *, munlock_args_t *, register_t *);
 
 struct sysent sysent[] = {
   [SYS_syscall] = { .nargs = 1, .call = (syscall_t *)sys_syscall },
@@ -157,5 +161,9 @@ struct sysent sysent[] = {
   [SYS_getlogin] = { .nargs = 2, .call = (syscall_t *)sys_getlogin },
   [SYS_setlogin] = { .nargs = 1, .call = (syscall_t *)sys_setlogin },
   [SYS_posix_openpt] = { .nargs = 1, .call = (syscall_t *)sys_posix_openpt },
+  [SYS_madvise] = { .nargs = 3, .call = (syscall_t *)sys_madvise },
+  [SYS_mincore] = { .nargs = 3, .call = (syscall_t *)sys_mincore },
+  [SYS_mlock] = { .nargs = 2, .call = (syscall_t *)sys_mlock },
+  [SYS_munlock] = { .nargs = 2, .call = (syscall_t *)sys_munlock },
 };
 
@@ -2,40 +2,161 @@
 #include <sys/malloc.h>
 #include <sys/queue.h>
 #include <sys/taskqueue.h>
+#include <sys/thread.h>
+#include <sys/sched.h>
+
+taskqueue_t taskqueue_system;
 
 void taskqueue_init(taskqueue_t *tq) {
   STAILQ_INIT(&tq->tq_list);
-  mtx_init(&tq->tq_mutex, LK_RECURSIVE);
+  spin_init(&tq->tq_lock, 0);
   cv_init(&tq->tq_nonempty, "taskqueue nonempty");
+  tq->tq_flags = 0;
+  tq->tq_nworkers = 0;
 }
 
 void taskqueue_destroy(taskqueue_t *tq) {
+  WITH_SPIN_LOCK (&tq->tq_lock) {
+    tq->tq_flags |= TQF_EXITING;
+    cv_broadcast(&tq->tq_nonempty);
+  }
+
+  for (unsigned i = 0; i < tq->tq_nworkers; i++)
+    thread_join(tq->tq_workers[i]);
+  tq->tq_nworkers = 0;
+
   assert(STAILQ_EMPTY(&tq->tq_list));
-  mtx_destroy(tq->tq_mutex);
   cv_destroy(tq->tq_nonempty);
 }
 
 void taskqueue_add(taskqueue_t *tq, task_t *task) {
-  SCOPED_MTX_LOCK(&tq->tq_mutex);
+  SCOPED_SPIN_LOCK(&tq->tq_lock);
+  /* Task is already waiting to be run, so there's no need to append it.
+   * Running task is appended by taskqueue_done. */
+  if (task->t_pending++ > 0 || task->t_running)
+    return;
   STAILQ_INSERT_TAIL(&tq->tq_list, task, t_link);
   cv_signal(&tq->tq_nonempty);
 }
 
+/* Removes the first task from the queue. Pending count is reset so the task
+ * can be enqueued again while it's being executed. */
+static task_t *taskqueue_take(taskqueue_t *tq) {
+  assert(spin_owned(&tq->tq_lock));
+
+  task_t *task = STAILQ_FIRST(&tq->tq_list);
+  STAILQ_REMOVE_HEAD(&tq->tq_list, t_link);
+  task->t_pending = 0;
+  task->t_running = true;
+  return task;
+}
+
+/* Called after the task has been executed. If it was enqueued in the meantime,
+ * it's appended now, so that no other worker runs it before this run ends. */
+static void taskqueue_done(taskqueue_t *tq, task_t *task) {
+  SCOPED_SPIN_LOCK(&tq->tq_lock);
+
+  task->t_running = false;
+  if (task->t_pending > 0) {
+    STAILQ_INSERT_TAIL(&tq->tq_list, task, t_link);
+    cv_signal(&tq->tq_nonempty);
+  }
+}
+
 void taskqueue_run(taskqueue_t *tq) {
   task_list_t tasklist;
 
-  WITH_MTX_LOCK (&tq->tq_mutex) {
+  WITH_SPIN_LOCK (&tq->tq_lock) {
     while (STAILQ_EMPTY(&tq->tq_list))
-      cv_wait(&tq->tq_nonempty, &tq->tq_mutex);
+      cv_wait(&tq->tq_nonempty, &tq->tq_lock);
 
-    /* Copy the list head into a local var, and empty the original head. */
-    tasklist = tq->tq_list;
-    STAILQ_INIT(&tq->tq_list);
+    /* Move tasks into a local list, and reset their pending counters. */
+    STAILQ_INIT(&tasklist);
+    while (!STAILQ_EMPTY(&tq->tq_list)) {
+      task_t *task = taskqueue_take(tq);
+      STAILQ_INSERT_TAIL(&tasklist, task, t_link);
+    }
   }
 
   while (!STAILQ_EMPTY(&tasklist)) {
     task_t *task = STAILQ_FIRST(&tasklist);
-    task->t_func(task->t_arg);
     STAILQ_REMOVE_HEAD(&tasklist, t_link);
+    task->t_func(task->t_arg);
+    taskqueue_done(tq, task);
+  }
+}
+
+static void taskqueue_worker(void *arg) {
+  taskqueue_t *tq = arg;
+
+  while (true) {
+    task_t *task;
+
+    WITH_SPIN_LOCK (&tq->tq_lock) {
+      while (STAILQ_EMPTY(&tq->tq_list) && !(tq->tq_flags & TQF_EXITING))
+        cv_wait(&tq->tq_nonempty, &tq->tq_lock);
+
+      /* Finish pending work before the worker terminates. */
+      if (STAILQ_EMPTY(&tq->tq_list))
+        return;
+
+      task = taskqueue_take(tq);
+    }
+
+    task->t_func(task->t_arg);
+    taskqueue_done(tq, task);
+  }
+}
+
+void taskqueue_start_threads(taskqueue_t *tq, unsigned nworkers, prio_t prio,
+                             const char *name) {
+  assert(tq->tq_nworkers + nworkers <= TQ_MAXWORKERS);
+
+  for (unsigned i = 0; i < nworkers; i++) {
+    thread_t *td = thread_create(name, taskqueue_worker, tq, prio);
+    tq->tq_workers[tq->tq_nworkers++] = td;
+    sched_add(td);
+  }
+}
+
+static void taskqueue_timeout_func(void *arg) {
+  timeout_task_t *tt = arg;
+  taskqueue_t *tq = tt->tt_queue;
+
+  WITH_SPIN_LOCK (&tq->tq_lock)
+    tt->tt_scheduled = false;
+
+  taskqueue_add(tq, &tt->tt_task);
+}
+
+bool taskqueue_enqueue_timeout(taskqueue_t *tq, timeout_task_t *tt,
+                               systime_t ticks) {
+  WITH_SPIN_LOCK (&tq->tq_lock) {
+    if (tt->tt_scheduled)
+      return false;
+    tt->tt_scheduled = true;
+    tt->tt_queue = tq;
   }
+
+  /* Callout may still be finishing previous invocation of
+   * taskqueue_timeout_func, which is fine, but we have to wait for it. */
+  callout_drain(&tt->tt_callout);
+  callout_setup_relative(&tt->tt_callout, ticks, taskqueue_timeout_func, tt);
+  return true;
+}
+
+bool taskqueue_cancel_timeout(taskqueue_t *tq, timeout_task_t *tt) {
+  SCOPED_SPIN_LOCK(&tq->tq_lock);
+
+  if (!tt->tt_scheduled || !callout_stop(&tt->tt_callout))
+    return false;
+
+  tt->tt_scheduled = false;
+  return true;
+}
+
+void init_taskqueue(void) {
+  taskqueue_init(&taskqueue_system);
+  taskqueue_start_threads(&taskqueue_system, 1,
+                          prio_ithread(PRIO_ITHRD_QTY - 1), "taskqueue");
 }
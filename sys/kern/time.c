@@ -1,7 +1,6 @@
 #include <sys/errno.h>
 #include <sys/sleepq.h>
 #include <sys/time.h>
-#include <limits.h>
 
 int do_clock_gettime(clockid_t clk, timespec_t *tp) {
   bintime_t bin;
@@ -19,31 +18,12 @@ int do_clock_gettime(clockid_t clk, timespec_t *tp) {
   return 0;
 }
 
-static systime_t ts2hz(timespec_t *ts) {
-  if (ts->tv_sec < 0 || (ts->tv_sec == 0 && ts->tv_nsec == 0))
-    return 0;
-
-  if (ts->tv_sec > UINT_MAX / CLK_TCK)
-    return UINT_MAX;
-
-  const int pow9 = 1000000000;
-  int tick = pow9 / CLK_TCK;
-
-  /* Round up the number of ticks */
-  long nsectck = (ts->tv_nsec + tick - 1) / tick;
-  systime_t ticks = ts->tv_sec * CLK_TCK;
-
-  if (ticks > UINT_MAX - nsectck - 1)
-    return UINT_MAX;
-
-  /* Add 1 for the current tick to expire */
-  return ticks + nsectck + 1;
-}
-
-static int ts2timo(clockid_t clock_id, int flags, timespec_t *ts,
-                   systime_t *timo, timespec_t *start) {
+/* Calculate absolute uptime at which the sleep requested by @ts ends. */
+static int ts2deadline(clockid_t clock_id, int flags, timespec_t *ts,
+                       bintime_t *deadline, timespec_t *start) {
+  timespec_t rel = *ts;
+  bintime_t bt;
   int error;
-  *timo = 0;
 
   if (ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000L || ts->tv_sec < 0 ||
       (flags & ~TIMER_ABSTIME))
@@ -53,12 +33,16 @@ static int ts2timo(clockid_t clock_id, int flags, timespec_t *ts,
     return error;
 
   if (flags & TIMER_ABSTIME)
-    timespecsub(ts, start, ts);
+    timespecsub(&rel, start, &rel);
 
-  if ((ts->tv_sec == 0 && ts->tv_nsec == 0) || ts->tv_sec < 0)
+  if ((rel.tv_sec == 0 && rel.tv_nsec == 0) || rel.tv_sec < 0)
     return ETIMEDOUT;
 
-  *timo = ts2hz(ts);
+  /* Sleep deadline is always expressed in terms of system uptime, so that
+   * it can be handled by a high-resolution callout. */
+  ts2bt(&rel, &bt);
+  *deadline = binuptime();
+  bintime_add(deadline, &bt);
 
   return 0;
 }
@@ -67,17 +51,17 @@ int do_clock_nanosleep(clockid_t clk, int flags, timespec_t *rqtp,
                        timespec_t *rmtp) {
   /* rmt - remaining time, rqt - requested time, p - pointer */
   timespec_t rmt_start, rmt_end, rmt;
-  systime_t timo;
+  bintime_t deadline;
   int error, error2;
 
-  if ((error = ts2timo(clk, flags, rqtp, &timo, &rmt_start))) {
+  if ((error = ts2deadline(clk, flags, rqtp, &deadline, &rmt_start))) {
     if (error == ETIMEDOUT)
       goto timedout;
     return error;
   }
 
   do {
-    error = sleepq_wait_timed((void *)(&rmt_start), __caller(0), timo);
+    error = sleepq_wait_timed_bt((void *)(&rmt_start), __caller(0), deadline);
     if (error == ETIMEDOUT)
       goto timedout;
 
@@ -97,9 +81,7 @@ int do_clock_nanosleep(clockid_t clk, int flags, timespec_t *rqtp,
       *rmtp = rmt;
     if (error)
       return error;
-
-    timo = ts2hz(&rmt);
-  } while (timo > 0);
+  } while (timespecisset(&rmt));
 
   return 0;
 
@@ -129,7 +129,8 @@ int tm_start(timer_t *tm, unsigned flags, const bintime_t start,
              const bintime_t period) {
   assert(is_initialized(tm));
 
-  if (is_active(tm))
+  /* Active one-shot timer may be rearmed without stopping it first. */
+  if (is_active(tm) && !(flags & TMF_ONESHOT))
     return EBUSY;
   if (((tm->tm_flags & flags) & TMF_TYPEMASK) == 0)
     return ENODEV;
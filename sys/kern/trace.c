@@ -0,0 +1,56 @@
+#include <sys/mimiker.h>
+#include <sys/kenv.h>
+#include <sys/libkern.h>
+#include <sys/pcpu.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/trace.h>
+
+static_assert(powerof2(TRACE_SIZE), "TRACE_SIZE must be a power of 2!");
+static_assert(sizeof(trace_event_t) == 48, "trace_event_t layout changed!");
+static_assert(offsetof(trace_event_t, te_seq) == 0,
+              "trace_event_t must begin with sequence number!");
+
+atomic_uint trace_mask;
+seqring_t trace_ring[MAXCPU];
+static trace_event_t trace_events[MAXCPU][TRACE_SIZE];
+
+void init_trace(void) {
+  for (int i = 0; i < MAXCPU; i++)
+    seqring_init(&trace_ring[i], trace_events[i], sizeof(trace_event_t),
+                 TRACE_SIZE);
+
+  const char *mask = kenv_get("trace-mask");
+  trace_setmask(mask ? (unsigned)strtoul(mask, NULL, 16) : TRACE_NONE);
+}
+
+unsigned trace_setmask(unsigned newmask) {
+  return atomic_exchange(&trace_mask, newmask & TRACE_ALL);
+}
+
+static inline uint64_t bt2ns(bintime_t bt) {
+  return (uint64_t)bt.sec * 1000000000 +
+         (((bt.frac >> 32) * 1000000000) >> 32);
+}
+
+void trace_record(trace_type_t type, uint64_t arg0, uint64_t arg1,
+                  uint64_t arg2) {
+  unsigned cpu = PCPU_GET(cpuid);
+  unsigned idx;
+  trace_event_t *te = seqring_reserve(&trace_ring[cpu], &idx);
+
+  te->te_type = type;
+  te->te_cpu = cpu;
+  te->te_time = bt2ns(binuptime());
+  te->te_tid = thread_self()->td_tid;
+  te->te_pad = 0;
+  te->te_args[0] = arg0;
+  te->te_args[1] = arg1;
+  te->te_args[2] = arg2;
+
+  seqring_publish(te, idx);
+}
+
+bool trace_get(unsigned cpu, trace_event_t *event) {
+  return seqring_get(&trace_ring[cpu], event);
+}
@@ -3,6 +3,7 @@
 #include <sys/spinlock.h>
 #include <sys/sched.h>
 #include <sys/turnstile.h>
+#include <sys/trace.h>
 #include <sys/queue.h>
 
 #define TC_TABLESIZE 256 /* Must be power of 2. */
@@ -356,6 +357,8 @@ void turnstile_wait(turnstile_t *ts, thread_t *owner, const void *waitpt) {
     ts->ts_state = USED_BLOCKED;
   }
 
+  TRACE(TRACE_TURNSTILE_BLOCK, owner->td_tid, (uintptr_t)ts->ts_wchan);
+
   switch_away(ts, waitpt);
 }
 
@@ -0,0 +1,563 @@
+#define KL_LOG KL_VM
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/condvar.h>
+#include <sys/kenv.h>
+#include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/pool.h>
+#include <sys/sched.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/vm_ksm.h>
+#include <sys/vm_object.h>
+#include <sys/vm_physmem.h>
+#include <sys/vmstat.h>
+
+/* Scanner wakes up that often to check next `ksm_rate` pages. */
+#define KSM_PERIOD (CLK_TCK / 5)
+
+#define KSM_HASH_SIZE 1024
+
+/* Pages seen in current pass are remembered in a direct-mapped table indexed
+ * by checksum, so an older page is forgotten if a newer one collides. */
+#define KSM_UNSTABLE_SIZE 512
+
+/* Field marking and corresponding locks:
+ * (K) ksm_lock
+ * (S) ksm_scan_lock */
+
+/* Read-only page with contents shared by pages of objects. */
+typedef struct ksm_page {
+  TAILQ_ENTRY(ksm_page) hash; /* (K) entry on hash chain by checksum */
+  vm_page_t *page;            /* page holding shared contents */
+  uint32_t csum;              /* checksum of contents */
+  unsigned refcnt;            /* (K) number of object pages sharing it */
+} ksm_page_t;
+
+/* Page of an object replaced by a shared one. */
+typedef struct ksm_rmap {
+  TAILQ_ENTRY(ksm_rmap) hash; /* (K) entry on hash chain by owner and offset */
+  vm_object_t *obj;           /* (K) object the page belongs to */
+  off_t offset;               /* (K) offset of the page in the object */
+  ksm_page_t *kp;             /* (K) shared page */
+} ksm_rmap_t;
+
+/* Page seen during current pass, for which no identical page was found. */
+typedef struct ksm_unstable {
+  vm_object_t *obj; /* (K) object the page belongs to or NULL */
+  off_t offset;     /* (K) offset of the page in the object */
+  uint32_t csum;    /* (K) checksum of contents when the page was seen */
+} ksm_unstable_t;
+
+typedef TAILQ_HEAD(, ksm_page) ksm_pagechain_t;
+typedef TAILQ_HEAD(, ksm_rmap) ksm_rmapchain_t;
+
+static POOL_DEFINE(P_KSM_PAGE, "ksm page", sizeof(ksm_page_t));
+static POOL_DEFINE(P_KSM_RMAP, "ksm rmap", sizeof(ksm_rmap_t));
+
+/* Lock order: ksm_scan_lock -> vm_object::mtx -> ksm_lock. */
+static mtx_t *ksm_scan_lock = &MTX_INITIALIZER(0);
+static mtx_t *ksm_lock = &MTX_INITIALIZER(0);
+static TAILQ_HEAD(, vm_object) ksm_objects = /* (K) registered objects */
+  TAILQ_HEAD_INITIALIZER(ksm_objects);
+static vm_object_t *ksm_cursor;  /* (K) object scanned now or next */
+static off_t ksm_cursor_offset;  /* (K) where to resume scan of the cursor */
+static vm_object_t *ksm_busy[2]; /* (K) objects the scanner works on */
+static condvar_t ksm_busy_cv;    /* threads wait here for scanner to finish */
+static ksm_pagechain_t ksm_stable[KSM_HASH_SIZE]; /* (K) shared pages */
+static ksm_rmapchain_t ksm_rmaps[KSM_HASH_SIZE];  /* (K) owner and offset */
+static ksm_unstable_t ksm_unstable[KSM_UNSTABLE_SIZE]; /* (K) candidates */
+static vaddr_t ksm_kva[2]; /* (S) windows to access contents of pages */
+static size_t ksm_rate;    /* pages checked by the scanner every period */
+static condvar_t ksm_cv;   /* scanner sleeps here between periods */
+
+static inline ksm_pagechain_t *ksm_stable_chain(uint32_t csum) {
+  return &ksm_stable[csum % KSM_HASH_SIZE];
+}
+
+static inline ksm_unstable_t *ksm_unstable_slot(uint32_t csum) {
+  return &ksm_unstable[csum % KSM_UNSTABLE_SIZE];
+}
+
+static ksm_rmapchain_t *ksm_rmap_chain(vm_object_t *obj, off_t offset) {
+  uintptr_t h = ((uintptr_t)obj >> 4) ^ (offset / PAGESIZE);
+  return &ksm_rmaps[h % KSM_HASH_SIZE];
+}
+
+static ksm_rmap_t *ksm_rmap_lookup(vm_object_t *obj, off_t offset) {
+  assert(mtx_owned(ksm_lock));
+
+  ksm_rmap_t *rm;
+  TAILQ_FOREACH (rm, ksm_rmap_chain(obj, offset), hash)
+    if (rm->obj == obj && rm->offset == offset)
+      return rm;
+  return NULL;
+}
+
+static const void *ksm_map(int i, vm_page_t *pg) {
+  pmap_kenter(ksm_kva[i], vm_page_paddr(pg), VM_PROT_READ, 0);
+  return (const void *)ksm_kva[i];
+}
+
+static void ksm_unmap(int i) {
+  pmap_kremove(ksm_kva[i], PAGESIZE);
+}
+
+/* Checksum of a page filled with zeros is zero. Words are accumulated with
+ * multiplicative hashing, which leaves low bits poorly mixed, so the result
+ * goes through the finalizer of MurmurHash3 before it's used as an index. */
+static uint32_t ksm_checksum(const void *data) {
+  const uint32_t *words = data;
+  uint32_t h = 0;
+  for (size_t i = 0; i < PAGESIZE / sizeof(uint32_t); i++)
+    h = (h + words[i]) * 2654435761U;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+static bool ksm_zero_p(const void *data) {
+  const uint32_t *words = data;
+  for (size_t i = 0; i < PAGESIZE / sizeof(uint32_t); i++)
+    if (words[i])
+      return false;
+  return true;
+}
+
+/* Drops a reference to shared page and frees it if that was the last one. */
+static void ksm_page_put(ksm_page_t *kp) {
+  WITH_MTX_LOCK (ksm_lock) {
+    if (--kp->refcnt > 0)
+      return;
+    TAILQ_REMOVE(ksm_stable_chain(kp->csum), kp, hash);
+  }
+
+  /* Pages of objects that shared the page may be still mapped to it. */
+  pmap_page_remove(kp->page);
+  kp->page->flags &= ~PG_MERGED;
+  vm_page_free(kp->page);
+  pool_free(P_KSM_PAGE, kp);
+  VMCNT_SUB(ksm_shared, 1);
+}
+
+/* Replaces page of `obj` with `kp`, whose reference is passed to the object.
+ * Contents of the page must have been found identical after all its mappings
+ * were removed. */
+static void ksm_merge(vm_object_t *obj, vm_page_t *pg, ksm_page_t *kp) {
+  assert(mtx_owned(&obj->mtx));
+
+  ksm_rmap_t *rm = pool_alloc(P_KSM_RMAP, 0);
+  rm->obj = obj;
+  rm->offset = vm_page_offset(pg);
+  rm->kp = kp;
+
+  vm_object_remove_page_nolock(obj, pg);
+  obj->nmerged++;
+
+  WITH_MTX_LOCK (ksm_lock)
+    TAILQ_INSERT_HEAD(ksm_rmap_chain(obj, rm->offset), rm, hash);
+
+  VMCNT_ADD(ksm_sharing, 1);
+}
+
+/* Looks for a shared page with the same contents as `data` has and takes
+ * a reference to it. */
+static ksm_page_t *ksm_stable_get(uint32_t csum, const void *data) {
+  SCOPED_MTX_LOCK(ksm_lock);
+
+  ksm_page_t *kp;
+  TAILQ_FOREACH (kp, ksm_stable_chain(csum), hash) {
+    if (kp->csum != csum)
+      continue;
+    bool same = memcmp(ksm_map(1, kp->page), data, PAGESIZE) == 0;
+    ksm_unmap(1);
+    if (same) {
+      kp->refcnt++;
+      return kp;
+    }
+  }
+
+  return NULL;
+}
+
+/* Makes `kp` shared by the page of `obj` if their contents are the same. */
+static bool ksm_merge_stable(vm_object_t *obj, vm_page_t *pg,
+                             const void *data, ksm_page_t *kp) {
+  /* After mappings are gone contents of the page cannot change. */
+  pmap_page_remove(pg);
+
+  bool same = memcmp(ksm_map(1, kp->page), data, PAGESIZE) == 0;
+  ksm_unmap(1);
+
+  if (!same) {
+    ksm_page_put(kp);
+    return false;
+  }
+
+  ksm_merge(obj, pg, kp);
+  return true;
+}
+
+/* Merges pages of two objects with identical contents into a new shared page.
+ * Returns false if they're not identical anymore or memory is short. */
+static bool ksm_merge_pair(vm_object_t *obj, vm_page_t *pg, const void *data,
+                           vm_object_t *pobj, vm_page_t *ppg, uint32_t csum) {
+  pmap_page_remove(pg);
+  pmap_page_remove(ppg);
+
+  bool same = memcmp(ksm_map(1, ppg), data, PAGESIZE) == 0;
+  ksm_unmap(1);
+
+  if (!same || ksm_checksum(data) != csum)
+    return false;
+
+  vm_page_t *shared = vm_page_alloc(1);
+  if (shared == NULL)
+    return false;
+
+  pmap_copy_page(pg, shared);
+  shared->flags |= PG_MERGED;
+
+  ksm_page_t *kp = pool_alloc(P_KSM_PAGE, 0);
+  kp->page = shared;
+  kp->csum = csum;
+  kp->refcnt = 2;
+
+  WITH_MTX_LOCK (ksm_lock)
+    TAILQ_INSERT_HEAD(ksm_stable_chain(csum), kp, hash);
+  VMCNT_ADD(ksm_shared, 1);
+
+  ksm_merge(obj, pg, kp);
+  ksm_merge(pobj, ppg, kp);
+  return true;
+}
+
+/* Page seen earlier in current pass had the same checksum as `pg` has, so it
+ * may be identical. It's worth merging them only if the older page did not
+ * change since then. */
+static bool ksm_merge_unstable(vm_object_t *obj, vm_page_t *pg,
+                               const void *data, uint32_t csum) {
+  ksm_unstable_t *u = ksm_unstable_slot(csum);
+  vm_object_t *pobj;
+  off_t poffset;
+
+  WITH_MTX_LOCK (ksm_lock) {
+    if (u->obj == NULL || u->csum != csum ||
+        (u->obj == obj && u->offset == vm_page_offset(pg))) {
+      u->obj = obj;
+      u->offset = vm_page_offset(pg);
+      u->csum = csum;
+      return false;
+    }
+    pobj = u->obj;
+    poffset = u->offset;
+    u->obj = NULL;
+    ksm_busy[1] = pobj;
+  }
+
+  bool merged = false;
+
+  /* Lock of the other object is taken against the lock order. */
+  if (mtx_trylock(&pobj->mtx)) {
+    vm_page_t *ppg = vm_object_find_page(pobj, poffset);
+    if (ppg && !(ppg->flags & PG_WIRED))
+      merged = ksm_merge_pair(obj, pg, data, pobj, ppg, csum);
+    mtx_unlock(&pobj->mtx);
+  }
+
+  WITH_MTX_LOCK (ksm_lock) {
+    ksm_busy[1] = NULL;
+    cv_broadcast(&ksm_busy_cv);
+  }
+
+  return merged;
+}
+
+/* Pages filled with zeros are recreated by the pager, so they're released. */
+static bool ksm_release_zero(vm_object_t *obj, vm_page_t *pg,
+                             const void *data) {
+  pmap_page_remove(pg);
+
+  if (!ksm_zero_p(data))
+    return false;
+
+  vm_object_remove_page_nolock(obj, pg);
+  VMCNT_ADD(ksm_zeroed, 1);
+  return true;
+}
+
+/* Returns true if any page of `obj` was released. */
+static bool ksm_scan_page(vm_object_t *obj, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (pg->flags & PG_WIRED)
+    return false;
+
+  VMCNT_ADD(ksm_scanned, 1);
+
+  const void *data = ksm_map(0, pg);
+  uint32_t csum = ksm_checksum(data);
+  ksm_page_t *kp;
+  bool released;
+
+  if (csum == 0 && ksm_zero_p(data))
+    released = ksm_release_zero(obj, pg, data);
+  else if ((kp = ksm_stable_get(csum, data)))
+    released = ksm_merge_stable(obj, pg, data, kp);
+  else
+    released = ksm_merge_unstable(obj, pg, data, csum);
+
+  ksm_unmap(0);
+  return released;
+}
+
+/* Checks at most `npages` pages of `obj` starting from `*offsetp`. Returns
+ * false if there are no more pages to check, or updates `*offsetp`. */
+static bool ksm_scan_object(vm_object_t *obj, off_t *offsetp, size_t *npages) {
+  SCOPED_MTX_LOCK(&obj->mtx);
+
+  vm_page_t *pg = vm_object_page_from(obj, *offsetp);
+
+  for (; pg && *npages > 0; (*npages)--) {
+    off_t next_offset = vm_page_offset(pg) + PAGESIZE;
+    vm_page_t *next = vm_object_next_page(obj, pg);
+    /* The next page may be gone as well if it was merged with `pg`. */
+    if (ksm_scan_page(obj, pg))
+      next = vm_object_page_from(obj, next_offset);
+    pg = next;
+  }
+
+  if (pg == NULL)
+    return false;
+  *offsetp = vm_page_offset(pg);
+  return true;
+}
+
+size_t ksm_scan(size_t npages) {
+  size_t left = npages;
+  bool pass_end = false;
+
+  SCOPED_MTX_LOCK(ksm_scan_lock);
+
+  WITH_MTX_LOCK (ksm_lock) {
+    if (ksm_cursor == NULL) {
+      ksm_cursor = TAILQ_FIRST(&ksm_objects);
+      ksm_cursor_offset = 0;
+    }
+  }
+
+  while (left > 0 && !pass_end) {
+    vm_object_t *obj;
+    off_t offset;
+
+    WITH_MTX_LOCK (ksm_lock) {
+      obj = ksm_cursor;
+      offset = ksm_cursor_offset;
+      ksm_busy[0] = obj;
+    }
+
+    if (obj == NULL)
+      break;
+
+    bool more = ksm_scan_object(obj, &offset, &left);
+
+    WITH_MTX_LOCK (ksm_lock) {
+      ksm_busy[0] = NULL;
+      cv_broadcast(&ksm_busy_cv);
+
+      if (more) {
+        ksm_cursor_offset = offset;
+      } else {
+        ksm_cursor = TAILQ_NEXT(obj, ksm_link);
+        ksm_cursor_offset = 0;
+      }
+
+      /* Candidates seen in this pass are likely to have changed. */
+      if (ksm_cursor == NULL) {
+        memset(ksm_unstable, 0, sizeof(ksm_unstable));
+        pass_end = true;
+      }
+    }
+  }
+
+  return npages - left;
+}
+
+void ksm_register(vm_object_t *obj) {
+  if (obj->pager != &pagers[VM_ANONYMOUS])
+    return;
+
+  SCOPED_MTX_LOCK(ksm_lock);
+  TAILQ_INSERT_TAIL(&ksm_objects, obj, ksm_link);
+}
+
+void ksm_unregister(vm_object_t *obj) {
+  if (obj->pager != &pagers[VM_ANONYMOUS])
+    return;
+
+  SCOPED_MTX_LOCK(ksm_lock);
+
+  while (ksm_busy[0] == obj || ksm_busy[1] == obj)
+    cv_wait(&ksm_busy_cv, ksm_lock);
+
+  if (ksm_cursor == obj) {
+    ksm_cursor = TAILQ_NEXT(obj, ksm_link);
+    ksm_cursor_offset = 0;
+  }
+
+  TAILQ_REMOVE(&ksm_objects, obj, ksm_link);
+
+  for (int i = 0; i < KSM_UNSTABLE_SIZE; i++)
+    if (ksm_unstable[i].obj == obj)
+      ksm_unstable[i].obj = NULL;
+}
+
+vm_page_t *ksm_lookup(vm_object_t *obj, off_t offset) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nmerged == 0)
+    return NULL;
+
+  SCOPED_MTX_LOCK(ksm_lock);
+  ksm_rmap_t *rm = ksm_rmap_lookup(obj, offset);
+  return rm ? rm->kp->page : NULL;
+}
+
+bool ksm_get(vm_object_t *obj, off_t offset, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nmerged == 0)
+    return false;
+
+  ksm_rmap_t *rm;
+
+  WITH_MTX_LOCK (ksm_lock) {
+    if (!(rm = ksm_rmap_lookup(obj, offset)))
+      return false;
+    TAILQ_REMOVE(ksm_rmap_chain(obj, offset), rm, hash);
+  }
+
+  obj->nmerged--;
+
+  ksm_page_t *kp = rm->kp;
+  pmap_copy_page(kp->page, pg);
+  pmap_set_modified(pg);
+
+  /* Other maps that use the object may still map the shared page. */
+  if (obj->ref_counter > 1)
+    pmap_page_remove(kp->page);
+
+  ksm_page_put(kp);
+  pool_free(P_KSM_RMAP, rm);
+
+  VMCNT_SUB(ksm_sharing, 1);
+  VMCNT_ADD(ksm_unmerged, 1);
+  return true;
+}
+
+void ksm_clone(vm_object_t *obj, vm_object_t *new_obj) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nmerged == 0)
+    return;
+
+  /* Allocate in advance, as the pool may need to wait for memory. */
+  ksm_rmapchain_t spare = TAILQ_HEAD_INITIALIZER(spare);
+  for (size_t i = 0; i < obj->nmerged; i++) {
+    ksm_rmap_t *rm = pool_alloc(P_KSM_RMAP, 0);
+    TAILQ_INSERT_HEAD(&spare, rm, hash);
+  }
+
+  WITH_MTX_LOCK (ksm_lock) {
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+      ksm_rmap_t *rm;
+      TAILQ_FOREACH (rm, &ksm_rmaps[i], hash) {
+        if (rm->obj != obj)
+          continue;
+        ksm_rmap_t *new_rm = TAILQ_FIRST(&spare);
+        TAILQ_REMOVE(&spare, new_rm, hash);
+        new_rm->obj = new_obj;
+        new_rm->offset = rm->offset;
+        new_rm->kp = rm->kp;
+        new_rm->kp->refcnt++;
+        TAILQ_INSERT_HEAD(ksm_rmap_chain(new_obj, rm->offset), new_rm, hash);
+      }
+    }
+  }
+
+  assert(TAILQ_EMPTY(&spare));
+  new_obj->nmerged = obj->nmerged;
+  VMCNT_ADD(ksm_sharing, obj->nmerged);
+}
+
+void ksm_remove(vm_object_t *obj, off_t offset, size_t length) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nmerged == 0)
+    return;
+
+  ksm_rmapchain_t removed = TAILQ_HEAD_INITIALIZER(removed);
+
+  WITH_MTX_LOCK (ksm_lock) {
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+      ksm_rmap_t *rm, *next;
+      TAILQ_FOREACH_SAFE (rm, &ksm_rmaps[i], hash, next) {
+        if (rm->obj == obj && rm->offset >= offset &&
+            (size_t)(rm->offset - offset) < length) {
+          TAILQ_REMOVE(&ksm_rmaps[i], rm, hash);
+          TAILQ_INSERT_HEAD(&removed, rm, hash);
+        }
+      }
+    }
+  }
+
+  ksm_rmap_t *rm, *next;
+  TAILQ_FOREACH_SAFE (rm, &removed, hash, next) {
+    obj->nmerged--;
+    ksm_page_put(rm->kp);
+    pool_free(P_KSM_RMAP, rm);
+    VMCNT_SUB(ksm_sharing, 1);
+  }
+}
+
+static void ksm_thread(void *arg) {
+  for (;;) {
+    ksm_scan(ksm_rate);
+    WITH_MTX_LOCK (ksm_lock)
+      cv_wait_timed(&ksm_cv, ksm_lock, KSM_PERIOD);
+  }
+}
+
+void init_vm_ksm(void) {
+  for (int i = 0; i < KSM_HASH_SIZE; i++) {
+    TAILQ_INIT(&ksm_stable[i]);
+    TAILQ_INIT(&ksm_rmaps[i]);
+  }
+
+  cv_init(&ksm_busy_cv, "ksm_busy");
+  cv_init(&ksm_cv, "ksm");
+
+  /* Page tables for the windows are allocated now and never released. */
+  vm_page_t *pg = vm_page_alloc(1);
+  for (int i = 0; i < 2; i++) {
+    ksm_kva[i] = kva_alloc(PAGESIZE);
+    ksm_map(i, pg);
+    ksm_unmap(i);
+  }
+  vm_page_free(pg);
+
+  if (!(ksm_rate = kenv_get_ulong("ksm")))
+    return;
+
+  klog("ksm: scanning %ld pages every %d ticks", ksm_rate, KSM_PERIOD);
+
+  thread_t *td = thread_create("ksmd", ksm_thread, NULL,
+                               prio_kthread(PRIO_QTY - 1));
+  sched_add(td);
+}
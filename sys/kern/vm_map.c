@@ -4,13 +4,17 @@
 #include <sys/libkern.h>
 #include <sys/pool.h>
 #include <sys/pmap.h>
+#include <sys/vm_ksm.h>
 #include <sys/vm_pager.h>
 #include <sys/vm_object.h>
 #include <sys/vm_map.h>
+#include <sys/vm_physmem.h>
 #include <sys/errno.h>
 #include <sys/proc.h>
 #include <sys/sched.h>
 #include <sys/pcpu.h>
+#include <sys/trace.h>
+#include <sys/vmstat.h>
 #include <machine/vm_param.h>
 
 struct vm_segment {
@@ -18,6 +22,7 @@ struct vm_segment {
   vm_object_t *object;
   vm_prot_t prot;
   vm_seg_flags_t flags;
+  vm_advice_t advice; /* expected access pattern, set by madvise */
   vaddr_t start;
   vaddr_t end;
 };
@@ -95,6 +100,9 @@ vm_map_t *vm_map_lookup(vaddr_t addr) {
   return NULL;
 }
 
+/* Read faults on anonymous memory that was never written map this page. */
+static vm_page_t *zero_page;
+
 static void vm_map_setup(vm_map_t *map) {
   TAILQ_INIT(&map->entries);
   mtx_init(&map->mtx, 0);
@@ -104,6 +112,9 @@ void init_vm_map(void) {
   vm_map_setup(kspace);
   kspace->pmap = pmap_kernel();
   vm_map_activate(kspace);
+
+  zero_page = vm_page_alloc_flags(1, M_ZERO);
+  zero_page->flags |= PG_ZERO;
 }
 
 vm_map_t *vm_map_new(void) {
@@ -185,6 +196,7 @@ void vm_segment_destroy_range(vm_map_t *map, vm_segment_t *seg, vaddr_t start,
     vm_object_remove_range(seg->object, end - seg->start, seg->end - end);
     vm_segment_t *new_seg =
       vm_segment_alloc(obj, end, seg->end, seg->prot, seg->flags);
+    new_seg->advice = seg->advice;
     seg->end = start;
     vm_map_insert_after(map, new_seg, seg);
   }
@@ -204,6 +216,129 @@ void vm_map_delete(vm_map_t *map) {
 void vm_map_protect(vm_map_t *map, vaddr_t start, vaddr_t end, vm_prot_t prot) {
 }
 
+/* Checks if [start, end) range is entirely covered by segments. */
+static bool vm_map_covered_p(vm_map_t *map, vaddr_t start, vaddr_t end) {
+  assert(mtx_owned(&map->mtx));
+
+  while (start < end) {
+    vm_segment_t *seg = vm_map_find_segment(map, start);
+    if (seg == NULL)
+      return false;
+    start = seg->end;
+  }
+
+  return true;
+}
+
+/* Brings in and maps pages that are not mapped yet, as if they were read. */
+static int vm_map_prefault(vm_map_t *map, vaddr_t start, vaddr_t end) {
+  for (vaddr_t va = start; va < end; va += PAGESIZE) {
+    paddr_t pa;
+    if (pmap_extract(map->pmap, va, &pa))
+      continue;
+    /* Pages that cannot be read are skipped. */
+    int error = vm_page_fault(map, va, VM_PROT_READ);
+    if (error == EFAULT)
+      return ENOMEM;
+  }
+
+  return 0;
+}
+
+int vm_map_advise(vm_map_t *map, vaddr_t start, vaddr_t end,
+                  vm_advice_t advice) {
+  assert(page_aligned_p(start) && page_aligned_p(end));
+
+  if (advice == VM_ADV_WILLNEED)
+    return vm_map_prefault(map, start, end);
+
+  SCOPED_VM_MAP_LOCK(map);
+
+  if (!vm_map_covered_p(map, start, end))
+    return ENOMEM;
+
+  vm_segment_t *seg;
+
+  /* Wired pages can't be discarded. Whole range is checked first, so that
+   * it's left intact on failure. */
+  if (advice == VM_ADV_DONTNEED) {
+    for (vaddr_t va = start; va < end; va = seg->end) {
+      seg = vm_map_find_segment(map, va);
+      if (seg->object && seg->object->nwired > 0)
+        return EINVAL;
+    }
+  }
+
+  for (vaddr_t va = start; va < end; va = seg->end) {
+    seg = vm_map_find_segment(map, va);
+    vm_object_t *obj = seg->object;
+    vaddr_t seg_end = min(end, seg->end);
+    off_t offset = va - seg->start;
+
+    if (advice == VM_ADV_NORMAL || advice == VM_ADV_RANDOM ||
+        advice == VM_ADV_SEQUENTIAL) {
+      /* Splitting the segment would require copying its object, so advice
+       * for a part of a segment is ignored. */
+      if (va == seg->start && seg_end == seg->end)
+        seg->advice = advice;
+    } else if (obj == NULL) {
+      continue;
+    } else if (advice == VM_ADV_DONTNEED) {
+      pmap_remove(map->pmap, va, seg_end);
+      /* Contents of shared memory must survive, other mappers can see it. */
+      if (!(seg->flags & VM_SEG_SHARED))
+        vm_object_remove_range(obj, offset, seg_end - va);
+    } else if (advice == VM_ADV_FREE) {
+      vm_object_free_range(obj, offset, seg_end - va);
+    } else {
+      return EINVAL;
+    }
+  }
+
+  return 0;
+}
+
+int vm_map_wire(vm_map_t *map, vaddr_t start, vaddr_t end, bool wire) {
+  assert(page_aligned_p(start) && page_aligned_p(end));
+
+  SCOPED_VM_MAP_LOCK(map);
+
+  if (!vm_map_covered_p(map, start, end))
+    return ENOMEM;
+
+  vm_segment_t *seg;
+  for (vaddr_t va = start; va < end; va = seg->end) {
+    seg = vm_map_find_segment(map, va);
+    if (seg->object)
+      vm_object_wire_range(seg->object, va - seg->start,
+                           min(end, seg->end) - va, wire);
+  }
+
+  return 0;
+}
+
+int vm_map_mincore(vm_map_t *map, vaddr_t start, vaddr_t end, char *vec) {
+  assert(page_aligned_p(start) && page_aligned_p(end));
+
+  SCOPED_VM_MAP_LOCK(map);
+
+  if (!vm_map_covered_p(map, start, end))
+    return ENOMEM;
+
+  vm_segment_t *seg;
+  for (vaddr_t va = start; va < end; va = seg->end) {
+    seg = vm_map_find_segment(map, va);
+    size_t length = min(end, seg->end) - va;
+    char *seg_vec = vec + (va - start) / PAGESIZE;
+    if (seg->object)
+      vm_object_mincore(seg->object, va - seg->start, length, seg_vec);
+    else
+      memset(seg_vec, 0, length / PAGESIZE);
+  }
+
+  return 0;
+}
+
 static int vm_map_findspace_nolock(vm_map_t *map, vaddr_t /*inout*/ *start_p,
                                    size_t length, vm_segment_t **after_p) {
   vaddr_t start = *start_p;
@@ -381,6 +516,7 @@ vm_map_t *vm_map_clone(vm_map_t *map) {
         obj = vm_object_clone(it->object);
       }
       seg = vm_segment_alloc(obj, it->start, it->end, it->prot, it->flags);
+      seg->advice = it->advice;
       TAILQ_INSERT_TAIL(&new_map->entries, seg, link);
       new_map->nentries++;
     }
@@ -389,7 +525,130 @@ vm_map_t *vm_map_clone(vm_map_t *map) {
   return new_map;
 }
 
+/* Returns true if pages of the object that are not resident would be filled
+ * with zeros by the pager. Objects with any page kept in swap, compressed
+ * store or shared with other objects are conservatively excluded. */
+static bool vm_fault_zero_p(vm_object_t *obj) {
+  return obj->pager == &pagers[VM_ANONYMOUS] && obj->nswapped == 0 &&
+         obj->ncompressed == 0 && obj->nmerged == 0;
+}
+
+/* Tries to back whole large page around `fault_addr` with physically
+ * contiguous memory and map it with a single TLB entry. It's possible only if
+ * the large page lies within the segment and none of its pages were touched,
+ * i.e. all of them would be filled with zeros by the pager. */
+static bool vm_fault_block(vm_map_t *map, vm_segment_t *seg,
+                           vaddr_t fault_addr) {
+  vm_object_t *obj = seg->object;
+  size_t blksz = pmap_block_size();
+
+  assert(mtx_owned(&obj->mtx));
+
+  if (blksz == 0 || obj->pager != &pagers[VM_ANONYMOUS])
+    return false;
+
+  vaddr_t start = fault_addr & -blksz;
+  if (start < seg->start || start + blksz > seg->end)
+    return false;
+
+  if (obj->nswapped > 0 || obj->ncompressed > 0 || obj->nmerged > 0)
+    return false;
+
+  off_t offset = start - seg->start;
+
+  vm_page_t *pg = vm_object_page_from(obj, offset);
+  if (pg && vm_page_offset(pg) < offset + (off_t)blksz)
+    return false;
+
+  size_t npages = blksz / PAGESIZE;
+  if (!(pg = vm_page_alloc_flags(npages, M_ZERO)))
+    return false;
+
+  /* Drop zero page mappings left by earlier read faults. */
+  pmap_remove(map->pmap, start, start + blksz);
+
+  /* Pages are not visible to pagedaemon until they're added to the object,
+   * so they can be still freed if the large page can't be mapped. */
+  if (!pmap_enter_block(map->pmap, start, pg, seg->prot, 0)) {
+    vm_page_free(pg);
+    return false;
+  }
+
+  vm_page_split(pg);
+  for (size_t i = 0; i < npages; i++)
+    vm_object_add_page(obj, offset + i * PAGESIZE, &pg[i]);
+
+  return true;
+}
+
+/* Number of pages in naturally aligned window around faulting page. */
+#define FAULT_AROUND 8
+
+/* Number of pages following faulting page in segments accessed sequentially. */
+#define FAULT_AHEAD 32
+
+/* Maps pages of the object that are resident in the window around
+ * `fault_page` but not mapped yet, as they're likely to be read soon.
+ * Each of them saves a page fault if it's accessed. The window depends on
+ * access pattern declared with madvise. Holes ahead of sequential reads of
+ * anonymous memory are filled with the zero page.
+ *
+ * Pages are entered read-only, so the first write still goes through
+ * vm_page_fault. They're also marked as referenced, since otherwise tracking
+ * of page accesses would make the first read fault anyway. */
+static void vm_fault_around(vm_map_t *map, vm_segment_t *seg,
+                            vaddr_t fault_page) {
+  vm_object_t *obj = seg->object;
+  vm_prot_t prot = seg->prot & ~VM_PROT_WRITE;
+  vaddr_t window;
+  size_t size;
+  unsigned n = 0;
+
+  assert(mtx_owned(&obj->mtx));
+
+  if (seg->advice == VM_ADV_RANDOM || !(prot & VM_PROT_READ))
+    return;
+
+  if (seg->advice == VM_ADV_SEQUENTIAL) {
+    window = fault_page;
+    size = FAULT_AHEAD * PAGESIZE;
+  } else {
+    window = fault_page & -(FAULT_AROUND * PAGESIZE);
+    size = FAULT_AROUND * PAGESIZE;
+  }
+
+  bool zero = seg->advice == VM_ADV_SEQUENTIAL && vm_fault_zero_p(obj);
+  off_t first = max(window, seg->start) - seg->start;
+  off_t last = min(window + size, seg->end) - seg->start;
+  vm_page_t *pg = vm_object_page_from(obj, first);
+
+  for (off_t off = first; off < last; off += PAGESIZE) {
+    while (pg && vm_page_offset(pg) < off)
+      pg = vm_object_next_page(obj, pg);
+
+    vm_page_t *frame = (pg && vm_page_offset(pg) == off) ? pg : NULL;
+    if (frame == NULL && zero)
+      frame = zero_page;
+
+    vaddr_t va = seg->start + off;
+    paddr_t pa;
+    if (!frame || va == fault_page || pmap_extract(map->pmap, va, &pa))
+      continue;
+
+    pmap_enter(map->pmap, va, frame, prot, 0);
+    /* Zero page is never tracked, so it's accessible right away. */
+    if (frame != zero_page)
+      pmap_set_referenced(frame);
+    n++;
+  }
+
+  if (n > 0)
+    VMCNT_ADD(prefaults, n);
+}
+
 int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
+  TRACE(TRACE_PAGE_FAULT, fault_addr, fault_type);
+
   SCOPED_VM_MAP_LOCK(map);
 
   vm_segment_t *seg = vm_map_find_segment(map, fault_addr);
@@ -420,17 +679,45 @@ int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
 
   assert(obj != NULL);
 
+  VMCNT_ADD(faults, 1);
+
   vaddr_t fault_page = fault_addr & -PAGESIZE;
   vaddr_t offset = fault_page - seg->start;
-  vm_page_t *frame = vm_object_find_page(seg->object, offset);
+
+  /* Pagedaemon must not reclaim the page before it gets mapped. */
+  SCOPED_MTX_LOCK(&obj->mtx);
+
+  if ((fault_type & VM_PROT_WRITE) && vm_fault_block(map, seg, fault_addr))
+    return 0;
+
+  vm_page_t *frame = vm_object_find_page(obj, offset);
+
+  /* Reads are served by shared page until the object gets a private copy. */
+  if (frame == NULL && !(fault_type & VM_PROT_WRITE))
+    frame = ksm_lookup(obj, offset);
+
+  if (frame == NULL && !(fault_type & VM_PROT_WRITE) &&
+      vm_fault_zero_p(obj)) {
+    VMCNT_ADD(zerofaults, 1);
+    frame = zero_page;
+  }
 
   if (frame == NULL)
     frame = obj->pager->pgr_fault(obj, offset);
 
+  /* Contents of the page could not be brought from backing store. */
   if (frame == NULL)
-    return EFAULT;
+    return EIO;
+
+  /* Private page replaces the zero page or shared page on first write. */
+  paddr_t pa;
+  if (pmap_extract(map->pmap, fault_page, &pa) && pa != vm_page_paddr(frame))
+    pmap_remove(map->pmap, fault_page, fault_page + PAGESIZE);
 
   pmap_enter(map->pmap, fault_page, frame, seg->prot, 0);
 
+  if (!(fault_type & VM_PROT_WRITE))
+    vm_fault_around(map, seg, fault_page);
+
   return 0;
 }
@@ -1,65 +1,102 @@
 #define KL_LOG KL_VM
 #include <sys/klog.h>
 #include <sys/mimiker.h>
+#include <sys/libkern.h>
 #include <sys/pool.h>
 #include <sys/pmap.h>
+#include <sys/vm_ksm.h>
 #include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
+#include <sys/vm_swap.h>
+#include <sys/vm_zstore.h>
 
 static POOL_DEFINE(P_VMOBJ, "vm_object", sizeof(vm_object_t));
 
+/* Pages are kept in a splay tree, which needs no more space in vm_page than
+ * a list does. Faults tend to hit pages close to each other, and these are
+ * found near the root. */
+static int vm_page_cmp(vm_page_t *pg1, vm_page_t *pg2) {
+  if (pg1->pindex < pg2->pindex)
+    return -1;
+  return pg1->pindex > pg2->pindex;
+}
+
+SPLAY_PROTOTYPE(vm_pagetree, vm_page, obj.tree, vm_page_cmp);
+SPLAY_GENERATE(vm_pagetree, vm_page, obj.tree, vm_page_cmp);
+
 vm_object_t *vm_object_alloc(vm_pgr_type_t type) {
   vm_object_t *obj = pool_alloc(P_VMOBJ, M_ZERO);
-  TAILQ_INIT(&obj->list);
-  mtx_init(&obj->mtx, 0);
+  SPLAY_INIT(&obj->pages);
+  TAILQ_INIT(&obj->swslots);
+  TAILQ_INIT(&obj->zchunks);
+  mtx_init(&obj->mtx, LK_RECURSIVE);
   obj->pager = &pagers[type];
   obj->ref_counter = 1;
+  ksm_register(obj);
   return obj;
 }
 
+vm_page_t *vm_object_page_from(vm_object_t *obj, off_t offset) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (SPLAY_EMPTY(&obj->pages) || offset / PAGESIZE > (off_t)UINT32_MAX)
+    return NULL;
+
+  /* Splaying brings the page or one of its neighbours to the root. */
+  vm_page_t key = {.pindex = offset / PAGESIZE};
+  vm_pagetree_SPLAY(&obj->pages, &key);
+
+  vm_page_t *pg = SPLAY_ROOT(&obj->pages);
+  if (pg->pindex < key.pindex)
+    pg = SPLAY_NEXT(vm_pagetree, &obj->pages, pg);
+  return pg;
+}
+
+vm_page_t *vm_object_next_page(vm_object_t *obj, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+  return SPLAY_NEXT(vm_pagetree, &obj->pages, pg);
+}
+
 vm_page_t *vm_object_find_page(vm_object_t *obj, off_t offset) {
   SCOPED_MTX_LOCK(&obj->mtx);
 
-  vm_page_t *pg;
-  TAILQ_FOREACH (pg, &obj->list, obj.list) {
-    if (pg->offset == offset)
-      return pg;
-  }
-
-  return NULL;
+  vm_page_t *pg = vm_object_page_from(obj, offset);
+  return (pg && vm_page_offset(pg) == offset) ? pg : NULL;
 }
 
 void vm_object_add_page(vm_object_t *obj, off_t offset, vm_page_t *pg) {
-  assert(page_aligned_p(pg->offset));
+  assert(page_aligned_p(offset));
+  assert(offset / PAGESIZE <= (off_t)UINT32_MAX);
   /* For simplicity of implementation let's insert pages of size 1 only */
   assert(pg->size == 1);
 
   pg->object = obj;
-  pg->offset = offset;
+  pg->pindex = offset / PAGESIZE;
 
-  WITH_MTX_LOCK (&obj->mtx) {
-    vm_page_t *it;
-    TAILQ_FOREACH (it, &obj->list, obj.list) {
-      if (it->offset > pg->offset) {
-        TAILQ_INSERT_BEFORE(it, pg, obj.list);
-        obj->npages++;
-        return;
-      }
-      /* there must be no page at the offset! */
-      assert(it->offset != pg->offset);
-    }
+  SCOPED_MTX_LOCK(&obj->mtx);
 
-    /* offset of page is greater than the offset of any other page */
-    TAILQ_INSERT_TAIL(&obj->list, pg, obj.list);
-    obj->npages++;
-  }
+  /* there must be no page at the offset! */
+  __unused vm_page_t *it = SPLAY_INSERT(vm_pagetree, &obj->pages, pg);
+  assert(it == NULL);
+
+  obj->npages++;
+  vm_pageq_insert(pg);
 }
 
-static void vm_object_remove_page_nolock(vm_object_t *obj, vm_page_t *page) {
-  page->offset = 0;
+void vm_object_remove_page_nolock(vm_object_t *obj, vm_page_t *page) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (page->flags & PG_WIRED) {
+    page->flags &= ~PG_WIRED;
+    obj->nwired--;
+  }
+
+  vm_pageq_remove(page);
+  SPLAY_REMOVE(vm_pagetree, &obj->pages, page);
+  page->pindex = 0;
   page->object = NULL;
 
-  TAILQ_REMOVE(&obj->list, page, obj.list);
   vm_page_free(page);
   obj->npages--;
 }
@@ -74,22 +111,100 @@ void vm_object_remove_range(vm_object_t *object, off_t offset, size_t length) {
   SCOPED_MTX_LOCK(&object->mtx);
 
   vm_page_t *pg, *next;
-  TAILQ_FOREACH_SAFE (pg, &object->list, obj.list, next) {
-    if (pg->offset >= (off_t)(offset + length))
+  for (pg = vm_object_page_from(object, offset); pg; pg = next) {
+    if (vm_page_offset(pg) >= (off_t)(offset + length))
       break;
-    if (pg->offset >= offset)
-      vm_object_remove_page_nolock(object, pg);
+    next = vm_object_next_page(object, pg);
+    vm_object_remove_page_nolock(object, pg);
   }
+
+  ksm_remove(object, offset, length);
+  zstore_remove(object, offset, length);
+  swap_remove(object, offset, length);
+}
+
+/* Contents of pages in the range are no longer needed, but the pages are
+ * reclaimed lazily: they're marked clean, so pagedaemon drops them instead of
+ * writing them back, unless they get modified again in the meantime. */
+void vm_object_free_range(vm_object_t *obj, off_t offset, size_t length) {
+  SCOPED_MTX_LOCK(&obj->mtx);
+
+  vm_page_t *pg;
+  for (pg = vm_object_page_from(obj, offset); pg;
+       pg = vm_object_next_page(obj, pg)) {
+    if (vm_page_offset(pg) >= (off_t)(offset + length))
+      break;
+    if (pg->flags & PG_WIRED)
+      continue;
+    pmap_clear_modified(pg);
+    pmap_clear_referenced(pg);
+    vm_pageq_deactivate(pg);
+  }
+
+  zstore_remove(obj, offset, length);
+  swap_remove(obj, offset, length);
+}
+
+/* Wiring brings pages of the range that are not resident into memory and
+ * takes all of them off pagedaemon queues. Unwiring reverts the latter. */
+void vm_object_wire_range(vm_object_t *obj, off_t offset, size_t length,
+                          bool wire) {
+  SCOPED_MTX_LOCK(&obj->mtx);
+
+  vm_page_t *next = vm_object_page_from(obj, offset);
+
+  for (off_t off = offset; off < (off_t)(offset + length); off += PAGESIZE) {
+    while (next && vm_page_offset(next) < off)
+      next = vm_object_next_page(obj, next);
+
+    vm_page_t *pg = (next && vm_page_offset(next) == off) ? next : NULL;
+    if (pg == NULL && wire)
+      pg = obj->pager->pgr_fault(obj, off);
+    if (pg == NULL)
+      continue;
+
+    if (wire)
+      vm_page_wire(pg);
+    else
+      vm_page_unwire(pg);
+  }
+}
+
+/* Sets i-th byte of `vec` to 1 if page at `offset + i * PAGESIZE` is resident,
+ * or to 0 otherwise. */
+void vm_object_mincore(vm_object_t *obj, off_t offset, size_t length,
+                       char *vec) {
+  SCOPED_MTX_LOCK(&obj->mtx);
+
+  memset(vec, 0, length / PAGESIZE);
+
+  vm_page_t *pg;
+  for (pg = vm_object_page_from(obj, offset); pg;
+       pg = vm_object_next_page(obj, pg)) {
+    if (vm_page_offset(pg) >= (off_t)(offset + length))
+      break;
+    vec[(vm_page_offset(pg) - offset) / PAGESIZE] = 1;
+  }
+
+  /* Shared pages are resident as well. */
+  for (size_t i = 0; i < length / PAGESIZE && obj->nmerged > 0; i++)
+    if (!vec[i] && ksm_lookup(obj, offset + i * PAGESIZE))
+      vec[i] = 1;
 }
 
 void vm_object_free(vm_object_t *obj) {
   if (!refcnt_release(&obj->ref_counter))
     return;
 
+  ksm_unregister(obj);
+
   WITH_MTX_LOCK (&obj->mtx) {
-    vm_page_t *pg, *next;
-    TAILQ_FOREACH_SAFE (pg, &obj->list, obj.list, next)
+    vm_page_t *pg;
+    while ((pg = SPLAY_ROOT(&obj->pages)))
       vm_object_remove_page_nolock(obj, pg);
+    ksm_remove(obj, 0, SIZE_MAX);
+    zstore_remove(obj, 0, SIZE_MAX);
+    swap_remove(obj, 0, SIZE_MAX);
   }
 
   pool_free(P_VMOBJ, obj);
@@ -100,14 +215,28 @@ vm_object_t *vm_object_clone(vm_object_t *obj) {
   new_obj->pager = obj->pager;
 
   WITH_MTX_LOCK (&obj->mtx) {
+    /* For simplicity the copy is made of resident pages only. */
+    zstore_get_all(obj);
+    swap_pagein_all(obj);
+
     vm_page_t *pg;
-    TAILQ_FOREACH (pg, &obj->list, obj.list) {
-      vm_page_t *new_pg = vm_page_alloc(1);
+    SPLAY_FOREACH (pg, vm_pagetree, &obj->pages) {
+      vm_page_t *new_pg;
+      while (!(new_pg = vm_page_alloc(1)))
+        vm_wait();
       pmap_copy_page(pg, new_pg);
-      vm_object_add_page(new_obj, pg->offset, new_pg);
+      /* Copy of a dirty page must not be reclaimed as if it was clean. */
+      if (pmap_is_modified(pg))
+        pmap_set_modified(new_pg);
+      vm_object_add_page(new_obj, vm_page_offset(pg), new_pg);
     }
+
+    /* Merged pages are not copied, the clone shares them as well. */
+    ksm_clone(obj, new_obj);
   }
 
+  /* Scanner must not see the object before it's complete. */
+  ksm_register(new_obj);
   return new_obj;
 }
 
@@ -115,7 +244,7 @@ void vm_map_object_dump(vm_object_t *obj) {
   SCOPED_MTX_LOCK(&obj->mtx);
 
   vm_page_t *pg;
-  TAILQ_FOREACH (pg, &obj->list, obj.list) {
-    klog("(vm-obj) offset: 0x%08lx, size: %ld", pg->offset, pg->size);
+  SPLAY_FOREACH (pg, vm_pagetree, &obj->pages) {
+    klog("(vm-obj) offset: 0x%08lx, size: %ld", vm_page_offset(pg), pg->size);
   }
 }
@@ -0,0 +1,327 @@
+#define KL_LOG KL_VM
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/condvar.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/pool.h>
+#include <sys/sched.h>
+#include <sys/spinlock.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
+#include <sys/vm_physmem.h>
+
+/* Pagedaemon is woken up when the number of free pages drops below
+ * 1/PAGEOUT_MIN_DIV of all pages and tries to free pages until there's
+ * 1/PAGEOUT_TARGET_DIV of all pages available. */
+#define PAGEOUT_MIN_DIV 64
+#define PAGEOUT_TARGET_DIV 32
+
+/* If a pass did not bring enough free memory, wait that long before the
+ * next one, so pagedaemon doesn't spin if nothing can be reclaimed. */
+#define PAGEOUT_BACKOFF (CLK_TCK / 10)
+
+/* Lock order: vm_object::mtx -> pageq_lock -> pv lock -> pmap::mtx.
+ * Pagedaemon reaches objects from page queues, so it uses mtx_trylock. */
+static mtx_t *pageq_lock = &MTX_INITIALIZER(0);
+static vm_pagelist_t pageq[PQ_COUNT];
+static size_t pageq_count[PQ_COUNT];
+
+static spin_t pageout_lock = SPIN_INITIALIZER(0);
+static condvar_t pageout_cv; /* pagedaemon waits here for work */
+static condvar_t vm_free_cv; /* threads in vm_wait wait here */
+static bool pageout_wanted;  /* someone requested a pass */
+static thread_t *pageout_td; /* pagedaemon thread */
+static size_t pageout_free_min;
+static size_t pageout_free_target;
+
+static void pageq_move(vm_page_t *pg, vm_pagequeue_t q) {
+  assert(mtx_owned(pageq_lock));
+
+  if (pg->queue != PQ_NONE) {
+    TAILQ_REMOVE(&pageq[pg->queue], pg, pageout);
+    pageq_count[pg->queue]--;
+  }
+
+  pg->queue = q;
+
+  if (q != PQ_NONE) {
+    TAILQ_INSERT_TAIL(&pageq[q], pg, pageout);
+    pageq_count[q]++;
+  }
+}
+
+void vm_pageq_insert(vm_page_t *pg) {
+  assert(mtx_owned(&pg->object->mtx));
+  SCOPED_MTX_LOCK(pageq_lock);
+  pageq_move(pg, PQ_ACTIVE);
+}
+
+void vm_pageq_remove(vm_page_t *pg) {
+  SCOPED_MTX_LOCK(pageq_lock);
+  pageq_move(pg, PQ_NONE);
+}
+
+void vm_pageq_deactivate(vm_page_t *pg) {
+  assert(mtx_owned(&pg->object->mtx));
+  SCOPED_MTX_LOCK(pageq_lock);
+  if (pg->queue != PQ_NONE)
+    pageq_move(pg, PQ_INACTIVE);
+}
+
+void vm_page_wire(vm_page_t *pg) {
+  vm_object_t *obj = pg->object;
+  assert(mtx_owned(&obj->mtx));
+
+  if (pg->flags & PG_WIRED)
+    return;
+
+  pg->flags |= PG_WIRED;
+  obj->nwired++;
+
+  SCOPED_MTX_LOCK(pageq_lock);
+  pageq_move(pg, PQ_NONE);
+}
+
+void vm_page_unwire(vm_page_t *pg) {
+  vm_object_t *obj = pg->object;
+  assert(mtx_owned(&obj->mtx));
+
+  if (!(pg->flags & PG_WIRED))
+    return;
+
+  pg->flags &= ~PG_WIRED;
+  obj->nwired--;
+
+  SCOPED_MTX_LOCK(pageq_lock);
+  pageq_move(pg, PQ_ACTIVE);
+}
+
+/* Moves pages that were not referenced since previous pass from active to
+ * inactive queue, until there are at least `target` inactive pages. */
+static void vm_pageout_deactivate(size_t target) {
+  SCOPED_MTX_LOCK(pageq_lock);
+
+  for (size_t n = pageq_count[PQ_ACTIVE];
+       n > 0 && pageq_count[PQ_INACTIVE] < target; n--) {
+    vm_page_t *pg = TAILQ_FIRST(&pageq[PQ_ACTIVE]);
+    /* Clearing the bit makes next access visible to us. */
+    pageq_move(pg, pmap_clear_referenced(pg) ? PQ_ACTIVE : PQ_INACTIVE);
+  }
+}
+
+/* Frees clean pages from inactive queue. Anonymous pages which have never
+ * been modified hold only zeros, so their contents will be recreated by the
+ * pager on the next page fault. */
+static size_t vm_pageout_inactive(size_t target) {
+  size_t freed = 0;
+
+  mtx_lock(pageq_lock);
+
+  for (size_t n = pageq_count[PQ_INACTIVE]; n > 0 && freed < target; n--) {
+    vm_page_t *pg = TAILQ_FIRST(&pageq[PQ_INACTIVE]);
+    vm_object_t *obj = pg->object;
+
+    /* Holding the object's lock guarantees the page won't be freed. */
+    if (!mtx_trylock(&obj->mtx)) {
+      pageq_move(pg, PQ_INACTIVE);
+      continue;
+    }
+
+    if (pmap_is_referenced(pg)) {
+      pageq_move(pg, PQ_ACTIVE);
+      mtx_unlock(&obj->mtx);
+      continue;
+    }
+
+    pageq_move(pg, PQ_NONE);
+    mtx_unlock(pageq_lock);
+
+    /* Check modified bit after all mappings are gone, so that it cannot be
+     * set behind our back. */
+    pmap_page_remove(pg);
+
+    if (pmap_is_modified(pg)) {
+      WITH_MTX_LOCK (pageq_lock)
+        pageq_move(pg, PQ_LAUNDRY);
+    } else {
+      vm_object_remove_page_nolock(obj, pg);
+      freed++;
+    }
+
+    mtx_unlock(&obj->mtx);
+    mtx_lock(pageq_lock);
+  }
+
+  mtx_unlock(pageq_lock);
+
+  return freed;
+}
+
+/* Pages are gathered from laundry queue only if they're close to the head,
+ * so that clustering does not make a pass quadratic in queue length. */
+#define LAUNDRY_LOOKAHEAD (4 * VM_PAGEOUT_CLUSTER)
+
+/* Takes from laundry queue up to VM_PAGEOUT_CLUSTER pages that belong to the
+ * same object as `pg` does and were not referenced recently. */
+static int vm_pageout_gather(vm_page_t *pg, vm_page_t **cluster) {
+  vm_object_t *obj = pg->object;
+  vm_page_t *next;
+  int npgs = 0;
+
+  for (int i = 0; pg && i < LAUNDRY_LOOKAHEAD && npgs < VM_PAGEOUT_CLUSTER;
+       pg = next, i++) {
+    next = TAILQ_NEXT(pg, pageout);
+    if (pg->object == obj && !pmap_is_referenced(pg)) {
+      pageq_move(pg, PQ_NONE);
+      cluster[npgs++] = pg;
+    }
+  }
+
+  return npgs;
+}
+
+/* Writes modified pages back to pager's backing store and frees them.
+ * Pages that cannot be paged out are kept on laundry queue until they're used
+ * again. Pager may save only some pages of a cluster (e.g. those that
+ * compress well), so a failure does not end the pass. */
+static size_t vm_pageout_laundry(size_t target) {
+  vm_page_t *cluster[VM_PAGEOUT_CLUSTER];
+  size_t freed = 0;
+
+  mtx_lock(pageq_lock);
+
+  for (size_t n = pageq_count[PQ_LAUNDRY]; n > 0 && freed < target; n--) {
+    vm_page_t *pg = TAILQ_FIRST(&pageq[PQ_LAUNDRY]);
+    if (pg == NULL)
+      break;
+
+    vm_object_t *obj = pg->object;
+
+    if (pmap_is_referenced(pg)) {
+      pageq_move(pg, PQ_ACTIVE);
+      continue;
+    }
+
+    if (!obj->pager->pgr_pageout || !mtx_trylock(&obj->mtx)) {
+      pageq_move(pg, PQ_LAUNDRY);
+      continue;
+    }
+
+    int npgs = vm_pageout_gather(pg, cluster);
+    mtx_unlock(pageq_lock);
+
+    /* Pages could have been mapped again after they were put on laundry. */
+    for (int i = 0; i < npgs; i++)
+      pmap_page_remove(cluster[i]);
+
+    int nsaved = obj->pager->pgr_pageout(obj, cluster, npgs);
+
+    for (int i = 0; i < nsaved; i++)
+      vm_object_remove_page_nolock(obj, cluster[i]);
+    freed += nsaved;
+
+    if (nsaved < npgs) {
+      WITH_MTX_LOCK (pageq_lock) {
+        for (int i = nsaved; i < npgs; i++)
+          pageq_move(cluster[i], PQ_LAUNDRY);
+      }
+    }
+
+    mtx_unlock(&obj->mtx);
+    mtx_lock(pageq_lock);
+  }
+
+  mtx_unlock(pageq_lock);
+
+  return freed;
+}
+
+size_t vm_pageout_scan(size_t target) {
+  /* Cached kernel objects are cheapest to give back. */
+  kmalloc_reclaim();
+  size_t bytes = pool_reclaim();
+
+  vm_pageout_deactivate(target);
+  size_t freed = vm_pageout_inactive(target);
+  if (freed < target)
+    freed += vm_pageout_laundry(target - freed);
+
+  klog("pagedaemon: reclaimed %ld pool bytes and %ld pages", bytes, freed);
+
+  return freed + bytes / PAGESIZE;
+}
+
+static size_t vm_page_shortage(void) {
+  size_t nfree = vm_page_nfree();
+  return nfree < pageout_free_target ? pageout_free_target - nfree : 0;
+}
+
+static void vm_pageout_thread(void *arg) {
+  for (;;) {
+    WITH_SPIN_LOCK (&pageout_lock) {
+      while (!pageout_wanted && vm_page_nfree() >= pageout_free_min)
+        cv_wait(&pageout_cv, &pageout_lock);
+    }
+
+    size_t shortage = vm_page_shortage();
+    size_t freed = vm_pageout_scan(max(shortage, (size_t)1));
+
+    WITH_SPIN_LOCK (&pageout_lock) {
+      pageout_wanted = false;
+      cv_broadcast(&vm_free_cv);
+      if (freed < shortage)
+        cv_wait_timed(&pageout_cv, &pageout_lock, PAGEOUT_BACKOFF);
+    }
+  }
+}
+
+bool vm_pageout_thread_p(void) {
+  return pageout_td != NULL && thread_self() == pageout_td;
+}
+
+void vm_pageout_check(void) {
+  if (pageout_td == NULL || pageout_wanted)
+    return;
+
+  if (vm_page_nfree() >= pageout_free_min)
+    return;
+
+  WITH_SPIN_LOCK (&pageout_lock) {
+    pageout_wanted = true;
+    cv_signal(&pageout_cv);
+  }
+}
+
+void vm_wait(void) {
+  klog("thread %ld waits for free memory", thread_self()->td_tid);
+
+  WITH_SPIN_LOCK (&pageout_lock) {
+    if (vm_pageout_thread_p()) {
+      cv_wait_timed(&vm_free_cv, &pageout_lock, PAGEOUT_BACKOFF);
+    } else {
+      pageout_wanted = true;
+      cv_signal(&pageout_cv);
+      cv_wait(&vm_free_cv, &pageout_lock);
+    }
+  }
+}
+
+void init_vm_pageout(void) {
+  for (int i = 0; i < PQ_COUNT; i++)
+    TAILQ_INIT(&pageq[i]);
+
+  cv_init(&pageout_cv, "pageout");
+  cv_init(&vm_free_cv, "vm_free");
+
+  size_t ntotal = vm_page_ntotal();
+  pageout_free_min = ntotal / PAGEOUT_MIN_DIV;
+  pageout_free_target = ntotal / PAGEOUT_TARGET_DIV;
+
+  pageout_td =
+    thread_create("pagedaemon", vm_pageout_thread, NULL, prio_kthread(0));
+  sched_add(pageout_td);
+}
@@ -1,8 +1,13 @@
 #include <sys/mimiker.h>
+#include <sys/errno.h>
 #include <sys/pmap.h>
+#include <sys/vm_ksm.h>
 #include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_pager.h>
 #include <sys/vm_physmem.h>
+#include <sys/vm_swap.h>
+#include <sys/vm_zstore.h>
 
 static vm_page_t *dummy_pager_fault(vm_object_t *obj, off_t offset) {
   return NULL;
@@ -11,13 +16,47 @@ static vm_page_t *dummy_pager_fault(vm_object_t *obj, off_t offset) {
 static vm_page_t *anon_pager_fault(vm_object_t *obj, off_t offset) {
   assert(obj != NULL);
 
-  vm_page_t *new_pg = vm_page_alloc(1);
-  pmap_zero_page(new_pg);
+  assert(mtx_owned(&obj->mtx));
+
+  /* Page is filled with zeros unless it has been merged with identical pages
+   * or paged out before. */
+  vm_page_t *new_pg;
+  while (!(new_pg = vm_page_alloc_flags(1, M_ZERO)))
+    vm_wait();
+  if (!ksm_get(obj, offset, new_pg) && !zstore_get(obj, offset, new_pg)) {
+    int error = swap_pagein(obj, offset, new_pg);
+    /* Contents are lost for now, so the page must not be made up. */
+    if (error && error != ENOENT) {
+      vm_page_free(new_pg);
+      return NULL;
+    }
+  }
   vm_object_add_page(obj, offset, new_pg);
   return new_pg;
 }
 
+/* Pages that compress well are kept in memory, the rest goes to swap. */
+static int anon_pager_pageout(vm_object_t *obj, vm_page_t **pgs, int npgs) {
+  assert(mtx_owned(&obj->mtx));
+
+  int nsaved = 0;
+
+  for (int i = 0; i < npgs; i++) {
+    vm_page_t *pg = pgs[i];
+    if (zstore_put(obj, pg)) {
+      pgs[i] = pgs[nsaved];
+      pgs[nsaved++] = pg;
+    }
+  }
+
+  if (nsaved < npgs && !swap_pageout(obj, pgs + nsaved, npgs - nsaved))
+    nsaved = npgs;
+
+  return nsaved;
+}
+
 vm_pager_t pagers[] = {
   [VM_DUMMY] = {.pgr_fault = dummy_pager_fault},
-  [VM_ANONYMOUS] = {.pgr_fault = anon_pager_fault},
+  [VM_ANONYMOUS] = {.pgr_fault = anon_pager_fault,
+                    .pgr_pageout = anon_pager_pageout},
 };
@@ -2,19 +2,43 @@
 #include <sys/klog.h>
 #include <sys/mimiker.h>
 #include <sys/libkern.h>
+#include <sys/condvar.h>
 #include <sys/mutex.h>
 #include <sys/pmap.h>
+#include <sys/pcpu.h>
+#include <sys/sched.h>
+#include <sys/spinlock.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
+#include <sys/vmstat.h>
 
 #define FREELIST(page) (&freelist[log2((page)->size)])
 #define PAGECOUNT(page) (pagecount[log2((page)->size)])
 
 #define PG_SIZE(pg) ((pg)->size * PAGESIZE)
-#define PG_START(pg) ((pg)->paddr)
-#define PG_END(pg) ((pg)->paddr + PG_SIZE(pg))
+#define PG_START(pg) vm_page_paddr(pg)
+#define PG_END(pg) (vm_page_paddr(pg) + PG_SIZE(pg))
 
 #define PM_NQUEUES 16U
 
+/* Per-CPU caches of single pages grow up to PM_CACHE_MAX pages, and are
+ * refilled and drained by PM_CACHE_BATCH pages under the physmem lock. */
+#define PM_CACHE_MAX 64
+#define PM_CACHE_BATCH 16
+
+/* Maximum number of pages zeroed in advance by each CPU. */
+#define PM_ZERO_MAX 32
+
+/* How often the prezero thread checks if idle thread has pages to zero. */
+#define PM_ZERO_PERIOD (CLK_TCK / 10)
+
+/* 1/PM_RESERVE_DIV of all pages may be taken only by pagedaemon and by
+ * allocations that cannot sleep, so that pagedaemon can make progress when
+ * memory runs out. */
+#define PM_RESERVE_DIV 128
+
 typedef struct vm_physseg {
   TAILQ_ENTRY(vm_physseg) seglink;
   paddr_t start;
@@ -24,22 +48,44 @@ typedef struct vm_physseg {
   vm_page_t *pages;
 } vm_physseg_t;
 
+/* Cached pages are allocated from the buddy system's point of view, thus
+ * they won't be merged with their buddies. */
+typedef struct vm_pcache {
+  vm_pagelist_t pages;  /* free single pages */
+  unsigned count;       /* number of pages on the list */
+  vm_pagelist_t zpages; /* free single pages filled with zeros */
+  unsigned zcount;      /* number of pages on the list */
+} vm_pcache_t;
+
 static TAILQ_HEAD(, vm_physseg) seglist = TAILQ_HEAD_INITIALIZER(seglist);
+static vm_physseg_t physseg[VM_PHYSSEG_NMAX];
+/* Segments with vm_page structures sorted by address. They don't change after
+ * init_vm_page, so they're searched without locks. */
+static vm_physseg_t *pageseg[VM_PHYSSEG_NMAX];
+static unsigned pageseg_count;
 static vm_pagelist_t freelist[PM_NQUEUES];
 static size_t pagecount[PM_NQUEUES];
+static size_t pm_nfree;  /* (P) number of pages in buddy system */
+static size_t pm_ntotal; /* number of pages available for allocation */
+static size_t pm_nreserved; /* number of free pages kept in reserve */
+static vm_pcache_t pcache[MAXCPU];
 static mtx_t *physmem_lock = &MTX_INITIALIZER(LK_RECURSIVE);
+static spin_t prezero_lock = SPIN_INITIALIZER(0);
+static condvar_t prezero_cv;
+
+paddr_t vm_physseg_start[VM_PHYSSEG_NMAX];
+vm_page_t *vm_physseg_pages[VM_PHYSSEG_NMAX];
 
 void _vm_physseg_plug(paddr_t start, paddr_t end, bool used) {
   assert(page_aligned_p(start) && page_aligned_p(end) && start < end);
 
-  static vm_physseg_t freeseg[VM_PHYSSEG_NMAX];
-  static unsigned freeseg_last = 0;
+  static unsigned physseg_last = 0;
 
   SCOPED_MTX_LOCK(physmem_lock);
 
-  assert(freeseg_last < VM_PHYSSEG_NMAX - 1);
+  assert(physseg_last < VM_PHYSSEG_NMAX - 1);
 
-  vm_physseg_t *seg = &freeseg[freeseg_last++];
+  vm_physseg_t *seg = &physseg[physseg_last++];
 
   seg->start = start;
   seg->end = end;
@@ -91,6 +137,10 @@ void init_vm_page(void) {
 
   for (unsigned i = 0; i < PM_NQUEUES; i++)
     TAILQ_INIT(&freelist[i]);
+  for (unsigned i = 0; i < MAXCPU; i++) {
+    TAILQ_INIT(&pcache[i].pages);
+    TAILQ_INIT(&pcache[i].zpages);
+  }
 
   /* Allocate contiguous array of vm_page_t to cover all physical memory. */
   size_t npages = 0;
@@ -105,13 +155,15 @@ void init_vm_page(void) {
     for (unsigned i = 0; i < seg->npages; i++) {
       vm_page_t *page = &pages[i];
       paddr_t pa = seg->start + i * PAGESIZE;
-      unsigned size = 1 << min(PM_NQUEUES - 1, ctz(pa / PAGESIZE));
+      /* Address 0 is aligned to any block size, but ctz(0) is undefined. */
+      unsigned order = pa ? ctz(pa / PAGESIZE) : PM_NQUEUES - 1;
+      unsigned size = 1 << min(PM_NQUEUES - 1, order);
       if (pa + size * PAGESIZE > seg->end)
         size = 1 << min(PM_NQUEUES - 1, log2((seg->end ^ pa) / PAGESIZE));
-      page->paddr = pa;
       page->size = size;
       page->flags = seg->used ? PG_ALLOCATED : 0;
-      TAILQ_INIT(&page->pv_list);
+      page->segidx = seg - physseg;
+      SLIST_INIT(&page->pv_list);
     }
 
     /* Insert pages into free lists of corresponding size. */
@@ -121,14 +173,25 @@ void init_vm_page(void) {
         TAILQ_INSERT_TAIL(FREELIST(page), page, freeq);
         PAGECOUNT(page)++;
         page->flags |= PG_MANAGED;
+        pm_nfree += page->size;
         i += page->size;
       }
+      pm_ntotal += seg->npages;
     }
 
     seg->pages = pages;
+    vm_physseg_start[seg - physseg] = seg->start;
+    vm_physseg_pages[seg - physseg] = pages;
     pages += seg->npages;
+
+    unsigned i = pageseg_count++;
+    for (; i > 0 && pageseg[i - 1]->start > seg->start; i--)
+      pageseg[i] = pageseg[i - 1];
+    pageseg[i] = seg;
   }
 
+  pm_nreserved = pm_ntotal / PM_RESERVE_DIV;
+
   vm_boot_finish();
 }
 
@@ -151,8 +214,9 @@ static vm_page_t *pm_find_buddy(vm_physseg_t *seg, vm_page_t *pg) {
   assert(powerof2(pg->size));
 
   /* When page address is divisible by (2 * size) then:
-   * look at left buddy, otherwise look at right buddy */
-  if ((pg - seg->pages) % (2 * pg->size) == 0)
+   * look at left buddy, otherwise look at right buddy.
+   * Physical address is used, so that blocks are naturally aligned. */
+  if ((PG_START(pg) / PAGESIZE) % (2 * pg->size) == 0)
     buddy += pg->size;
   else
     buddy -= pg->size;
@@ -194,10 +258,8 @@ static void pm_split_page(vm_page_t *page) {
   buddy->flags |= PG_MANAGED;
 }
 
-vm_page_t *vm_page_alloc(size_t npages) {
-  assert((npages > 0) && powerof2(npages));
-
-  SCOPED_MTX_LOCK(physmem_lock);
+static vm_page_t *pm_alloc(size_t npages) {
+  assert(mtx_owned(physmem_lock));
 
   size_t n = log2(npages);
   size_t i = n;
@@ -213,9 +275,10 @@ vm_page_t *vm_page_alloc(size_t npages) {
     pm_split_page(TAILQ_FIRST(&freelist[i]));
 
   vm_page_t *page = TAILQ_FIRST(&freelist[i]);
-  klog("%s: allocated %lx of size %ld", __func__, page->paddr, page->size);
+  klog("%s: allocated %lx of size %ld", __func__, PG_START(page), page->size);
   TAILQ_REMOVE(&freelist[i], page, freeq);
   pagecount[i]--;
+  pm_nfree -= page->size;
   page->flags &= ~PG_MANAGED;
   for (unsigned j = 0; j < page->size; j++)
     page[j].flags |= PG_ALLOCATED;
@@ -223,10 +286,181 @@ vm_page_t *vm_page_alloc(size_t npages) {
   return page;
 }
 
-static void pm_free_from_seg(vm_physseg_t *seg, vm_page_t *page) {
-  if (!(page->flags & PG_ALLOCATED))
-    panic("page is already free: %p", (void *)page->paddr);
+/* Refills per-CPU cache and returns one of the pages. */
+static vm_page_t *pm_cache_refill(void) {
+  vm_pagelist_t batch = TAILQ_HEAD_INITIALIZER(batch);
+  vm_page_t *page;
+
+  WITH_MTX_LOCK (physmem_lock) {
+    for (int i = 0; i < PM_CACHE_BATCH; i++) {
+      if (!(page = pm_alloc(1)))
+        break;
+      TAILQ_INSERT_TAIL(&batch, page, freeq);
+    }
+  }
+
+  vm_page_t *first = TAILQ_FIRST(&batch);
+  if (first == NULL)
+    return NULL;
+  TAILQ_REMOVE(&batch, first, freeq);
+
+  WITH_NO_PREEMPTION {
+    vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+    while ((page = TAILQ_FIRST(&batch))) {
+      TAILQ_REMOVE(&batch, page, freeq);
+      TAILQ_INSERT_HEAD(&pc->pages, page, freeq);
+      pc->count++;
+    }
+  }
+
+  return first;
+}
+
+/* Takes a page from per-CPU list of free or pre-zeroed pages. */
+static vm_page_t *pm_cache_get(bool zeroed) {
+  vm_page_t *page;
+
+  SCOPED_NO_PREEMPTION();
+
+  vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+  if (zeroed) {
+    if ((page = TAILQ_FIRST(&pc->zpages))) {
+      TAILQ_REMOVE(&pc->zpages, page, freeq);
+      pc->zcount--;
+    }
+  } else {
+    if ((page = TAILQ_FIRST(&pc->pages))) {
+      TAILQ_REMOVE(&pc->pages, page, freeq);
+      pc->count--;
+    }
+  }
+  return page;
+}
+
+static vm_page_t *pm_alloc_single(kmem_flags_t flags) {
+  vm_page_t *page;
+
+  if (flags & M_ZERO) {
+    if ((page = pm_cache_get(true))) {
+      VMCNT_ADD(prezero_hits, 1);
+      return page;
+    }
+    if ((page = pm_cache_get(false)) || (page = pm_cache_refill()))
+      pmap_zero_page(page);
+    return page;
+  }
+
+  if ((page = pm_cache_get(false)) || (page = pm_cache_refill()))
+    return page;
+
+  /* Pre-zeroed pages are the last resort. */
+  return pm_cache_get(true);
+}
+
+static size_t pm_cache_drain(void);
+
+vm_page_t *vm_page_alloc_flags(size_t npages, kmem_flags_t flags) {
+  assert((npages > 0) && powerof2(npages));
+
+  vm_pageout_check();
+
+  if (!(flags & M_NOWAIT) && !vm_pageout_thread_p() &&
+      vm_page_nfree() < pm_nreserved + npages)
+    return NULL;
+
+  if (npages == 1)
+    return pm_alloc_single(flags);
+
+  vm_page_t *page;
+
+  WITH_MTX_LOCK (physmem_lock) {
+    /* Cached single pages may be the buddies needed to form the block. */
+    if (!(page = pm_alloc(npages)) && pm_cache_drain() > 0)
+      page = pm_alloc(npages);
+  }
+
+  if (page && (flags & M_ZERO))
+    for (size_t i = 0; i < npages; i++)
+      pmap_zero_page(&page[i]);
+
+  return page;
+}
+
+vm_page_t *vm_page_alloc(size_t npages) {
+  return vm_page_alloc_flags(npages, 0);
+}
+
+void vm_page_split(vm_page_t *page) {
+  assert(page->flags & PG_ALLOCATED);
+
+  for (unsigned i = 0, n = page->size; i < n; i++)
+    page[i].size = 1;
+}
+
+bool vm_page_prezero(void) {
+  vm_page_t *page = NULL;
+  bool full;
+
+  WITH_NO_PREEMPTION {
+    vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+    full = pc->zcount >= PM_ZERO_MAX;
+    if (!full && (page = TAILQ_FIRST(&pc->pages))) {
+      TAILQ_REMOVE(&pc->pages, page, freeq);
+      pc->count--;
+    }
+  }
+
+  /* Idle thread must never own a sleep lock, so it doesn't reach for the
+   * buddy system. Cache is refilled by prezero thread instead. */
+  if (full || page == NULL)
+    return false;
+
+  pmap_zero_page(page);
+  VMCNT_ADD(prezeroed, 1);
+
+  WITH_NO_PREEMPTION {
+    vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+    TAILQ_INSERT_HEAD(&pc->zpages, page, freeq);
+    pc->zcount++;
+  }
+
+  return true;
+}
 
+/* Runs at the lowest priority, so it takes physmem lock only when no other
+ * thread needs the CPU, and leaves freshly refilled cache to idle thread. */
+static void vm_prezero_thread(void *arg) {
+  for (;;) {
+    bool empty;
+
+    WITH_NO_PREEMPTION {
+      vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+      empty = pc->count == 0 && pc->zcount < PM_ZERO_MAX;
+    }
+
+    vm_page_t *page;
+    if (empty && (page = pm_cache_refill())) {
+      WITH_NO_PREEMPTION {
+        vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+        TAILQ_INSERT_HEAD(&pc->pages, page, freeq);
+        pc->count++;
+      }
+    }
+
+    WITH_SPIN_LOCK (&prezero_lock)
+      cv_wait_timed(&prezero_cv, &prezero_lock, PM_ZERO_PERIOD);
+  }
+}
+
+void init_vm_prezero(void) {
+  cv_init(&prezero_cv, "prezero");
+
+  thread_t *td = thread_create("prezero", vm_prezero_thread, NULL,
+                               prio_uthread(PRIO_QTY - 1));
+  sched_add(td);
+}
+
+static void pm_free_from_seg(vm_physseg_t *seg, vm_page_t *page) {
   vm_page_t *buddy;
   while ((buddy = pm_find_buddy(seg, page))) {
     TAILQ_REMOVE(FREELIST(buddy), buddy, freeq);
@@ -238,39 +472,110 @@ static void pm_free_from_seg(vm_physseg_t *seg, vm_page_t *page) {
   TAILQ_INSERT_HEAD(FREELIST(page), page, freeq);
   PAGECOUNT(page)++;
   page->flags |= PG_MANAGED;
-  for (unsigned i = 0; i < page->size; i++) {
-    pmap_page_remove(&page[i]);
+  for (unsigned i = 0; i < page->size; i++)
     page[i].flags &= ~PG_ALLOCATED;
-    page[i].flags &= ~(PG_REFERENCED | PG_MODIFIED);
+}
+
+static void pm_free(vm_page_t *page) {
+  assert(mtx_owned(physmem_lock));
+
+  klog("%s: free %lx of size %ld", __func__, PG_START(page), page->size);
+
+  vm_physseg_t *seg = &physseg[page->segidx];
+  assert(PG_START(page) >= seg->start && PG_END(page) <= seg->end);
+  pm_nfree += page->size;
+  pm_free_from_seg(seg, page);
+}
+
+/* Returns pages cached by current CPU to the buddy system, so that they can be
+ * merged with their buddies. As long as MAXCPU is 1 that's all cached pages.
+ *
+ * \returns number of returned pages */
+static size_t pm_cache_drain(void) {
+  assert(mtx_owned(physmem_lock));
+
+  vm_pagelist_t batch = TAILQ_HEAD_INITIALIZER(batch);
+  size_t n;
+
+  WITH_NO_PREEMPTION {
+    vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+    TAILQ_CONCAT(&batch, &pc->pages, freeq);
+    TAILQ_CONCAT(&batch, &pc->zpages, freeq);
+    n = pc->count + pc->zcount;
+    pc->count = 0;
+    pc->zcount = 0;
   }
+
+  vm_page_t *page, *next;
+  TAILQ_FOREACH_SAFE (page, &batch, freeq, next)
+    pm_free(page);
+
+  return n;
 }
 
 void vm_page_free(vm_page_t *page) {
-  vm_physseg_t *seg_it = NULL;
-
-  SCOPED_MTX_LOCK(physmem_lock);
+  if (!(page->flags & PG_ALLOCATED))
+    panic("page is already free: %p", (void *)PG_START(page));
 
-  klog("%s: free %lx of size %ld", __func__, page->paddr, page->size);
+  /* Page is owned by the caller, so it can be unmapped without physmem
+   * lock. */
+  for (unsigned i = 0; i < page->size; i++) {
+    pmap_page_remove(&page[i]);
+    page[i].flags &= ~(PG_REFERENCED | PG_MODIFIED);
+  }
 
-  TAILQ_FOREACH (seg_it, &seglist, seglink) {
-    if (PG_START(page) >= seg_it->start && PG_END(page) <= seg_it->end) {
-      pm_free_from_seg(seg_it, page);
-      return;
+  if (page->size == 1) {
+    vm_pagelist_t batch = TAILQ_HEAD_INITIALIZER(batch);
+
+    WITH_NO_PREEMPTION {
+      vm_pcache_t *pc = &pcache[PCPU_GET(cpuid)];
+      TAILQ_INSERT_HEAD(&pc->pages, page, freeq);
+      if (++pc->count <= PM_CACHE_MAX)
+        return;
+      /* Cache is full - return least recently freed pages. */
+      for (int i = 0; i < PM_CACHE_BATCH; i++) {
+        vm_page_t *last = TAILQ_LAST(&pc->pages, vm_pagelist);
+        TAILQ_REMOVE(&pc->pages, last, freeq);
+        TAILQ_INSERT_TAIL(&batch, last, freeq);
+      }
+      pc->count -= PM_CACHE_BATCH;
     }
+
+    SCOPED_MTX_LOCK(physmem_lock);
+    vm_page_t *next;
+    TAILQ_FOREACH_SAFE (page, &batch, freeq, next)
+      pm_free(page);
+    return;
   }
 
-  panic("page out of range: %p", (void *)page->paddr);
+  SCOPED_MTX_LOCK(physmem_lock);
+  pm_free(page);
 }
 
-vm_page_t *vm_page_find(paddr_t pa) {
-  SCOPED_MTX_LOCK(physmem_lock);
+size_t vm_page_nfree(void) {
+  size_t nfree = pm_nfree;
+  /* Counters are read without locks, so the result is an estimate. */
+  for (unsigned i = 0; i < MAXCPU; i++)
+    nfree += pcache[i].count + pcache[i].zcount;
+  return nfree;
+}
 
-  vm_physseg_t *seg_it;
-  TAILQ_FOREACH (seg_it, &seglist, seglink) {
-    if (seg_it->start <= pa && pa < seg_it->end) {
-      intptr_t index = (pa - seg_it->start) / PAGESIZE;
-      return &seg_it->pages[index];
-    }
+size_t vm_page_ntotal(void) {
+  return pm_ntotal;
+}
+
+vm_page_t *vm_page_find(paddr_t pa) {
+  unsigned lo = 0, hi = pageseg_count;
+
+  while (lo < hi) {
+    unsigned mid = (lo + hi) / 2;
+    vm_physseg_t *seg = pageseg[mid];
+    if (pa < seg->start)
+      hi = mid;
+    else if (pa >= seg->end)
+      lo = mid + 1;
+    else
+      return &seg->pages[(pa - seg->start) / PAGESIZE];
   }
 
   return NULL;
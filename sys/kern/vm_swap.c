@@ -0,0 +1,369 @@
+#define KL_LOG KL_VM
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/fcntl.h>
+#include <sys/file.h>
+#include <sys/kenv.h>
+#include <sys/kmem.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/proc.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#include <sys/vm_map.h>
+#include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
+#include <sys/vm_physmem.h>
+#include <sys/vm_swap.h>
+#include <sys/vnode.h>
+#include <bitstring.h>
+
+/* Used if `swapsize` was not given in kernel environment. */
+#define SWAP_DEFAULT_SIZE (16 * 1024 * 1024)
+
+/* Average length of hash chain. */
+#define SWAP_HASH_LOAD 4
+
+static KMALLOC_DEFINE(M_SWAP, "swap");
+
+/* Field marking and corresponding locks:
+ * (S) swap_lock
+ * (!) set by swap_on, read-only afterwards */
+
+typedef struct swslot {
+  TAILQ_ENTRY(swslot) hash;    /* (S) entry on hash chain */
+  TAILQ_ENTRY(swslot) objlink; /* (S) entry on owner's list of slots */
+  vm_object_t *obj;            /* (S) owner of the slot or NULL if it's free */
+  off_t offset;                /* (S) offset of the page in owner */
+} swslot_t;
+
+typedef TAILQ_HEAD(, swslot) swhashchain_t;
+
+/* Lock order: vm_object::mtx -> swap_lock -> vnode lock. */
+static mtx_t *swap_lock = &MTX_INITIALIZER(0);
+static vnode_t *swap_vp;            /* (!) backing file of swap area */
+static size_t swap_nslots;          /* (!) size of swap area in pages */
+static vaddr_t swap_kva;            /* (S) window used to map pages for I/O */
+static bitstr_t *swap_map;          /* (S) bitmap of used slots */
+static size_t swap_nused;           /* (S) number of used slots */
+static size_t swap_rotor;           /* (S) next fit allocation start */
+static swslot_t *swap_slots;        /* (S) owners of slots */
+static swhashchain_t *swap_hashtbl; /* (S) owner and offset to slot map */
+static size_t swap_hashmask;        /* (!) number of hash chains minus one */
+
+static swhashchain_t *swap_chain(vm_object_t *obj, off_t offset) {
+  uintptr_t h = ((uintptr_t)obj >> 4) ^ (offset / PAGESIZE);
+  return &swap_hashtbl[h & swap_hashmask];
+}
+
+static swslot_t *swap_lookup(vm_object_t *obj, off_t offset) {
+  assert(mtx_owned(swap_lock));
+
+  swslot_t *sw;
+  TAILQ_FOREACH (sw, swap_chain(obj, offset), hash)
+    if (sw->obj == obj && sw->offset == offset)
+      return sw;
+  return NULL;
+}
+
+/* Finds a run of `n` free slots in [from, to) range. */
+static bool swap_find_run(size_t from, size_t to, size_t n, size_t *slotp) {
+  size_t len = 0;
+  for (size_t i = from; i < to; i++) {
+    len = bit_test(swap_map, i) ? 0 : len + 1;
+    if (len == n) {
+      *slotp = i + 1 - n;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool swap_alloc(size_t n, size_t *slotp) {
+  assert(mtx_owned(swap_lock));
+
+  if (swap_nused + n > swap_nslots)
+    return false;
+  if (!swap_find_run(swap_rotor, swap_nslots, n, slotp) &&
+      !swap_find_run(0, swap_nslots, n, slotp))
+    return false;
+
+  bit_nset(swap_map, *slotp, *slotp + n - 1);
+  swap_nused += n;
+  swap_rotor = *slotp + n;
+  return true;
+}
+
+static void swap_assign(size_t slot, vm_object_t *obj, off_t offset) {
+  swslot_t *sw = &swap_slots[slot];
+  sw->obj = obj;
+  sw->offset = offset;
+  TAILQ_INSERT_HEAD(swap_chain(obj, offset), sw, hash);
+  TAILQ_INSERT_TAIL(&obj->swslots, sw, objlink);
+  obj->nswapped++;
+}
+
+static void swap_release(size_t slot) {
+  assert(mtx_owned(swap_lock));
+  assert(bit_test(swap_map, slot));
+
+  swslot_t *sw = &swap_slots[slot];
+  if (sw->obj) {
+    TAILQ_REMOVE(swap_chain(sw->obj, sw->offset), sw, hash);
+    TAILQ_REMOVE(&sw->obj->swslots, sw, objlink);
+    sw->obj->nswapped--;
+    sw->obj = NULL;
+  }
+
+  bit_clear(swap_map, slot);
+  swap_nused--;
+}
+
+/* Transfers contents of pages from or to consecutive slots of swap area.
+ * Pages are temporarily mapped into kernel virtual address space, so that
+ * a cluster of pages is moved by single filesystem request. */
+static int swap_io(uio_op_t op, size_t slot, vm_page_t **pgs, int npgs) {
+  assert(mtx_owned(swap_lock));
+  assert(npgs <= VM_PAGEOUT_CLUSTER);
+
+  size_t size = npgs * PAGESIZE;
+  int error;
+
+  for (int i = 0; i < npgs; i++)
+    pmap_kenter(swap_kva + i * PAGESIZE, vm_page_paddr(pgs[i]),
+                VM_PROT_READ | VM_PROT_WRITE, 0);
+
+  uio_t uio = UIO_SINGLE_KERNEL(op, slot * PAGESIZE, (void *)swap_kva, size);
+
+  vnode_lock(swap_vp);
+  if (op == UIO_READ)
+    error = VOP_READ(swap_vp, &uio, 0);
+  else
+    error = VOP_WRITE(swap_vp, &uio, 0);
+  vnode_unlock(swap_vp);
+
+  pmap_kremove(swap_kva, size);
+
+  if (!error && uio.uio_resid > 0)
+    error = EIO;
+  return error;
+}
+
+/* Releases slots assigned to given pages. */
+static void swap_unassign(vm_object_t *obj, vm_page_t **pgs, int npgs) {
+  for (int i = 0; i < npgs; i++) {
+    swslot_t *sw = swap_lookup(obj, vm_page_offset(pgs[i]));
+    swap_release(sw - swap_slots);
+  }
+}
+
+int swap_pageout(vm_object_t *obj, vm_page_t **pgs, int npgs) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (swap_vp == NULL)
+    return ENODEV;
+
+  SCOPED_MTX_LOCK(swap_lock);
+
+  /* Split the cluster if swap area is too fragmented. */
+  for (int done = 0; done < npgs;) {
+    size_t n = npgs - done, slot;
+    int error = ENOSPC;
+
+    while (n > 0 && !swap_alloc(n, &slot))
+      n /= 2;
+
+    if (n > 0 && (error = swap_io(UIO_WRITE, slot, pgs + done, n))) {
+      klog("swap: failed to write %ld pages at slot %ld", n, slot);
+      for (size_t i = 0; i < n; i++)
+        swap_release(slot + i);
+    }
+
+    if (error) {
+      /* Caller keeps the pages, so forget about those already written. */
+      swap_unassign(obj, pgs, done);
+      return error;
+    }
+
+    for (size_t i = 0; i < n; i++)
+      swap_assign(slot + i, obj, vm_page_offset(pgs[done + i]));
+
+    done += n;
+  }
+
+  return 0;
+}
+
+int swap_pagein(vm_object_t *obj, off_t offset, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nswapped == 0)
+    return ENOENT;
+
+  SCOPED_MTX_LOCK(swap_lock);
+
+  swslot_t *sw = swap_lookup(obj, offset);
+  if (sw == NULL)
+    return ENOENT;
+
+  /* Slot is kept, so that the read may be retried. */
+  size_t slot = sw - swap_slots;
+  int error = swap_io(UIO_READ, slot, &pg, 1);
+  if (error) {
+    klog("swap: failed to read page from slot %ld (error %d)", slot, error);
+    return error;
+  }
+
+  swap_release(slot);
+  pmap_set_modified(pg);
+  return 0;
+}
+
+void swap_pagein_all(vm_object_t *obj) {
+  assert(mtx_owned(&obj->mtx));
+
+  while (obj->nswapped > 0) {
+    off_t offset;
+
+    WITH_MTX_LOCK (swap_lock)
+      offset = TAILQ_FIRST(&obj->swslots)->offset;
+
+    /* Must not hold swap_lock, since pagedaemon may need it. */
+    vm_page_t *pg;
+    while (!(pg = vm_page_alloc(1)))
+      vm_wait();
+
+    int error = swap_pagein(obj, offset, pg);
+    if (error)
+      panic("swap: cannot bring page back to memory (error %d)", error);
+    vm_object_add_page(obj, offset, pg);
+  }
+}
+
+void swap_remove(vm_object_t *obj, off_t offset, size_t length) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->nswapped == 0)
+    return;
+
+  SCOPED_MTX_LOCK(swap_lock);
+
+  /* Range smaller than the number of swapped out pages is looked up page by
+   * page, otherwise the whole list of object's slots is checked. */
+  if (length / PAGESIZE < obj->nswapped) {
+    for (size_t off = 0; off < length; off += PAGESIZE) {
+      swslot_t *sw = swap_lookup(obj, offset + off);
+      if (sw != NULL)
+        swap_release(sw - swap_slots);
+    }
+    return;
+  }
+
+  swslot_t *sw, *next;
+  TAILQ_FOREACH_SAFE (sw, &obj->swslots, objlink, next)
+    if (sw->offset >= offset && (size_t)(sw->offset - offset) < length)
+      swap_release(sw - swap_slots);
+}
+
+size_t swap_nfree(void) {
+  SCOPED_MTX_LOCK(swap_lock);
+  return swap_nslots - swap_nused;
+}
+
+/* Fills whole swap area with zeros, so that filesystem allocates all blocks
+ * in advance. This also populates page tables for the I/O window. */
+static int swap_prealloc(vnode_t *vp, vaddr_t kva, size_t nslots) {
+  vm_page_t *pg;
+  int error = 0;
+
+  while (!(pg = vm_page_alloc_flags(1, M_ZERO)))
+    vm_wait();
+
+  for (int i = 0; i < VM_PAGEOUT_CLUSTER; i++)
+    pmap_kenter(kva + i * PAGESIZE, vm_page_paddr(pg), VM_PROT_READ, 0);
+
+  vnode_lock(vp);
+  for (size_t i = 0; i < nslots && !error; i += VM_PAGEOUT_CLUSTER) {
+    size_t n = min(nslots - i, (size_t)VM_PAGEOUT_CLUSTER);
+    uio_t uio =
+      UIO_SINGLE_KERNEL(UIO_WRITE, i * PAGESIZE, (void *)kva, n * PAGESIZE);
+    error = VOP_WRITE(vp, &uio, 0);
+  }
+  vnode_unlock(vp);
+
+  pmap_kremove(kva, VM_PAGEOUT_CLUSTER * PAGESIZE);
+  vm_page_free(pg);
+  return error;
+}
+
+int swap_on(proc_t *p, char *path, size_t size) {
+  size_t nslots = size / PAGESIZE;
+  vnode_t *vp;
+  int fd, error;
+
+  if (nslots == 0)
+    return EINVAL;
+
+  if (swap_vp != NULL)
+    return EBUSY;
+
+  if ((error = do_open(p, path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR, &fd)))
+    return error;
+  do_close(p, fd);
+
+  if ((error = vfs_namelookup(path, &vp, &p->p_cred)))
+    return error;
+
+  if (vp->v_type != V_REG && vp->v_type != V_DEV) {
+    vnode_drop(vp);
+    return EINVAL;
+  }
+
+  vaddr_t kva = kva_alloc(VM_PAGEOUT_CLUSTER * PAGESIZE);
+  size_t nbuckets = 1L << log2(max(nslots / SWAP_HASH_LOAD, (size_t)1));
+
+  if ((error = swap_prealloc(vp, kva, nslots))) {
+    kva_free(kva, VM_PAGEOUT_CLUSTER * PAGESIZE);
+    vnode_drop(vp);
+    return error;
+  }
+
+  WITH_MTX_LOCK (swap_lock) {
+    if (swap_vp != NULL) {
+      kva_free(kva, VM_PAGEOUT_CLUSTER * PAGESIZE);
+      vnode_drop(vp);
+      return EBUSY;
+    }
+
+    swap_map = kmalloc(M_SWAP, bitstr_size(nslots), M_ZERO);
+    swap_slots = kmalloc(M_SWAP, nslots * sizeof(swslot_t), M_ZERO);
+    swap_hashtbl = kmalloc(M_SWAP, nbuckets * sizeof(swhashchain_t), 0);
+    for (size_t i = 0; i < nbuckets; i++)
+      TAILQ_INIT(&swap_hashtbl[i]);
+    swap_hashmask = nbuckets - 1;
+    swap_kva = kva;
+    swap_nslots = nslots;
+    swap_vp = vp;
+  }
+
+  klog("swap: using '%s' with %ld pages", path, nslots);
+
+  return 0;
+}
+
+void init_vm_swap(void) {
+  char *path = kenv_get("swap");
+  if (path == NULL)
+    return;
+
+  size_t size = kenv_get_ulong("swapsize");
+  if (size == 0)
+    size = SWAP_DEFAULT_SIZE;
+
+  int error = swap_on(&proc0, path, size);
+  if (error)
+    kprintf("[swap] failed to enable swap on '%s' (error %d)\n", path, error);
+}
@@ -0,0 +1,353 @@
+#define KL_LOG KL_VM
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/lz4.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/time.h>
+#include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
+#include <sys/vm_physmem.h>
+#include <sys/vm_zstore.h>
+
+/* Sizes of chunks are multiples of ZCHUNK_ALIGN. */
+#define ZCHUNK_ALIGN 32
+/* Chunks begin after slab header. */
+#define ZSLAB_HDRSIZE roundup(sizeof(zslab_t), ZCHUNK_ALIGN)
+/* At least two chunks must fit into a slab, otherwise there's no gain. */
+#define ZCHUNK_MAX rounddown((PAGESIZE - ZSLAB_HDRSIZE) / 2, ZCHUNK_ALIGN)
+#define ZCLASS_COUNT (ZCHUNK_MAX / ZCHUNK_ALIGN)
+
+/* Store may hold at most 1/ZSTORE_LIMIT_DIV of all physical pages. */
+#define ZSTORE_LIMIT_DIV 4
+
+#define ZHASH_SIZE 1024
+
+/* Field marking and corresponding locks:
+ * (Z) zstore_lock */
+
+typedef struct zchunk zchunk_t;
+typedef struct zslab zslab_t;
+typedef TAILQ_HEAD(, zslab) zslablist_t;
+
+/* Compressed page. Free chunks are linked through `hash` entry. */
+struct zchunk {
+  TAILQ_ENTRY(zchunk) hash;    /* (Z) entry on hash chain or free list */
+  TAILQ_ENTRY(zchunk) objlink; /* (Z) entry on owner's list of chunks */
+  vm_object_t *obj;            /* (Z) object the page belongs to */
+  off_t offset;                /* (Z) offset of the page in the object */
+  uint16_t size;               /* (Z) size of compressed data */
+  uint8_t data[];              /* compressed contents of the page */
+};
+
+/* Header placed at the beginning of each page used by the store. */
+struct zslab {
+  TAILQ_ENTRY(zslab) link;        /* (Z) entry on list of slabs of a class */
+  TAILQ_HEAD(, zchunk) freelist;  /* (Z) free chunks */
+  vm_page_t *page;                /* physical page the slab resides in */
+  uint16_t nused;                 /* (Z) number of chunks in use */
+  uint16_t nchunks;               /* total number of chunks */
+  uint8_t class;                  /* size class of chunks */
+};
+
+typedef struct zclass {
+  zslablist_t partial; /* (Z) slabs with at least one free chunk */
+  zslablist_t full;    /* (Z) slabs without free chunks */
+} zclass_t;
+
+typedef TAILQ_HEAD(, zchunk) zhashchain_t;
+
+/* Lock order: vm_object::mtx -> zstore_lock. */
+static mtx_t *zstore_lock = &MTX_INITIALIZER(0);
+static zclass_t zclass[ZCLASS_COUNT];       /* (Z) slabs by size class */
+static zhashchain_t zhashtbl[ZHASH_SIZE];   /* (Z) owner and offset to chunk */
+static vaddr_t zstore_kva;                  /* (Z) window to access a page */
+static uint8_t zstore_buf[PAGESIZE];        /* (Z) output of compressor */
+static uint16_t zstore_htab[LZ4_HASHSIZE];  /* (Z) compressor state */
+static zstat_t zstat;                       /* (Z) statistics */
+
+static inline size_t zchunk_size(unsigned class) {
+  return (class + 1) * ZCHUNK_ALIGN;
+}
+
+static inline unsigned zchunk_class(size_t size) {
+  return roundup(size, ZCHUNK_ALIGN) / ZCHUNK_ALIGN - 1;
+}
+
+static inline zslab_t *zchunk_slab(zchunk_t *zc) {
+  return (zslab_t *)rounddown((vaddr_t)zc, PAGESIZE);
+}
+
+static zhashchain_t *zstore_chain(vm_object_t *obj, off_t offset) {
+  uintptr_t h = ((uintptr_t)obj >> 4) ^ (offset / PAGESIZE);
+  return &zhashtbl[h % ZHASH_SIZE];
+}
+
+static zchunk_t *zstore_lookup(vm_object_t *obj, off_t offset) {
+  assert(mtx_owned(zstore_lock));
+
+  zchunk_t *zc;
+  TAILQ_FOREACH (zc, zstore_chain(obj, offset), hash)
+    if (zc->obj == obj && zc->offset == offset)
+      return zc;
+  return NULL;
+}
+
+/* Pages of the store are obtained straight from physical memory allocator,
+ * as kernel memory allocators would wait for pagedaemon if memory is short. */
+static zslab_t *zslab_create(unsigned class) {
+  vm_page_t *pg = vm_page_alloc(1);
+  if (pg == NULL)
+    return NULL;
+
+  vaddr_t va = kva_alloc(PAGESIZE);
+  if (va == 0) {
+    vm_page_free(pg);
+    return NULL;
+  }
+
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
+
+  zslab_t *zs = (zslab_t *)va;
+  size_t size = zchunk_size(class);
+  TAILQ_INIT(&zs->freelist);
+  zs->page = pg;
+  zs->nused = 0;
+  zs->nchunks = (PAGESIZE - ZSLAB_HDRSIZE) / size;
+  zs->class = class;
+
+  for (unsigned i = 0; i < zs->nchunks; i++) {
+    zchunk_t *zc = (zchunk_t *)(va + ZSLAB_HDRSIZE + i * size);
+    TAILQ_INSERT_TAIL(&zs->freelist, zc, hash);
+  }
+
+  zstat.zs_memsize += PAGESIZE;
+  return zs;
+}
+
+static void zslab_destroy(zslab_t *zs) {
+  vaddr_t va = (vaddr_t)zs;
+  vm_page_t *pg = zs->page;
+
+  pmap_kremove(va, PAGESIZE);
+  kva_free(va, PAGESIZE);
+  vm_page_free(pg);
+
+  zstat.zs_memsize -= PAGESIZE;
+}
+
+static zchunk_t *zchunk_alloc(size_t size) {
+  assert(mtx_owned(zstore_lock));
+
+  unsigned class = zchunk_class(size);
+  zclass_t *zcl = &zclass[class];
+  zslab_t *zs = TAILQ_FIRST(&zcl->partial);
+
+  if (zs == NULL) {
+    if (!(zs = zslab_create(class)))
+      return NULL;
+    TAILQ_INSERT_HEAD(&zcl->partial, zs, link);
+  }
+
+  zchunk_t *zc = TAILQ_FIRST(&zs->freelist);
+  TAILQ_REMOVE(&zs->freelist, zc, hash);
+
+  if (++zs->nused == zs->nchunks) {
+    TAILQ_REMOVE(&zcl->partial, zs, link);
+    TAILQ_INSERT_HEAD(&zcl->full, zs, link);
+  }
+
+  return zc;
+}
+
+static void zchunk_free(zchunk_t *zc) {
+  assert(mtx_owned(zstore_lock));
+
+  zslab_t *zs = zchunk_slab(zc);
+  zclass_t *zcl = &zclass[zs->class];
+
+  TAILQ_INSERT_HEAD(&zs->freelist, zc, hash);
+
+  if (zs->nused-- == zs->nchunks) {
+    TAILQ_REMOVE(&zcl->full, zs, link);
+    TAILQ_INSERT_HEAD(&zcl->partial, zs, link);
+  }
+
+  if (zs->nused == 0) {
+    TAILQ_REMOVE(&zcl->partial, zs, link);
+    zslab_destroy(zs);
+  }
+}
+
+/* Removes page from the store. */
+static void zstore_release(zchunk_t *zc) {
+  TAILQ_REMOVE(zstore_chain(zc->obj, zc->offset), zc, hash);
+  TAILQ_REMOVE(&zc->obj->zchunks, zc, objlink);
+  zc->obj->ncompressed--;
+  zstat.zs_npages--;
+  zstat.zs_comprsize -= zc->size;
+  zchunk_free(zc);
+}
+
+static void *zstore_map(vm_page_t *pg) {
+  pmap_kenter(zstore_kva, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
+  return (void *)zstore_kva;
+}
+
+static void zstore_unmap(void) {
+  pmap_kremove(zstore_kva, PAGESIZE);
+}
+
+bool zstore_put(vm_object_t *obj, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+
+  SCOPED_MTX_LOCK(zstore_lock);
+
+  if (zstat.zs_memsize >= zstat.zs_limit * PAGESIZE)
+    return false;
+
+  size_t size = lz4_compress(zstore_map(pg), PAGESIZE, zstore_buf,
+                             ZCHUNK_MAX - sizeof(zchunk_t), zstore_htab);
+  zstore_unmap();
+
+  if (size == 0) {
+    zstat.zs_nrejected++;
+    return false;
+  }
+
+  zchunk_t *zc = zchunk_alloc(sizeof(zchunk_t) + size);
+  if (zc == NULL)
+    return false;
+
+  zc->obj = obj;
+  zc->offset = vm_page_offset(pg);
+  zc->size = size;
+  memcpy(zc->data, zstore_buf, size);
+  TAILQ_INSERT_HEAD(zstore_chain(obj, vm_page_offset(pg)), zc, hash);
+  TAILQ_INSERT_TAIL(&obj->zchunks, zc, objlink);
+  obj->ncompressed++;
+
+  zstat.zs_npages++;
+  zstat.zs_comprsize += size;
+  zstat.zs_nstored++;
+  return true;
+}
+
+static void zstore_account_load(bintime_t start) {
+  bintime_t now = binuptime();
+  bintime_sub(&now, &start);
+
+  timespec_t ts;
+  bt2ts(&now, &ts);
+
+  /* Last bucket covers anything longer than 2^15us, so seconds don't fit. */
+  unsigned bucket = ZSTAT_NBUCKETS - 1;
+  if (ts.tv_sec == 0) {
+    unsigned long us = ts.tv_nsec / 1000;
+    if (us < 2)
+      bucket = 0;
+    else
+      bucket = min((unsigned)log2(us), bucket);
+  }
+
+  zstat.zs_latency[bucket]++;
+  zstat.zs_nloaded++;
+}
+
+bool zstore_get(vm_object_t *obj, off_t offset, vm_page_t *pg) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->ncompressed == 0)
+    return false;
+
+  SCOPED_MTX_LOCK(zstore_lock);
+
+  zchunk_t *zc = zstore_lookup(obj, offset);
+  if (zc == NULL)
+    return false;
+
+  bintime_t start = binuptime();
+
+  ssize_t size = lz4_decompress(zc->data, zc->size, zstore_map(pg), PAGESIZE);
+  zstore_unmap();
+
+  if (size != PAGESIZE)
+    panic("zstore: page 0x%08x of object %p is corrupted", offset, obj);
+
+  zstore_release(zc);
+  pmap_set_modified(pg);
+
+  zstore_account_load(start);
+  return true;
+}
+
+void zstore_get_all(vm_object_t *obj) {
+  assert(mtx_owned(&obj->mtx));
+
+  while (obj->ncompressed > 0) {
+    off_t offset;
+
+    WITH_MTX_LOCK (zstore_lock)
+      offset = TAILQ_FIRST(&obj->zchunks)->offset;
+
+    vm_page_t *pg;
+    while (!(pg = vm_page_alloc(1)))
+      vm_wait();
+
+    bool found = zstore_get(obj, offset, pg);
+    assert(found);
+    vm_object_add_page(obj, offset, pg);
+  }
+}
+
+void zstore_remove(vm_object_t *obj, off_t offset, size_t length) {
+  assert(mtx_owned(&obj->mtx));
+
+  if (obj->ncompressed == 0)
+    return;
+
+  SCOPED_MTX_LOCK(zstore_lock);
+
+  /* Range smaller than the number of compressed pages is looked up page by
+   * page, otherwise the whole list of object's chunks is checked. */
+  if (length / PAGESIZE < obj->ncompressed) {
+    for (size_t off = 0; off < length; off += PAGESIZE) {
+      zchunk_t *zc = zstore_lookup(obj, offset + off);
+      if (zc != NULL)
+        zstore_release(zc);
+    }
+    return;
+  }
+
+  zchunk_t *zc, *next;
+  TAILQ_FOREACH_SAFE (zc, &obj->zchunks, objlink, next)
+    if (zc->offset >= offset && (size_t)(zc->offset - offset) < length)
+      zstore_release(zc);
+}
+
+void zstore_stats(zstat_t *zs) {
+  SCOPED_MTX_LOCK(zstore_lock);
+  memcpy(zs, &zstat, sizeof(zstat_t));
+}
+
+void init_vm_zstore(void) {
+  for (unsigned i = 0; i < ZCLASS_COUNT; i++) {
+    TAILQ_INIT(&zclass[i].partial);
+    TAILQ_INIT(&zclass[i].full);
+  }
+
+  for (int i = 0; i < ZHASH_SIZE; i++)
+    TAILQ_INIT(&zhashtbl[i]);
+
+  /* Page table for the window is allocated now and never released, so
+   * compressing a page never needs memory for that. */
+  vm_page_t *pg = vm_page_alloc(1);
+  zstore_kva = kva_alloc(PAGESIZE);
+  zstore_map(pg);
+  zstore_unmap();
+  vm_page_free(pg);
+
+  zstat.zs_limit = vm_page_ntotal() / ZSTORE_LIMIT_DIV;
+}
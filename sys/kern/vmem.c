@@ -9,6 +9,9 @@
 #include <sys/errno.h>
 #include <sys/hash.h>
 #include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/sched.h>
+#include <sys/bitops.h>
 #include <machine/vm_param.h>
 
 #define VMEM_DEBUG 0
@@ -16,14 +19,42 @@
 #define VMEM_MAXORDER ((int)(sizeof(vmem_size_t) * CHAR_BIT))
 #define VMEM_MAXHASH 512
 #define VMEM_NAME_MAX 16
+#define VMEM_QCACHE_IDX_MAX 16 /* max. number of quantum caches */
+
+#define QC_SIZE 16 /* number of segments in per-CPU quantum cache */
+/* Number of segments moved between the cache and the arena at once. Must be
+ * half of QC_SIZE. */
+#define QC_BATCH (QC_SIZE / 2)
+
+/* Number of boundary tags kept in reserve, so that an allocation can split
+ * a free segment without leaving the vmem lock. Up to BT_MAXFREE tags are
+ * retained after segments get coalesced. */
+#define BT_MINRESERVE 2
+#define BT_MAXFREE 64
 
 #define ORDER2SIZE(order) ((vmem_size_t)1 << (order))
 #define SIZE2ORDER(size) ((int)log2(size))
+#define VMEM_ALIGNUP(addr, align) (-(-(addr) & -(align)))
+#define VMEM_CROSS_P(addr1, addr2, boundary)                                   \
+  ((((addr1) ^ (addr2)) & -(boundary)) != 0)
 
 typedef TAILQ_HEAD(vmem_seglist, bt) vmem_seglist_t;
 typedef LIST_HEAD(vmem_freelist, bt) vmem_freelist_t;
 typedef LIST_HEAD(vmem_hashlist, bt) vmem_hashlist_t;
 
+/*! \brief Per-CPU cache of free segments of a single size.
+ *
+ * Cached segments remain allocated in the arena. */
+typedef struct vmem_qcpu {
+  unsigned count;
+  vmem_addr_t addr[QC_SIZE];
+} vmem_qcpu_t;
+
+typedef struct vmem_qcache {
+  vmem_size_t qc_size; /* size of cached segments */
+  vmem_qcpu_t qc_cpu[MAXCPU];
+} vmem_qcache_t;
+
 /* List of all vmem instances and a guarding mutex */
 static mtx_t vmem_list_lock = MTX_INITIALIZER(0);
 static LIST_HEAD(, vmem) vmem_list = LIST_HEAD_INITIALIZER(vmem_list);
@@ -34,6 +65,7 @@ static LIST_HEAD(, vmem) vmem_list = LIST_HEAD_INITIALIZER(vmem_list);
  *  (a) vm_lock
  *  (@) vmem_list_lock
  *  (!) read-only access, do not modify!
+ *  (p) accessed by owning CPU with preemption disabled
  */
 typedef struct vmem {
   LIST_ENTRY(vmem) vm_link; /* (@) link for vmem_list */
@@ -46,6 +78,12 @@ typedef struct vmem {
   vmem_seglist_t vm_seglist;   /* (a) list of all segments */
   /* (a) table of lists of free segments */
   vmem_freelist_t vm_freelist[VMEM_MAXORDER];
+  uint64_t vm_freemap;          /* (a) bitmap of non-empty vm_freelist[] */
+  vmem_freelist_t vm_freetags;  /* (a) boundary tags kept in reserve */
+  int vm_nfreetags;             /* (a) number of tags in vm_freetags */
+  vmem_size_t vm_qcache_max;    /* (!) largest size served by quantum caches */
+  /* (p) quantum caches for sizes of 1, 2, ... quanta */
+  vmem_qcache_t vm_qcache[VMEM_QCACHE_IDX_MAX];
   /* (a) hashtable of lists of allocated segments */
   vmem_hashlist_t vm_hashlist[VMEM_MAXHASH];
 } vmem_t;
@@ -64,7 +102,8 @@ typedef enum {
 typedef struct bt {
   TAILQ_ENTRY(bt) bt_seglink; /* (a) link for vm_seglist */
   union {
-    /* (a) link for vm_freelist[] (array index based on bt_size) */
+    /* (a) link for vm_freelist[] (array index based on bt_size)
+     * or vm_freetags */
     LIST_ENTRY(bt) bt_freelink;
     /* (a) link for vm_hashlist[] (array index based on bt_start) */
     LIST_ENTRY(bt) bt_hashlink;
@@ -76,22 +115,60 @@ typedef struct bt {
 
 static KMALLOC_DEFINE(M_VMEM, "vmem");
 static POOL_DEFINE(P_BT, "vmem boundary tag", sizeof(bt_t));
-/* Note: in the future, the amount of static memory for boundary tags should
- * be reduced by more clever tag allocation technique that always keeps some
- * number of free tags. For more information, please see bt_alloc and bt_refill
- * methods in NetBSD's vmem and M_NOGROW flag in Mimiker. */
 static alignas(PAGESIZE) uint8_t P_BT_BOOTPAGE[PAGESIZE];
 
 void init_vmem(void) {
   pool_add_page(P_BT, P_BT_BOOTPAGE, sizeof(P_BT_BOOTPAGE));
 }
 
-static vmem_freelist_t *bt_freehead(vmem_t *vm, vmem_size_t size) {
+static int bt_freeidx(vmem_t *vm, vmem_size_t size) {
   vmem_size_t qsize = size >> vm->vm_quantum_shift;
   assert(size != 0 && qsize != 0);
   int idx = SIZE2ORDER(qsize);
   assert(idx >= 0 && idx < VMEM_MAXORDER);
-  return &vm->vm_freelist[idx];
+  return idx;
+}
+
+/* Reserves at least n boundary tags and returns with vmem lock held. */
+static int bt_reserve(vmem_t *vm, int n, kmem_flags_t flags) {
+  mtx_lock(&vm->vm_lock);
+  while (vm->vm_nfreetags < n) {
+    mtx_unlock(&vm->vm_lock);
+    bt_t *bt = pool_alloc(P_BT, flags & M_NOWAIT);
+    if (bt == NULL)
+      return ENOMEM;
+    mtx_lock(&vm->vm_lock);
+    LIST_INSERT_HEAD(&vm->vm_freetags, bt, bt_freelink);
+    vm->vm_nfreetags++;
+  }
+  return 0;
+}
+
+static bt_t *bt_alloc(vmem_t *vm) {
+  assert(mtx_owned(&vm->vm_lock));
+  bt_t *bt = LIST_FIRST(&vm->vm_freetags);
+  assert(bt != NULL);
+  LIST_REMOVE(bt, bt_freelink);
+  vm->vm_nfreetags--;
+  return bt;
+}
+
+/* Keeps the tag in reserve or moves it to `trash` list, which must be
+ * released with bt_release after vmem lock is dropped. */
+static void bt_free(vmem_t *vm, bt_t *bt, vmem_freelist_t *trash) {
+  assert(mtx_owned(&vm->vm_lock));
+  if (vm->vm_nfreetags < BT_MAXFREE) {
+    LIST_INSERT_HEAD(&vm->vm_freetags, bt, bt_freelink);
+    vm->vm_nfreetags++;
+  } else {
+    LIST_INSERT_HEAD(trash, bt, bt_freelink);
+  }
+}
+
+static void bt_release(vmem_freelist_t *trash) {
+  bt_t *bt, *next;
+  LIST_FOREACH_SAFE (bt, trash, bt_freelink, next)
+    pool_free(P_BT, bt);
 }
 
 static vmem_addr_t bt_end(const bt_t *bt) {
@@ -106,14 +183,23 @@ static vmem_hashlist_t *bt_hashhead(vmem_t *vm, vmem_addr_t addr) {
 static void bt_insfree(vmem_t *vm, bt_t *bt) {
   assert(mtx_owned(&vm->vm_lock));
   assert(bt->bt_type == BT_TYPE_FREE);
-  vmem_freelist_t *list = bt_freehead(vm, bt->bt_size);
-  LIST_INSERT_HEAD(list, bt, bt_freelink);
+  int idx = bt_freeidx(vm, bt->bt_size);
+  LIST_INSERT_HEAD(&vm->vm_freelist[idx], bt, bt_freelink);
+  vm->vm_freemap |= (uint64_t)1 << idx;
 }
 
 static void bt_remfree(vmem_t *vm, bt_t *bt) {
   assert(mtx_owned(&vm->vm_lock));
   assert(bt->bt_type == BT_TYPE_FREE);
+  int idx = bt_freeidx(vm, bt->bt_size);
   LIST_REMOVE(bt, bt_freelink);
+  if (LIST_EMPTY(&vm->vm_freelist[idx]))
+    vm->vm_freemap &= ~((uint64_t)1 << idx);
+}
+
+static void bt_insseg_before(vmem_t *vm, bt_t *bt, bt_t *next) {
+  assert(mtx_owned(&vm->vm_lock));
+  TAILQ_INSERT_BEFORE(next, bt, bt_seglink);
 }
 
 static void bt_insseg_tail(vmem_t *vm, bt_t *bt) {
@@ -158,22 +244,152 @@ static bt_t *bt_lookupbusy(vmem_t *vm, vmem_addr_t addr) {
   return NULL;
 }
 
-static bt_t *bt_find_freeseg(vmem_t *vm, vmem_size_t size) {
+/* Checks if a segment of given size that satisfies the constraints fits
+ * into free segment `bt`. If so its start address is stored in `startp`. */
+static bool bt_fit(const bt_t *bt, vmem_size_t size, vmem_size_t align,
+                   vmem_size_t phase, vmem_size_t nocross, vmem_addr_t minaddr,
+                   vmem_addr_t maxaddr, vmem_addr_t *startp) {
+  vmem_addr_t start = max(bt->bt_start, minaddr);
+  vmem_addr_t end = min(bt_end(bt), maxaddr);
+
+  if (start > end)
+    return false;
+
+  start = VMEM_ALIGNUP(start - phase, align) + phase;
+  if (start < bt->bt_start)
+    start += align;
+  if (nocross && VMEM_CROSS_P(start, start + size - 1, nocross))
+    start = VMEM_ALIGNUP(start - phase, nocross) + phase;
+
+  if (start < bt->bt_start || start > end || end - start < size - 1)
+    return false;
+
+  *startp = start;
+  return true;
+}
+
+/* Returns lowest index of non-empty free list at `idx` or above. */
+static int bt_nextfree(vmem_t *vm, int idx) {
+  if (idx >= VMEM_MAXORDER)
+    return -1;
+  uint64_t map = vm->vm_freemap & ~(((uint64_t)1 << idx) - 1);
+  return ffs64(map) - 1;
+}
+
+static bt_t *bt_find_freeseg(vmem_t *vm, vmem_size_t size, vmem_size_t align,
+                             vmem_size_t phase, vmem_size_t nocross,
+                             vmem_addr_t minaddr, vmem_addr_t maxaddr,
+                             kmem_flags_t flags, vmem_addr_t *startp) {
   assert(mtx_owned(&vm->vm_lock));
 
-  vmem_freelist_t *first = bt_freehead(vm, size);
-  vmem_freelist_t *end = &vm->vm_freelist[VMEM_MAXORDER];
+  int first = bt_freeidx(vm, size);
+  bt_t *bt;
 
-  for (vmem_freelist_t *list = first; list < end; list++) {
-    bt_t *bt;
-    LIST_FOREACH (bt, list, bt_freelink) {
-      if (bt->bt_size >= size)
+  if (!(flags & VM_BESTFIT)) {
+    /* Every segment on free lists starting from the one for sizes rounded
+     * up to a power of 2 is big enough - check only heads of lists. */
+    int idx = first + !powerof2(size >> vm->vm_quantum_shift);
+    for (idx = bt_nextfree(vm, idx); idx >= 0; idx = bt_nextfree(vm, idx + 1))
+      if (bt_fit((bt = LIST_FIRST(&vm->vm_freelist[idx])), size, align, phase,
+                 nocross, minaddr, maxaddr, startp))
         return bt;
+    /* Otherwise fall back to best fit. */
+  }
+
+  /* Lists contain segments of sizes from [2^idx, 2^(idx+1)) quanta, so the
+   * smallest segment that fits in the first list with such segments is the
+   * best fit. */
+  for (int idx = bt_nextfree(vm, first); idx >= 0;
+       idx = bt_nextfree(vm, idx + 1)) {
+    bt_t *best = NULL;
+    vmem_addr_t start;
+    LIST_FOREACH (bt, &vm->vm_freelist[idx], bt_freelink) {
+      if (bt->bt_size < size || (best && bt->bt_size >= best->bt_size))
+        continue;
+      if (bt_fit(bt, size, align, phase, nocross, minaddr, maxaddr, &start)) {
+        best = bt;
+        *startp = start;
+      }
     }
+    if (best)
+      return best;
   }
+
   return NULL;
 }
 
+/* Allocates [start, start + size) range out of free segment `bt`. Remaining
+ * parts of the segment are kept free. Needs up to two reserved tags. */
+static void bt_carve(vmem_t *vm, bt_t *bt, vmem_addr_t start,
+                     vmem_size_t size) {
+  assert(mtx_owned(&vm->vm_lock));
+  assert(start >= bt->bt_start && start + size - 1 <= bt_end(bt));
+
+  bt_remfree(vm, bt);
+
+  if (start > bt->bt_start) {
+    /* Split [bt] into [btfront | bt] */
+    bt_t *btfront = bt_alloc(vm);
+    btfront->bt_type = BT_TYPE_FREE;
+    btfront->bt_start = bt->bt_start;
+    btfront->bt_size = start - bt->bt_start;
+    bt->bt_start = start;
+    bt->bt_size -= btfront->bt_size;
+    bt_insseg_before(vm, btfront, bt);
+    bt_insfree(vm, btfront);
+  }
+
+  if (bt->bt_size > size) {
+    /* Split [bt] into [bt | btnew] */
+    bt_t *btnew = bt_alloc(vm);
+    btnew->bt_type = BT_TYPE_FREE;
+    btnew->bt_start = bt->bt_start + size;
+    btnew->bt_size = bt->bt_size - size;
+    bt->bt_size = size;
+    bt_insseg_after(vm, btnew, bt);
+    bt_insfree(vm, btnew);
+  }
+
+  bt->bt_type = BT_TYPE_BUSY;
+  bt_insbusy(vm, bt);
+}
+
+/* Returns busy segment to free lists coalescing it with its neighbours. */
+static void bt_unbusy(vmem_t *vm, vmem_addr_t addr, vmem_size_t size,
+                      vmem_freelist_t *trash) {
+  assert(mtx_owned(&vm->vm_lock));
+
+  bt_t *bt = bt_lookupbusy(vm, addr);
+  assert(bt != NULL);
+  assert(bt->bt_size == size);
+
+  bt_rembusy(vm, bt);
+  bt->bt_type = BT_TYPE_FREE;
+
+  /* coalesce previous segment */
+  bt_t *prev = TAILQ_PREV(bt, vmem_seglist, bt_seglink);
+  if (prev != NULL && prev->bt_type == BT_TYPE_FREE) {
+    assert(bt_end(prev) < bt->bt_start);
+    bt_remfree(vm, prev);
+    bt_remseg(vm, prev);
+    bt->bt_size += prev->bt_size;
+    bt->bt_start = prev->bt_start;
+    bt_free(vm, prev, trash);
+  }
+
+  /* coalesce next segment */
+  bt_t *next = TAILQ_NEXT(bt, bt_seglink);
+  if (next != NULL && next->bt_type == BT_TYPE_FREE) {
+    assert(bt_end(bt) < next->bt_start);
+    bt_remfree(vm, next);
+    bt_remseg(vm, next);
+    bt->bt_size += next->bt_size;
+    bt_free(vm, next, trash);
+  }
+
+  bt_insfree(vm, bt);
+}
+
 #if VMEM_DEBUG
 static bool bt_isspan(const bt_t *bt) {
   return bt->bt_type == BT_TYPE_SPAN;
@@ -204,7 +420,8 @@ static void vmem_check_sanity(vmem_t *vm) {
 #define vmem_check_sanity(vm) (void)vm
 #endif
 
-vmem_t *vmem_create(const char *name, vmem_size_t quantum) {
+vmem_t *vmem_create(const char *name, vmem_size_t quantum,
+                    vmem_size_t qcache_max) {
   vmem_t *vm = kmalloc(M_VMEM, sizeof(vmem_t), M_NOWAIT | M_ZERO);
   assert(vm != NULL);
 
@@ -214,6 +431,11 @@ vmem_t *vmem_create(const char *name, vmem_size_t quantum) {
   /* Check that quantum is a power of 2 */
   assert(ORDER2SIZE(vm->vm_quantum_shift) == quantum);
 
+  vm->vm_qcache_max =
+    min(rounddown(qcache_max, quantum), VMEM_QCACHE_IDX_MAX * quantum);
+  for (int i = 0; i < VMEM_QCACHE_IDX_MAX; i++)
+    vm->vm_qcache[i].qc_size = (i + 1) * quantum;
+
   mtx_init(&vm->vm_lock, 0);
   strlcpy(vm->vm_name, name, sizeof(vm->vm_name));
 
@@ -222,6 +444,7 @@ vmem_t *vmem_create(const char *name, vmem_size_t quantum) {
     LIST_INIT(&vm->vm_freelist[i]);
   for (int i = 0; i < VMEM_MAXHASH; i++)
     LIST_INIT(&vm->vm_hashlist[i]);
+  LIST_INIT(&vm->vm_freetags);
 
   WITH_MTX_LOCK (&vmem_list_lock)
     LIST_INSERT_HEAD(&vmem_list, vm, vm_link);
@@ -256,125 +479,194 @@ int vmem_add(vmem_t *vm, vmem_addr_t addr, vmem_size_t size) {
   return 0;
 }
 
-int vmem_alloc(vmem_t *vm, vmem_size_t size, vmem_addr_t *addrp,
-               kmem_flags_t flags) {
+int vmem_xalloc(vmem_t *vm, vmem_size_t size, vmem_size_t align,
+                vmem_size_t phase, vmem_size_t nocross, vmem_addr_t minaddr,
+                vmem_addr_t maxaddr, kmem_flags_t flags, vmem_addr_t *addrp) {
   size = align(size, vm->vm_quantum);
   assert(size > 0);
 
-  /* Allocate new boundary tag before acquiring the vmem lock */
-  bt_t *bt, *btnew;
+  if (align == 0)
+    align = vm->vm_quantum;
+  assert(powerof2(align) && is_aligned(align, vm->vm_quantum));
+  assert(phase < align && is_aligned(phase, vm->vm_quantum));
+  assert(nocross == 0 || (powerof2(nocross) && nocross >= size));
+  assert(minaddr <= maxaddr);
+  assert((flags & (VM_INSTANTFIT | VM_BESTFIT)) !=
+         (VM_INSTANTFIT | VM_BESTFIT));
+
+  vmem_addr_t start;
+
+  /* Reserve boundary tags before looking for free segment, as the pool may
+   * need to sleep. */
+  if (bt_reserve(vm, BT_MINRESERVE, flags))
+    return ENOMEM;
+
+  vmem_check_sanity(vm);
+
+  bt_t *bt = bt_find_freeseg(vm, size, align, phase, nocross, minaddr,
+                             maxaddr, flags, &start);
 
-  if (!(btnew = pool_alloc(P_BT, flags | M_ZERO)))
+  if (bt == NULL) {
+    mtx_unlock(&vm->vm_lock);
+    klog("%s: block of %lu bytes not found in '%s'", __func__, size,
+         vm->vm_name);
     return ENOMEM;
+  }
+
+  bt_carve(vm, bt, start, size);
+  vmem_check_sanity(vm);
+  mtx_unlock(&vm->vm_lock);
+
+  if (addrp != NULL)
+    *addrp = start;
+
+  klog("%s: found block of %lu bytes in '%s'", __func__, size, vm->vm_name);
+  return 0;
+}
+
+void vmem_xfree(vmem_t *vm, vmem_addr_t addr, vmem_size_t size) {
+  vmem_freelist_t trash = LIST_HEAD_INITIALIZER(trash);
 
   WITH_MTX_LOCK (&vm->vm_lock) {
     vmem_check_sanity(vm);
+    bt_unbusy(vm, addr, align(size, vm->vm_quantum), &trash);
+    vmem_check_sanity(vm);
+  }
 
-    bt = bt_find_freeseg(vm, size);
+  bt_release(&trash);
 
-    if (bt == NULL) {
-      pool_free(P_BT, btnew);
-      klog("%s: block of %lu bytes not found in '%s'", __func__, size,
-           vm->vm_name);
-      return ENOMEM;
-    }
+  klog("%s: block of %lu bytes deallocated from '%s'", __func__, size,
+       vm->vm_name);
+}
 
-    bt_remfree(vm, bt);
-    vmem_check_sanity(vm);
+/* Moves a batch of segments from the arena to the quantum cache of the
+ * current CPU. Returns one of them in `addrp`. */
+static int qc_import(vmem_t *vm, vmem_qcache_t *qc, vmem_addr_t *addrp,
+                     kmem_flags_t flags) {
+  vmem_addr_t addr[QC_BATCH];
+  int n;
 
-    if (bt->bt_size > size && bt->bt_size - size >= vm->vm_quantum) {
-      /* Split [bt] into [bt | btnew] */
-      btnew->bt_type = BT_TYPE_FREE;
-      btnew->bt_start = bt->bt_start + size;
-      btnew->bt_size = bt->bt_size - size;
-      bt->bt_type = BT_TYPE_BUSY;
-      bt->bt_size = size;
-      bt_insfree(vm, btnew);
-      bt_insseg_after(vm, btnew, bt);
-      bt_insbusy(vm, bt);
-      /* Set btnew to NULL so that it won't be deallocated after exiting
-       * from the vmem lock */
-      btnew = NULL;
-    } else {
-      bt->bt_type = BT_TYPE_BUSY;
-      bt_insbusy(vm, bt);
-    }
+  /* Each segment needs at most one new boundary tag. */
+  if (bt_reserve(vm, QC_BATCH, flags))
+    return ENOMEM;
 
-    vmem_check_sanity(vm);
+  for (n = 0; n < QC_BATCH; n++) {
+    bt_t *bt = bt_find_freeseg(vm, qc->qc_size, vm->vm_quantum, 0, 0,
+                               VMEM_ADDR_MIN, VMEM_ADDR_MAX, 0, &addr[n]);
+    if (bt == NULL)
+      break;
+    bt_carve(vm, bt, addr[n], qc->qc_size);
   }
 
-  if (btnew != NULL)
-    pool_free(P_BT, btnew);
+  vmem_check_sanity(vm);
+  mtx_unlock(&vm->vm_lock);
 
-  assert(bt->bt_size >= size);
-  assert(bt->bt_type == BT_TYPE_BUSY);
+  if (n == 0)
+    return ENOMEM;
 
-  if (addrp != NULL)
-    *addrp = bt->bt_start;
+  *addrp = addr[--n];
+
+  /* We may have been migrated to another CPU in the meantime, and its cache
+   * may be full, so give back whatever doesn't fit. */
+  WITH_NO_PREEMPTION {
+    vmem_qcpu_t *cpu = &qc->qc_cpu[PCPU_GET(cpuid)];
+    while (n > 0 && cpu->count < QC_SIZE)
+      cpu->addr[cpu->count++] = addr[--n];
+  }
+
+  while (n > 0)
+    vmem_xfree(vm, addr[--n], qc->qc_size);
 
-  klog("%s: found block of %lu bytes in '%s'", __func__, size, vm->vm_name);
   return 0;
 }
 
-void vmem_free(vmem_t *vm, vmem_addr_t addr, vmem_size_t size) {
-  bt_t *prev = NULL;
-  bt_t *next = NULL;
+/* Moves a batch of segments from the quantum cache to the arena. */
+static void qc_export(vmem_t *vm, vmem_qcache_t *qc, vmem_addr_t *addr,
+                      int n) {
+  vmem_freelist_t trash = LIST_HEAD_INITIALIZER(trash);
 
   WITH_MTX_LOCK (&vm->vm_lock) {
+    for (int i = 0; i < n; i++)
+      bt_unbusy(vm, addr[i], qc->qc_size, &trash);
     vmem_check_sanity(vm);
+  }
 
-    bt_t *bt = bt_lookupbusy(vm, addr);
-    assert(bt != NULL);
-    assert(bt->bt_size == align(size, vm->vm_quantum));
-
-    bt_rembusy(vm, bt);
-    bt->bt_type = BT_TYPE_FREE;
-
-    /* coalesce previous segment */
-    prev = TAILQ_PREV(bt, vmem_seglist, bt_seglink);
-    if (prev != NULL && prev->bt_type == BT_TYPE_FREE) {
-      assert(bt_end(prev) < bt->bt_start);
-      bt_remfree(vm, prev);
-      bt_remseg(vm, prev);
-      bt->bt_size += prev->bt_size;
-      bt->bt_start = prev->bt_start;
-    } else {
-      /* Set prev to NULL so that it won't be deallocated after exiting
-       * from the vmem lock */
-      prev = NULL;
-    }
+  bt_release(&trash);
+}
 
-    /* coalesce next segment */
-    next = TAILQ_NEXT(bt, bt_seglink);
-    if (next != NULL && next->bt_type == BT_TYPE_FREE) {
-      assert(bt_end(bt) < next->bt_start);
-      bt_remfree(vm, next);
-      bt_remseg(vm, next);
-      bt->bt_size += next->bt_size;
-    } else {
-      /* Set next to NULL so that it won't be deallocated after exiting
-       * from the vmem lock */
-      next = NULL;
+int vmem_alloc(vmem_t *vm, vmem_size_t size, vmem_addr_t *addrp,
+               kmem_flags_t flags) {
+  size = align(size, vm->vm_quantum);
+  assert(size > 0);
+
+  if (size > vm->vm_qcache_max)
+    return vmem_xalloc(vm, size, 0, 0, 0, VMEM_ADDR_MIN, VMEM_ADDR_MAX, flags,
+                       addrp);
+
+  vmem_qcache_t *qc = &vm->vm_qcache[(size >> vm->vm_quantum_shift) - 1];
+  vmem_addr_t addr = 0;
+  bool found = false;
+
+  WITH_NO_PREEMPTION {
+    vmem_qcpu_t *cpu = &qc->qc_cpu[PCPU_GET(cpuid)];
+    if (cpu->count > 0) {
+      addr = cpu->addr[--cpu->count];
+      found = true;
     }
+  }
 
-    bt_insfree(vm, bt);
+  if (!found && qc_import(vm, qc, &addr, flags)) {
+    klog("%s: block of %lu bytes not found in '%s'", __func__, size,
+         vm->vm_name);
+    return ENOMEM;
+  }
 
-    vmem_check_sanity(vm);
+  if (addrp != NULL)
+    *addrp = addr;
+  return 0;
+}
+
+void vmem_free(vmem_t *vm, vmem_addr_t addr, vmem_size_t size) {
+  size = align(size, vm->vm_quantum);
+
+  if (size > vm->vm_qcache_max) {
+    vmem_xfree(vm, addr, size);
+    return;
   }
 
-  if (prev != NULL)
-    pool_free(P_BT, prev);
-  if (next != NULL)
-    pool_free(P_BT, next);
+  vmem_qcache_t *qc = &vm->vm_qcache[(size >> vm->vm_quantum_shift) - 1];
+  vmem_addr_t batch[QC_BATCH];
+  int n = 0;
+
+  WITH_NO_PREEMPTION {
+    vmem_qcpu_t *cpu = &qc->qc_cpu[PCPU_GET(cpuid)];
+    if (cpu->count == QC_SIZE) {
+      /* Cache is full - return older half of it to the arena. */
+      n = QC_BATCH;
+      memcpy(batch, cpu->addr, sizeof(batch));
+      memcpy(cpu->addr, cpu->addr + n, (QC_SIZE - n) * sizeof(vmem_addr_t));
+      cpu->count -= n;
+    }
+    cpu->addr[cpu->count++] = addr;
+  }
 
-  klog("%s: block of %lu bytes deallocated from '%s'", __func__, size,
-       vm->vm_name);
+  if (n > 0)
+    qc_export(vm, qc, batch, n);
 }
 
 void vmem_destroy(vmem_t *vm) {
   WITH_MTX_LOCK (&vmem_list_lock)
     LIST_REMOVE(vm, vm_link);
 
+  /* return cached segments to the arena */
+  for (int i = 0; i < VMEM_QCACHE_IDX_MAX; i++) {
+    vmem_qcache_t *qc = &vm->vm_qcache[i];
+    for (int cpu = 0; cpu < MAXCPU; cpu++) {
+      qc_export(vm, qc, qc->qc_cpu[cpu].addr, qc->qc_cpu[cpu].count);
+      qc->qc_cpu[cpu].count = 0;
+    }
+  }
+
   /* perform last sanity checks */
 
   /* check #1
@@ -423,5 +715,6 @@ void vmem_destroy(vmem_t *vm) {
   bt_t *next;
   TAILQ_FOREACH_SAFE (bt, &vm->vm_seglist, bt_seglink, next)
     pool_free(P_BT, bt);
+  bt_release(&vm->vm_freetags);
   kfree(M_VMEM, vm);
 }
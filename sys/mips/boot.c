@@ -159,5 +159,7 @@ __boot_text void _gdb_tlb_read_index(unsigned i) {
   _gdb_tlb_entry.hi = mips32_getentryhi();
   _gdb_tlb_entry.lo0 = mips32_getentrylo0();
   _gdb_tlb_entry.lo1 = mips32_getentrylo1();
+  _gdb_tlb_entry.mask = mips32_getpagemask();
+  mips32_setpagemask(0);
   mips32_setentryhi(saved);
 }
@@ -53,13 +53,15 @@ static void cpu_read_config(void) {
   cpuinfo.tlb_entries = bitfield(cfg1, CFG1_MMUS) + 1;
 
   /* Instruction cache size and organization. */
-  cpuinfo.ic_linesize = (cfg1 & CFG1_IL_MASK) ? 32 : 0;
+  cpuinfo.ic_linesize =
+    (cfg1 & CFG1_IL_MASK) ? 2 << bitfield(cfg1, CFG1_IL) : 0;
   cpuinfo.ic_nways = bitfield(cfg1, CFG1_IA) + 1;
   cpuinfo.ic_nsets = 1 << (bitfield(cfg1, CFG1_IS) + 6);
   cpuinfo.ic_size = cpuinfo.ic_nways * cpuinfo.ic_linesize * cpuinfo.ic_nsets;
 
   /* Data cache size and organization. */
-  cpuinfo.dc_linesize = (cfg1 & CFG1_DL_MASK) ? 32 : 0;
+  cpuinfo.dc_linesize =
+    (cfg1 & CFG1_DL_MASK) ? 2 << bitfield(cfg1, CFG1_DL) : 0;
   cpuinfo.dc_nways = bitfield(cfg1, CFG1_DA) + 1;
   cpuinfo.dc_nsets = 1 << (bitfield(cfg1, CFG1_DS) + 6);
   cpuinfo.dc_size = cpuinfo.dc_nways * cpuinfo.dc_linesize * cpuinfo.dc_nsets;
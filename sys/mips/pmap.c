@@ -3,6 +3,7 @@
 #include <sys/mimiker.h>
 #include <sys/libkern.h>
 #include <sys/pool.h>
+#include <mips/cpuinfo.h>
 #include <mips/mips.h>
 #include <mips/tlb.h>
 #include <mips/pmap.h>
@@ -10,12 +11,13 @@
 #include <sys/pmap.h>
 #include <sys/mutex.h>
 #include <sys/sched.h>
+#include <sys/vm_pageout.h>
 #include <sys/vm_physmem.h>
-#include <bitstring.h>
 
 typedef struct pmap {
   mtx_t mtx;                      /* protects all fields in this structure */
   asid_t asid;                    /* address space identifier */
+  uint32_t asid_gen;              /* generation of asid (asid_lock) */
   pde_t *pde;                     /* directory page table (kseg0) */
   vm_pagelist_t pte_pages;        /* pages we allocate in page table */
   TAILQ_HEAD(, pv_entry) pv_list; /* all pages mapped by this physical map */
@@ -23,7 +25,7 @@ typedef struct pmap {
 
 typedef struct pv_entry {
   TAILQ_ENTRY(pv_entry) pmap_link; /* link on pmap::pv_list */
-  TAILQ_ENTRY(pv_entry) page_link; /* link on vm_page::pv_list */
+  SLIST_ENTRY(pv_entry) page_link; /* link on vm_page::pv_list */
   pmap_t *pmap;                    /* page is mapped in this pmap */
   vaddr_t va;                      /* under this address */
 } pv_entry_t;
@@ -31,6 +33,16 @@ typedef struct pv_entry {
 static POOL_DEFINE(P_PMAP, "pmap", sizeof(pmap_t));
 static POOL_DEFINE(P_PV, "pv_entry", sizeof(pv_entry_t));
 
+/* Page zeroing and copying routines implemented in pagecopy.S. */
+void pagezero(void *va);
+void pagezero_pf(void *va);
+void pagecopy(void *dst, const void *src);
+void pagecopy_pf(void *dst, const void *src);
+
+/* Chosen by init_pmap based on data cache line size. */
+static void (*pagezero_fn)(void *va) = pagezero;
+static void (*pagecopy_fn)(void *dst, const void *src) = pagecopy;
+
 static const pte_t vm_prot_map[] = {
   [VM_PROT_NONE] = 0,
   [VM_PROT_READ] = PTE_VALID | PTE_NO_EXEC,
@@ -44,11 +56,15 @@ static const pte_t vm_prot_map[] = {
 
 static pmap_t kernel_pmap;
 pde_t *_kernel_pmap_pde;
-static bitstr_t asid_used[bitstr_size(MAX_ASID)] = {0};
 static spin_t *asid_lock = &SPIN_INITIALIZER(0);
+static unsigned asid_next = 1; /* next ASID to be assigned */
+static uint32_t asid_gen = 1;  /* current ASID generation */
 
-/* this lock is used to protect the vm_page::pv_list field */
-static mtx_t *pv_list_lock = &MTX_INITIALIZER(0);
+/* Pv lists of pages are protected by a pool of locks, each page is assigned
+ * one of them by its physical address. Lock order is pv lock -> pmap::mtx.
+ * Functions that find pages by walking page tables must use pv_lock_pmap. */
+#define PV_LOCKS 64
+static mtx_t pv_locks[PV_LOCKS];
 
 #define PDE_OF(pmap, vaddr) ((pmap)->pde[PDE_INDEX(vaddr)])
 #define PT_BASE(pde) ((pte_t *)(((pde) >> PTE_PFN_SHIFT) << PTE_INDEX_SHIFT))
@@ -56,7 +72,7 @@ static mtx_t *pv_list_lock = &MTX_INITIALIZER(0);
 
 #define PTE_FRAME_ADDR(pte) (PTE_PFN_OF(pte) * PAGESIZE)
 #define PAGE_OFFSET(x) ((x) & (PAGESIZE - 1))
-#define PG_KSEG0_ADDR(pg) (void *)(MIPS_PHYS_TO_KSEG0((pg)->paddr))
+#define PG_KSEG0_ADDR(pg) (void *)(MIPS_PHYS_TO_KSEG0(vm_page_paddr(pg)))
 
 /*
  * Helper functions.
@@ -79,11 +95,11 @@ static bool kern_addr_p(vaddr_t addr) {
 }
 
 inline vaddr_t pmap_start(pmap_t *pmap) {
-  return pmap->asid ? PMAP_USER_BEGIN : PMAP_KERNEL_BEGIN;
+  return pmap == pmap_kernel() ? PMAP_KERNEL_BEGIN : PMAP_USER_BEGIN;
 }
 
 inline vaddr_t pmap_end(pmap_t *pmap) {
-  return pmap->asid ? PMAP_USER_END : PMAP_KERNEL_END;
+  return pmap == pmap_kernel() ? PMAP_KERNEL_END : PMAP_USER_END;
 }
 
 inline bool pmap_address_p(pmap_t *pmap, vaddr_t va) {
@@ -114,42 +130,70 @@ pmap_t *pmap_lookup(vaddr_t addr) {
  * Address space identifiers management.
  */
 
-static asid_t alloc_asid(void) {
-  int free = 0;
-  WITH_SPIN_LOCK (asid_lock) {
-    bit_ffc(asid_used, MAX_ASID, &free);
-    if (free < 0)
-      panic("Out of asids!");
-    bit_set(asid_used, free);
+/* ASIDs are assigned when a pmap is activated. Once all of them are used up
+ * a new generation begins: whole TLB is flushed and each pmap receives a new
+ * ASID when it's activated next time. Thus the number of address spaces is
+ * not limited by the number of ASIDs. ASID 0 is reserved for the kernel. */
+static void pmap_asid_assign(pmap_t *pmap) {
+  SCOPED_SPIN_LOCK(asid_lock);
+
+  if (pmap->asid_gen == asid_gen)
+    return;
+
+  if (asid_next > MAX_ASID) {
+    /* Generation 0 marks pmaps that were never activated. */
+    if (++asid_gen == 0)
+      asid_gen = 1;
+    asid_next = 1;
+    tlb_invalidate_all();
+    klog("ASID generation %u begins", asid_gen);
   }
-  klog("alloc_asid() = %d", free);
-  return free;
-}
 
-static void free_asid(asid_t asid) {
-  klog("free_asid(%d)", asid);
-  SCOPED_SPIN_LOCK(asid_lock);
-  bit_clear(asid_used, (unsigned)asid);
-  tlb_invalidate_asid(asid);
+  pmap->asid = asid_next++;
+  pmap->asid_gen = asid_gen;
+  klog("Assigned ASID %d to pmap %p", pmap->asid, pmap);
 }
 
 /*
  * Physical-to-virtual entries are managed for all pageable mappings.
  */
 
-static void pv_add(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
-  pv_entry_t *pv = pool_alloc(P_PV, M_ZERO);
+static inline mtx_t *pv_lock(vm_page_t *pg) {
+  return &pv_locks[(vm_page_paddr(pg) / PAGESIZE) % PV_LOCKS];
+}
+
+/* Locks pv list of `pg` with pmap already locked. If the lock is contended,
+ * pmap is unlocked to respect lock order, after gathered TLB invalidations are
+ * flushed. Returns false in that case, as the caller must look up the mapping
+ * again. */
+static bool pv_lock_pmap(pmap_t *pmap, vm_page_t *pg, tlb_gather_t *tg) {
+  assert(mtx_owned(&pmap->mtx));
+
+  if (mtx_trylock(pv_lock(pg)))
+    return true;
+
+  if (tg)
+    tlb_gather_flush(tg);
+  mtx_unlock(&pmap->mtx);
+  mtx_lock(pv_lock(pg));
+  mtx_lock(&pmap->mtx);
+  return false;
+}
+
+/* Entry is allocated by the caller before taking any locks, since pool
+ * allocator may wait for memory. */
+static void pv_add(pmap_t *pmap, vaddr_t va, vm_page_t *pg, pv_entry_t *pv) {
+  assert(mtx_owned(pv_lock(pg)));
   pv->pmap = pmap;
   pv->va = va;
-  TAILQ_INSERT_TAIL(&pg->pv_list, pv, page_link);
+  SLIST_INSERT_HEAD(&pg->pv_list, pv, page_link);
   TAILQ_INSERT_TAIL(&pmap->pv_list, pv, pmap_link);
 }
 
 static pv_entry_t *pv_find(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
+  assert(mtx_owned(pv_lock(pg)));
   pv_entry_t *pv;
-  TAILQ_FOREACH (pv, &pg->pv_list, page_link) {
+  SLIST_FOREACH (pv, &pg->pv_list, page_link) {
     if (pv->pmap == pmap && pv->va == va)
       return pv;
   }
@@ -157,10 +201,10 @@ static pv_entry_t *pv_find(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
 }
 
 static void pv_remove(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
-  assert(mtx_owned(pv_list_lock));
+  assert(mtx_owned(pv_lock(pg)));
   pv_entry_t *pv = pv_find(pmap, va, pg);
   assert(pv != NULL);
-  TAILQ_REMOVE(&pg->pv_list, pv, page_link);
+  SLIST_REMOVE(&pg->pv_list, pv, pv_entry, page_link);
   TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
   pool_free(P_PV, pv);
 }
@@ -169,17 +213,21 @@ static void pv_remove(pmap_t *pmap, vaddr_t va, vm_page_t *pg) {
  * Routines for accessing page table entries.
  */
 
+/* Page tables are allocated with pmap locked, so they must not wait for
+ * memory, but may use pages kept in reserve. */
 static vm_page_t *pmap_pagealloc(void) {
-  vm_page_t *pg = vm_page_alloc(1);
-  pmap_zero_page(pg);
-  return pg;
+  return vm_page_alloc_flags(1, M_ZERO | M_NOWAIT);
 }
 
-/* Add PT to PD so kernel can handle access to @vaddr. */
+/* Add PT to PD so kernel can handle access to @vaddr. Returns invalid entry
+ * if there's no memory for the page table. */
 static pde_t pmap_add_pde(pmap_t *pmap, vaddr_t vaddr) {
   assert(!is_valid_pde(PDE_OF(pmap, vaddr)));
 
   vm_page_t *pg = pmap_pagealloc();
+  if (pg == NULL)
+    return 0;
+
   pde_t pde = PTE_PFN((vaddr_t)PG_KSEG0_ADDR(pg)) | PTE_KERNEL;
   PDE_OF(pmap, vaddr) = pde;
 
@@ -204,22 +252,40 @@ static pte_t pmap_pte_read(pmap_t *pmap, vaddr_t vaddr) {
   return PTE_OF(pde, vaddr);
 }
 
-/*! \brief Writes \a pte as the new PTE mapping virtual address \a vaddr. */
-static void pmap_pte_write(pmap_t *pmap, vaddr_t vaddr, pte_t pte,
-                           unsigned flags) {
+static pte_t pmap_cache_bits(unsigned flags) {
   unsigned cacheflags = flags & PMAP_CACHE_MASK;
 
   if (cacheflags == PMAP_NOCACHE)
-    pte |= PTE_CACHE_UNCACHED;
-  else if (cacheflags == PMAP_WRITE_THROUGH)
-    pte |= PTE_CACHE_WRITE_THROUGH;
-  else
-    pte |= PTE_CACHE_WRITE_BACK;
-
+    return PTE_CACHE_UNCACHED;
+  if (cacheflags == PMAP_WRITE_THROUGH)
+    return PTE_CACHE_WRITE_THROUGH;
+  return PTE_CACHE_WRITE_BACK;
+}
+
+/*! \brief Makes sure there is a page table for virtual address \a vaddr.
+ *
+ * If it can't be allocated, the caller should release pmap lock and wait for
+ * free memory with vm_wait before trying again.
+ *
+ * \returns false if there's no memory for the page table */
+static bool pmap_ensure_pde(pmap_t *pmap, vaddr_t vaddr) {
+  return is_valid_pde(PDE_OF(pmap, vaddr)) ||
+         is_valid_pde(pmap_add_pde(pmap, vaddr));
+}
+
+/*! \brief Stores \a pte as the new PTE mapping virtual address \a vaddr.
+ *
+ * Page table must be present. TLB is not invalidated. */
+static void pmap_pte_store(pmap_t *pmap, vaddr_t vaddr, pte_t pte) {
   pde_t pde = PDE_OF(pmap, vaddr);
-  if (!is_valid_pde(pde))
-    pde = pmap_add_pde(pmap, vaddr);
+  assert(is_valid_pde(pde));
   PTE_OF(pde, vaddr) = pte;
+}
+
+/*! \brief Writes \a pte as the new PTE mapping virtual address \a vaddr. */
+static void pmap_pte_write(pmap_t *pmap, vaddr_t vaddr, pte_t pte,
+                           unsigned flags) {
+  pmap_pte_store(pmap, vaddr, pte | pmap_cache_bits(flags));
   tlb_invalidate(PTE_VPN2(vaddr) | PTE_ASID(pmap->asid));
 }
 
@@ -248,6 +314,9 @@ void pmap_activate(pmap_t *umap) {
   PCPU_SET(curpmap, umap);
   update_wired_pde(umap);
 
+  if (umap)
+    pmap_asid_assign(umap);
+
   /* Set ASID for current process */
   mips32_setentryhi(umap ? umap->asid : 0);
 }
@@ -257,18 +326,87 @@ void pmap_activate(pmap_t *umap) {
  */
 
 void pmap_kenter(vaddr_t va, paddr_t pa, vm_prot_t prot, unsigned flags) {
+  pmap_kenter_range(va, pa, PAGESIZE, prot, flags);
+}
+
+/* Large pages that can be used for wired kernel mappings, largest first. */
+static const size_t pmap_wired_pgsz[] = {16 << 20, 1 << 20, 64 << 10};
+
+/*! \brief Covers as much as possible of kernel mapping [va, va+size) with
+ * wired TLB entries of large pages.
+ *
+ * A TLB entry maps a pair of adjacent pages, and an invalid half would make
+ * accesses to other kernel memory that lies there fault. Hence a page size is
+ * used only if both pages of the pair are within the mapping.
+ *
+ * Page tables still describe the whole mapping, so the part that did not get
+ * a wired entry is handled by TLB refill as usual. */
+static void pmap_kwire(vaddr_t va, paddr_t pa, size_t size, pte_t pte) {
+  vaddr_t end = va + size;
+
+  while (va < end) {
+    size_t pgsz = 0;
+    for (size_t i = 0; i < __arraycount(pmap_wired_pgsz) && !pgsz; i++) {
+      size_t sz = pmap_wired_pgsz[i];
+      if (is_aligned(va, 2 * sz) && is_aligned(pa, sz) && end - va >= 2 * sz)
+        pgsz = sz;
+    }
+
+    if (pgsz == 0) {
+      va += PAGESIZE;
+      pa += PAGESIZE;
+      continue;
+    }
+
+    /* Both halves need global bit to make the entry global. */
+    tlbentry_t e = {.hi = PTE_VPN2(va),
+                    .lo0 = PTE_PFN(pa) | pte,
+                    .lo1 = PTE_PFN(pa + pgsz) | pte,
+                    .mask = PAGEMASK(pgsz)};
+    size_t len = 2 * pgsz;
+
+    if (!tlb_wire(&e))
+      return;
+
+    klog("Wired %08lx - %08lx with %ld KiB pages", va, va + len - 1,
+         pgsz >> 10);
+
+    va += len;
+    pa += len;
+  }
+}
+
+void pmap_kenter_range(vaddr_t va, paddr_t pa, size_t size, vm_prot_t prot,
+                       unsigned flags) {
   pmap_t *pmap = pmap_kernel();
 
-  assert(page_aligned_p(pa) && page_aligned_p(va));
-  assert(pmap_address_p(pmap, va));
+  assert(page_aligned_p(pa) && page_aligned_p(va) && page_aligned_p(size));
+  assert(pmap_contains_p(pmap, va, va + size));
   assert(pa != 0);
 
-  klog("Enter unmanaged mapping from %p to %p", va, pa);
+  klog("Enter unmanaged mapping from %p - %p to %p", va, va + size - 1, pa);
 
-  pte_t pte = vm_prot_map[prot] | PTE_GLOBAL;
+  pte_t pte = vm_prot_map[prot] | pmap_cache_bits(flags) | PTE_GLOBAL;
+  bool entered = false;
 
-  WITH_MTX_LOCK (&pmap->mtx)
-    pmap_pte_write(pmap, va, PTE_PFN(pa) | pte, flags);
+  while (!entered) {
+    WITH_MTX_LOCK (&pmap->mtx) {
+      /* Page tables are allocated before the range is changed. */
+      entered = true;
+      for (size_t off = 0; off < size && entered; off += PAGESIZE)
+        entered = pmap_ensure_pde(pmap, va + off);
+      if (entered) {
+        tlb_unwire(va, va + size);
+        for (size_t off = 0; off < size; off += PAGESIZE)
+          pmap_pte_store(pmap, va + off, PTE_PFN(pa + off) | pte);
+        tlb_invalidate_range(va, va + size, PTE_ASID(pmap->asid));
+        if (size >= 2 * pmap_wired_pgsz[__arraycount(pmap_wired_pgsz) - 1])
+          pmap_kwire(va, pa, size, pte);
+      }
+    }
+    if (!entered)
+      vm_wait();
+  }
 }
 
 void pmap_kremove(vaddr_t va, size_t size) {
@@ -281,15 +419,16 @@ void pmap_kremove(vaddr_t va, size_t size) {
        va + size - 1);
 
   WITH_MTX_LOCK (&pmap->mtx) {
-    for (size_t off = 0; off < size; off += PAGESIZE)
-      pmap_pte_write(pmap, va + off, PTE_GLOBAL, 0);
+    for (size_t off = 0; off < size; off += PAGESIZE) {
+      pde_t pde = PDE_OF(pmap, va + off);
+      if (is_valid_pde(pde))
+        PTE_OF(pde, va + off) = PTE_GLOBAL;
+    }
+    tlb_unwire(va, va + size);
+    tlb_invalidate_range(va, va + size, PTE_ASID(pmap->asid));
   }
 }
 
-bool pmap_kextract(vaddr_t va, paddr_t *pap) {
-  return pmap_extract(pmap_kernel(), va, pap);
-}
-
 /*
  * Pageable (user & kernel) memory interface.
  */
@@ -307,9 +446,15 @@ static bool pmap_extract_nolock(pmap_t *pmap, vaddr_t va, paddr_t *pap) {
   return true;
 }
 
+/* Kernel page tables are never freed, and mappings of kernel memory do not
+ * change while it's in use, so the owner may look it up without the lock. */
+bool pmap_kextract(vaddr_t va, paddr_t *pap) {
+  return pmap_extract_nolock(pmap_kernel(), va, pap);
+}
+
 void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
                 unsigned flags) {
-  paddr_t pa = pg->paddr;
+  paddr_t pa = vm_page_paddr(pg);
 
   assert(page_aligned_p(va));
   assert(pmap_address_p(pmap, va));
@@ -318,22 +463,71 @@ void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
 
   bool kern_mapping = (pmap == pmap_kernel());
 
-  /* Mark user pages as non-referenced & non-modified. */
-  pte_t mask = kern_mapping ? (PTE_VALID | PTE_DIRTY) : 0;
+  /* Writes to shared pages must fault to get a private copy. */
+  if (pg->flags & PG_COW)
+    prot &= ~VM_PROT_WRITE;
+
+  bool entered = false;
+
+  /* Zero page is never written to nor paged out, so it has no pv entries. */
+  if (pg->flags & PG_ZERO) {
+    pte_t pte = vm_prot_map[prot] | empty_pte(pmap);
+    while (!entered) {
+      WITH_MTX_LOCK (&pmap->mtx) {
+        if ((entered = pmap_ensure_pde(pmap, va)))
+          pmap_pte_write(pmap, va, PTE_PFN(pa) | pte, flags);
+      }
+      if (!entered)
+        vm_wait();
+    }
+    return;
+  }
+
+  /* Mark user pages as non-referenced & non-modified. Merged pages are not
+   * on pagedaemon queues, so their access is not tracked. */
+  bool tracked = !kern_mapping && !(pg->flags & PG_MERGED);
+  pte_t mask = tracked ? 0 : (PTE_VALID | PTE_DIRTY);
   pte_t pte = (vm_prot_map[prot] & mask) | empty_pte(pmap);
 
-  WITH_MTX_LOCK (&pmap->mtx) {
-    WITH_MTX_LOCK (pv_list_lock) {
-      pv_entry_t *pv = pv_find(pmap, va, pg);
-      if (pv == NULL)
-        pv_add(pmap, va, pg);
+  /* Nothing may wait for memory with pv lock held, as pagedaemon needs these
+   * locks to free pages. */
+  pv_entry_t *pv = pool_alloc(P_PV, M_ZERO);
+
+  while (!entered) {
+    WITH_MTX_LOCK (pv_lock(pg)) {
+      WITH_MTX_LOCK (&pmap->mtx) {
+        if ((entered = pmap_ensure_pde(pmap, va))) {
+          if (pv_find(pmap, va, pg) == NULL) {
+            pv_add(pmap, va, pg, pv);
+            pv = NULL;
+          }
+          if (kern_mapping)
+            pg->flags |= PG_MODIFIED | PG_REFERENCED;
+          else /* Modified bit is sticky, as contents were not written back. */
+            pg->flags &= ~PG_REFERENCED;
+          pmap_pte_write(pmap, va, PTE_PFN(pa) | pte, flags);
+        }
+      }
     }
-    if (kern_mapping)
-      pg->flags |= PG_MODIFIED | PG_REFERENCED;
-    else
-      pg->flags &= ~(PG_MODIFIED | PG_REFERENCED);
-    pmap_pte_write(pmap, va, PTE_PFN(pa) | pte, flags);
+    if (!entered)
+      vm_wait();
   }
+
+  if (pv)
+    pool_free(P_PV, pv);
+}
+
+unsigned pmap_tlb_misses(void) {
+  return tlb_misses();
+}
+
+size_t pmap_block_size(void) {
+  return 0;
+}
+
+bool pmap_enter_block(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
+                      unsigned flags) {
+  panic("Large pages are not supported!");
 }
 
 void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end) {
@@ -342,16 +536,33 @@ void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end) {
 
   klog("Remove page mapping for address range %p-%p", start, end);
 
+  tlb_gather_t tg;
+
   WITH_MTX_LOCK (&pmap->mtx) {
-    for (vaddr_t va = start; va < end; va += PAGESIZE) {
+    tlb_gather_init(&tg, PTE_ASID(pmap->asid));
+    /* If pmap had to be unlocked to get pv lock, the address is retried. */
+    for (vaddr_t va = start; va < end;) {
       paddr_t pa;
-      if (pmap_extract_nolock(pmap, va, &pa)) {
-        vm_page_t *pg = vm_page_find(pa);
-        WITH_MTX_LOCK (pv_list_lock)
-          pv_remove(pmap, va, pg);
-        pmap_pte_write(pmap, va, empty_pte(pmap), 0);
+      if (!pmap_extract_nolock(pmap, va, &pa)) {
+        va += PAGESIZE;
+        continue;
       }
+      vm_page_t *pg = vm_page_find(pa);
+      if (pg->flags & PG_ZERO) {
+        pmap_pte_store(pmap, va, empty_pte(pmap) | pmap_cache_bits(0));
+        tlb_gather_add(&tg, va);
+        va += PAGESIZE;
+        continue;
+      }
+      if (pv_lock_pmap(pmap, pg, &tg)) {
+        pv_remove(pmap, va, pg);
+        pmap_pte_store(pmap, va, empty_pte(pmap) | pmap_cache_bits(0));
+        tlb_gather_add(&tg, va);
+        va += PAGESIZE;
+      }
+      mtx_unlock(pv_lock(pg));
     }
+    tlb_gather_flush(&tg);
 
     /* TODO: Deallocate empty page table fragment by calling pmap_remove_pde. */
   }
@@ -364,13 +575,26 @@ void pmap_protect(pmap_t *pmap, vaddr_t start, vaddr_t end, vm_prot_t prot) {
   klog("Change protection bits to %x for address range %p-%p", prot, start,
        end);
 
+  tlb_gather_t tg;
+
   WITH_MTX_LOCK (&pmap->mtx) {
+    tlb_gather_init(&tg, PTE_ASID(pmap->asid));
     for (vaddr_t va = start; va < end; va += PAGESIZE) {
       pte_t pte = pmap_pte_read(pmap, va);
       if (pte == 0)
         continue;
-      pmap_pte_write(pmap, va, (pte & ~PTE_PROT_MASK) | vm_prot_map[prot], 0);
+      /* Shared pages stay read-only. */
+      vm_prot_t pg_prot = prot;
+      paddr_t pa;
+      vm_page_t *pg;
+      if (pmap_extract_nolock(pmap, va, &pa) && (pg = vm_page_find(pa)) &&
+          (pg->flags & PG_COW))
+        pg_prot &= ~VM_PROT_WRITE;
+      pte = (pte & ~PTE_PROT_MASK) | vm_prot_map[pg_prot];
+      pmap_pte_store(pmap, va, pte | pmap_cache_bits(0));
+      tlb_gather_add(&tg, va);
     }
+    tlb_gather_flush(&tg);
   }
 }
 
@@ -380,30 +604,32 @@ bool pmap_extract(pmap_t *pmap, vaddr_t va, paddr_t *pap) {
 }
 
 void pmap_page_remove(vm_page_t *pg) {
-  SCOPED_MTX_LOCK(pv_list_lock);
-  while (!TAILQ_EMPTY(&pg->pv_list)) {
-    pv_entry_t *pv = TAILQ_FIRST(&pg->pv_list);
+  SCOPED_MTX_LOCK(pv_lock(pg));
+  while (!SLIST_EMPTY(&pg->pv_list)) {
+    pv_entry_t *pv = SLIST_FIRST(&pg->pv_list);
     pmap_t *pmap = pv->pmap;
     vaddr_t va = pv->va;
-    TAILQ_REMOVE(&pg->pv_list, pv, page_link);
-    TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
-    pmap_pte_write(pmap, va, empty_pte(pmap), 0);
+    WITH_MTX_LOCK (&pmap->mtx) {
+      SLIST_REMOVE_HEAD(&pg->pv_list, page_link);
+      TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
+      pmap_pte_write(pmap, va, empty_pte(pmap), 0);
+    }
     pool_free(P_PV, pv);
   }
 }
 
 void pmap_zero_page(vm_page_t *pg) {
-  bzero(PG_KSEG0_ADDR(pg), PAGESIZE);
+  pagezero_fn(PG_KSEG0_ADDR(pg));
 }
 
 void pmap_copy_page(vm_page_t *src, vm_page_t *dst) {
-  memcpy(PG_KSEG0_ADDR(dst), PG_KSEG0_ADDR(src), PAGESIZE);
+  pagecopy_fn(PG_KSEG0_ADDR(dst), PG_KSEG0_ADDR(src));
 }
 
 static void pmap_modify_flags(vm_page_t *pg, pte_t set, pte_t clr) {
-  SCOPED_MTX_LOCK(pv_list_lock);
+  SCOPED_MTX_LOCK(pv_lock(pg));
   pv_entry_t *pv;
-  TAILQ_FOREACH (pv, &pg->pv_list, page_link) {
+  SLIST_FOREACH (pv, &pg->pv_list, page_link) {
     pmap_t *pmap = pv->pmap;
     vaddr_t va = pv->va;
     WITH_MTX_LOCK (&pmap->mtx) {
@@ -455,7 +681,6 @@ void pmap_set_modified(vm_page_t *pg) {
  */
 
 static void pmap_setup(pmap_t *pmap) {
-  pmap->asid = alloc_asid();
   mtx_init(&pmap->mtx, 0);
   TAILQ_INIT(&pmap->pte_pages);
   TAILQ_INIT(&pmap->pv_list);
@@ -464,13 +689,28 @@ static void pmap_setup(pmap_t *pmap) {
 void init_pmap(void) {
   pmap_setup(&kernel_pmap);
   kernel_pmap.pde = _kernel_pmap_pde;
+
+  for (int i = 0; i < PV_LOCKS; i++)
+    mtx_init(&pv_locks[i], 0);
+
+  /* Allocating cache lines without fetching them from memory requires
+   * destination to be written in whole lines, i.e. 32 bytes at a time. */
+  if (cpuinfo.dc_linesize == 32) {
+    pagezero_fn = pagezero_pf;
+    pagecopy_fn = pagecopy_pf;
+  }
+
+  klog("Page zero/copy routines: %s",
+       pagezero_fn == pagezero_pf ? "prepare-for-store" : "generic");
 }
 
 pmap_t *pmap_new(void) {
   pmap_t *pmap = pool_alloc(P_PMAP, M_ZERO);
   pmap_setup(pmap);
 
-  vm_page_t *pg = pmap_pagealloc();
+  vm_page_t *pg;
+  while (!(pg = pmap_pagealloc()))
+    vm_wait();
   pmap->pde = PG_KSEG0_ADDR(pg);
   klog("Page directory table allocated at %p", pmap->pde);
 
@@ -479,16 +719,19 @@ pmap_t *pmap_new(void) {
 
 void pmap_delete(pmap_t *pmap) {
   assert(pmap != pmap_kernel());
-  while (!TAILQ_EMPTY(&pmap->pv_list)) {
-    pv_entry_t *pv = TAILQ_FIRST(&pmap->pv_list);
-    vm_page_t *pg;
-    paddr_t pa;
-    pmap_extract_nolock(pmap, pv->va, &pa);
-    pg = vm_page_find(pa);
-    WITH_MTX_LOCK (pv_list_lock)
-      TAILQ_REMOVE(&pg->pv_list, pv, page_link);
-    TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
-    pool_free(P_PV, pv);
+  WITH_MTX_LOCK (&pmap->mtx) {
+    while (!TAILQ_EMPTY(&pmap->pv_list)) {
+      pv_entry_t *pv = TAILQ_FIRST(&pmap->pv_list);
+      paddr_t pa;
+      pmap_extract_nolock(pmap, pv->va, &pa);
+      vm_page_t *pg = vm_page_find(pa);
+      if (pv_lock_pmap(pmap, pg, NULL)) {
+        SLIST_REMOVE(&pg->pv_list, pv, pv_entry, page_link);
+        TAILQ_REMOVE(&pmap->pv_list, pv, pmap_link);
+        pool_free(P_PV, pv);
+      }
+      mtx_unlock(pv_lock(pg));
+    }
   }
 
   while (!TAILQ_EMPTY(&pmap->pte_pages)) {
@@ -499,6 +742,5 @@ void pmap_delete(pmap_t *pmap) {
 
   vm_page_t *pg = vm_page_find(MIPS_KSEG0_TO_PHYS(pmap->pde));
   vm_page_free(pg);
-  free_asid(pmap->asid);
   pool_free(P_PMAP, pmap);
 }
@@ -0,0 +1,105 @@
+#include <sys/mimiker.h>
+#include <sys/context.h>
+#include <sys/stack.h>
+#include <sys/thread.h>
+
+/*
+ * MIPS ABI does not link stack frames together, even if the code is
+ * compiled with frame pointer. Hence kernel stack is unwound by looking for
+ * function prologue, i.e. scanning instructions backwards from PC for
+ * "addiu sp,sp,-N" that allocates stack frame and "sw ra,M(sp)" that stores
+ * return address in that frame. This is a heuristic - a function with many
+ * exit paths can confuse it, so the unwinder stops at the first frame that
+ * doesn't look right.
+ */
+
+#define INSN_ADDIU_SP_SP 0x27bd0000 /* addiu sp,sp,imm */
+#define INSN_SW_RA_SP 0xafbf0000    /* sw ra,imm(sp) */
+#define INSN_JR_RA 0x03e00008       /* jr ra */
+#define INSN_OPMASK 0xffff0000
+#define INSN_IMM(insn) ((int16_t)((insn)&0xffff))
+
+/* How many instructions are examined to find beginning of a function. */
+#define MAX_SCAN 1024
+
+extern char __etext[];
+
+static inline bool kernel_text_p(vaddr_t pc) {
+  return (vaddr_t)__text <= pc && pc < (vaddr_t)__etext;
+}
+
+/* Finds size of stack frame of function containing pc, and offset of saved
+ * return address in that frame (or -1 if it's kept in ra register). */
+static bool frame_info(vaddr_t pc, int *framesize, int *raoff) {
+  uint32_t *insn = (uint32_t *)(pc & ~3);
+
+  *raoff = -1;
+
+  for (int i = 0; i < MAX_SCAN && kernel_text_p((vaddr_t)insn); i++) {
+    uint32_t op = *insn--;
+
+    if ((op & INSN_OPMASK) == INSN_SW_RA_SP) {
+      *raoff = INSN_IMM(op);
+    } else if ((op & INSN_OPMASK) == INSN_ADDIU_SP_SP && INSN_IMM(op) < 0) {
+      *framesize = -INSN_IMM(op);
+      return true;
+    } else if (op == INSN_JR_RA) {
+      /* Reached end of previous function - this one is a leaf that does
+       * not allocate stack frame. */
+      *framesize = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+unsigned stack_unwind_kernel(thread_t *td, ctx_t *ctx, uint64_t *pcs,
+                             unsigned n) {
+  vaddr_t lo = (vaddr_t)td->td_kstack.stk_base;
+  vaddr_t hi = lo + td->td_kstack.stk_size;
+  vaddr_t pc = _REG(ctx, EPC);
+  vaddr_t sp = _REG(ctx, SP);
+  vaddr_t ra = _REG(ctx, RA);
+  unsigned i = 0;
+
+  if (n == 0)
+    return 0;
+
+  pcs[i++] = pc;
+
+  while (i < n) {
+    int framesize, raoff;
+
+    if (!kernel_text_p(pc) || !frame_info(pc, &framesize, &raoff))
+      break;
+
+    if (raoff >= 0) {
+      vaddr_t slot = sp + raoff;
+      if (slot < lo || slot + sizeof(register_t) > hi)
+        break;
+      ra = *(register_t *)slot;
+    } else if (i > 1) {
+      /* Only the interrupted function may keep return address in ra. */
+      break;
+    }
+
+    sp += framesize;
+    if (!kernel_text_p(ra) || ra == pc)
+      break;
+    pc = ra;
+    pcs[i++] = pc;
+  }
+
+  return i;
+}
+
+/* Return address register holds a stale value unless the program was
+ * stopped in a leaf function, and user stack can't be scanned for function
+ * prologues as cheaply as kernel's one. So only the interrupted PC is taken. */
+unsigned stack_unwind_user(mcontext_t *uctx, uint64_t *pcs, unsigned n) {
+  if (n == 0)
+    return 0;
+  pcs[0] = _REG(uctx, EPC);
+  return 1;
+}
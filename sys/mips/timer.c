@@ -14,6 +14,8 @@ typedef struct mips_timer_state {
   uint32_t last_count_lo;     /* used to detect counter overflow */
   volatile timercntr_t count; /* last written value of counter reg. (64 bits) */
   volatile timercntr_t compare; /* last read value of compare reg. (64 bits) */
+  bool oneshot;                 /* timer works in one-shot mode */
+  bool intr_setup;              /* interrupt handler has been installed */
   timer_t timer;
   resource_t *irq_res;
 } mips_timer_state_t;
@@ -49,29 +51,65 @@ static int set_next_tick(mips_timer_state_t *state) {
   return ticks;
 }
 
+/* Minimum number of counter ticks between now and next one-shot event. */
+#define MIN_ONESHOT_DELTA 100
+
+static void set_deadline(mips_timer_state_t *state, uint64_t deadline) {
+  SCOPED_INTR_DISABLED();
+
+  uint64_t count = read_count(state);
+  /* Compare register is 32-bit wide, so we cannot set a deadline too far
+   * in the future. Timer will trigger earlier and user will rearm it. */
+  if (deadline > count && deadline - count > UINT32_MAX)
+    deadline = count + UINT32_MAX;
+
+  /* Counter keeps running while compare register is written, so the deadline
+   * is pushed forward until it is still ahead of counter after the write. */
+  do {
+    if (deadline < count + MIN_ONESHOT_DELTA)
+      deadline = count + MIN_ONESHOT_DELTA;
+    state->compare.val = deadline;
+    mips32_set_c0(C0_COMPARE, state->compare.lo);
+    count = read_count(state);
+  } while (state->compare.val <= count);
+}
+
 static intr_filter_t mips_timer_intr(void *data) {
   device_t *dev = data;
   mips_timer_state_t *state = dev->state;
-  /* TODO(cahir): can we tell scheduler that clock ticked more than once? */
-  (void)set_next_tick(state);
+  if (state->oneshot) {
+    /* Acknowledge the interrupt. Callback is expected to rearm the timer. */
+    set_deadline(state, read_count(state) + UINT32_MAX);
+  } else {
+    /* TODO(cahir): can we tell scheduler that clock ticked more than once? */
+    (void)set_next_tick(state);
+  }
   tm_trigger(&state->timer);
   return IF_FILTERED;
 }
 
 static int mips_timer_start(timer_t *tm, unsigned flags, const bintime_t start,
                             const bintime_t period) {
-  assert(flags & TMF_PERIODIC);
-  assert(!(flags & TMF_ONESHOT));
-
   device_t *dev = tm->tm_priv;
   mips_timer_state_t *state = dev->state;
 
-  state->period_cntr = bintime_mul(period, tm->tm_frequency).sec;
-  state->compare.val = read_count(state);
-  state->last_count_lo = state->count.lo;
-  set_next_tick(state);
-  bus_intr_setup(dev, state->irq_res, mips_timer_intr, NULL, dev,
-                 "MIPS CPU timer");
+  if (flags & TMF_ONESHOT) {
+    state->oneshot = true;
+    set_deadline(state, bintime_mul(start, tm->tm_frequency).sec);
+  } else {
+    assert(flags & TMF_PERIODIC);
+    state->oneshot = false;
+    state->period_cntr = bintime_mul(period, tm->tm_frequency).sec;
+    state->compare.val = read_count(state);
+    state->last_count_lo = state->count.lo;
+    set_next_tick(state);
+  }
+
+  if (!state->intr_setup) {
+    bus_intr_setup(dev, state->irq_res, mips_timer_intr, NULL, dev,
+                   "MIPS CPU timer");
+    state->intr_setup = true;
+  }
   return 0;
 }
 
@@ -79,6 +117,7 @@ static int mips_timer_stop(timer_t *tm) {
   device_t *dev = tm->tm_priv;
   mips_timer_state_t *state = dev->state;
   bus_intr_teardown(dev, state->irq_res);
+  state->intr_setup = false;
   return 0;
 }
 
@@ -105,7 +144,7 @@ static int mips_timer_attach(device_t *dev) {
 
   state->timer = (timer_t){
     .tm_name = "mips-cpu-timer",
-    .tm_flags = TMF_PERIODIC,
+    .tm_flags = TMF_PERIODIC | TMF_ONESHOT,
     .tm_frequency = CPU_FREQ,
     .tm_min_period = BINTIME(1 / (double)CPU_FREQ),
     .tm_max_period = BINTIME(((1LL << 32) - 1) / (double)CPU_FREQ),
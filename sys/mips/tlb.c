@@ -1,6 +1,9 @@
+#include <sys/mimiker.h>
+#include <machine/vm_param.h>
 #include <mips/m32c0.h>
 #include <mips/tlb.h>
 #include <sys/interrupt.h>
+#include <sys/pcpu.h>
 
 #define mips32_getasid() (mips32_getentryhi() & PTE_ASID_MASK)
 #define mips32_setasid(v) mips32_setentryhi((v)&PTE_ASID_MASK)
@@ -10,6 +13,11 @@
 
 static unsigned _tlb_size = 0;
 
+/* Copies of wired entries with large pages, so they can be moved around when
+ * one of them is released. Protected by disabling interrupts. */
+static tlbentry_t _tlb_wired[TLB_WIRED_MAX];
+static unsigned _tlb_nwired = 0;
+
 /*
  * NOTE: functions that set coprocessor 0 registers like TLBHi/Lo, Index,
  * etc. must not be interrupted or generate exceptions between setting
@@ -28,8 +36,11 @@ static inline void _tlb_read(unsigned i, tlbentry_t *e) {
   tlbhi_t hi = mips32_getentryhi();
   tlblo_t lo0 = mips32_getentrylo0();
   tlblo_t lo1 = mips32_getentrylo1();
+  tlbmask_t mask = mips32_getpagemask();
+  /* TLB refill handler expects PageMask to select 4KiB pages. */
+  mips32_setpagemask(0);
   barrier();
-  *e = (tlbentry_t){.hi = hi, .lo0 = lo0, .lo1 = lo1};
+  *e = (tlbentry_t){.hi = hi, .lo0 = lo0, .lo1 = lo1, .mask = mask};
 }
 
 static inline void _load_tlb_entry(tlbentry_t *e) {
@@ -40,10 +51,28 @@ static inline void _load_tlb_entry(tlbentry_t *e) {
   tlbhi_t hi = e->hi;
   tlblo_t lo0 = e->lo0;
   tlblo_t lo1 = e->lo1;
+  tlbmask_t mask = e->mask;
   barrier();
   mips32_setentryhi(hi);
   mips32_setentrylo0(lo0);
   mips32_setentrylo1(lo1);
+  mips32_setpagemask(mask);
+}
+
+/* Returns the first virtual address translated by the entry. */
+static inline vaddr_t _tlb_entry_start(tlbentry_t *e) {
+  return e->hi & ~(e->mask | PTE_LO_INDEX_MASK | (PAGESIZE - 1));
+}
+
+/* Returns the size of address range translated by the entry. */
+static inline size_t _tlb_entry_size(tlbentry_t *e) {
+  return (e->mask | PTE_LO_INDEX_MASK | (PAGESIZE - 1)) + 1;
+}
+
+static inline bool _tlb_entry_overlaps(tlbentry_t *e, vaddr_t start,
+                                       vaddr_t end) {
+  vaddr_t va = _tlb_entry_start(e);
+  return va < end && start < va + _tlb_entry_size(e);
 }
 
 static inline int _tlb_probe(tlbhi_t hi) {
@@ -83,7 +112,8 @@ void tlb_invalidate(tlbhi_t hi) {
   SCOPED_INTR_DISABLED();
   tlbhi_t saved = mips32_getasid();
   int i = _tlb_probe(hi);
-  if (i >= 0)
+  /* Wired entries are changed only by tlb_write and tlb_unwire. */
+  if (i >= (int)mips32_getwired())
     _tlb_invalidate(i);
   mips32_setasid(saved);
 }
@@ -105,6 +135,90 @@ void tlb_invalidate_asid(tlbhi_t asid) {
   mips32_setasid(saved);
 }
 
+void tlb_invalidate_all(void) {
+  SCOPED_INTR_DISABLED();
+  tlbhi_t saved = mips32_getasid();
+  for (unsigned i = mips32_getwired(); i < _tlb_size; i++) {
+    tlbentry_t e;
+    _tlb_read(i, &e);
+    /* Ignore global mappings! */
+    if ((e.lo0 & PTE_GLOBAL) && (e.lo1 & PTE_GLOBAL))
+      continue;
+    _tlb_invalidate(i);
+  }
+  mips32_setasid(saved);
+}
+
+void tlb_invalidate_range(vaddr_t start, vaddr_t end, tlbhi_t asid) {
+  start = PTE_VPN2(start);
+  end = roundup(end, 2 * PAGESIZE);
+
+  /* Each TLB entry maps a pair of pages. Probing for every pair is cheaper
+   * than scanning whole TLB only if the range is small. */
+  if ((end - start) / (2 * PAGESIZE) <= _tlb_size) {
+    for (vaddr_t va = start; va < end; va += 2 * PAGESIZE)
+      tlb_invalidate(va | asid);
+    return;
+  }
+
+  SCOPED_INTR_DISABLED();
+  tlbhi_t saved = mips32_getasid();
+  for (unsigned i = mips32_getwired(); i < _tlb_size; i++) {
+    tlbentry_t e;
+    _tlb_read(i, &e);
+    vaddr_t va = PTE_VPN2(e.hi);
+    if (va < start || va >= end)
+      continue;
+    /* Ignore non-global mappings with different ASID */
+    bool global = (e.lo0 & PTE_GLOBAL) && (e.lo1 & PTE_GLOBAL);
+    if (!global && (e.hi & PTE_ASID_MASK) != asid)
+      continue;
+    _tlb_invalidate(i);
+  }
+  mips32_setasid(saved);
+}
+
+void tlb_gather_init(tlb_gather_t *tg, tlbhi_t asid) {
+  tg->asid = asid;
+  tg->count = 0;
+  tg->start = (vaddr_t)-1;
+  tg->end = 0;
+}
+
+void tlb_gather_add(tlb_gather_t *tg, vaddr_t va) {
+  va = PTE_VPN2(va);
+  /* Both pages of a pair are translated by the same entry. */
+  if (tg->count > 0 && tg->count <= TLB_GATHER_MAX &&
+      tg->va[tg->count - 1] == va)
+    return;
+  if (tg->count < TLB_GATHER_MAX)
+    tg->va[tg->count] = va;
+  tg->count++;
+  tg->start = min(tg->start, va);
+  tg->end = max(tg->end, va + 2 * PAGESIZE);
+}
+
+void tlb_gather_flush(tlb_gather_t *tg) {
+  if (tg->count == 0)
+    return;
+
+  if (tg->count > TLB_GATHER_MAX) {
+    tlb_invalidate_range(tg->start, tg->end, tg->asid);
+  } else {
+    SCOPED_INTR_DISABLED();
+    tlbhi_t saved = mips32_getasid();
+    unsigned wired = mips32_getwired();
+    for (unsigned i = 0; i < tg->count; i++) {
+      int j = _tlb_probe(tg->va[i] | tg->asid);
+      if (j >= (int)wired)
+        _tlb_invalidate(j);
+    }
+    mips32_setasid(saved);
+  }
+
+  tlb_gather_init(tg, tg->asid);
+}
+
 void tlb_write(unsigned i, tlbentry_t *e) {
   SCOPED_INTR_DISABLED();
   tlbhi_t saved = mips32_getasid();
@@ -115,5 +229,69 @@ void tlb_write(unsigned i, tlbentry_t *e) {
     mips32_setindex(i);
     mips32_tlbwi();
   }
+  mips32_setpagemask(0);
+  mips32_setasid(saved);
+}
+
+bool tlb_wire(tlbentry_t *e) {
+  SCOPED_INTR_DISABLED();
+
+  /* Wired entries must not take away too many slots from TLB refill. */
+  if (_tlb_nwired >= min((unsigned)TLB_WIRED_MAX, _tlb_size / 8))
+    return false;
+
+  tlbhi_t saved = mips32_getasid();
+  vaddr_t start = _tlb_entry_start(e);
+  vaddr_t end = start + _tlb_entry_size(e);
+  unsigned wired = mips32_getwired();
+
+  /* Multiple matching entries may cause machine check exception. */
+  for (unsigned i = wired; i < _tlb_size; i++) {
+    tlbentry_t old;
+    _tlb_read(i, &old);
+    if (_tlb_entry_overlaps(&old, start, end))
+      _tlb_invalidate(i);
+  }
+
+  _tlb_wired[_tlb_nwired++] = *e;
+  mips32_setwired(wired + 1);
+  _load_tlb_entry(e);
+  mips32_setindex(wired);
+  mips32_tlbwi();
+  mips32_setpagemask(0);
+  mips32_setasid(saved);
+  return true;
+}
+
+void tlb_unwire(vaddr_t start, vaddr_t end) {
+  SCOPED_INTR_DISABLED();
+
+  unsigned n = 0;
+  for (unsigned i = 0; i < _tlb_nwired; i++)
+    if (!_tlb_entry_overlaps(&_tlb_wired[i], start, end))
+      _tlb_wired[n++] = _tlb_wired[i];
+
+  if (n == _tlb_nwired)
+    return;
+
+  /* Remaining entries are moved to the front of wired area, so that the
+   * freed slots can be given back to TLB refill. All slots are cleared
+   * first, as the same entry must not be present in TLB twice. */
+  tlbhi_t saved = mips32_getasid();
+  unsigned base = mips32_getwired() - _tlb_nwired;
+  for (unsigned i = 0; i < _tlb_nwired; i++)
+    _tlb_invalidate(base + i);
+  for (unsigned i = 0; i < n; i++) {
+    _load_tlb_entry(&_tlb_wired[i]);
+    mips32_setindex(base + i);
+    mips32_tlbwi();
+  }
+  mips32_setpagemask(0);
+  mips32_setwired(base + n);
+  _tlb_nwired = n;
   mips32_setasid(saved);
 }
+
+unsigned tlb_misses(void) {
+  return PCPU_GET(tlb_misses);
+}
@@ -8,6 +8,7 @@
 #include <sys/pmap.h>
 #include <sys/sysent.h>
 #include <sys/thread.h>
+#include <sys/trace.h>
 #include <sys/vm_map.h>
 #include <sys/vm_physmem.h>
 #include <sys/ktest.h>
@@ -56,9 +57,13 @@ static void syscall_handler(ctx_t *ctx, syscall_result_t *result) {
 
   assert(td->td_proc != NULL);
 
+  TRACE(TRACE_SYSCALL_ENTER, code);
+
   if (!error)
     error = se->call(td->td_proc, (void *)args, &retval);
 
+  TRACE(TRACE_SYSCALL_EXIT, code, error, retval);
+
   result->retval = error ? -1 : retval;
   result->error = error;
 }
@@ -129,6 +134,7 @@ static __noreturn void kernel_oops(ctx_t *ctx) {
 
 static void tlb_exception_handler(ctx_t *ctx) {
   thread_t *td = thread_self();
+  int error = EFAULT;
 
   int code = exc_code(ctx);
   vaddr_t vaddr = _REG(ctx, BADVADDR);
@@ -142,12 +148,14 @@ static void tlb_exception_handler(ctx_t *ctx) {
     goto fault;
   }
 
+  /* Writes to the zero page or pages shared after merging are resolved by
+   * vm_page_fault, which replaces them with a private copy. */
   paddr_t pa;
-  if (pmap_extract(pmap, vaddr, &pa)) {
-    vm_page_t *pg = vm_page_find(pa);
-
+  vm_page_t *pg;
+  if (pmap_extract(pmap, vaddr, &pa) &&
+      !((pg = vm_page_find(pa))->flags & PG_COW)) {
     /* Kernel non-pageable memory? */
-    if (TAILQ_EMPTY(&pg->pv_list))
+    if (SLIST_EMPTY(&pg->pv_list))
       goto fault;
 
     if (code == EXC_TLBL) {
@@ -168,7 +176,7 @@ static void tlb_exception_handler(ctx_t *ctx) {
     goto fault;
   }
   vm_prot_t access = (code == EXC_TLBL) ? VM_PROT_READ : VM_PROT_WRITE;
-  if (vm_page_fault(vmap, vaddr, access) == 0)
+  if ((error = vm_page_fault(vmap, vaddr, access)) == 0)
     return;
 
 fault:
@@ -177,8 +185,9 @@ fault:
     _REG(ctx, EPC) = td->td_onfault;
     td->td_onfault = 0;
   } else if (user_mode_p(ctx)) {
-    /* Send a segmentation fault signal to the user program. */
-    sig_trap(ctx, SIGSEGV);
+    /* Send a segmentation fault signal to the user program, or bus error if
+     * the page couldn't be read from backing store. */
+    sig_trap(ctx, error == EIO ? SIGBUS : SIGSEGV);
   } else {
     /* Panic when kernel-mode thread uses wrong pointer. */
     kernel_oops(ctx);
@@ -0,0 +1,115 @@
+"""Minimal ELF reader used by host-side tools that decode kernel buffers.
+
+Only little-endian ELF32 and ELF64 files are supported, which covers both
+mips (malta) and aarch64 (rpi3) kernel images.
+"""
+
+import bisect
+import struct
+
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+STT_OBJECT = 1
+
+
+class Section():
+    def __init__(self, name, type, addr, offset, size, link, entsize):
+        self.name = name
+        self.type = type
+        self.addr = addr
+        self.offset = offset
+        self.size = size
+        self.link = link
+        self.entsize = entsize
+
+
+class Elf():
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF':
+            raise ValueError('%s: not an ELF file' % path)
+        if self.data[5] != 1:
+            raise ValueError('%s: only little-endian ELF is supported' % path)
+        self.bits = 64 if self.data[4] == 2 else 32
+        self.ptrsize = self.bits // 8
+        self.sections = self._read_sections()
+        self._symbols = None
+
+    def _read_sections(self):
+        if self.bits == 32:
+            shoff, = struct.unpack_from('<I', self.data, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data,
+                                                            0x2e)
+            fmt = '<IIIIIIIIII'
+        else:
+            shoff, = struct.unpack_from('<Q', self.data, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data,
+                                                            0x3a)
+            fmt = '<IIQQQQIIQQ'
+        raw = []
+        for i in range(shnum):
+            raw.append(struct.unpack_from(fmt, self.data,
+                                          shoff + i * shentsize))
+        strtab = raw[shstrndx]
+        sections = []
+        for (name, type, _, addr, offset, size, link, _, _, entsize) in raw:
+            sname = self._cstring(strtab[4] + name)
+            sections.append(Section(sname, type, addr, offset, size, link,
+                                    entsize))
+        return sections
+
+    def _cstring(self, offset):
+        end = self.data.index(b'\0', offset)
+        return self.data[offset:end].decode('utf-8', errors='replace')
+
+    def section_of(self, addr):
+        for s in self.sections:
+            if s.addr and s.type != 8 and s.addr <= addr < s.addr + s.size:
+                return s
+        return None
+
+    def read_cstring(self, addr):
+        """Return C string stored in the image at virtual address addr."""
+        s = self.section_of(addr)
+        if s is None:
+            return None
+        return self._cstring(s.offset + addr - s.addr)
+
+    @property
+    def symbols(self):
+        """Sorted list of (address, size, name) of functions and objects."""
+        if self._symbols is not None:
+            return self._symbols
+        self._symbols = []
+        for s in self.sections:
+            if s.type != SHT_SYMTAB:
+                continue
+            strtab = self.sections[s.link]
+            for i in range(s.size // s.entsize):
+                off = s.offset + i * s.entsize
+                if self.bits == 32:
+                    name, value, size, info = struct.unpack_from(
+                        '<IIIB', self.data, off)
+                else:
+                    name, info, _, _, value, size = struct.unpack_from(
+                        '<IBBHQQ', self.data, off)
+                if info & 0xf not in (STT_FUNC, STT_OBJECT) or not value:
+                    continue
+                self._symbols.append(
+                    (value, size, self._cstring(strtab.offset + name)))
+        self._symbols.sort()
+        self._addrs = [sym[0] for sym in self._symbols]
+        return self._symbols
+
+    def symbolize(self, addr):
+        """Return name of the symbol that contains addr or None."""
+        symbols = self.symbols
+        i = bisect.bisect_right(self._addrs, addr) - 1
+        if i < 0:
+            return None
+        value, size, name = symbols[i]
+        if size and addr >= value + size:
+            return None
+        return name
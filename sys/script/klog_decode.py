@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Decode binary kernel log records read from /dev/klog.
+
+Records refer to format strings and file names by their addresses in kernel
+image, so the kernel ELF file that produced the log must be provided.
+"""
+
+import argparse
+import os.path
+import re
+import struct
+import sys
+
+from kelf import Elf
+
+
+KLOG_H = os.path.join(os.path.dirname(__file__), '../../include/sys/klog.h')
+
+FORMAT_RE = re.compile(
+    r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([a-zA-Z%])')
+
+
+def klog_origins():
+    with open(KLOG_H) as f:
+        text = f.read()
+    enum = re.search(r'typedef enum {(.*?)} klog_origin_t;', text, re.S)
+    names = re.findall(r'\bKL_(\w+),', enum.group(1))
+    return [name.lower() for name in names]
+
+
+def record_format(ptrsize):
+    # Matches layout of klog_entry_t: kl_seq, kl_origin, kl_timestamp (sec,
+    # frac), kl_tid, kl_line, kl_file, kl_format, kl_params[6].
+    ptr = 'I' if ptrsize == 4 else 'Q'
+    return struct.Struct('<IIqQII' + ptr * 8)
+
+
+def format_message(elf, fmt, params):
+    params = list(params)
+    mask = (1 << (elf.ptrsize * 8)) - 1
+
+    def subst(m):
+        flags, length, conv = m.groups()
+        if conv == '%':
+            return '%'
+        value = params.pop(0) if params else 0
+        if conv == 's':
+            return elf.read_cstring(value) or '0x%x' % value
+        if conv == 'p':
+            return '0x%x' % value
+        if conv in 'di':
+            sign = 1 << (elf.ptrsize * 8 - 1)
+            value = (value & mask) - ((value & sign) << 1)
+        if conv == 'c':
+            return chr(value & 0xff)
+        if conv in 'diouxX':
+            return ('%' + flags + conv) % value
+        return m.group(0)
+
+    return FORMAT_RE.sub(subst, fmt)
+
+
+def decode(elf, data):
+    origins = klog_origins()
+    rec = record_format(elf.ptrsize)
+    entries = []
+    for off in range(0, len(data) - rec.size + 1, rec.size):
+        (seq, origin, sec, frac, tid, line, file, fmt, *params) = \
+            rec.unpack_from(data, off)
+        entries.append((sec + frac / 2**64, tid, origin, line, file, fmt,
+                        params))
+    # Records coming from different CPUs are not ordered.
+    entries.sort(key=lambda e: e[0])
+    for (time, tid, origin, line, file, fmt, params) in entries:
+        fmt = elf.read_cstring(fmt) or '<unknown format 0x%x>' % fmt
+        if origin < len(origins) and origins[origin] != 'undef':
+            source = origins[origin]
+        else:
+            source = '%s:%d' % (elf.read_cstring(file), line)
+        print('%12.6f %4d [%s] %s' % (time, tid, source,
+                                      format_message(elf, fmt, params)))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Decode binary records read from /dev/klog.')
+    parser.add_argument('kernel', help='Kernel ELF image (e.g. mimiker.elf).')
+    parser.add_argument('records', nargs='?', default='-',
+                        help='File with records (default: stdin).')
+    args = parser.parse_args()
+
+    if args.records == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.records, 'rb') as f:
+            data = f.read()
+
+    decode(Elf(args.kernel), data)
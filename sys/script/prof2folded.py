@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""Convert profiler samples read from /dev/prof into folded stacks.
+
+Each output line has the form "program;outer;...;inner count" which is the
+input format of flamegraph.pl (https://github.com/brendangregg/FlameGraph)
+and speedscope. Kernel addresses are symbolized using the kernel image, user
+addresses using program binaries found by name of the sampled program.
+"""
+
+import argparse
+import collections
+import os
+import os.path
+import struct
+import sys
+
+from kelf import Elf
+
+
+PROF_DEPTH = 8
+PROF_NAMELEN = 16
+
+# Matches layout of prof_sample_t: ps_seq, ps_cpu, ps_kdepth, ps_udepth,
+# ps_tid, ps_pid, ps_name, ps_pc[PROF_DEPTH].
+RECORD = struct.Struct('<IHBBII%ds%dQ' % (PROF_NAMELEN, PROF_DEPTH))
+
+
+class Symbolizer():
+    def __init__(self, kernel, sysroot, user):
+        self.kernel = Elf(kernel)
+        self.paths = {}
+        self.images = {}
+        if sysroot:
+            for root, _, files in os.walk(sysroot):
+                for name in files:
+                    self.paths.setdefault(name, os.path.join(root, name))
+        for path in user:
+            name = os.path.basename(path)
+            if name.endswith('.uelf'):
+                name = name[:-5]
+            self.paths[name] = path
+
+    def image(self, program):
+        if program not in self.images:
+            path = self.paths.get(program)
+            try:
+                self.images[program] = Elf(path) if path else None
+            except (OSError, ValueError):
+                self.images[program] = None
+        return self.images[program]
+
+    @staticmethod
+    def lookup(elf, pc, inner):
+        # Return addresses point after the call instruction, which may be
+        # the first instruction of the next function.
+        addr = pc if inner else pc - 1
+        name = elf.symbolize(addr) if elf else None
+        return name or '0x%x' % pc
+
+    def frames(self, program, pcs, image):
+        return [self.lookup(image, pc, i == 0) for i, pc in enumerate(pcs)]
+
+    def stack(self, program, kpcs, upcs):
+        # Frames are stored innermost first, folded stacks list them
+        # outermost first.
+        user = self.frames(program, upcs, self.image(program))
+        kernel = self.frames(program, kpcs, self.kernel)
+        return [program] + user[::-1] + kernel[::-1]
+
+
+def read_samples(data):
+    for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        (seq, cpu, kdepth, udepth, tid, pid, name, *pcs) = \
+            RECORD.unpack_from(data, off)
+        name = name.split(b'\0', 1)[0].decode('utf-8', errors='replace')
+        kdepth = min(kdepth, PROF_DEPTH)
+        udepth = min(udepth, PROF_DEPTH - kdepth)
+        yield (name or '[unknown]', pcs[:kdepth], pcs[kdepth:kdepth + udepth])
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Convert samples read from /dev/prof to folded stacks.')
+    parser.add_argument('kernel', help='Kernel ELF image (e.g. mimiker.elf).')
+    parser.add_argument('samples', nargs='?', default='-',
+                        help='File with samples (default: stdin).')
+    parser.add_argument('--sysroot', help='Directory with user programs.')
+    parser.add_argument('--user', action='append', default=[],
+                        help='User program image (can be repeated).')
+    args = parser.parse_args()
+
+    if args.samples == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.samples, 'rb') as f:
+            data = f.read()
+
+    sym = Symbolizer(args.kernel, args.sysroot, args.user)
+    counts = collections.Counter()
+    for (program, kpcs, upcs) in read_samples(data):
+        counts[';'.join(sym.stack(program, kpcs, upcs))] += 1
+
+    for stack, count in sorted(counts.items()):
+        print('%s %d' % (stack, count))
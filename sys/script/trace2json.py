@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Convert binary trace records read from /dev/trace into JSON trace format.
+
+Output can be loaded into chrome://tracing or https://ui.perfetto.dev. Each
+CPU gets a track that shows which thread was running and which interrupts
+were handled. Each thread gets a track with system calls it performed and
+instant events like page faults, wakeups or blocking on turnstiles.
+"""
+
+import argparse
+import json
+import os.path
+import re
+import struct
+import sys
+
+
+INCLUDE = os.path.join(os.path.dirname(__file__), '../../include/sys')
+
+# Matches layout of trace_event_t: te_seq, te_type, te_cpu, te_time, te_tid,
+# te_pad, te_args[3].
+RECORD = struct.Struct('<IHHQII3Q')
+
+CPU_PID = 0
+THREAD_PID = 1
+
+
+def trace_types():
+    with open(os.path.join(INCLUDE, 'trace.h')) as f:
+        text = f.read()
+    enum = re.search(r'typedef enum {(.*?)} trace_type_t;', text, re.S)
+    return re.findall(r'\b(TRACE_\w+),', enum.group(1))
+
+
+def syscall_names():
+    with open(os.path.join(INCLUDE, 'syscall.h')) as f:
+        text = f.read()
+    return {int(num): name for name, num in
+            re.findall(r'#define SYS_(\w+)\s+(\d+)', text)}
+
+
+def read_events(data):
+    types = trace_types()
+    events = []
+    for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        (seq, type, cpu, time, tid, _, *args) = RECORD.unpack_from(data, off)
+        if type < len(types):
+            events.append((time, cpu, tid, types[type], args))
+    # Records coming from different CPUs are not ordered.
+    events.sort(key=lambda ev: ev[0])
+    return events
+
+
+def convert(events):
+    syscalls = syscall_names()
+    out = []
+    running = {}  # cpu -> (thread id, start time)
+    insyscall = {}  # thread id -> syscall number
+    threads = set()
+
+    def usec(ns):
+        return ns / 1000.0
+
+    def run_slice(cpu, end):
+        tid, start = running[cpu]
+        if end == start:
+            return
+        out.append({'name': 'thread %d' % tid, 'ph': 'X', 'pid': CPU_PID,
+                    'tid': cpu, 'ts': usec(start), 'dur': usec(end - start),
+                    'args': {'tid': tid}})
+
+    def instant(name, time, tid, args):
+        out.append({'name': name, 'ph': 'i', 's': 't', 'pid': THREAD_PID,
+                    'tid': tid, 'ts': usec(time), 'args': args})
+
+    for (time, cpu, tid, type, args) in events:
+        threads.add(tid)
+        running.setdefault(cpu, (tid, time))
+
+        if type == 'TRACE_SCHED_SWITCH':
+            run_slice(cpu, time)
+            running[cpu] = (args[1], time)
+        elif type == 'TRACE_SCHED_WAKEUP':
+            instant('wakeup %d' % args[0], time, tid, {'reason': args[1]})
+        elif type == 'TRACE_SYSCALL_ENTER':
+            insyscall[tid] = args[0]
+            out.append({'name': syscalls.get(args[0], str(args[0])),
+                        'ph': 'B', 'pid': THREAD_PID, 'tid': tid,
+                        'ts': usec(time)})
+        elif type == 'TRACE_SYSCALL_EXIT':
+            # Tracing may have been enabled in the middle of a system call.
+            if insyscall.pop(tid, None) is None:
+                continue
+            out.append({'ph': 'E', 'pid': THREAD_PID, 'tid': tid,
+                        'ts': usec(time),
+                        'args': {'error': args[1], 'retval': args[2]}})
+        elif type == 'TRACE_PAGE_FAULT':
+            instant('page fault', time, tid,
+                    {'vaddr': hex(args[0]), 'access': args[1]})
+        elif type == 'TRACE_TURNSTILE_BLOCK':
+            instant('turnstile block', time, tid,
+                    {'owner': args[0], 'wchan': hex(args[1])})
+        elif type == 'TRACE_INTR_ENTER':
+            out.append({'name': 'irq %d' % args[0], 'ph': 'B',
+                        'pid': CPU_PID, 'tid': cpu, 'ts': usec(time)})
+        elif type == 'TRACE_INTR_EXIT':
+            out.append({'ph': 'E', 'pid': CPU_PID, 'tid': cpu,
+                        'ts': usec(time), 'args': {'status': args[1]}})
+
+    if events:
+        last = events[-1][0]
+        for cpu in running:
+            run_slice(cpu, last)
+
+    out.append({'name': 'process_name', 'ph': 'M', 'pid': CPU_PID,
+                'args': {'name': 'CPUs'}})
+    out.append({'name': 'process_name', 'ph': 'M', 'pid': THREAD_PID,
+                'args': {'name': 'Threads'}})
+    for cpu in running:
+        out.append({'name': 'thread_name', 'ph': 'M', 'pid': CPU_PID,
+                    'tid': cpu, 'args': {'name': 'cpu %d' % cpu}})
+    for tid in sorted(threads):
+        out.append({'name': 'thread_name', 'ph': 'M', 'pid': THREAD_PID,
+                    'tid': tid, 'args': {'name': 'thread %d' % tid}})
+
+    return {'traceEvents': out, 'displayTimeUnit': 'ns'}
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Convert records read from /dev/trace to JSON trace.')
+    parser.add_argument('records', nargs='?', default='-',
+                        help='File with records (default: stdin).')
+    parser.add_argument('-o', '--output', default='-',
+                        help='Output JSON file (default: stdout).')
+    args = parser.parse_args()
+
+    if args.records == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.records, 'rb') as f:
+            data = f.read()
+
+    trace = convert(read_events(data))
+
+    if args.output == '-':
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
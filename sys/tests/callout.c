@@ -60,6 +60,44 @@ static int test_callout_order(void) {
   return KTEST_SUCCESS;
 }
 
+/* This test checks if high-resolution callouts are executed in order and
+ * never before their deadlines. */
+static bintime_t hires_deadline[ORDER_N];
+
+static void callout_hires_ordered(void *arg) {
+  int ord = (intptr_t)arg;
+  bintime_t now = binuptime();
+  assert(bintime_cmp(&now, &hires_deadline[ord], >=));
+  assert(current == ord);
+  current++;
+}
+
+static int test_callout_hires(void) {
+  callout_t callouts[ORDER_N];
+  bzero(callouts, sizeof(callout_t) * ORDER_N);
+  current = 0;
+
+  /* Deadlines are 100us apart, i.e. a few of them fit within single tick. */
+  bintime_t step = HZ2BT(10000);
+  bintime_t now = binuptime();
+  for (int i = 0; i < ORDER_N; i++) {
+    int ord = order[i];
+    bintime_t delta = bintime_mul(step, ord + 1);
+    hires_deadline[ord] = now;
+    bintime_add(&hires_deadline[ord], &delta);
+    callout_setup_bt(&callouts[i], hires_deadline[ord], callout_hires_ordered,
+                     (void *)(intptr_t)ord);
+  }
+
+  /* Wait for all callouts. */
+  for (int i = 0; i < ORDER_N; i++)
+    callout_drain(&callouts[i]);
+
+  assert(current == ORDER_N);
+
+  return KTEST_SUCCESS;
+}
+
 /* This test verifies that callouts removed with callout_stop are not run. */
 static void callout_bad(void *arg) {
   panic("%s: should never be called!", __func__);
@@ -104,5 +142,6 @@ static int test_callout_drain(void) {
 
 KTEST_ADD(callout_simple, test_callout_simple, 0);
 KTEST_ADD(callout_order, test_callout_order, 0);
+KTEST_ADD(callout_hires, test_callout_hires, 0);
 KTEST_ADD(callout_stop, test_callout_stop, 0);
 KTEST_ADD(callout_drain, test_callout_drain, 0);
@@ -23,11 +23,20 @@ static int rand(void) {
   return seed;
 }
 
+/* Number of log entries stored in the ring of current CPU. */
+static unsigned klog_count(void) {
+  return seqring_count(&klog.ring[PCPU_GET(cpuid)]);
+}
+
 static int logging_with_custom_mask(void) {
   klog_(KL_NONE, "Testing custom mask %d", KL_NONE);
-  assert(klog.first == klog.last);
+  assert(klog_count() == 0);
   klog_(KL_TEST, "Testing custom mask %d", KL_TEST);
-  assert((klog.first + 1) % KL_SIZE == klog.last);
+  assert(klog_count() == 1);
+  klog_entry_t entry;
+  assert(seqring_get(&klog.ring[PCPU_GET(cpuid)], &entry));
+  assert(entry.kl_origin == KL_TEST && entry.kl_params[0] == KL_TEST);
+  assert(klog_count() == 0);
   klog_clear();
   return 0;
 }
@@ -35,7 +44,7 @@ static int logging_with_custom_mask(void) {
 /* Testing logging when klog don't accept logs (klog.mask = KL_NONE) */
 static int logging_klog_zero_mask(void) {
   klog("Testing klog while acceptance mask is %d", klog.mask);
-  assert(klog.first == klog.last);
+  assert(klog_count() == 0);
   klog_clear();
   return 0;
 }
@@ -44,8 +53,8 @@ static int test_log_messages(const int number_of_logs) {
   for (int i = 0; i < number_of_logs; ++i)
     klog("Testing logger; Message %d, of %d", i, number_of_logs);
 
-  int saved_logs = (number_of_logs < KL_SIZE) ? number_of_logs : KL_SIZE - 1;
-  assert(((klog.first + saved_logs) % KL_SIZE) == klog.last);
+  unsigned saved_logs = (number_of_logs < KL_SIZE) ? number_of_logs : KL_SIZE;
+  assert(klog_count() == saved_logs);
 
   klog_clear();
   return 0;
@@ -80,10 +89,10 @@ static int multithreads_test(const int number_of_threads) {
   for (int i = 0; i < number_of_threads; i++)
     thread_join(threads[i]);
 
-  int saved_logs = (NUM_OF_LOG_PER_THREAD * number_of_threads < KL_SIZE)
-                     ? NUM_OF_LOG_PER_THREAD * number_of_threads
-                     : KL_SIZE - 1;
-  assert(((klog.first + saved_logs) % KL_SIZE) == klog.last);
+  unsigned saved_logs = (NUM_OF_LOG_PER_THREAD * number_of_threads < KL_SIZE)
+                          ? NUM_OF_LOG_PER_THREAD * number_of_threads
+                          : KL_SIZE;
+  assert(klog_count() == saved_logs);
 
   klog_clear();
 
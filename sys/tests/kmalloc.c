@@ -0,0 +1,94 @@
+#include <sys/libkern.h>
+#include <sys/malloc.h>
+#include <sys/ktest.h>
+
+static KMALLOC_DEFINE(M_KMTEST, "kmalloc test");
+
+/* Exercise all size classes and a few arena sized requests. */
+static const size_t sizes[] = {1,    15,   16,   17,   100,  128,
+                               129,  250,  513,  1000, 1537, 2047,
+                               2048, 2049, 4000, 8192};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static int test_kmalloc_classes(void) {
+  void *ptr[NSIZES];
+
+  for (size_t i = 0; i < NSIZES; i++) {
+    ptr[i] = kmalloc(M_KMTEST, sizes[i], M_ZERO);
+    assert(ptr[i] != NULL);
+    uint8_t *p = ptr[i];
+    for (size_t j = 0; j < sizes[i]; j++)
+      assert(p[j] == 0);
+    memset(p, i + 1, sizes[i]);
+  }
+
+  assert(M_KMTEST->active == NSIZES);
+
+  for (size_t i = 0; i < NSIZES; i++) {
+    uint8_t *p = ptr[i];
+    for (size_t j = 0; j < sizes[i]; j++)
+      assert(p[j] == i + 1);
+    assert(M_KMTEST->used >= sizes[i]);
+  }
+
+  for (size_t i = 0; i < NSIZES; i++)
+    kfree(M_KMTEST, ptr[i]);
+
+  assert(M_KMTEST->active == 0);
+  assert(M_KMTEST->used == 0);
+  return KTEST_SUCCESS;
+}
+
+/* Objects freed to per-CPU cache must be handed out again intact. */
+static int test_kmalloc_reuse(void) {
+  const int N = 100;
+  void **item = kmalloc(M_KMTEST, sizeof(void *) * N, M_ZERO);
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < N; i++) {
+      item[i] = kmalloc(M_KMTEST, 64, 0);
+      memset(item[i], i, 64);
+    }
+    for (int i = 0; i < N; i++) {
+      uint8_t *p = item[i];
+      assert(p[0] == (uint8_t)i && p[63] == (uint8_t)i);
+      kfree(M_KMTEST, item[i]);
+    }
+  }
+
+  kfree(M_KMTEST, item);
+  assert(M_KMTEST->active == 0);
+  return KTEST_SUCCESS;
+}
+
+/* Requests that exceed the limit must fail if they cannot wait. */
+static int test_kmalloc_limit(void) {
+  /* Other tests may have left their marks on the counters. */
+  size_t nfailed = M_KMTEST->nfailed;
+  size_t used = M_KMTEST->used;
+
+  kmalloc_setlimit(M_KMTEST, used + 1024);
+
+  void *p = kmalloc(M_KMTEST, 512, M_NOWAIT);
+  void *q = kmalloc(M_KMTEST, 512, M_NOWAIT);
+  assert(p != NULL && q != NULL);
+  assert(kmalloc(M_KMTEST, 16, M_NOWAIT) == NULL);
+  assert(kmalloc(M_KMTEST, 4096, M_NOWAIT) == NULL);
+  assert(M_KMTEST->nfailed - nfailed == 2);
+  assert(M_KMTEST->used - used == 1024);
+
+  kfree(M_KMTEST, q);
+  q = kmalloc(M_KMTEST, 16, M_NOWAIT);
+  assert(q != NULL);
+
+  kfree(M_KMTEST, p);
+  kfree(M_KMTEST, q);
+  kmalloc_setlimit(M_KMTEST, 0);
+  assert(M_KMTEST->used == used);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(kmalloc_classes, test_kmalloc_classes, 0);
+KTEST_ADD(kmalloc_reuse, test_kmalloc_reuse, 0);
+KTEST_ADD(kmalloc_limit, test_kmalloc_limit, 0);
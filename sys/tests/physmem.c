@@ -1,13 +1,24 @@
 #include <sys/mimiker.h>
 #include <sys/libkern.h>
+#include <sys/malloc.h>
+#include <sys/kmem.h>
+#include <sys/time.h>
 #include <sys/vm_physmem.h>
+#include <sys/vmstat.h>
 #include <sys/ktest.h>
 
 static int test_physmem(void) {
   const int N = 7;
   vm_page_t *pgs[N];
-  for (int i = 0; i < N; i++)
+  for (int i = 0; i < N; i++) {
     pgs[i] = vm_page_alloc(1 << i);
+    /* Physical address is derived from position of vm_page in the array. */
+    paddr_t pa = vm_page_paddr(pgs[i]);
+    assert(is_aligned(pa, PAGESIZE << i));
+    assert(vm_page_find(pa) == pgs[i]);
+    for (int j = 0; j < (1 << i); j++)
+      assert(vm_page_paddr(&pgs[i][j]) == pa + j * PAGESIZE);
+  }
   for (int i = 0; i < N; i += 2)
     vm_page_free(pgs[i]);
   for (int i = 1; i < N; i += 2)
@@ -16,4 +27,140 @@ static int test_physmem(void) {
   return KTEST_SUCCESS;
 }
 
+/* Single pages go through per-CPU cache which is refilled and drained in
+ * batches. Allocate more pages than the cache can hold. */
+static int test_physmem_pcache(void) {
+  const int N = 200;
+  vm_page_t **pgs = kmalloc(M_TEST, sizeof(vm_page_t *) * N, M_ZERO);
+
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < N; i++) {
+      pgs[i] = vm_page_alloc(1);
+      assert(pgs[i] != NULL);
+      assert(pgs[i]->size == 1);
+      assert(pgs[i]->flags & PG_ALLOCATED);
+      for (int j = 0; j < i; j++)
+        assert(pgs[i] != pgs[j]);
+    }
+    for (int i = 0; i < N; i++)
+      vm_page_free(pgs[i]);
+  }
+
+  kfree(M_TEST, pgs);
+  return KTEST_SUCCESS;
+}
+
+/* Must match PM_ZERO_MAX in vm_physmem.c. */
+#define NPREZERO 32
+
+/* Pages zeroed in advance must not retain contents from previous users. */
+static int test_physmem_prezero(void) {
+  const int N = 8;
+  uint8_t *ptrs[N];
+  vm_page_t *pgs[NPREZERO];
+  vmstat_t before, after;
+
+  /* Take pages zeroed earlier, so that there's room for more. */
+  for (int i = 0; i < NPREZERO; i++) {
+    pgs[i] = vm_page_alloc_flags(1, M_ZERO);
+    assert(pgs[i] != NULL);
+  }
+  for (int i = 0; i < NPREZERO; i++)
+    vm_page_free(pgs[i]);
+
+  for (int i = 0; i < N; i++) {
+    ptrs[i] = kmem_alloc(PAGESIZE, 0);
+    memset(ptrs[i], 0xAA, PAGESIZE);
+  }
+  for (int i = 0; i < N; i++)
+    kmem_free(ptrs[i], PAGESIZE);
+
+  /* Freed pages stay in per-CPU cache, where idle thread finds them. */
+  vmstat_read(&before);
+  while (vm_page_prezero())
+    continue;
+  vmstat_read(&after);
+  assert(after.v_prezeroed - before.v_prezeroed >= (uint64_t)N);
+
+  for (int i = 0; i < N; i++) {
+    ptrs[i] = kmem_alloc(PAGESIZE, M_ZERO);
+    for (size_t j = 0; j < PAGESIZE; j++)
+      assert(ptrs[i][j] == 0);
+  }
+
+  /* All these pages were zeroed in advance. */
+  vmstat_read(&before);
+  assert(before.v_prezero_hits - after.v_prezero_hits >= (uint64_t)N);
+  for (int i = 0; i < N; i++)
+    kmem_free(ptrs[i], PAGESIZE);
+
+  return KTEST_SUCCESS;
+}
+
+/* Regular requests leave a reserve of free pages, which can be taken by
+ * requests that cannot sleep. */
+static int test_physmem_reserve(void) {
+  vm_pagelist_t pages = TAILQ_HEAD_INITIALIZER(pages);
+  vm_page_t *pg;
+
+  for (size_t n = 1024; n > 0; n /= 2)
+    while ((pg = vm_page_alloc(n)))
+      TAILQ_INSERT_TAIL(&pages, pg, freeq);
+
+  pg = vm_page_alloc_flags(1, M_NOWAIT);
+  assert(pg != NULL);
+  vm_page_free(pg);
+
+  while ((pg = TAILQ_FIRST(&pages))) {
+    TAILQ_REMOVE(&pages, pg, freeq);
+    vm_page_free(pg);
+  }
+
+  return KTEST_SUCCESS;
+}
+
+#define BENCH_ROUNDS 256
+
+static uint64_t elapsed_ns(bintime_t start) {
+  bintime_t now = binuptime();
+  timespec_t ts;
+  bintime_sub(&now, &start);
+  bt2ts(&now, &ts);
+  return max(ts.tv_sec * 1000000000ULL + ts.tv_nsec, 1ULL);
+}
+
+/* Buddy allocator touches vm_page of every block it splits or merges, so its
+ * speed depends on how many of them fit in the cache. */
+static int test_physmem_bench(void) {
+  vm_page_t **pgs = kmalloc(M_TEST, sizeof(vm_page_t *) * BENCH_ROUNDS, 0);
+
+  kprintf("vm_page_t: %u bytes per %u byte page\n",
+          (unsigned)sizeof(vm_page_t), (unsigned)PAGESIZE);
+
+  for (int order = 0; order <= 4; order++) {
+    bintime_t start = binuptime();
+    int n;
+    for (n = 0; n < BENCH_ROUNDS; n++)
+      if (!(pgs[n] = vm_page_alloc(1 << order)))
+        break;
+    uint64_t alloc_ns = elapsed_ns(start);
+
+    start = binuptime();
+    for (int i = 0; i < n; i++)
+      vm_page_free(pgs[i]);
+    uint64_t free_ns = elapsed_ns(start);
+
+    n = max(n, 1);
+    kprintf("%2u pages: alloc %u ns, free %u ns\n", 1U << order,
+            (unsigned)(alloc_ns / n), (unsigned)(free_ns / n));
+  }
+
+  kfree(M_TEST, pgs);
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(physmem, test_physmem, 0);
+KTEST_ADD(physmem_pcache, test_physmem_pcache, 0);
+KTEST_ADD(physmem_prezero, test_physmem_prezero, 0);
+KTEST_ADD(physmem_reserve, test_physmem_reserve, 0);
+KTEST_ADD(physmem_bench, test_physmem_bench, KTEST_FLAG_BENCHMARK);
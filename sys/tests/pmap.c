@@ -5,6 +5,8 @@
 #include <sys/ktest.h>
 #include <sys/sched.h>
 #include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/time.h>
 
 static vm_page_t *x_vm_page_alloc(size_t npages) {
   vm_page_t *pg = vm_page_alloc(npages);
@@ -31,14 +33,14 @@ static int test_pmap_kenter(void) {
   unsigned *ptr = (unsigned *)va;
 
   /* read-write */
-  pmap_kenter(va, pg->paddr, VM_PROT_READ | VM_PROT_WRITE, 0);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
   for (i = 0; i < PAGESIZE / sizeof(unsigned); i++) {
     done = try_store_word(&ptr[i], i);
     assert(done);
   }
 
   /* read-only */
-  pmap_kenter(va, pg->paddr, VM_PROT_READ, 0);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ, 0);
   for (i = 0; i < PAGESIZE / sizeof(unsigned); i++) {
     done = try_load_word(&ptr[i], &val);
     assert(done && val == i);
@@ -48,7 +50,7 @@ static int test_pmap_kenter(void) {
   assert(!done);
 
   /* no access allowed */
-  pmap_kenter(va, pg->paddr, 0, 0);
+  pmap_kenter(va, vm_page_paddr(pg), 0, 0);
 
   done = try_load_word(ptr, &val);
   assert(!done);
@@ -66,11 +68,11 @@ static int test_pmap_kenter(void) {
 static int test_pmap_kextract(void) {
   vm_page_t *pg = x_vm_page_alloc(1);
   vaddr_t va = x_kva_alloc(PAGESIZE);
-  pmap_kenter(va, pg->paddr, VM_PROT_READ, 0);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ, 0);
 
   paddr_t pa;
   bool ok = pmap_kextract(va, &pa);
-  assert(ok && pa == pg->paddr);
+  assert(ok && pa == vm_page_paddr(pg));
 
   pmap_kremove(va, PAGESIZE);
   kva_free(va, PAGESIZE);
@@ -79,6 +81,92 @@ static int test_pmap_kextract(void) {
   return KTEST_SUCCESS;
 }
 
+static int test_pmap_kenter_range(void) {
+  const size_t npages = 4;
+  vm_page_t *pg = x_vm_page_alloc(npages);
+  vaddr_t va = x_kva_alloc(npages * PAGESIZE);
+
+  bool done;
+  unsigned val;
+
+  pmap_kenter_range(va, vm_page_paddr(pg), npages * PAGESIZE,
+                    VM_PROT_READ | VM_PROT_WRITE, 0);
+  for (size_t i = 0; i < npages; i++) {
+    paddr_t pa;
+    bool ok = pmap_kextract(va + i * PAGESIZE, &pa);
+    assert(ok && pa == vm_page_paddr(pg) + i * PAGESIZE);
+    done = try_store_word((unsigned *)(va + i * PAGESIZE), i);
+    assert(done);
+  }
+
+  pmap_kremove(va, npages * PAGESIZE);
+  for (size_t i = 0; i < npages; i++) {
+    done = try_load_word((unsigned *)(va + i * PAGESIZE), &val);
+    assert(!done);
+  }
+
+  kva_free(va, npages * PAGESIZE);
+  vm_page_free(pg);
+
+  return KTEST_SUCCESS;
+}
+
+#define KMAP_SIZE (2 << 20)
+#define KMAP_HALF (64 << 10)
+
+static int test_pmap_kmap_large(void) {
+  vm_page_t *pg = x_vm_page_alloc(KMAP_SIZE / PAGESIZE);
+  vaddr_t va = kmem_map(vm_page_paddr(pg), KMAP_SIZE, 0);
+
+  bool done;
+  unsigned val;
+
+  /* Virtual address is aligned like the physical one. */
+  assert(is_aligned(va, KMAP_SIZE));
+
+  unsigned misses = pmap_tlb_misses();
+
+  for (size_t off = 0; off < KMAP_SIZE; off += PAGESIZE) {
+    done = try_store_word((unsigned *)(va + off), off);
+    assert(done);
+  }
+
+  for (size_t off = 0; off < KMAP_SIZE; off += PAGESIZE) {
+    paddr_t pa;
+    bool ok = pmap_kextract(va + off, &pa);
+    assert(ok && pa == vm_page_paddr(pg) + off);
+    done = try_load_word((unsigned *)(va + off), &val);
+    assert(done && val == off);
+  }
+
+  kprintf("%u TLB misses while accessing %d pages twice\n",
+          pmap_tlb_misses() - misses, KMAP_SIZE / PAGESIZE);
+
+  /* Large pages must be gone as well. */
+  pmap_kremove(va, KMAP_SIZE);
+  for (size_t off = 0; off < KMAP_SIZE; off += PAGESIZE) {
+    done = try_load_word((unsigned *)(va + off), &val);
+    assert(!done);
+  }
+
+  /* Mapping of the upper half of a pair of 64KiB pages must not make memory
+   * mapped just below it inaccessible. */
+  const vm_prot_t prot = VM_PROT_READ | VM_PROT_WRITE;
+  pmap_kenter_range(va, vm_page_paddr(pg), KMAP_HALF, prot, 0);
+  pmap_kenter_range(va + KMAP_HALF, vm_page_paddr(pg) + KMAP_HALF, KMAP_HALF,
+                    prot, 0);
+  for (size_t off = 0; off < 2 * KMAP_HALF; off += PAGESIZE) {
+    done = try_load_word((unsigned *)(va + off), &val);
+    assert(done && val == off);
+  }
+  pmap_kremove(va, 2 * KMAP_HALF);
+
+  kva_free(va, KMAP_SIZE);
+  vm_page_free(pg);
+
+  return KTEST_SUCCESS;
+}
+
 static int test_pmap_page_copy(void) {
   vm_page_t *pg1 = x_vm_page_alloc(1);
   vm_page_t *pg2 = x_vm_page_alloc(2);
@@ -88,7 +176,7 @@ static int test_pmap_page_copy(void) {
   unsigned i, val;
   unsigned *ptr = (unsigned *)va;
 
-  pmap_kenter(va, pg1->paddr, VM_PROT_READ | VM_PROT_WRITE, 0);
+  pmap_kenter(va, vm_page_paddr(pg1), VM_PROT_READ | VM_PROT_WRITE, 0);
   for (i = 0; i < PAGESIZE / sizeof(unsigned); i++) {
     done = try_store_word(&ptr[i], i);
     assert(done);
@@ -101,7 +189,7 @@ static int test_pmap_page_copy(void) {
     assert(done && val == 0);
   }
 
-  pmap_kenter(va, pg2->paddr, VM_PROT_READ, 0);
+  pmap_kenter(va, vm_page_paddr(pg2), VM_PROT_READ, 0);
   for (i = 0; i < PAGESIZE / sizeof(unsigned); i++) {
     done = try_load_word(&ptr[i], &val);
     assert(done && val == i);
@@ -117,6 +205,8 @@ static int test_pmap_page_copy(void) {
 
 KTEST_ADD(pmap_kenter, test_pmap_kenter, 0);
 KTEST_ADD(pmap_kextract, test_pmap_kextract, 0);
+KTEST_ADD(pmap_kenter_range, test_pmap_kenter_range, 0);
+KTEST_ADD(pmap_kmap_large, test_pmap_kmap_large, 0);
 KTEST_ADD(pmap_page_copy, test_pmap_page_copy, 0);
 
 /*
@@ -161,6 +251,94 @@ static int test_user_pmap(void) {
   return KTEST_SUCCESS;
 }
 
+/* More address spaces than there are ASIDs on any architecture. */
+#define NPMAPS 70000
+
+static int test_pmap_asid_rollover(void) {
+  SCOPED_NO_PREEMPTION();
+
+  pmap_t *orig = pmap_user();
+
+  pmap_t *pmap1 = pmap_new();
+  pmap_t *pmap2 = pmap_new();
+
+  volatile int *ptr = (int *)0x1001000;
+
+  vm_page_t *pg1 = x_vm_page_alloc(1);
+  vm_page_t *pg2 = x_vm_page_alloc(1);
+
+  pmap_activate(pmap1);
+  pmap_enter(pmap1, (vaddr_t)ptr, pg1, VM_PROT_READ | VM_PROT_WRITE, 0);
+  *ptr = 100;
+  pmap_activate(pmap2);
+  pmap_enter(pmap2, (vaddr_t)ptr, pg2, VM_PROT_READ | VM_PROT_WRITE, 0);
+  *ptr = 200;
+
+  /* Each activation of a new pmap consumes an ASID, so all of them get
+   * recycled many times. Translations of both pmaps must remain intact. */
+  for (int i = 0; i < NPMAPS; i++) {
+    pmap_t *pmap = pmap_new();
+    pmap_activate(pmap);
+    pmap_activate((i & 1) ? pmap1 : pmap2);
+    assert(*ptr == ((i & 1) ? 100 : 200));
+    pmap_delete(pmap);
+  }
+
+  pmap_delete(pmap1);
+  pmap_delete(pmap2);
+
+  /* Restore original user pmap */
+  pmap_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
+/* More pages than TLB invalidations gathered one by one. */
+#define NRANGE 64
+
+static int test_pmap_range(void) {
+  SCOPED_NO_PREEMPTION();
+
+  pmap_t *orig = pmap_user();
+  pmap_t *pmap = pmap_new();
+
+  vaddr_t start = 0x1000000;
+  vaddr_t end = start + NRANGE * PAGESIZE;
+  vm_page_t *pg = x_vm_page_alloc(NRANGE);
+
+  bool done;
+  unsigned val;
+
+  pmap_activate(pmap);
+
+  for (int i = 0; i < NRANGE; i++)
+    pmap_enter(pmap, start + i * PAGESIZE, &pg[i], VM_PROT_READ | VM_PROT_WRITE,
+               0);
+
+  /* Bring translations into TLB, so that stale ones could be used. */
+  for (vaddr_t va = start; va < end; va += PAGESIZE) {
+    done = try_store_word((unsigned *)va, va);
+    assert(done);
+  }
+
+  /* Remove a few pages and then the rest of them. */
+  for (int n = 4; n <= NRANGE; n *= 16) {
+    vaddr_t last = start + n * PAGESIZE;
+    pmap_remove(pmap, start, last);
+    for (vaddr_t va = start; va < end; va += PAGESIZE) {
+      done = try_load_word((unsigned *)va, &val);
+      assert(done == (va >= last));
+      assert(!done || val == va);
+    }
+  }
+
+  pmap_delete(pmap);
+  pmap_activate(orig);
+  vm_page_free(pg);
+
+  return KTEST_SUCCESS;
+}
+
 static int test_rmbits(void) {
   /* This test mustn't be preempted since PCPU's user-space vm_map
    * (and its pmap) will not be restored while switching back. */
@@ -196,6 +374,11 @@ static int test_rmbits(void) {
 
   assert(pmap_is_referenced(pg) && !pmap_is_modified(pg));
 
+  /* Page written to again must be laundered again. */
+  *ptr = 200;
+
+  assert(pmap_is_modified(pg));
+
   pmap_delete(pmap);
 
   /* Restore original user pmap */
@@ -204,5 +387,219 @@ static int test_rmbits(void) {
   return KTEST_SUCCESS;
 }
 
+/*
+ * Page zeroing and copying routines.
+ */
+
+#define BENCH_ROUNDS 256
+
+static uint64_t elapsed_ns(bintime_t start) {
+  bintime_t now = binuptime();
+  timespec_t ts;
+  bintime_sub(&now, &start);
+  bt2ts(&now, &ts);
+  return max(ts.tv_sec * 1000000000ULL + ts.tv_nsec, 1ULL);
+}
+
+static void report(const char *name, uint64_t ns) {
+  /* bytes per nanosecond equals gigabytes per second */
+  uint64_t mbps = (uint64_t)BENCH_ROUNDS * PAGESIZE * 1000 / ns;
+  kprintf("%-16s %u.%03u GB/s\n", name, (unsigned)(mbps / 1000),
+          (unsigned)(mbps % 1000));
+}
+
+static int test_pmap_page_ops(void) {
+  uint8_t *src = kmem_alloc(PAGESIZE, 0);
+  uint8_t *dst = kmem_alloc(PAGESIZE, 0);
+  vm_page_t *src_pg = kva_find_page((vaddr_t)src);
+  vm_page_t *dst_pg = kva_find_page((vaddr_t)dst);
+
+  for (int i = 0; i < PAGESIZE; i++)
+    src[i] = i * 7 + 1;
+
+  pmap_copy_page(src_pg, dst_pg);
+  for (int i = 0; i < PAGESIZE; i++)
+    assert(dst[i] == src[i]);
+
+  pmap_zero_page(dst_pg);
+  for (int i = 0; i < PAGESIZE; i++)
+    assert(dst[i] == 0);
+
+  kmem_free(src, PAGESIZE);
+  kmem_free(dst, PAGESIZE);
+  return KTEST_SUCCESS;
+}
+
+static int test_pmap_page_bench(void) {
+  uint8_t *src = kmem_alloc(PAGESIZE, 0);
+  uint8_t *dst = kmem_alloc(PAGESIZE, 0);
+  vm_page_t *src_pg = kva_find_page((vaddr_t)src);
+  vm_page_t *dst_pg = kva_find_page((vaddr_t)dst);
+  bintime_t start;
+
+  start = binuptime();
+  for (int i = 0; i < BENCH_ROUNDS; i++)
+    pmap_zero_page(dst_pg);
+  report("pmap_zero_page", elapsed_ns(start));
+
+  start = binuptime();
+  for (int i = 0; i < BENCH_ROUNDS; i++)
+    bzero(dst, PAGESIZE);
+  report("bzero", elapsed_ns(start));
+
+  start = binuptime();
+  for (int i = 0; i < BENCH_ROUNDS; i++)
+    pmap_copy_page(src_pg, dst_pg);
+  report("pmap_copy_page", elapsed_ns(start));
+
+  start = binuptime();
+  for (int i = 0; i < BENCH_ROUNDS; i++)
+    memcpy(dst, src, PAGESIZE);
+  report("memcpy", elapsed_ns(start));
+
+  kmem_free(src, PAGESIZE);
+  kmem_free(dst, PAGESIZE);
+  return KTEST_SUCCESS;
+}
+
+/*
+ * Large page mappings.
+ */
+
+#define NBLOCKS 32 /* 64MiB with 2MiB blocks */
+#define STRIDE_ROUNDS 16
+
+/* Reads one word from each page of the range, so that every access needs a
+ * different translation if small pages are used. */
+static uint64_t stride_read(vaddr_t start, size_t size) {
+  bintime_t begin = binuptime();
+  unsigned sum = 0;
+
+  for (int r = 0; r < STRIDE_ROUNDS; r++)
+    for (vaddr_t va = start; va < start + size; va += PAGESIZE)
+      sum += *(volatile unsigned *)va;
+
+  assert(sum == 0);
+  return elapsed_ns(begin);
+}
+
+/* Allocates physical memory for n large pages. Returns false if there's not
+ * enough contiguous memory. */
+static bool alloc_blocks(vm_page_t **blocks, int n) {
+  size_t blksz = pmap_block_size();
+
+  for (int i = 0; i < n; i++) {
+    if (!(blocks[i] = vm_page_alloc_flags(blksz / PAGESIZE, M_ZERO))) {
+      while (--i >= 0)
+        vm_page_free(blocks[i]);
+      kprintf("not enough contiguous memory, skipping\n");
+      return false;
+    }
+    assert(is_aligned(vm_page_paddr(blocks[i]), blksz));
+  }
+  return true;
+}
+
+static int test_pmap_block(void) {
+  size_t blksz = pmap_block_size();
+  if (blksz == 0)
+    return KTEST_SUCCESS;
+
+  const vm_prot_t prot = VM_PROT_READ | VM_PROT_WRITE;
+  vm_page_t *block;
+
+  if (!alloc_blocks(&block, 1))
+    return KTEST_SUCCESS;
+
+  SCOPED_NO_PREEMPTION();
+
+  pmap_t *orig = pmap_user();
+  pmap_t *pmap = pmap_new();
+  vaddr_t start = 0x1000000;
+
+  pmap_activate(pmap);
+
+  assert(pmap_enter_block(pmap, start, block, prot, 0));
+
+  paddr_t pa;
+  for (vaddr_t va = start; va < start + blksz; va += PAGESIZE) {
+    assert(pmap_extract(pmap, va, &pa));
+    assert(pa == vm_page_paddr(block) + (va - start));
+    assert(*(volatile unsigned *)va == 0);
+  }
+
+  /* Changing protection of a single page splits the large page, but the
+   * other pages must remain accessible. */
+  volatile unsigned *ptr = (unsigned *)(start + PAGESIZE);
+  *ptr = 0xDEADC0DE;
+  pmap_protect(pmap, start, start + PAGESIZE, VM_PROT_READ);
+  assert(pmap_extract(pmap, (vaddr_t)ptr, &pa));
+  assert(pa == vm_page_paddr(block) + PAGESIZE && *ptr == 0xDEADC0DE);
+  *ptr = 0;
+
+  pmap_remove(pmap, start, start + blksz);
+  assert(!pmap_extract(pmap, start, &pa));
+
+  pmap_delete(pmap);
+  pmap_activate(orig);
+
+  vm_page_free(block);
+
+  return KTEST_SUCCESS;
+}
+
+static int test_pmap_block_bench(void) {
+  size_t blksz = pmap_block_size();
+  if (blksz == 0)
+    return KTEST_SUCCESS;
+
+  const size_t npages = blksz / PAGESIZE;
+  const size_t size = NBLOCKS * blksz;
+  const vm_prot_t prot = VM_PROT_READ | VM_PROT_WRITE;
+  vm_page_t *blocks[NBLOCKS];
+
+  if (!alloc_blocks(blocks, NBLOCKS))
+    return KTEST_SUCCESS;
+
+  SCOPED_NO_PREEMPTION();
+
+  pmap_t *orig = pmap_user();
+  pmap_t *pmap = pmap_new();
+  vaddr_t start = 0x1000000;
+
+  pmap_activate(pmap);
+
+  for (int i = 0; i < NBLOCKS; i++)
+    assert(pmap_enter_block(pmap, start + i * blksz, blocks[i], prot, 0));
+
+  uint64_t large = stride_read(start, size);
+
+  pmap_remove(pmap, start, start + size);
+
+  for (int i = 0; i < NBLOCKS; i++)
+    for (size_t j = 0; j < npages; j++)
+      pmap_enter(pmap, start + i * blksz + j * PAGESIZE, &blocks[i][j], prot,
+                 0);
+
+  uint64_t small = stride_read(start, size);
+
+  kprintf("stride read: %u us with large pages, %u us with small pages\n",
+          (unsigned)(large / 1000), (unsigned)(small / 1000));
+
+  pmap_delete(pmap);
+  pmap_activate(orig);
+
+  for (int i = 0; i < NBLOCKS; i++)
+    vm_page_free(blocks[i]);
+
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(pmap_user, test_user_pmap, 0);
+KTEST_ADD(pmap_asid_rollover, test_pmap_asid_rollover, 0);
+KTEST_ADD(pmap_range, test_pmap_range, 0);
 KTEST_ADD(pmap_rmbits, test_rmbits, 0);
+KTEST_ADD(pmap_page_ops, test_pmap_page_ops, 0);
+KTEST_ADD(pmap_page_bench, test_pmap_page_bench, KTEST_FLAG_BENCHMARK);
+KTEST_ADD(pmap_block, test_pmap_block, 0);
+KTEST_ADD(pmap_block_bench, test_pmap_block_bench, KTEST_FLAG_BENCHMARK);
@@ -0,0 +1,45 @@
+#include <sys/mimiker.h>
+#include <sys/ktest.h>
+#include <sys/pcpu.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/prof.h>
+
+extern char __etext[];
+
+static int test_prof(void) {
+  unsigned cpu = PCPU_GET(cpuid);
+  thread_t *td = thread_self();
+  prof_sample_t ps;
+
+  bool enabled = prof_enable(false);
+  while (prof_get(cpu, &ps))
+    continue;
+
+  /* Spin in the kernel for a while, so clock ticks catch us running. */
+  prof_enable(true);
+  bintime_t end = binuptime();
+  bintime_t delta = HZ2BT(20); /* 50ms */
+  bintime_add(&end, &delta);
+  for (bintime_t now = binuptime(); bintime_cmp(&now, &end, <);
+       now = binuptime())
+    continue;
+  prof_enable(false);
+
+  unsigned nsamples = 0;
+  while (prof_get(cpu, &ps)) {
+    if (ps.ps_tid != (uint32_t)td->td_tid)
+      continue;
+    assert(ps.ps_pid == 0 && ps.ps_udepth == 0);
+    assert(ps.ps_kdepth >= 1 && ps.ps_kdepth <= PROF_DEPTH);
+    assert((uintptr_t)__text <= ps.ps_pc[0] &&
+           ps.ps_pc[0] < (uintptr_t)__etext);
+    nsamples++;
+  }
+  assert(nsamples > 0);
+
+  prof_enable(enabled);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(prof, test_prof, 0);
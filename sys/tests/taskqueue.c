@@ -37,4 +37,107 @@ static int test_taskqueue(void) {
   return KTEST_SUCCESS;
 }
 
+/* Task enqueued multiple times before it runs is executed only once. */
+static int test_taskqueue_coalesce(void) {
+  taskqueue_t tq;
+
+  int N = 1;
+  task_t task = TASK_INIT(func, &N);
+
+  counter = 0;
+
+  taskqueue_init(&tq);
+  for (int i = 0; i < 5; i++)
+    taskqueue_add(&tq, &task);
+
+  assert(task.t_pending == 5);
+
+  taskqueue_run(&tq);
+
+  assert(counter == 1);
+  assert(task.t_pending == 0);
+
+  taskqueue_destroy(&tq);
+
+  return KTEST_SUCCESS;
+}
+
+static taskqueue_t *requeue_tq;
+
+static void requeue_func(void *arg) {
+  task_t *task = arg;
+  /* Only the first run enqueues the task again. */
+  if (counter++ == 0) {
+    taskqueue_add(requeue_tq, task);
+    assert(task->t_pending == 1);
+  }
+}
+
+/* Task enqueued while running is appended only after the run finishes. */
+static int test_taskqueue_requeue(void) {
+  taskqueue_t tq;
+  task_t task = TASK_INIT(requeue_func, &task);
+
+  counter = 0;
+  requeue_tq = &tq;
+
+  taskqueue_init(&tq);
+  taskqueue_add(&tq, &task);
+
+  taskqueue_run(&tq);
+  assert(counter == 1);
+  assert(task.t_pending == 1 && !task.t_running);
+
+  taskqueue_run(&tq);
+  assert(counter == 2);
+  assert(task.t_pending == 0);
+
+  taskqueue_destroy(&tq);
+
+  return KTEST_SUCCESS;
+}
+
+#define TASKS 16
+
+/* Tasks are executed by worker threads, both immediately and after timeout. */
+static int test_taskqueue_workers(void) {
+  taskqueue_t tq;
+
+  int N[TASKS];
+  task_t tasks[TASKS];
+  timeout_task_t tt;
+
+  counter = 0;
+
+  taskqueue_init(&tq);
+  taskqueue_start_threads(&tq, 1, prio_kthread(0), "test-taskqueue");
+
+  for (int i = 0; i < TASKS; i++) {
+    N[i] = i;
+    tasks[i] = TASK_INIT(func, &N[i]);
+    taskqueue_add(&tq, &tasks[i]);
+  }
+
+  int M = 1000;
+  tt = TIMEOUT_TASK_INIT(func, &M);
+  bool scheduled = taskqueue_enqueue_timeout(&tq, &tt, 5);
+  assert(scheduled);
+  /* Timeout task which is already scheduled is not scheduled again. */
+  scheduled = taskqueue_enqueue_timeout(&tq, &tt, 5);
+  assert(!scheduled);
+
+  /* Wait until the timeout task is enqueued. */
+  callout_drain(&tt.tt_callout);
+
+  /* Workers finish all pending tasks before they terminate. */
+  taskqueue_destroy(&tq);
+
+  assert(counter == (unsigned)(TASKS * (TASKS - 1) / 2 + M));
+
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(taskqueue, test_taskqueue, 0);
+KTEST_ADD(taskqueue_coalesce, test_taskqueue_coalesce, 0);
+KTEST_ADD(taskqueue_requeue, test_taskqueue_requeue, 0);
+KTEST_ADD(taskqueue_workers, test_taskqueue_workers, 0);
@@ -0,0 +1,54 @@
+#include <sys/mimiker.h>
+#include <sys/ktest.h>
+#include <sys/pcpu.h>
+#include <sys/thread.h>
+#include <sys/trace.h>
+
+static void trace_drain(void) {
+  trace_event_t ev;
+  while (trace_get(PCPU_GET(cpuid), &ev))
+    continue;
+}
+
+static int test_trace(void) {
+  unsigned cpu = PCPU_GET(cpuid);
+  trace_event_t ev;
+
+  unsigned mask_old = trace_setmask(TRACE_MASK(TRACE_PAGE_FAULT));
+  trace_drain();
+
+  /* Disabled tracepoint must not record anything. */
+  TRACE(TRACE_SCHED_WAKEUP, 1, 2);
+  assert(!trace_get(cpu, &ev));
+
+  TRACE(TRACE_PAGE_FAULT, 0xdeadc0de, 3);
+  trace_setmask(TRACE_NONE);
+
+  assert(trace_get(cpu, &ev));
+  assert(ev.te_type == TRACE_PAGE_FAULT);
+  assert(ev.te_cpu == cpu);
+  assert(ev.te_tid == (uint32_t)thread_self()->td_tid);
+  assert(ev.te_args[0] == 0xdeadc0de && ev.te_args[1] == 3);
+  assert(ev.te_args[2] == 0);
+  assert(!trace_get(cpu, &ev));
+
+  /* When the buffer overflows only the newest events are kept. */
+  trace_setmask(TRACE_MASK(TRACE_PAGE_FAULT));
+  for (unsigned i = 0; i < TRACE_SIZE + 10; i++)
+    TRACE(TRACE_PAGE_FAULT, i, 0);
+  trace_setmask(TRACE_NONE);
+
+  uint64_t prev = 0;
+  for (unsigned i = 0; i < TRACE_SIZE; i++) {
+    assert(trace_get(cpu, &ev));
+    assert(ev.te_args[0] == i + 10);
+    assert(ev.te_time >= prev);
+    prev = ev.te_time;
+  }
+  assert(!trace_get(cpu, &ev));
+
+  trace_setmask(mask_old);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(trace, test_trace, 0);
@@ -0,0 +1,98 @@
+#include <sys/mimiker.h>
+#include <sys/kmem.h>
+#include <sys/ktest.h>
+#include <sys/pmap.h>
+#include <sys/vm_ksm.h>
+#include <sys/vm_object.h>
+#include <sys/vmstat.h>
+
+#define N 8
+
+/* Fills page with pseudo-random contents determined by seed, or checks if
+ * they're there. */
+static bool page_pattern(vm_page_t *pg, uint32_t seed, bool fill) {
+  vaddr_t va = kva_alloc(PAGESIZE);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
+
+  uint32_t *words = (uint32_t *)va;
+  bool ok = true;
+  for (size_t i = 0; i < PAGESIZE / sizeof(uint32_t); i++) {
+    uint32_t w = (seed ^ i) * 2654435761U;
+    if (fill)
+      words[i] = w;
+    else if (words[i] != w)
+      ok = false;
+  }
+
+  pmap_kremove(va, PAGESIZE);
+  kva_free(va, PAGESIZE);
+  return ok;
+}
+
+/* Seed 0 leaves the page filled with zeros. */
+static void object_fill(vm_object_t *obj, off_t offset, uint32_t seed) {
+  SCOPED_MTX_LOCK(&obj->mtx);
+  vm_page_t *pg = obj->pager->pgr_fault(obj, offset);
+  if (seed)
+    page_pattern(pg, seed, true);
+  pmap_set_modified(pg);
+}
+
+static int test_vm_ksm(void) {
+  vm_object_t *obj1 = vm_object_alloc(VM_ANONYMOUS);
+  vm_object_t *obj2 = vm_object_alloc(VM_ANONYMOUS);
+  vmstat_t before, after;
+  vmstat_read(&before);
+
+  /* Both objects have the same first N pages. */
+  for (int i = 0; i < N; i++) {
+    object_fill(obj1, i * PAGESIZE, i + 1);
+    object_fill(obj2, i * PAGESIZE, i + 1);
+  }
+  object_fill(obj1, N * PAGESIZE, 0);
+  object_fill(obj2, N * PAGESIZE, N + 1);
+
+  /* Finish current pass, then make a full one. */
+  ksm_scan(SIZE_MAX);
+  ksm_scan(SIZE_MAX);
+
+  assert(obj1->nmerged == N && obj1->npages == 0);
+  assert(obj2->nmerged == N && obj2->npages == 1);
+
+  vmstat_read(&after);
+  assert(after.v_ksm_shared == before.v_ksm_shared + N);
+  assert(after.v_ksm_sharing == before.v_ksm_sharing + 2 * N);
+  assert(after.v_ksm_zeroed == before.v_ksm_zeroed + 1);
+
+  /* Page fault gives the object back its private copy. */
+  WITH_MTX_LOCK (&obj1->mtx) {
+    assert(ksm_lookup(obj1, PAGESIZE) != NULL);
+    vm_page_t *pg = obj1->pager->pgr_fault(obj1, PAGESIZE);
+    assert(pmap_is_modified(pg));
+    assert(page_pattern(pg, 2, false));
+    assert(ksm_lookup(obj1, PAGESIZE) == NULL);
+  }
+
+  assert(obj1->nmerged == N - 1);
+
+  /* Clone shares merged pages instead of copying them. */
+  vm_object_t *obj3 = vm_object_clone(obj2);
+  assert(obj3->nmerged == N);
+
+  vmstat_read(&after);
+  assert(after.v_ksm_shared == before.v_ksm_shared + N);
+  assert(after.v_ksm_sharing == before.v_ksm_sharing + 3 * N - 1);
+  assert(after.v_ksm_unmerged == before.v_ksm_unmerged + 1);
+
+  vm_object_free(obj3);
+  vm_object_free(obj2);
+  vm_object_free(obj1);
+
+  vmstat_read(&after);
+  assert(after.v_ksm_shared == before.v_ksm_shared);
+  assert(after.v_ksm_sharing == before.v_ksm_sharing);
+
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(vm_ksm, test_vm_ksm, 0);
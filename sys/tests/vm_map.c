@@ -5,8 +5,10 @@
 #include <sys/vm_pager.h>
 #include <sys/vm_object.h>
 #include <sys/vm_map.h>
+#include <sys/vmstat.h>
 #include <sys/errno.h>
 #include <sys/thread.h>
+#include <sys/time.h>
 #include <sys/ktest.h>
 #include <sys/sched.h>
 
@@ -161,5 +163,281 @@ static int findspace_demo(void) {
   return KTEST_SUCCESS;
 }
 
+/* Must match FAULT_AROUND in vm_map.c. */
+#define NAROUND 8
+
+static int fault_around_demo(void) {
+  /* This test mustn't be preempted since PCPU's user-space vm_map will not be
+   * restored while switching back. */
+  SCOPED_NO_PREEMPTION();
+
+  vm_map_t *orig = vm_map_user();
+
+  vm_map_t *umap = vm_map_new();
+  vm_map_activate(umap);
+
+  const vaddr_t start = 0x1000000;
+  const vaddr_t end = start + NAROUND * PAGESIZE;
+  vmstat_t before, after;
+  int n;
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  vm_segment_t *seg = vm_segment_alloc(
+    obj, start, end, VM_PROT_READ | VM_PROT_WRITE, VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+
+  /* Make pages resident, then unmap them leaving the object intact. */
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    *(volatile vaddr_t *)va = va;
+  pmap_remove(pmap_user(), start, end);
+
+  /* First read maps the whole window. Neighbours are made accessible without
+   * waiting for their first access. */
+  vmstat_read(&before);
+  assert(*(volatile vaddr_t *)start == start);
+  for (off_t off = PAGESIZE; off < NAROUND * PAGESIZE; off += PAGESIZE)
+    assert(pmap_is_referenced(vm_object_find_page(obj, off)));
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == va);
+  vmstat_read(&after);
+
+  assert(after.v_faults == before.v_faults + 1);
+  assert(after.v_prefaults == before.v_prefaults + NAROUND - 1);
+
+
+  /* Sequential reads of untouched anonymous memory are served by zero page
+   * mapped ahead. */
+  const vaddr_t seq_start = end;
+  const vaddr_t seq_end = seq_start + NAROUND * PAGESIZE;
+
+  obj = vm_object_alloc(VM_ANONYMOUS);
+  seg = vm_segment_alloc(obj, seq_start, seq_end, VM_PROT_READ | VM_PROT_WRITE,
+                         VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+  n = vm_map_advise(umap, seq_start, seq_end, VM_ADV_SEQUENTIAL);
+  assert(n == 0);
+
+  vmstat_read(&before);
+  for (vaddr_t va = seq_start; va < seq_end; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == 0);
+  vmstat_read(&after);
+
+  assert(after.v_faults == before.v_faults + 1);
+  assert(after.v_prefaults == before.v_prefaults + NAROUND - 1);
+
+  vm_map_delete(umap);
+
+  /* Restore original vm_map */
+  vm_map_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
+#define NZERO 8
+
+static int zero_page_demo(void) {
+  /* This test mustn't be preempted since PCPU's user-space vm_map will not be
+   * restored while switching back. */
+  SCOPED_NO_PREEMPTION();
+
+  vm_map_t *orig = vm_map_user();
+
+  vm_map_t *umap = vm_map_new();
+  vm_map_activate(umap);
+
+  const vaddr_t start = 0x1000000;
+  const vaddr_t end = start + NZERO * PAGESIZE;
+  vmstat_t before, after;
+  paddr_t zero_pa, pa;
+  int n;
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  vm_segment_t *seg = vm_segment_alloc(
+    obj, start, end, VM_PROT_READ | VM_PROT_WRITE, VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+
+  /* Reads map the same physical page and do not allocate memory. */
+  vmstat_read(&before);
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    assert(*(volatile unsigned *)va == 0);
+  vmstat_read(&after);
+
+  assert(after.v_zerofaults == before.v_zerofaults + NZERO);
+  assert(obj->npages == 0);
+
+  assert(pmap_extract(pmap_user(), start, &zero_pa));
+  for (vaddr_t va = start; va < end; va += PAGESIZE) {
+    assert(pmap_extract(pmap_user(), va, &pa));
+    assert(pa == zero_pa);
+  }
+
+  /* First write gives the page a private copy. */
+  volatile unsigned *ptr = (unsigned *)(start + PAGESIZE);
+  *ptr = 0xDEADC0DE;
+  assert(obj->npages == 1);
+  assert(pmap_extract(pmap_user(), (vaddr_t)ptr, &pa));
+  assert(pa != zero_pa);
+  assert(*ptr == 0xDEADC0DE);
+  assert(*(volatile unsigned *)start == 0);
+
+  vm_map_delete(umap);
+
+  /* Restore original vm_map */
+  vm_map_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
+#define NADVISE 8
+
+static int madvise_demo(void) {
+  /* This test mustn't be preempted since PCPU's user-space vm_map will not be
+   * restored while switching back. */
+  SCOPED_NO_PREEMPTION();
+
+  vm_map_t *orig = vm_map_user();
+
+  vm_map_t *umap = vm_map_new();
+  vm_map_activate(umap);
+
+  const vaddr_t start = 0x1000000;
+  const vaddr_t end = start + NADVISE * PAGESIZE;
+  const vaddr_t mid = start + NADVISE / 2 * PAGESIZE;
+  char vec[NADVISE];
+  int n;
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  vm_segment_t *seg = vm_segment_alloc(
+    obj, start, end, VM_PROT_READ | VM_PROT_WRITE, VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    *(volatile vaddr_t *)va = va;
+  assert(obj->npages == NADVISE);
+
+  n = vm_map_mincore(umap, start, end, vec);
+  assert(n == 0);
+  for (int i = 0; i < NADVISE; i++)
+    assert(vec[i] == 1);
+
+  /* Locked pages cannot be dropped. */
+  n = vm_map_wire(umap, start, mid, true);
+  assert(n == 0);
+  assert(obj->nwired == NADVISE / 2);
+  n = vm_map_advise(umap, start, end, VM_ADV_DONTNEED);
+  assert(n == EINVAL);
+  n = vm_map_wire(umap, start, mid, false);
+  assert(n == 0);
+  assert(obj->nwired == 0);
+
+  /* Locked pages in a following segment leave preceding ones intact. */
+  const vaddr_t wired_end = end + NADVISE * PAGESIZE;
+  vm_object_t *wired_obj = vm_object_alloc(VM_ANONYMOUS);
+  seg = vm_segment_alloc(wired_obj, end, wired_end,
+                         VM_PROT_READ | VM_PROT_WRITE, VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+  n = vm_map_wire(umap, end, wired_end, true);
+  assert(n == 0);
+  n = vm_map_advise(umap, start, wired_end, VM_ADV_DONTNEED);
+  assert(n == EINVAL);
+  assert(obj->npages == NADVISE);
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == va);
+  n = vm_map_wire(umap, end, wired_end, false);
+  assert(n == 0);
+
+  /* Dropped pages read back as zeros and are not resident anymore. */
+  n = vm_map_advise(umap, mid, end, VM_ADV_DONTNEED);
+  assert(n == 0);
+  assert(obj->npages == NADVISE / 2);
+  n = vm_map_mincore(umap, start, end, vec);
+  assert(n == 0);
+  for (int i = 0; i < NADVISE; i++)
+    assert(vec[i] == (i < NADVISE / 2));
+  for (vaddr_t va = mid; va < end; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == 0);
+
+  /* Freed pages keep their contents until pagedaemon reclaims them. */
+  n = vm_map_advise(umap, start, mid, VM_ADV_FREE);
+  assert(n == 0);
+  for (vaddr_t va = start; va < mid; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == va);
+
+  n = vm_map_mincore(umap, start, wired_end + PAGESIZE, vec);
+  assert(n == ENOMEM);
+
+  vm_map_delete(umap);
+
+  /* Restore original vm_map */
+  vm_map_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
+#define NBENCH 256
+
+static uint64_t elapsed_ns(bintime_t start) {
+  bintime_t now = binuptime();
+  timespec_t ts;
+  bintime_sub(&now, &start);
+  bt2ts(&now, &ts);
+  return max(ts.tv_sec * 1000000000ULL + ts.tv_nsec, 1ULL);
+}
+
+/* Write faults allocate pages and insert them into the object. Read faults
+ * after pmap_remove look resident pages up and map them again. */
+static int fault_bench(void) {
+  /* This test mustn't be preempted since PCPU's user-space vm_map will not be
+   * restored while switching back. */
+  SCOPED_NO_PREEMPTION();
+
+  vm_map_t *orig = vm_map_user();
+
+  vm_map_t *umap = vm_map_new();
+  vm_map_activate(umap);
+
+  const vaddr_t start = 0x1000000;
+  const vaddr_t end = start + NBENCH * PAGESIZE;
+  int n;
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  vm_segment_t *seg = vm_segment_alloc(
+    obj, start, end, VM_PROT_READ | VM_PROT_WRITE, VM_SEG_PRIVATE);
+  n = vm_map_insert(umap, seg, VM_FIXED);
+  assert(n == 0);
+
+  bintime_t begin = binuptime();
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    *(volatile vaddr_t *)va = va;
+  uint64_t write_ns = elapsed_ns(begin);
+  assert(obj->npages == NBENCH);
+
+  pmap_remove(pmap_user(), start, end);
+
+  begin = binuptime();
+  for (vaddr_t va = start; va < end; va += PAGESIZE)
+    assert(*(volatile vaddr_t *)va == va);
+  uint64_t read_ns = elapsed_ns(begin);
+
+  kprintf("write fault: %u ns per page, read fault: %u ns per page\n",
+          (unsigned)(write_ns / NBENCH), (unsigned)(read_ns / NBENCH));
+
+  vm_map_delete(umap);
+
+  /* Restore original vm_map */
+  vm_map_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(vm, paging_on_demand_and_memory_protection_demo, 0);
 KTEST_ADD(findspace, findspace_demo, 0);
+KTEST_ADD(fault_around, fault_around_demo, 0);
+KTEST_ADD(zero_page, zero_page_demo, 0);
+KTEST_ADD(madvise, madvise_demo, 0);
+KTEST_ADD(fault_bench, fault_bench, KTEST_FLAG_BENCHMARK);
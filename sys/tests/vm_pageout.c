@@ -0,0 +1,48 @@
+#include <sys/mimiker.h>
+#include <sys/ktest.h>
+#include <sys/pmap.h>
+#include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
+#include <sys/vm_physmem.h>
+
+/* Pages of anonymous object that were never written to can be dropped and
+ * recreated on next page fault, while modified ones must stay resident. */
+static int test_vm_pageout(void) {
+  const int N = 16;
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+
+  WITH_MTX_LOCK (&obj->mtx) {
+    for (int i = 0; i < N; i++) {
+      vm_page_t *pg = obj->pager->pgr_fault(obj, i * PAGESIZE);
+      assert(pg != NULL);
+      if (i % 2)
+        pmap_set_modified(pg);
+    }
+  }
+
+  /* First pass moves pages to inactive queue, next ones free them. */
+  for (int pass = 0; pass < 4; pass++)
+    vm_pageout_scan(vm_page_ntotal());
+
+  for (int i = 0; i < N; i++) {
+    vm_page_t *pg = vm_object_find_page(obj, i * PAGESIZE);
+    /* Modified pages may have been compressed or written to swap. */
+    if (i % 2)
+      assert(pg ? pmap_is_modified(pg) : obj->ncompressed + obj->nswapped > 0);
+    else
+      assert(pg == NULL);
+  }
+
+  assert(obj->npages + obj->ncompressed + obj->nswapped == (size_t)N / 2);
+
+  /* Reclaimed page is brought back filled with zeros. */
+  WITH_MTX_LOCK (&obj->mtx) {
+    vm_page_t *pg = obj->pager->pgr_fault(obj, 0);
+    assert(pg != NULL && !pmap_is_modified(pg));
+  }
+
+  vm_object_free(obj);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(vm_pageout, test_vm_pageout, 0);
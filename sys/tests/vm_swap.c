@@ -0,0 +1,75 @@
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/kmem.h>
+#include <sys/ktest.h>
+#include <sys/pmap.h>
+#include <sys/proc.h>
+#include <sys/vm_object.h>
+#include <sys/vm_pageout.h>
+#include <sys/vm_physmem.h>
+#include <sys/vm_swap.h>
+
+#define SWAP_PATH "/tmp/swap"
+#define SWAP_SIZE (1024 * PAGESIZE)
+
+/* Fills page with a pattern derived from `seed` or checks if it's there. */
+static bool page_pattern(vm_page_t *pg, uint32_t seed, bool fill) {
+  vaddr_t va = kva_alloc(PAGESIZE);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
+
+  uint32_t *words = (uint32_t *)va;
+  bool ok = true;
+  for (size_t i = 0; i < PAGESIZE / sizeof(uint32_t); i++) {
+    if (fill)
+      words[i] = seed ^ i;
+    else if (words[i] != (seed ^ i))
+      ok = false;
+  }
+
+  pmap_kremove(va, PAGESIZE);
+  kva_free(va, PAGESIZE);
+  return ok;
+}
+
+static int test_vm_swap(void) {
+  const int N = 32;
+
+  int error = swap_on(proc_self(), SWAP_PATH, SWAP_SIZE);
+  assert(error == 0 || error == EBUSY);
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+
+  WITH_MTX_LOCK (&obj->mtx) {
+    for (int i = 0; i < N; i++) {
+      vm_page_t *pg = obj->pager->pgr_fault(obj, i * PAGESIZE);
+      page_pattern(pg, i, true);
+      pmap_set_modified(pg);
+    }
+  }
+
+  /* Other pages in the system compete for swap space, so try a few times. */
+  for (int pass = 0; pass < 32 && obj->nswapped < (size_t)N; pass++)
+    vm_pageout_scan(vm_page_ntotal());
+
+  assert(obj->nswapped == (size_t)N);
+  assert(obj->npages == 0);
+
+  /* Dropped pages lose their slots. */
+  vm_object_remove_range(obj, 0, 2 * PAGESIZE);
+  assert(obj->nswapped == (size_t)N - 2);
+
+  WITH_MTX_LOCK (&obj->mtx) {
+    for (int i = 2; i < N; i++) {
+      vm_page_t *pg = obj->pager->pgr_fault(obj, i * PAGESIZE);
+      assert(pmap_is_modified(pg));
+      assert(page_pattern(pg, i, false));
+    }
+  }
+
+  assert(obj->nswapped == 0);
+
+  vm_object_free(obj);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(vm_swap, test_vm_swap, 0);
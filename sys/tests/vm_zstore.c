@@ -0,0 +1,143 @@
+#include <sys/mimiker.h>
+#include <sys/kmem.h>
+#include <sys/ktest.h>
+#include <sys/libkern.h>
+#include <sys/lz4.h>
+#include <sys/malloc.h>
+#include <sys/pmap.h>
+#include <sys/vm_object.h>
+#include <sys/vm_physmem.h>
+#include <sys/vm_zstore.h>
+
+#define N 16
+
+static uint16_t htab[LZ4_HASHSIZE];
+
+/* Fills page with contents that are either easy or impossible to compress,
+ * or checks if they're there. */
+static bool page_pattern(vm_page_t *pg, uint32_t seed, bool fill) {
+  vaddr_t va = kva_alloc(PAGESIZE);
+  pmap_kenter(va, vm_page_paddr(pg), VM_PROT_READ | VM_PROT_WRITE, 0);
+
+  uint32_t *words = (uint32_t *)va;
+  bool ok = true;
+  for (size_t i = 0; i < PAGESIZE / sizeof(uint32_t); i++) {
+    /* Odd seeds give a pseudo-random sequence with no repeated words. */
+    uint32_t w = (seed & 1) ? (seed ^ i) * 2654435761U : seed + i % 8;
+    if (fill)
+      words[i] = w;
+    else if (words[i] != w)
+      ok = false;
+  }
+
+  pmap_kremove(va, PAGESIZE);
+  kva_free(va, PAGESIZE);
+  return ok;
+}
+
+static bool lz4_roundtrip(const void *src, size_t len, size_t *comprlen) {
+  uint8_t *zbuf = kmalloc(M_TEMP, 2 * len, 0);
+  uint8_t *dst = kmalloc(M_TEMP, len, 0);
+  bool ok = false;
+
+  if ((*comprlen = lz4_compress(src, len, zbuf, 2 * len, htab)) > 0)
+    ok = lz4_decompress(zbuf, *comprlen, dst, len) == (ssize_t)len &&
+         memcmp(src, dst, len) == 0;
+
+  kfree(M_TEMP, dst);
+  kfree(M_TEMP, zbuf);
+  return ok;
+}
+
+static int test_lz4(void) {
+  static const char text[] =
+    "Compressed store keeps modified anonymous pages evicted by pagedaemon "
+    "in memory, compressed with LZ4. Compressed pages are packed into slabs "
+    "of fixed size chunks, one slab per physical page.";
+  uint8_t *buf = kmalloc(M_TEMP, PAGESIZE, M_ZERO);
+  size_t len;
+
+  assert(lz4_roundtrip(buf, PAGESIZE, &len));
+  assert(len < PAGESIZE / 16);
+
+  for (size_t i = 0; i < PAGESIZE; i++)
+    buf[i] = text[i % (sizeof(text) - 1)];
+  assert(lz4_roundtrip(buf, PAGESIZE, &len));
+  assert(len < PAGESIZE / 2);
+
+  uint32_t x = 1;
+  for (size_t i = 0; i < PAGESIZE; i++) {
+    x = x * 1103515245 + 12345;
+    buf[i] = x >> 16;
+  }
+  assert(lz4_roundtrip(buf, PAGESIZE, &len));
+
+  /* Output that does not fit into the buffer is rejected. */
+  uint8_t zbuf[64];
+  assert(lz4_compress(buf, PAGESIZE, zbuf, sizeof(zbuf), htab) == 0);
+
+  /* Truncated input must not make decompressor read out of bounds. */
+  memset(buf, 'a', PAGESIZE);
+  len = lz4_compress(buf, PAGESIZE, zbuf, sizeof(zbuf), htab);
+  assert(len > 0);
+  assert(lz4_decompress(zbuf, len - 1, buf, PAGESIZE) < 0);
+
+  kfree(M_TEMP, buf);
+  return KTEST_SUCCESS;
+}
+
+static int test_vm_zstore(void) {
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  zstat_t before, after;
+  zstore_stats(&before);
+
+  WITH_MTX_LOCK (&obj->mtx) {
+    for (int i = 0; i < N; i++) {
+      vm_page_t *pg = obj->pager->pgr_fault(obj, i * PAGESIZE);
+      page_pattern(pg, i, true);
+      pmap_set_modified(pg);
+    }
+
+    vm_page_t *pg, *next;
+    for (pg = vm_object_page_from(obj, 0); pg; pg = next) {
+      next = vm_object_next_page(obj, pg);
+      /* Only pages with even offsets compress well. */
+      bool even = pg->pindex % 2 == 0;
+      bool stored = zstore_put(obj, pg);
+      assert(!stored || even);
+      if (stored)
+        vm_object_remove_page_nolock(obj, pg);
+    }
+  }
+
+  assert(obj->ncompressed == N / 2);
+  assert(obj->npages == N / 2);
+
+  zstore_stats(&after);
+  assert(after.zs_npages == before.zs_npages + N / 2);
+  assert(after.zs_nrejected == before.zs_nrejected + N / 2);
+
+  /* Dropped pages are removed from the store. */
+  vm_object_remove_range(obj, 0, 2 * PAGESIZE);
+  assert(obj->ncompressed == N / 2 - 1);
+
+  WITH_MTX_LOCK (&obj->mtx) {
+    for (int i = 2; i < N; i += 2) {
+      vm_page_t *pg = obj->pager->pgr_fault(obj, i * PAGESIZE);
+      assert(pmap_is_modified(pg));
+      assert(page_pattern(pg, i, false));
+    }
+  }
+
+  assert(obj->ncompressed == 0);
+
+  zstore_stats(&after);
+  assert(after.zs_npages == before.zs_npages);
+  assert(after.zs_nloaded == before.zs_nloaded + N / 2 - 1);
+
+  vm_object_free(obj);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(lz4, test_lz4, 0);
+KTEST_ADD(vm_zstore, test_vm_zstore, 0);
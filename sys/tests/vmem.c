@@ -15,7 +15,7 @@ static void assert_addr_is_in_span(vmem_addr_t addr, vmem_size_t size,
 
 static int test_vmem(void) {
   int quantum = 1 << 12;
-  vmem_t *vm = vmem_create("test vmem", quantum);
+  vmem_t *vm = vmem_create("test vmem", quantum, 0);
   assert(vm != NULL);
 
   int rc;
@@ -77,4 +77,82 @@ static int test_vmem(void) {
   return KTEST_SUCCESS;
 }
 
+static int test_vmem_xalloc(void) {
+  vmem_size_t quantum = 1 << 12;
+  vmem_t *vm = vmem_create("test vmem", quantum, 0);
+  int rc;
+
+  span_t span = {.addr = 3 * quantum, .size = 64 * quantum};
+  rc = vmem_add(vm, span.addr, span.size);
+  assert(rc == 0);
+
+  /* alloc 4 quantums aligned to 16 quantums */
+  vmem_addr_t addr1;
+  rc = vmem_xalloc(vm, 4 * quantum, 16 * quantum, 0, 0, VMEM_ADDR_MIN,
+                   VMEM_ADDR_MAX, 0, &addr1);
+  assert(rc == 0);
+  assert(addr1 == 16 * quantum);
+
+  /* alloc 2 quantums at address equal to 1 quantum modulo 8 quantums */
+  vmem_addr_t addr2;
+  rc = vmem_xalloc(vm, 2 * quantum, 8 * quantum, quantum, 0, VMEM_ADDR_MIN,
+                   VMEM_ADDR_MAX, VM_BESTFIT, &addr2);
+  assert(rc == 0);
+  assert(addr2 % (8 * quantum) == quantum);
+
+  /* alloc 8 quantums not crossing 16 quantum boundary above 40 quantums */
+  vmem_addr_t addr3;
+  rc = vmem_xalloc(vm, 8 * quantum, 0, 0, 16 * quantum, 40 * quantum,
+                   VMEM_ADDR_MAX, 0, &addr3);
+  assert(rc == 0);
+  assert(addr3 >= 40 * quantum);
+  assert(addr3 / (16 * quantum) == (addr3 + 8 * quantum - 1) / (16 * quantum));
+  assert_addr_is_in_span(addr3, 8 * quantum, &span);
+
+  /* alloc 4 quantums below 6 quantums, should fail */
+  vmem_addr_t addr4;
+  rc = vmem_xalloc(vm, 4 * quantum, 0, 0, 0, VMEM_ADDR_MIN, 6 * quantum - 1,
+                   0, &addr4);
+  assert(rc == ENOMEM);
+
+  vmem_xfree(vm, addr1, 4 * quantum);
+  vmem_xfree(vm, addr2, 2 * quantum);
+  vmem_xfree(vm, addr3, 8 * quantum);
+
+  vmem_destroy(vm);
+
+  return KTEST_SUCCESS;
+}
+
+static int test_vmem_qcache(void) {
+  vmem_size_t quantum = 1 << 12;
+  vmem_t *vm = vmem_create("test vmem", quantum, 4 * quantum);
+  vmem_addr_t addr[40];
+  int rc;
+
+  span_t span = {.addr = 1000 * quantum, .size = 1000 * quantum};
+  rc = vmem_add(vm, span.addr, span.size);
+  assert(rc == 0);
+
+  /* allocate segments of cached sizes and one that is too big for cache */
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 40; i++) {
+      vmem_size_t size = (i % 5 + 1) * quantum;
+      rc = vmem_alloc(vm, size, &addr[i], 0);
+      assert(rc == 0);
+      assert_addr_is_in_span(addr[i], size, &span);
+      for (int j = 0; j < i; j++)
+        assert(addr[i] != addr[j]);
+    }
+    for (int i = 0; i < 40; i++)
+      vmem_free(vm, addr[i], (i % 5 + 1) * quantum);
+  }
+
+  vmem_destroy(vm);
+
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(vmem, test_vmem, 0);
+KTEST_ADD(vmem_xalloc, test_vmem_xalloc, 0);
+KTEST_ADD(vmem_qcache, test_vmem_qcache, 0);
@@ -0,0 +1,216 @@
+#include <sys/kmemstat.h>
+#include <sys/vmstat.h>
+#include <sys/vm_zstore.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define KMEMSTAT_PATH "/dev/kmemstat"
+#define ZSTAT_PATH "/dev/zstat"
+#define VMSTAT_PATH "/dev/vmstat"
+#define MAXRECORDS 256
+
+static kmemstat_t stats[MAXRECORDS];
+
+static size_t read_stats(void) {
+  int fd = open(KMEMSTAT_PATH, O_RDONLY, 0);
+  if (fd < 0)
+    err(EXIT_FAILURE, "%s", KMEMSTAT_PATH);
+
+  ssize_t len = read(fd, stats, sizeof(stats));
+  if (len < 0)
+    err(EXIT_FAILURE, "%s", KMEMSTAT_PATH);
+
+  close(fd);
+  return len / sizeof(kmemstat_t);
+}
+
+static void print_size(uint64_t bytes) {
+  if (bytes >= 10 * 1024 * 1024)
+    printf(" %7lluM", (unsigned long long)(bytes >> 20));
+  else if (bytes >= 10 * 1024)
+    printf(" %7lluK", (unsigned long long)(bytes >> 10));
+  else
+    printf(" %8llu", (unsigned long long)bytes);
+}
+
+static void print_malloc(size_t n) {
+  uint64_t total = 0;
+
+  printf("Memory statistics by type\n");
+  printf("%-24s %8s %8s %8s %8s %8s %6s\n", "Type", "InUse", "MemUse",
+         "HighUse", "Limit", "Requests", "Fail");
+
+  for (size_t i = 0; i < n; i++) {
+    kmemstat_t *ks = &stats[i];
+    if (ks->ks_type != KMEMSTAT_MALLOC)
+      continue;
+    printf("%-24.24s %8llu", ks->ks_name, (unsigned long long)ks->ks_active);
+    print_size(ks->ks_inuse);
+    print_size(ks->ks_peak);
+    if (ks->ks_limit)
+      print_size(ks->ks_limit);
+    else
+      printf(" %8s", "-");
+    printf(" %8llu %6llu\n", (unsigned long long)ks->ks_nrequests,
+           (unsigned long long)ks->ks_nfailed);
+    total += ks->ks_inuse;
+  }
+
+  printf("Memory totals: in use");
+  print_size(total);
+  printf("\n\n");
+}
+
+static void print_pool(size_t n) {
+  uint64_t total = 0, inuse = 0;
+
+  printf("Memory resource pool statistics\n");
+  printf("%-24s %6s %8s %8s %8s %8s %8s\n", "Name", "Size", "Requests",
+         "InUse", "MemUse", "HighUse", "Slabs");
+
+  for (size_t i = 0; i < n; i++) {
+    kmemstat_t *ks = &stats[i];
+    if (ks->ks_type != KMEMSTAT_POOL)
+      continue;
+    printf("%-24.24s %6u %8llu %8llu", ks->ks_name, ks->ks_itemsize,
+           (unsigned long long)ks->ks_nrequests,
+           (unsigned long long)ks->ks_active);
+    print_size(ks->ks_inuse);
+    print_size(ks->ks_peak);
+    print_size(ks->ks_size);
+    printf("\n");
+    total += ks->ks_size;
+    inuse += ks->ks_inuse;
+  }
+
+  printf("In use");
+  print_size(inuse);
+  printf(", total allocated");
+  print_size(total);
+  if (total)
+    printf(", utilization %.1f%%", 100.0 * inuse / total);
+  printf("\n");
+}
+
+static void print_zstore(void) {
+  zstat_t zs;
+
+  int fd = open(ZSTAT_PATH, O_RDONLY, 0);
+  if (fd < 0)
+    err(EXIT_FAILURE, "%s", ZSTAT_PATH);
+  if (read(fd, &zs, sizeof(zs)) != sizeof(zs))
+    err(EXIT_FAILURE, "%s", ZSTAT_PATH);
+  close(fd);
+
+  uint64_t pagesize = getpagesize();
+  uint64_t origsize = zs.zs_npages * pagesize;
+
+  printf("Compressed page store\n");
+  printf("%-24s %8llu\n", "Pages stored", (unsigned long long)zs.zs_npages);
+  printf("%-24s", "Original size");
+  print_size(origsize);
+  printf("\n%-24s", "Compressed size");
+  print_size(zs.zs_comprsize);
+  printf("\n%-24s", "Memory used");
+  print_size(zs.zs_memsize);
+  printf("\n%-24s", "Memory limit");
+  print_size(zs.zs_limit * pagesize);
+  printf("\n");
+  if (zs.zs_memsize)
+    printf("%-24s %8.2f\n", "Compression ratio",
+           (double)origsize / zs.zs_memsize);
+  printf("%-24s %8llu\n", "Pages compressed",
+         (unsigned long long)zs.zs_nstored);
+  printf("%-24s %8llu\n", "Pages rejected",
+         (unsigned long long)zs.zs_nrejected);
+  printf("%-24s %8llu\n\n", "Pages decompressed",
+         (unsigned long long)zs.zs_nloaded);
+
+  printf("Decompression latency\n");
+  printf("%-24s %8s\n", "Time", "Count");
+  for (int i = 0; i < ZSTAT_NBUCKETS; i++) {
+    char range[32];
+    if (i == 0)
+      snprintf(range, sizeof(range), "< 2us");
+    else if (i == ZSTAT_NBUCKETS - 1)
+      snprintf(range, sizeof(range), ">= %uus", 1U << i);
+    else
+      snprintf(range, sizeof(range), "%u-%uus", 1U << i, (1U << (i + 1)) - 1);
+    printf("%-24s %8llu\n", range, (unsigned long long)zs.zs_latency[i]);
+  }
+}
+
+static void print_vmstat(void) {
+  vmstat_t vs;
+
+  int fd = open(VMSTAT_PATH, O_RDONLY, 0);
+  if (fd < 0)
+    err(EXIT_FAILURE, "%s", VMSTAT_PATH);
+  if (read(fd, &vs, sizeof(vs)) != sizeof(vs))
+    err(EXIT_FAILURE, "%s", VMSTAT_PATH);
+  close(fd);
+
+  printf("%8llu page faults\n", (unsigned long long)vs.v_faults);
+  printf("%8llu pages mapped by fault-around\n",
+         (unsigned long long)vs.v_prefaults);
+  printf("%8llu read faults served by zero page\n",
+         (unsigned long long)vs.v_zerofaults);
+  printf("%8llu pages checked for merging\n",
+         (unsigned long long)vs.v_ksm_scanned);
+  printf("%8llu pages shared\n", (unsigned long long)vs.v_ksm_shared);
+  printf("%8llu pages sharing them (%llu saved)\n",
+         (unsigned long long)vs.v_ksm_sharing,
+         (unsigned long long)(vs.v_ksm_sharing - vs.v_ksm_shared));
+  printf("%8llu zero-filled pages released\n",
+         (unsigned long long)vs.v_ksm_zeroed);
+  printf("%8llu shared pages copied on write\n",
+         (unsigned long long)vs.v_ksm_unmerged);
+  printf("%8llu pages zeroed in advance\n", (unsigned long long)vs.v_prezeroed);
+  printf("%8llu zero-filled allocations served by them\n",
+         (unsigned long long)vs.v_prezero_hits);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: vmstat -m | -s | -z\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  bool mflag = false, sflag = false, zflag = false;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "msz")) != -1) {
+    switch (ch) {
+      case 'm':
+        mflag = true;
+        break;
+      case 's':
+        sflag = true;
+        break;
+      case 'z':
+        zflag = true;
+        break;
+      default:
+        usage();
+    }
+  }
+
+  if (mflag + sflag + zflag != 1 || optind != argc)
+    usage();
+
+  if (mflag) {
+    size_t n = read_stats();
+    print_malloc(n);
+    print_pool(n);
+  } else if (sflag) {
+    print_vmstat();
+  } else {
+    print_zstore();
+  }
+
+  return EXIT_SUCCESS;
+}